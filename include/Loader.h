@@ -7,6 +7,14 @@
 #include <variant>
 #include <tuple>
 #include <memory>
+#include <fstream>
+#include <sstream>
+#include <typeinfo>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <iterator>
 
 #include "TH1.h"
 #include "TH2.h"
@@ -29,6 +37,7 @@
 #include "base.h"
 #include "data.h"
 #include "module.h"
+#include "jit.h"
 
 class Loader {
 private:
@@ -48,6 +57,9 @@ private:
     std::vector<std::string> variable_names;
     std::vector<std::string> VariableTypes;
 
+    // the last snapshot of variables, shared by modules
+    SchemaPtr schema;
+
     // vector of modules
     std::vector<Module::Module*> Modules;
 
@@ -62,6 +74,77 @@ private:
     // to save memory, std::deque is used
     std::deque<Data> TotalData;
 
+    // checkpoint file. If it is empty, checkpoint is not used
+    std::string checkpoint_name;
+    int checkpoint_interval;
+
+    // computed before processing, because modules may change their state while processing
+    std::string checkpoint_fingerprint;
+
+    std::string ConfigurationFingerprint();
+    void WriteCheckpoint();
+    bool ReadCheckpoint();
+
+    // memoization. If the directory is empty, memoization is not used
+    std::string memoization_directory;
+
+    // rows given to `Modules.at(materialization_index)` are saved. -1 means that there is no materialization point
+    int materialization_index;
+    std::vector<std::string> materialized_variable_names;
+    std::vector<std::string> materialized_VariableTypes;
+    SchemaPtr materialized_schema;
+
+    // file of the state and fingerprint of each memoizable module
+    std::map<Module::Module*, std::pair<std::string, std::string>> memoized_states;
+
+    // modules whose state is read from the memoization. They do not see data
+    std::vector<Module::Module*> served_modules;
+
+    void ApplyMemoization();
+    void SaveMemoizedStates();
+
+    // the number of loading modules at the beginning
+    int NLoadingModules();
+
+    // rows passing the cuts so far. Rows are compacted if the fraction of them is below `compaction_threshold`
+    std::vector<size_t> selection;
+    double compaction_threshold;
+
+    // event offsets of `TotalData` for the event variables `event_offset_keys`
+    std::vector<size_t> event_offsets;
+    std::vector<int> event_offset_keys;
+
+    /*
+     * If `shared_data_` is given, rows are read from it through `selection`, and it is not changed.
+     * Selected rows are copied into `TotalData` only when a module may change rows, i.e. it is not terminal, a cut, or selection-aware, or it needs all rows at once.
+     */
+    bool ProcessModules(int first_module_, std::deque<Data>* shared_data_ = nullptr);
+
+    // aliases as (name, expression). They are inlined into expressions, and become a variable only when a writer outputs them
+    std::vector<std::pair<std::string, std::string>> aliases;
+
+    // expanded expressions of `Draw2DPunziFOM`, which keeps them as `const char*`
+    std::deque<std::string> expanded_scan_expressions;
+
+    std::string ExpandAlias(const std::string& expression_);
+    std::vector<std::string> ExpandAlias(const std::vector<std::string>& expressions_);
+    std::map<std::string, std::string> ExpandAlias(const std::map<std::string, std::string>& expressions_);
+    // new variables cannot have the name of an alias, because the name is replaced by the alias in later expressions
+    void CheckAliasCollision(const char* module_name_, const std::vector<std::string>& names_);
+    void MaterializeAliases(const std::vector<std::string>& include_, const std::vector<std::string>& exclude_ = {}, const std::map<std::string, std::string>& narrowing_ = {});
+
+    // sharded execution. If `Nshards` is 0, all files are read in this process
+    int shard_index;
+    int Nshards;
+    bool IsMergeStep;
+    std::string shard_directory;
+
+    std::string ShardStateName(int shard_index_);
+    bool IsMergedModule(Module::Module* module_);
+    void PrepareShard();
+    void WriteShardState(const std::string& fingerprint_);
+    void MergeShards();
+
 public:
     Loader(const char* TTree_name_);
     void SetName(const char* loader_name_);
@@ -80,8 +163,76 @@ public:
     void SetSignal(std::vector<std::string> labels_);
     void SetBackground(std::vector<std::string> labels_);
 
+    /*
+     * set the number of threads used by heavy modules (e.g. `FastBDTApplication`).
+     * 0 means the number of hardware threads
+     */
+    void SetNThreads(unsigned int NThreads_);
+
+    /*
+     * consecutive cuts only refine the selection of rows. Rows are moved when the fraction of selected rows is below `threshold_`,
+     * or when the next module needs rows. 0 means that rows are moved only when needed, and 1 means after every cut.
+     */
+    void SetCompactionThreshold(double threshold_);
+
+    /*
+     * expressions defined after this are compiled into native functions with Cling when the modules are started, so call it before adding modules.
+     * The setting is shared by all loaders. If an expression cannot be compiled, it is interpreted as before.
+     * If `cache_directory_` is given, compiled libraries are kept there and reused by later runs (e.g. other shards) while the expression and the variables are the same.
+     * Otherwise compiled functions are reused within the process only, so each run compiles its expressions again.
+     */
+    void SetJIT(bool enable_, const char* cache_directory_ = "");
+
+    /*
+     * write the state of all modules into `checkpoint_name_` after every `interval_` input files.
+     * If the checkpoint exists when `end` is called, the run is resumed from it. The checkpoint is removed when the run is done.
+     * Configuration (modules and variables) should be the same as the run which wrote the checkpoint.
+     * If a module does not support it (e.g. `PrintRootFile`, `FillDataSet`), the checkpoint is disabled.
+     */
+    void SetCheckpoint(const char* checkpoint_name_, int interval_ = 1);
+
+    /*
+     * results of terminal modules (e.g. `DrawTH1D`, `DrawFOM`, `CalculateAUC`) are saved in `directory_`.
+     * In the next run, a module is served from there if the module, all modules which change data before it, and input files are not changed.
+     * The weight function (`ObtainWeight`) is not a part of the fingerprint, so remove the directory if it is changed.
+     */
+    void SetMemoization(const char* directory_);
+
+    /*
+     * rows at this point (e.g. after `BCS`) are saved in the memoization directory.
+     * In the next run, modules before this point are replaced by reading the saved rows, if they are not changed.
+     */
+    void Materialize();
+
+    /*
+     * read only `shard_index_`-th shard among `Nshards_` shards. Input files are sorted and assigned to shards in turn.
+     * Terminal modules (histograms, FOM, AUC, yields, ...) write their partial results into `directory_`, and `End` is not called for them.
+     * Outputs written per shard (ROOT files, cache) get the suffix `_shard{i}of{N}`.
+     * Histograms should have the range, because the range determined in each shard would be different.
+     */
+    void SetShard(int shard_index_, int Nshards_, const char* directory_);
+
+    /*
+     * merge partial results of `Nshards_` shards in `directory_` and call `End` of terminal modules. Data is not read.
+     * Modules should be the same as the shards.
+     */
+    void SetMerge(int Nshards_, const char* directory_);
+
+    /*
+     * `--shard i/N` calls `SetShard` and `--merge N` calls `SetMerge`. Without them, nothing is changed.
+     */
+    void SetShardFromArguments(int argc, char* argv[], const char* directory_);
+
+    /*
+     * `name_` can be used in later expressions in place of `expression_`. It is inlined when the expressions are compiled, so rows do not get a new variable.
+     * An alias is added as a Double_t variable only when it is written, i.e. matched by `include_` (or by `narrowing_` if `include_` is empty) and not by `exclude_` of `PrintRootFile` and `PrintSeparateRootFile`, or listed in `PrintEvent`.
+     * Later modules cannot add a new variable with the name of an alias.
+     */
+    void Alias(const char* name_, const char* expression_);
+
     void Load(const char* dirname_, const char* including_string_, const char* label_);
     void LoadWithCut(const char* dirname_, const char* including_string_, const char* label_, const char* cut_string_);
+    void LoadCache(const char* path_, const char* label_ = "");
     void Cut(const char* cut_string_);
     std::shared_ptr<std::vector<double>> PrintInformation(const char* print_string_, const std::vector<std::string> Event_variable_list_ = { "__experiment__", "__run__", "__event__", "__production__", "__ncandidates__" });
     void DrawTH1D(const char* expression_, const char* hist_title_, int nbins_, double x_low_, double x_high_, const char* png_name_);
@@ -95,11 +246,34 @@ public:
     void DrawStack(const char* expression_, const char* stack_title_, const char* png_name_);
     void DrawStack(const char* expression_, const char* stack_title_, const char* png_name_, bool normalized_, bool LogScale_);
     void PrintSeparateRootFile(const char* path_, const char* prefix_, const char* suffix_);
+    void PrintSeparateRootFile(const char* path_, const char* prefix_, const char* suffix_, bool parallel_);
+
+    /*
+     * only variables matched with `include_` and not matched with `exclude_` are written. Glob patterns (`*`, `?`) can be used.
+     * `narrowing_` changes the type of Double_t variables in the output file, e.g. {{"*", "Float_t"}} writes every Double_t variable as Float_t.
+     * Empty `include_` means every variable
+     */
+    void PrintSeparateRootFile(const char* path_, const char* prefix_, const char* suffix_, bool parallel_, std::vector<std::string> include_, std::vector<std::string> exclude_, std::map<std::string, std::string> narrowing_ = {});
     void PrintRootFile(const char* output_name_);
+
+    /*
+     * compression algorithm follows ROOT::RCompressionSetting::EAlgorithm (1: ZLIB, 2: LZMA, 4: LZ4, 5: ZSTD).
+     * Negative value means the default of ROOT
+     */
+    void PrintRootFile(const char* output_name_, int compression_algorithm_, int compression_level_, int basket_size_);
+    void PrintRootFile(const char* output_name_, std::vector<std::string> include_, std::vector<std::string> exclude_, std::map<std::string, std::string> narrowing_ = {});
+    void PrintRootFile(const char* output_name_, int compression_algorithm_, int compression_level_, int basket_size_, std::vector<std::string> include_, std::vector<std::string> exclude_, std::map<std::string, std::string> narrowing_ = {});
+    void SaveCache(const char* path_);
     void BCS(const char* expression_, const char* criteria_, const std::vector<std::string> Event_variable_list_ = { "__experiment__", "__run__", "__event__", "__production__", "__ncandidates__" });
     void RandomBCS(const std::vector<std::string> Event_variable_list_ = { "__experiment__", "__run__", "__event__", "__production__", "__ncandidates__" });
     void IsBCSValid(const std::vector<std::string> Event_variable_list_ = { "__experiment__", "__run__", "__event__", "__production__", "__ncandidates__" });
     void RandomEventSelection(int split_num_, int selected_index_, const std::vector<std::string> Event_variable_list_ = { "__experiment__", "__run__", "__event__", "__production__", "__ncandidates__" });
+
+    /*
+     * add per-event aggregates (count, sum, min, max, mean) and per-candidate ranks in one pass over events. See `Module::EventAggregateColumn`.
+     * e.g. `EventAggregate({ {"rank", "rank_highest", {"Btag_chiProb"}}, {"Ncand", "count", {}} })` and then `Cut("rank <= 2")` keeps the best two candidates.
+     */
+    void EventAggregate(const std::vector<Module::EventAggregateColumn> columns_, const std::vector<std::string> Event_variable_list_ = { "__experiment__", "__run__", "__event__", "__production__", "__ncandidates__" });
     std::shared_ptr<std::vector<double>> DrawFOM(const char* equation_, double MIN_, double MAX_, const char* png_name_);
     std::shared_ptr<std::vector<double>> DrawFOM(const char* equation_, double MIN_, double MAX_, double NBin_, int rank_, const char* png_name_);
     std::shared_ptr<std::vector<double>> DrawPunziFOM(const char* equation_, double MIN_, double MAX_, double NSIG_initial_, double alpha_, const char* png_name_);
@@ -107,15 +281,26 @@ public:
     std::shared_ptr<std::vector<double>> Draw2DPunziFOM(std::vector<std::tuple<const char*, double, double, int>> scan_conditions_, double NSIG_initial_, double alpha_, const char* png_name_);
     std::shared_ptr<std::vector<double>> Draw2DPunziFOM(std::vector<std::tuple<const char*, double, double, int>> scan_conditions_, const char* preselection_x_, const char* preselection_y_, double NSIG_initial_, double alpha_, const char* png_name_);
     std::shared_ptr<double> CalculateAUC(const char* equation_, double MIN_, double MAX_, const char* output_name_, const char* write_option_);
+    std::shared_ptr<double> CalculateAUC(const char* equation_, double MIN_, double MAX_, const char* output_name_, const char* write_option_, const char* roc_output_name_);
     void FastBDTTrain(std::vector<std::string> input_variables_, const char* Signal_preselection_, const char* Background_preselection_, std::map<std::string, double> hyperparameters_, const char* path_, const char* output_name_ = "");
     void FastBDTTrain(std::vector<std::string> input_variables_, const char* Signal_preselection_, const char* Background_preselection_, std::map<std::string, double> hyperparameters_, bool balanced_weight_, const char* path_, const char* output_name_ = "");
+    std::shared_ptr<std::vector<double>> FastBDTGridSearch(std::vector<std::string> input_variables_, const char* Signal_preselection_, const char* Background_preselection_, std::map<std::string, std::vector<double>> hyperparameter_grid_, double test_fraction_, bool balanced_weight_, const char* path_, const char* summary_name_, const std::vector<std::string> Event_variable_list_ = { "__experiment__", "__run__", "__event__", "__production__" });
+    void FastBDTKFoldTrain(std::vector<std::string> input_variables_, const char* Signal_preselection_, const char* Background_preselection_, std::map<std::string, double> hyperparameters_, int K_, bool balanced_weight_, const char* path_, const char* output_name_ = "", const std::vector<std::string> Event_variable_list_ = { "__experiment__", "__run__", "__event__", "__production__" });
     void FastBDTApplication(std::vector<std::string> input_variables_, const char* classifier_path_, const char* branch_name_);
+    void FastBDTApplication(std::vector<std::string> input_variables_, std::vector<std::string> classifier_paths_, std::vector<std::string> branch_names_);
+    void FastBDTKFoldApplication(std::vector<std::string> input_variables_, const char* classifier_path_, int K_, const char* branch_name_, const std::vector<std::string> Event_variable_list_ = { "__experiment__", "__run__", "__event__", "__production__" });
     void DefineNewVariable(const char* equation_, const char* new_variable_name_);
     void ConditionalPairDefineNewVariable(std::map<std::string, std::string> condition_equation__criteria_equation_list_, int condition_order_, const char* new_variable_name_);
     void GetAverage(std::vector<std::string> equations_, const char* new_variable_name_);
     void GetStdDev(std::vector<std::string> equations_, const char* new_variable_name_);
     void GetDiff(std::vector<std::string> equations_, int order_, const char* new_variable_name_);
     void GetAdd(std::vector<std::string> equations_, int order_, const char* new_variable_name_);
+
+    /*
+     * inputs are evaluated once for each row, and several outputs (mean, std, sum, min, max, diff, add) are added in one pass. See `Module::ReductionOutput`.
+     * e.g. `Reduce({ "p1", "p2", "p3" }, { {"p_mean", "mean"}, {"p_max", "max"}, {"p_diff1", "diff", 1} })`
+     */
+    void Reduce(std::vector<std::string> equations_, std::vector<Module::ReductionOutput> outputs_);
     void FillDataSet(RooDataSet* dataset_, std::vector<RooRealVar*> realvars_, std::vector<std::string> equations_);
     void FillTProfile(TProfile* tprofile_, std::string equation_x_, std::string equation_y_);
     void FillTH1D(TH1D* th1d_, std::string equation_);
@@ -128,6 +313,14 @@ public:
     void InsertCustomizedModule(Module::Module* module_);
     void end();
 
+    /*
+     * run `end` of several loaders reading the same input files at once. Each file is read only once, by the first loader.
+     * The other loaders see its rows through their own selection, and copy only the selected rows when a module needs its own rows.
+     * The other loaders run one by one before the first loader, so there is at most one copy at a time. Loading modules (`Load`, `LoadWithCut`, `LoadCache`) should come first,
+     * and they should be the same in all loaders. Checkpoint, memoization, and shards are not supported.
+     */
+    static void EndTogether(std::vector<Loader*> loaders_);
+
     /*
      * get pointer when make the customized module
      */
@@ -137,9 +330,15 @@ public:
     std::vector<std::string>* BackgroundLabel_address();
     std::vector<std::string>* DataLabel_address();
     std::vector<std::string>* MCLabel_address();
+
+    /*
+     * immutable snapshot of the current variables with their types and the name-to-index map, which is given to modules.
+     * A new version is made only if variables are changed after the last call, so modules between changes share the same snapshot.
+     */
+    SchemaPtr GetSchema();
 };
 
-Loader::Loader(const char* TTree_name_) : TTree_name(TTree_name_), DataStructureDefined(false) {}
+Loader::Loader(const char* TTree_name_) : TTree_name(TTree_name_), DataStructureDefined(false), checkpoint_interval(1), materialization_index(-1), shard_index(0), Nshards(0), IsMergeStep(false), compaction_threshold(0.25) {}
 
 void Loader::SetName(const char* loader_name_) {
     loader_name = std::string(loader_name_);
@@ -161,247 +360,492 @@ void Loader::SetBackground(std::vector<std::string> labels_) {
     Background_label_list = labels_;
 }
 
+void Loader::SetNThreads(unsigned int NThreads_) {
+    ::SetNThreads(NThreads_);
+}
+
+void Loader::SetCheckpoint(const char* checkpoint_name_, int interval_) {
+    if (interval_ <= 0) {
+        printf("[Loader] interval of checkpoint should be positive: %d\n", interval_);
+        exit(1);
+    }
+    checkpoint_name = std::string(checkpoint_name_);
+    checkpoint_interval = interval_;
+}
+
+void Loader::SetMemoization(const char* directory_) {
+    memoization_directory = std::string(directory_);
+}
+
+void Loader::Materialize() {
+    materialization_index = Modules.size();
+    materialized_variable_names = variable_names;
+    materialized_VariableTypes = VariableTypes;
+    materialized_schema = GetSchema();
+}
+
+void Loader::SetJIT(bool enable_, const char* cache_directory_) {
+    if (enable_) ExpressionCompiler = PrepareExpressionWithCling;
+    else ExpressionCompiler = nullptr;
+    JITCacheDirectory = std::string(cache_directory_);
+}
+
+void Loader::SetCompactionThreshold(double threshold_) {
+    if ((threshold_ < 0) || (threshold_ > 1)) {
+        printf("[Loader] compaction threshold should be in [0, 1]: %f\n", threshold_);
+        exit(1);
+    }
+    compaction_threshold = threshold_;
+}
+
+void Loader::SetShard(int shard_index_, int Nshards_, const char* directory_) {
+    if ((Nshards_ <= 0) || (shard_index_ < 0) || (shard_index_ >= Nshards_)) {
+        printf("[Loader] wrong shard: %d/%d\n", shard_index_, Nshards_);
+        exit(1);
+    }
+    shard_index = shard_index_;
+    Nshards = Nshards_;
+    IsMergeStep = false;
+    shard_directory = std::string(directory_);
+}
+
+void Loader::SetMerge(int Nshards_, const char* directory_) {
+    if (Nshards_ <= 0) {
+        printf("[Loader] wrong number of shards: %d\n", Nshards_);
+        exit(1);
+    }
+    shard_index = 0;
+    Nshards = Nshards_;
+    IsMergeStep = true;
+    shard_directory = std::string(directory_);
+}
+
+void Loader::SetShardFromArguments(int argc, char* argv[], const char* directory_) {
+    for (int i = 1; i < argc; i++) {
+        if ((strcmp(argv[i], "--shard") == 0) && (i + 1 < argc)) {
+            int temp_index;
+            int temp_Nshards;
+            if (sscanf(argv[i + 1], "%d/%d", &temp_index, &temp_Nshards) != 2) {
+                printf("[Loader] `--shard` should be followed by i/N: %s\n", argv[i + 1]);
+                exit(1);
+            }
+            SetShard(temp_index, temp_Nshards, directory_);
+        }
+        else if ((strcmp(argv[i], "--merge") == 0) && (i + 1 < argc)) {
+            SetMerge(atoi(argv[i + 1]), directory_);
+        }
+    }
+}
+
+void Loader::Alias(const char* name_, const char* expression_) {
+    if (GetSchema()->Index(name_) >= 0) {
+        printf("[Alias] there is already %s variable\n", name_);
+        exit(1);
+    }
+    for (int i = 0; i < aliases.size(); i++) {
+        if (aliases.at(i).first == name_) {
+            printf("[Alias] there is already %s alias\n", name_);
+            exit(1);
+        }
+    }
+
+    // aliases used in `expression_` are expanded here, so each alias is expanded only once later
+    aliases.push_back(std::make_pair(std::string(name_), ExpandAlias(expression_)));
+}
+
+std::string Loader::ExpandAlias(const std::string& expression_) {
+    if (aliases.size() == 0) return expression_;
+    return ExpandAliases(expression_, aliases);
+}
+
+std::vector<std::string> Loader::ExpandAlias(const std::vector<std::string>& expressions_) {
+    std::vector<std::string> expanded_expressions;
+    for (int i = 0; i < expressions_.size(); i++) expanded_expressions.push_back(ExpandAlias(expressions_.at(i)));
+    return expanded_expressions;
+}
+
+std::map<std::string, std::string> Loader::ExpandAlias(const std::map<std::string, std::string>& expressions_) {
+    std::map<std::string, std::string> expanded_expressions;
+    for (std::map<std::string, std::string>::const_iterator iter = expressions_.begin(); iter != expressions_.end(); ++iter) expanded_expressions.insert(std::make_pair(ExpandAlias(iter->first), ExpandAlias(iter->second)));
+    return expanded_expressions;
+}
+
+void Loader::CheckAliasCollision(const char* module_name_, const std::vector<std::string>& names_) {
+    for (int i = 0; i < names_.size(); i++) {
+        for (int j = 0; j < aliases.size(); j++) {
+            if (aliases.at(j).first == names_.at(i)) {
+                printf("[%s] there is already %s alias\n", module_name_, names_.at(i).c_str());
+                exit(1);
+            }
+        }
+    }
+}
+
+void Loader::MaterializeAliases(const std::vector<std::string>& include_, const std::vector<std::string>& exclude_, const std::map<std::string, std::string>& narrowing_) {
+    // aliases are selected by the same patterns as the written variables. Without `include_`, all variables are written, and aliases in `narrowing_` are selected
+    std::vector<std::string> patterns = include_;
+    if (include_.size() == 0) {
+        for (std::map<std::string, std::string>::const_iterator iter = narrowing_.begin(); iter != narrowing_.end(); ++iter) patterns.push_back(iter->first);
+    }
+
+    for (int i = 0; i < aliases.size(); i++) {
+        bool IsSelected = false;
+        for (int j = 0; j < patterns.size(); j++) {
+            if (MatchGlob(patterns.at(j), aliases.at(i).first)) IsSelected = true;
+        }
+        for (int j = 0; j < exclude_.size(); j++) {
+            if (MatchGlob(exclude_.at(j), aliases.at(i).first)) IsSelected = false;
+        }
+        if (!IsSelected) continue;
+
+        // from now on, the alias is an ordinary variable
+        Module::Module* temp_module = new Module::DefineNewVariable(aliases.at(i).second.c_str(), aliases.at(i).first.c_str(), GetSchema(), &variable_names, &VariableTypes);
+        Modules.push_back(temp_module);
+        aliases.erase(aliases.begin() + i);
+        i--;
+    }
+}
+
 void Loader::Load(const char* dirname_, const char* including_string_, const char* label_) {
     Module::Module* temp_module = new Module::Load(dirname_, including_string_, label_, &DataStructureDefined, &variable_names, &VariableTypes, TTree_name.c_str());
     Modules.push_back(temp_module);
 }
 
 void Loader::LoadWithCut(const char* dirname_, const char* including_string_, const char* label_, const char* cut_string_) {
-    Module::Module* temp_module = new Module::LoadWithCut(dirname_, including_string_, label_, cut_string_ , &DataStructureDefined, &variable_names, &VariableTypes, TTree_name.c_str());
+    Module::Module* temp_module = new Module::LoadWithCut(dirname_, including_string_, label_, ExpandAlias(cut_string_).c_str(), &DataStructureDefined, &variable_names, &VariableTypes, TTree_name.c_str());
+    Modules.push_back(temp_module);
+}
+
+void Loader::LoadCache(const char* path_, const char* label_) {
+    Module::Module* temp_module = new Module::LoadCache(path_, label_, &DataStructureDefined, &variable_names, &VariableTypes);
     Modules.push_back(temp_module);
 }
 
 void Loader::Cut(const char* cut_string_) {
-    Module::Module* temp_module = new Module::Cut(cut_string_, &variable_names, &VariableTypes);
+    Module::Module* temp_module = new Module::Cut(ExpandAlias(cut_string_).c_str(), GetSchema());
     Modules.push_back(temp_module);
 }
 
 std::shared_ptr<std::vector<double>> Loader::PrintInformation(const char* print_string_, const std::vector<std::string> Event_variable_list_) {
     std::shared_ptr<std::vector<double>> temp_ptr = std::make_shared<std::vector<double>>();
-    Module::Module* temp_module = new Module::PrintInformation(print_string_, Event_variable_list_, temp_ptr, &variable_names, &VariableTypes);
+    Module::Module* temp_module = new Module::PrintInformation(print_string_, Event_variable_list_, temp_ptr, GetSchema());
     Modules.push_back(temp_module);
     return temp_ptr;
 }
 
 void Loader::DrawTH1D(const char* expression_, const char* hist_title_, int nbins_, double x_low_, double x_high_, const char* png_name_) {
-    Module::Module* temp_module = new Module::DrawTH1D(expression_, hist_title_, nbins_, x_low_, x_high_, png_name_, &variable_names, &VariableTypes);
+    Module::Module* temp_module = new Module::DrawTH1D(ExpandAlias(expression_).c_str(), hist_title_, nbins_, x_low_, x_high_, png_name_, GetSchema());
     Modules.push_back(temp_module);
 }
 
 void Loader::DrawTH1D(const char* expression_, const char* hist_title_, int nbins_, double x_low_, double x_high_, const char* png_name_, bool normalized_, bool LogScale_) {
-    Module::Module* temp_module = new Module::DrawTH1D(expression_, hist_title_, nbins_, x_low_, x_high_, png_name_, normalized_, LogScale_, &variable_names, &VariableTypes);
+    Module::Module* temp_module = new Module::DrawTH1D(ExpandAlias(expression_).c_str(), hist_title_, nbins_, x_low_, x_high_, png_name_, normalized_, LogScale_, GetSchema());
     Modules.push_back(temp_module);
 }
 
 void Loader::DrawTH1D(const char* expression_, const char* hist_title_, const char* png_name_) {
-    Module::Module* temp_module = new Module::DrawTH1D(expression_, hist_title_, png_name_, &variable_names, &VariableTypes);
+    Module::Module* temp_module = new Module::DrawTH1D(ExpandAlias(expression_).c_str(), hist_title_, png_name_, GetSchema());
     Modules.push_back(temp_module);
 }
 
 void Loader::DrawTH1D(const char* expression_, const char* hist_title_, const char* png_name_, bool normalized_, bool LogScale_) {
-    Module::Module* temp_module = new Module::DrawTH1D(expression_, hist_title_, png_name_, normalized_, LogScale_, &variable_names, &VariableTypes);
+    Module::Module* temp_module = new Module::DrawTH1D(ExpandAlias(expression_).c_str(), hist_title_, png_name_, normalized_, LogScale_, GetSchema());
     Modules.push_back(temp_module);
 }
 
 void Loader::DrawTH2D(const char* x_expression_, const char* y_expression_, const char* hist_title_, int x_nbins_, double x_low_, double x_high_, int y_nbins_, double y_low_, double y_high_, const char* png_name_, const char* draw_option_) {
-    Module::Module* temp_module = new Module::DrawTH2D(x_expression_, y_expression_, hist_title_, x_nbins_, x_low_, x_high_, y_nbins_, y_low_, y_high_, png_name_, draw_option_, &variable_names, &VariableTypes);
+    Module::Module* temp_module = new Module::DrawTH2D(ExpandAlias(x_expression_).c_str(), ExpandAlias(y_expression_).c_str(), hist_title_, x_nbins_, x_low_, x_high_, y_nbins_, y_low_, y_high_, png_name_, draw_option_, GetSchema());
     Modules.push_back(temp_module);
 }
 
 void Loader::DrawTH2D(const char* x_expression_, const char* y_expression_, const char* hist_title_, const char* png_name_, const char* draw_option_) {
-    Module::Module* temp_module = new Module::DrawTH2D(x_expression_, y_expression_, hist_title_, png_name_, draw_option_, &variable_names, &VariableTypes);
+    Module::Module* temp_module = new Module::DrawTH2D(ExpandAlias(x_expression_).c_str(), ExpandAlias(y_expression_).c_str(), hist_title_, png_name_, draw_option_, GetSchema());
     Modules.push_back(temp_module);
 }
 
 void Loader::DrawStack(const char* expression_, const char* stack_title_, int nbins_, double x_low_, double x_high_, const char* png_name_) {
-    Module::Module* temp_module = new Module::DrawStack(expression_, stack_title_, nbins_, x_low_, x_high_, png_name_, Signal_label_list, Background_label_list, Data_label_list, MC_label_list, &variable_names, &VariableTypes);
+    Module::Module* temp_module = new Module::DrawStack(ExpandAlias(expression_).c_str(), stack_title_, nbins_, x_low_, x_high_, png_name_, Signal_label_list, Background_label_list, Data_label_list, MC_label_list, GetSchema());
     Modules.push_back(temp_module);
 }
 
 void Loader::DrawStack(const char* expression_, const char* stack_title_, int nbins_, double x_low_, double x_high_, const char* png_name_, bool normalized_, bool LogScale_) {
-    Module::Module* temp_module = new Module::DrawStack(expression_, stack_title_, nbins_, x_low_, x_high_, png_name_, normalized_, LogScale_, Signal_label_list, Background_label_list, Data_label_list, MC_label_list, &variable_names, &VariableTypes);
+    Module::Module* temp_module = new Module::DrawStack(ExpandAlias(expression_).c_str(), stack_title_, nbins_, x_low_, x_high_, png_name_, normalized_, LogScale_, Signal_label_list, Background_label_list, Data_label_list, MC_label_list, GetSchema());
     Modules.push_back(temp_module);
 }
 
 void Loader::DrawStack(const char* expression_, const char* stack_title_, const char* png_name_) {
-    Module::Module* temp_module = new Module::DrawStack(expression_, stack_title_, png_name_, Signal_label_list, Background_label_list, Data_label_list, MC_label_list, &variable_names, &VariableTypes);
+    Module::Module* temp_module = new Module::DrawStack(ExpandAlias(expression_).c_str(), stack_title_, png_name_, Signal_label_list, Background_label_list, Data_label_list, MC_label_list, GetSchema());
     Modules.push_back(temp_module);
 }
 
 void Loader::DrawStack(const char* expression_, const char* stack_title_, const char* png_name_, bool normalized_, bool LogScale_) {
-    Module::Module* temp_module = new Module::DrawStack(expression_, stack_title_, png_name_, normalized_, LogScale_, Signal_label_list, Background_label_list, Data_label_list, MC_label_list, &variable_names, &VariableTypes);
+    Module::Module* temp_module = new Module::DrawStack(ExpandAlias(expression_).c_str(), stack_title_, png_name_, normalized_, LogScale_, Signal_label_list, Background_label_list, Data_label_list, MC_label_list, GetSchema());
     Modules.push_back(temp_module);
 }
 
 void Loader::PrintSeparateRootFile(const char* path_, const char* prefix_, const char* suffix_) {
-    Module::Module* temp_module = new Module::PrintSeparateRootFile(path_, prefix_, suffix_, &variable_names, &VariableTypes, TTree_name.c_str());
+    Module::Module* temp_module = new Module::PrintSeparateRootFile(path_, prefix_, suffix_, GetSchema(), TTree_name.c_str());
+    Modules.push_back(temp_module);
+}
+
+void Loader::PrintSeparateRootFile(const char* path_, const char* prefix_, const char* suffix_, bool parallel_) {
+    Module::Module* temp_module = new Module::PrintSeparateRootFile(path_, prefix_, suffix_, parallel_, GetSchema(), TTree_name.c_str());
+    Modules.push_back(temp_module);
+}
+
+void Loader::PrintSeparateRootFile(const char* path_, const char* prefix_, const char* suffix_, bool parallel_, std::vector<std::string> include_, std::vector<std::string> exclude_, std::map<std::string, std::string> narrowing_) {
+    MaterializeAliases(include_, exclude_, narrowing_);
+    Module::Module* temp_module = new Module::PrintSeparateRootFile(path_, prefix_, suffix_, parallel_, include_, exclude_, narrowing_, GetSchema(), TTree_name.c_str());
     Modules.push_back(temp_module);
 }
 
 void Loader::PrintRootFile(const char* output_name_) {
-    Module::Module* temp_module = new Module::PrintRootFile(output_name_, &variable_names, &VariableTypes, TTree_name.c_str());
+    Module::Module* temp_module = new Module::PrintRootFile(output_name_, GetSchema(), TTree_name.c_str());
+    Modules.push_back(temp_module);
+}
+
+void Loader::PrintRootFile(const char* output_name_, int compression_algorithm_, int compression_level_, int basket_size_) {
+    Module::Module* temp_module = new Module::PrintRootFile(output_name_, compression_algorithm_, compression_level_, basket_size_, GetSchema(), TTree_name.c_str());
+    Modules.push_back(temp_module);
+}
+
+void Loader::PrintRootFile(const char* output_name_, std::vector<std::string> include_, std::vector<std::string> exclude_, std::map<std::string, std::string> narrowing_) {
+    MaterializeAliases(include_, exclude_, narrowing_);
+    Module::Module* temp_module = new Module::PrintRootFile(output_name_, -1, -1, -1, include_, exclude_, narrowing_, GetSchema(), TTree_name.c_str());
+    Modules.push_back(temp_module);
+}
+
+void Loader::PrintRootFile(const char* output_name_, int compression_algorithm_, int compression_level_, int basket_size_, std::vector<std::string> include_, std::vector<std::string> exclude_, std::map<std::string, std::string> narrowing_) {
+    MaterializeAliases(include_, exclude_, narrowing_);
+    Module::Module* temp_module = new Module::PrintRootFile(output_name_, compression_algorithm_, compression_level_, basket_size_, include_, exclude_, narrowing_, GetSchema(), TTree_name.c_str());
+    Modules.push_back(temp_module);
+}
+
+void Loader::SaveCache(const char* path_) {
+    Module::Module* temp_module = new Module::SaveCache(path_, GetSchema());
     Modules.push_back(temp_module);
 }
 
 void Loader::BCS(const char* expression_, const char* criteria_, const std::vector<std::string> Event_variable_list_) {
-    Module::Module* temp_module = new Module::BCS(expression_, criteria_, Event_variable_list_, &variable_names, &VariableTypes);
+    Module::Module* temp_module = new Module::BCS(ExpandAlias(expression_).c_str(), criteria_, Event_variable_list_, GetSchema());
     Modules.push_back(temp_module);
 }
 
 void Loader::RandomBCS(const std::vector<std::string> Event_variable_list_) {
-    Module::Module* temp_module = new Module::RandomBCS(Event_variable_list_, &variable_names, &VariableTypes);
+    Module::Module* temp_module = new Module::RandomBCS(Event_variable_list_, GetSchema());
+    Modules.push_back(temp_module);
+}
+
+void Loader::EventAggregate(const std::vector<Module::EventAggregateColumn> columns_, const std::vector<std::string> Event_variable_list_) {
+    for (int i = 0; i < columns_.size(); i++) CheckAliasCollision("EventAggregate", { columns_.at(i).name });
+    std::vector<Module::EventAggregateColumn> expanded_columns = columns_;
+    for (int i = 0; i < expanded_columns.size(); i++) expanded_columns.at(i).expressions = ExpandAlias(expanded_columns.at(i).expressions);
+    Module::Module* temp_module = new Module::EventAggregate(expanded_columns, Event_variable_list_, GetSchema(), &variable_names, &VariableTypes);
     Modules.push_back(temp_module);
 }
 
 void Loader::IsBCSValid(const std::vector<std::string> Event_variable_list_) {
-    Module::Module* temp_module = new Module::IsBCSValid(Event_variable_list_, &variable_names, &VariableTypes);
+    Module::Module* temp_module = new Module::IsBCSValid(Event_variable_list_, GetSchema());
     Modules.push_back(temp_module);
 }
 
 void Loader::RandomEventSelection(int split_num_, int selected_index_, const std::vector<std::string> Event_variable_list_) {
-    Module::Module* temp_module = new Module::RandomEventSelection(split_num_, selected_index_, Event_variable_list_, &variable_names, &VariableTypes);
+    Module::Module* temp_module = new Module::RandomEventSelection(split_num_, selected_index_, Event_variable_list_, GetSchema());
     Modules.push_back(temp_module);
 }
 
 std::shared_ptr<std::vector<double>> Loader::DrawFOM(const char* expression_, double MIN_, double MAX_, const char* png_name_) {
     std::shared_ptr<std::vector<double>> temp_ptr = std::make_shared<std::vector<double>>();
-    Module::Module* temp_module = new Module::DrawFOM(expression_, MIN_, MAX_, png_name_, Signal_label_list, Background_label_list, temp_ptr, &variable_names, &VariableTypes);
+    Module::Module* temp_module = new Module::DrawFOM(ExpandAlias(expression_).c_str(), MIN_, MAX_, png_name_, Signal_label_list, Background_label_list, temp_ptr, GetSchema());
     Modules.push_back(temp_module);
     return temp_ptr;
 }
 
 std::shared_ptr<std::vector<double>> Loader::DrawFOM(const char* expression_, double MIN_, double MAX_, double NBin_, int rank_, const char* png_name_) {
     std::shared_ptr<std::vector<double>> temp_ptr = std::make_shared<std::vector<double>>();
-    Module::Module* temp_module = new Module::DrawFOM(expression_, MIN_, MAX_, NBin_, rank_, png_name_, Signal_label_list, Background_label_list, temp_ptr, &variable_names, &VariableTypes);
+    Module::Module* temp_module = new Module::DrawFOM(ExpandAlias(expression_).c_str(), MIN_, MAX_, NBin_, rank_, png_name_, Signal_label_list, Background_label_list, temp_ptr, GetSchema());
     Modules.push_back(temp_module);
     return temp_ptr;
 }
 
 std::shared_ptr<std::vector<double>> Loader::DrawPunziFOM(const char* equation_, double MIN_, double MAX_, double NSIG_initial_, double alpha_, const char* png_name_) {
     std::shared_ptr<std::vector<double>> temp_ptr = std::make_shared<std::vector<double>>();
-    Module::Module* temp_module = new Module::DrawPunziFOM(equation_, MIN_, MAX_, NSIG_initial_, alpha_, png_name_, Signal_label_list, Background_label_list, temp_ptr, &variable_names, &VariableTypes);
+    Module::Module* temp_module = new Module::DrawPunziFOM(ExpandAlias(equation_).c_str(), MIN_, MAX_, NSIG_initial_, alpha_, png_name_, Signal_label_list, Background_label_list, temp_ptr, GetSchema());
     Modules.push_back(temp_module);
     return temp_ptr;
 }
 
 std::shared_ptr<std::vector<double>> Loader::DrawPunziFOM(const char* equation_, double MIN_, double MAX_, double NBin_, double NSIG_initial_, double alpha_, int rank_, const char* png_name_) {
     std::shared_ptr<std::vector<double>> temp_ptr = std::make_shared<std::vector<double>>();
-    Module::Module* temp_module = new Module::DrawPunziFOM(equation_, MIN_, MAX_, NBin_, NSIG_initial_, alpha_, rank_, png_name_, Signal_label_list, Background_label_list, temp_ptr, &variable_names, &VariableTypes);
+    Module::Module* temp_module = new Module::DrawPunziFOM(ExpandAlias(equation_).c_str(), MIN_, MAX_, NBin_, NSIG_initial_, alpha_, rank_, png_name_, Signal_label_list, Background_label_list, temp_ptr, GetSchema());
     Modules.push_back(temp_module);
     return temp_ptr;
 }
 
 std::shared_ptr<std::vector<double>> Loader::Draw2DPunziFOM(std::vector<std::tuple<const char*, double, double, int>> scan_conditions_, double NSIG_initial_, double alpha_, const char* png_name_) {
     std::shared_ptr<std::vector<double>> temp_ptr = std::make_shared<std::vector<double>>();
-    Module::Module* temp_module = new Module::Draw2DPunziFOM(scan_conditions_, NSIG_initial_, alpha_, png_name_, Signal_label_list, Background_label_list, temp_ptr, &variable_names, &VariableTypes);
+    for (int i = 0; i < scan_conditions_.size(); i++) {
+        expanded_scan_expressions.push_back(ExpandAlias(std::get<0>(scan_conditions_.at(i))));
+        std::get<0>(scan_conditions_.at(i)) = expanded_scan_expressions.back().c_str();
+    }
+    Module::Module* temp_module = new Module::Draw2DPunziFOM(scan_conditions_, NSIG_initial_, alpha_, png_name_, Signal_label_list, Background_label_list, temp_ptr, GetSchema());
     Modules.push_back(temp_module);
     return temp_ptr;
 }
 
 std::shared_ptr<std::vector<double>> Loader::Draw2DPunziFOM(std::vector<std::tuple<const char*, double, double, int>> scan_conditions_, const char* preselection_x_, const char* preselection_y_, double NSIG_initial_, double alpha_, const char* png_name_) {
     std::shared_ptr<std::vector<double>> temp_ptr = std::make_shared<std::vector<double>>();
-    Module::Module* temp_module = new Module::Draw2DPunziFOM(scan_conditions_, preselection_x_, preselection_y_, NSIG_initial_, alpha_, png_name_, Signal_label_list, Background_label_list, temp_ptr, &variable_names, &VariableTypes);
+    for (int i = 0; i < scan_conditions_.size(); i++) {
+        expanded_scan_expressions.push_back(ExpandAlias(std::get<0>(scan_conditions_.at(i))));
+        std::get<0>(scan_conditions_.at(i)) = expanded_scan_expressions.back().c_str();
+    }
+    Module::Module* temp_module = new Module::Draw2DPunziFOM(scan_conditions_, ExpandAlias(preselection_x_).c_str(), ExpandAlias(preselection_y_).c_str(), NSIG_initial_, alpha_, png_name_, Signal_label_list, Background_label_list, temp_ptr, GetSchema());
     Modules.push_back(temp_module);
     return temp_ptr;
 }
 
 std::shared_ptr<double> Loader::CalculateAUC(const char* equation_, double MIN_, double MAX_, const char* output_name_, const char* write_option_) {
     std::shared_ptr<double> temp_ptr = std::make_shared<double>();
-    Module::Module* temp_module = new Module::CalculateAUC(equation_, MIN_, MAX_, output_name_, write_option_, Signal_label_list, Background_label_list, temp_ptr, &variable_names, &VariableTypes);
+    Module::Module* temp_module = new Module::CalculateAUC(ExpandAlias(equation_).c_str(), MIN_, MAX_, output_name_, write_option_, Signal_label_list, Background_label_list, temp_ptr, GetSchema());
+    Modules.push_back(temp_module);
+    return temp_ptr;
+}
+
+std::shared_ptr<double> Loader::CalculateAUC(const char* equation_, double MIN_, double MAX_, const char* output_name_, const char* write_option_, const char* roc_output_name_) {
+    std::shared_ptr<double> temp_ptr = std::make_shared<double>();
+    Module::Module* temp_module = new Module::CalculateAUC(ExpandAlias(equation_).c_str(), MIN_, MAX_, output_name_, write_option_, roc_output_name_, Signal_label_list, Background_label_list, temp_ptr, GetSchema());
     Modules.push_back(temp_module);
     return temp_ptr;
 }
 
 void Loader::FastBDTTrain(std::vector<std::string> input_variables_, const char* Signal_preselection_, const char* Background_preselection_, std::map<std::string, double> hyperparameters_, const char* path_, const char* output_name_) {
-    Module::Module* temp_module = new Module::FastBDTTrain(input_variables_, Signal_preselection_, Background_preselection_, hyperparameters_, path_, output_name_, Signal_label_list, Background_label_list, &variable_names, &VariableTypes);
+    Module::Module* temp_module = new Module::FastBDTTrain(ExpandAlias(input_variables_), ExpandAlias(Signal_preselection_).c_str(), ExpandAlias(Background_preselection_).c_str(), hyperparameters_, path_, output_name_, Signal_label_list, Background_label_list, GetSchema());
     Modules.push_back(temp_module);
 }
 
 void Loader::FastBDTTrain(std::vector<std::string> input_variables_, const char* Signal_preselection_, const char* Background_preselection_, std::map<std::string, double> hyperparameters_, bool balanced_weight_, const char* path_, const char* output_name_) {
-    Module::Module* temp_module = new Module::FastBDTTrain(input_variables_, Signal_preselection_, Background_preselection_, hyperparameters_, balanced_weight_, path_, output_name_, Signal_label_list, Background_label_list, &variable_names, &VariableTypes);
+    Module::Module* temp_module = new Module::FastBDTTrain(ExpandAlias(input_variables_), ExpandAlias(Signal_preselection_).c_str(), ExpandAlias(Background_preselection_).c_str(), hyperparameters_, balanced_weight_, path_, output_name_, Signal_label_list, Background_label_list, GetSchema());
+    Modules.push_back(temp_module);
+}
+
+std::shared_ptr<std::vector<double>> Loader::FastBDTGridSearch(std::vector<std::string> input_variables_, const char* Signal_preselection_, const char* Background_preselection_, std::map<std::string, std::vector<double>> hyperparameter_grid_, double test_fraction_, bool balanced_weight_, const char* path_, const char* summary_name_, const std::vector<std::string> Event_variable_list_) {
+    std::shared_ptr<std::vector<double>> temp_ptr = std::make_shared<std::vector<double>>();
+    Module::Module* temp_module = new Module::FastBDTGridSearch(ExpandAlias(input_variables_), ExpandAlias(Signal_preselection_).c_str(), ExpandAlias(Background_preselection_).c_str(), hyperparameter_grid_, test_fraction_, balanced_weight_, path_, summary_name_, Event_variable_list_, Signal_label_list, Background_label_list, temp_ptr, GetSchema());
+    Modules.push_back(temp_module);
+    return temp_ptr;
+}
+
+void Loader::FastBDTKFoldTrain(std::vector<std::string> input_variables_, const char* Signal_preselection_, const char* Background_preselection_, std::map<std::string, double> hyperparameters_, int K_, bool balanced_weight_, const char* path_, const char* output_name_, const std::vector<std::string> Event_variable_list_) {
+    Module::Module* temp_module = new Module::FastBDTKFoldTrain(ExpandAlias(input_variables_), ExpandAlias(Signal_preselection_).c_str(), ExpandAlias(Background_preselection_).c_str(), hyperparameters_, K_, balanced_weight_, path_, output_name_, Event_variable_list_, Signal_label_list, Background_label_list, GetSchema());
     Modules.push_back(temp_module);
 }
 
 void Loader::FastBDTApplication(std::vector<std::string> input_variables_, const char* classifier_path_, const char* branch_name_) {
-    Module::Module* temp_module = new Module::FastBDTApplication(input_variables_, classifier_path_, branch_name_, &variable_names, &VariableTypes);
+    CheckAliasCollision("FastBDTApplication", { branch_name_ });
+    Module::Module* temp_module = new Module::FastBDTApplication(ExpandAlias(input_variables_), classifier_path_, branch_name_, GetSchema(), &variable_names, &VariableTypes);
+    Modules.push_back(temp_module);
+}
+
+void Loader::FastBDTApplication(std::vector<std::string> input_variables_, std::vector<std::string> classifier_paths_, std::vector<std::string> branch_names_) {
+    CheckAliasCollision("FastBDTApplication", branch_names_);
+    Module::Module* temp_module = new Module::FastBDTApplication(ExpandAlias(input_variables_), classifier_paths_, branch_names_, GetSchema(), &variable_names, &VariableTypes);
+    Modules.push_back(temp_module);
+}
+
+void Loader::FastBDTKFoldApplication(std::vector<std::string> input_variables_, const char* classifier_path_, int K_, const char* branch_name_, const std::vector<std::string> Event_variable_list_) {
+    CheckAliasCollision("FastBDTKFoldApplication", { branch_name_ });
+    Module::Module* temp_module = new Module::FastBDTKFoldApplication(ExpandAlias(input_variables_), classifier_path_, K_, branch_name_, Event_variable_list_, GetSchema(), &variable_names, &VariableTypes);
     Modules.push_back(temp_module);
 }
 
 void Loader::DefineNewVariable(const char* equation_, const char* new_variable_name_) {
-    Module::Module* temp_module = new Module::DefineNewVariable(equation_, new_variable_name_, &variable_names, &VariableTypes);
+    CheckAliasCollision("DefineNewVariable", { new_variable_name_ });
+    Module::Module* temp_module = new Module::DefineNewVariable(ExpandAlias(equation_).c_str(), new_variable_name_, GetSchema(), &variable_names, &VariableTypes);
     Modules.push_back(temp_module);
 }
 
 void Loader::ConditionalPairDefineNewVariable(std::map<std::string, std::string> condition_equation__criteria_equation_list_, int condition_order_, const char* new_variable_name_) {
-    Module::Module* temp_module = new Module::ConditionalPairDefineNewVariable(condition_equation__criteria_equation_list_, condition_order_, new_variable_name_, &variable_names, &VariableTypes);
+    CheckAliasCollision("ConditionalPairDefineNewVariable", { new_variable_name_ });
+    Module::Module* temp_module = new Module::ConditionalPairDefineNewVariable(ExpandAlias(condition_equation__criteria_equation_list_), condition_order_, new_variable_name_, GetSchema(), &variable_names, &VariableTypes);
     Modules.push_back(temp_module);
 }
 
 void Loader::GetAverage(std::vector<std::string> equations_, const char* new_variable_name_) {
-    Module::Module* temp_module = new Module::GetAverage(equations_, new_variable_name_, &variable_names, &VariableTypes);
+    CheckAliasCollision("GetAverage", { new_variable_name_ });
+    Module::Module* temp_module = new Module::GetAverage(ExpandAlias(equations_), new_variable_name_, GetSchema(), &variable_names, &VariableTypes);
     Modules.push_back(temp_module);
 }
 
 void Loader::GetStdDev(std::vector<std::string> equations_, const char* new_variable_name_) {
-    Module::Module* temp_module = new Module::GetStdDev(equations_, new_variable_name_, &variable_names, &VariableTypes);
+    CheckAliasCollision("GetStdDev", { new_variable_name_ });
+    Module::Module* temp_module = new Module::GetStdDev(ExpandAlias(equations_), new_variable_name_, GetSchema(), &variable_names, &VariableTypes);
     Modules.push_back(temp_module);
 }
 
 void Loader::GetDiff(std::vector<std::string> equations_, int order_, const char* new_variable_name_) {
-    Module::Module* temp_module = new Module::GetDiff(equations_, order_, new_variable_name_, &variable_names, &VariableTypes);
+    CheckAliasCollision("GetDiff", { new_variable_name_ });
+    Module::Module* temp_module = new Module::GetDiff(ExpandAlias(equations_), order_, new_variable_name_, GetSchema(), &variable_names, &VariableTypes);
     Modules.push_back(temp_module);
 }
 
 void Loader::GetAdd(std::vector<std::string> equations_, int order_, const char* new_variable_name_) {
-    Module::Module* temp_module = new Module::GetAdd(equations_, order_, new_variable_name_, &variable_names, &VariableTypes);
+    CheckAliasCollision("GetAdd", { new_variable_name_ });
+    Module::Module* temp_module = new Module::GetAdd(ExpandAlias(equations_), order_, new_variable_name_, GetSchema(), &variable_names, &VariableTypes);
+    Modules.push_back(temp_module);
+}
+
+void Loader::Reduce(std::vector<std::string> equations_, std::vector<Module::ReductionOutput> outputs_) {
+    for (int i = 0; i < outputs_.size(); i++) CheckAliasCollision("Reduce", { outputs_.at(i).name });
+    Module::Module* temp_module = new Module::Reduce(ExpandAlias(equations_), outputs_, GetSchema(), &variable_names, &VariableTypes);
     Modules.push_back(temp_module);
 }
 
 void Loader::FillDataSet(RooDataSet* dataset_, std::vector<RooRealVar*> realvars_, std::vector<std::string> equations_) {
-    Module::Module* temp_module = new Module::FillDataSet(dataset_, realvars_, equations_, &variable_names, &VariableTypes);
+    Module::Module* temp_module = new Module::FillDataSet(dataset_, realvars_, ExpandAlias(equations_), GetSchema());
     Modules.push_back(temp_module);
 }
 
 void Loader::FillTProfile(TProfile* tprofile_, std::string equation_x_, std::string equation_y_) {
-    Module::Module* temp_module = new Module::FillTProfile(tprofile_, equation_x_, equation_y_, &variable_names, &VariableTypes);
+    Module::Module* temp_module = new Module::FillTProfile(tprofile_, ExpandAlias(equation_x_), ExpandAlias(equation_y_), GetSchema());
     Modules.push_back(temp_module);
 }
 
 void Loader::FillTH1D(TH1D* th1d_, std::string equation_) {
-    Module::Module* temp_module = new Module::FillTH1D(th1d_, equation_, &variable_names, &VariableTypes);
+    Module::Module* temp_module = new Module::FillTH1D(th1d_, ExpandAlias(equation_), GetSchema());
     Modules.push_back(temp_module);
 }
 
 void Loader::FillCustomizedTH1D(TH1D* th1d_, std::vector<std::string> equations_, double (*custom_function_)(std::vector<double>)) {
-    Module::Module* temp_module = new Module::FillCustomizedTH1D(th1d_, equations_, custom_function_, &variable_names, &VariableTypes);
+    Module::Module* temp_module = new Module::FillCustomizedTH1D(th1d_, ExpandAlias(equations_), custom_function_, GetSchema());
     Modules.push_back(temp_module);
 }
 
 void Loader::FillTH2D(TH2D* th2d_, const char* x_expression_, const char* y_expression_) {
-    Module::Module* temp_module = new Module::FillTH2D(th2d_, x_expression_, y_expression_, &variable_names, &VariableTypes);
+    Module::Module* temp_module = new Module::FillTH2D(th2d_, ExpandAlias(x_expression_).c_str(), ExpandAlias(y_expression_).c_str(), GetSchema());
     Modules.push_back(temp_module);
 }
 
 void Loader::FillCustomizedTH2D(TH2D* th2d_, std::vector<std::string> equations_, double (*x_custom_function_)(std::vector<double>), double (*y_custom_function_)(std::vector<double>)) {
-    Module::Module* temp_module = new Module::FillCustomizedTH2D(th2d_, equations_, x_custom_function_, y_custom_function_, &variable_names, &VariableTypes);
+    Module::Module* temp_module = new Module::FillCustomizedTH2D(th2d_, ExpandAlias(equations_), x_custom_function_, y_custom_function_, GetSchema());
     Modules.push_back(temp_module);
 }
 
 void Loader::PrintEvent(std::vector<std::string> print_variables_) {
-    Module::Module* temp_module = new Module::PrintEvent(print_variables_, &variable_names, &VariableTypes);
+    MaterializeAliases(print_variables_);
+    Module::Module* temp_module = new Module::PrintEvent(print_variables_, GetSchema());
     Modules.push_back(temp_module);
 }
 
 std::shared_ptr<std::vector<double>> Loader::ABCDmethod(const char* region_A_, const char* region_B_, const char* region_C_, const char* region_D_, bool WeightSumError_) {
     std::shared_ptr<std::vector<double>> temp_ptr = std::make_shared<std::vector<double>>();
-    Module::Module* temp_module = new Module::ABCDmethod(region_A_, region_B_, region_C_, region_D_, WeightSumError_, temp_ptr, &variable_names, &VariableTypes);
+    Module::Module* temp_module = new Module::ABCDmethod(ExpandAlias(region_A_).c_str(), ExpandAlias(region_B_).c_str(), ExpandAlias(region_C_).c_str(), ExpandAlias(region_D_).c_str(), WeightSumError_, temp_ptr, GetSchema());
     Modules.push_back(temp_module);
     return temp_ptr;
 }
 
 std::shared_ptr<std::vector<double>> Loader::ABCDmethod(const char* region_A_, const char* region_B_, const char* region_C_, const char* region_D_, const char* region_Aprime_, const char* region_Bprime_, const char* region_Cprime_, const char* region_Dprime_, bool WeightSumError_) {
     std::shared_ptr<std::vector<double>> temp_ptr = std::make_shared<std::vector<double>>();
-    Module::Module* temp_module = new Module::ABCDmethod(region_A_, region_B_, region_C_, region_D_, region_Aprime_, region_Bprime_, region_Cprime_, region_Dprime_, WeightSumError_, temp_ptr, &variable_names, &VariableTypes);
+    Module::Module* temp_module = new Module::ABCDmethod(ExpandAlias(region_A_).c_str(), ExpandAlias(region_B_).c_str(), ExpandAlias(region_C_).c_str(), ExpandAlias(region_D_).c_str(), ExpandAlias(region_Aprime_).c_str(), ExpandAlias(region_Bprime_).c_str(), ExpandAlias(region_Cprime_).c_str(), ExpandAlias(region_Dprime_).c_str(), WeightSumError_, temp_ptr, GetSchema());
     Modules.push_back(temp_module);
     return temp_ptr;
 }
@@ -412,26 +856,103 @@ void Loader::InsertCustomizedModule(Module::Module* module_) {
 }
 
 void Loader::end() {
+    // the merge step does not read data
+    if (IsMergeStep) {
+        MergeShards();
+
+        for (int i = 0; i < Modules.size(); i++) delete Modules.at(i);
+        printf("[Loader] loader %s is successfully done\n", loader_name.c_str());
+        return;
+    }
+
+    // fingerprint of all files, which should be the same as the merge step
+    std::string shard_fingerprint;
+    if (Nshards > 0) {
+        shard_fingerprint = ConfigurationFingerprint();
+        PrepareShard();
+    }
+
+    // replace memoized modules
+    ApplyMemoization();
+
+    // push leading cuts down to `LoadCache`, so that it can skip blocks using the zone map.
+    // Only cuts right after the loading modules are used. `Cut` modules are still applied
+    std::vector<Module::LoadCache*> cache_loaders;
+    std::vector<std::string> leading_cuts;
+    for (int i = 0; i < Modules.size(); i++) {
+        if (leading_cuts.size() == 0) {
+            if (Module::LoadCache* temp_module = dynamic_cast<Module::LoadCache*>(Modules.at(i))) {
+                cache_loaders.push_back(temp_module);
+                continue;
+            }
+            if ((dynamic_cast<Module::Load*>(Modules.at(i)) != nullptr) || (dynamic_cast<Module::LoadWithCut*>(Modules.at(i)) != nullptr)) continue;
+        }
+        if (Module::Cut* temp_module = dynamic_cast<Module::Cut*>(Modules.at(i))) leading_cuts.push_back(temp_module->GetCutString());
+        else break;
+    }
+    for (int i = 0; i < cache_loaders.size(); i++) cache_loaders.at(i)->SetPushdownCuts(leading_cuts);
+
     // run Start
     for (int i = 0; i < Modules.size(); i++) Modules.at(i)->Start();
+    CompilePendingExpressions();
+
+    // checkpoint is used only when every module supports it
+    bool UseCheckpoint = (checkpoint_name != "");
+    for (int i = 0; (i < Modules.size()) && UseCheckpoint; i++) {
+        if (!Modules.at(i)->IsCheckpointable()) {
+            printf("[Loader] module %s does not support checkpoint. Checkpoint is disabled\n", typeid(*Modules.at(i)).name());
+            UseCheckpoint = false;
+        }
+    }
+    if (UseCheckpoint) checkpoint_fingerprint = ConfigurationFingerprint();
+    if (UseCheckpoint && ReadCheckpoint()) printf("[Loader] loader %s is resumed from %s\n", loader_name.c_str(), checkpoint_name.c_str());
 
+    int Nrounds = 0;
     while (true) {
         bool AreAllFilesRead = true;
 
         // run Process
-        for (int i = 0; i < Modules.size(); i++) {
-            if (Modules.at(i)->Process(&TotalData) == 0) AreAllFilesRead = false;
-        }
+        if (ProcessModules(0) == false) AreAllFilesRead = false;
 
         // clear remaining data
         TotalData.clear();
 
         // If all files are read, exit from while loop
         if (AreAllFilesRead) break;
+
+        // one round reads one file, so there is no data between modules here
+        Nrounds++;
+        if (UseCheckpoint && (Nrounds % checkpoint_interval == 0)) WriteCheckpoint();
     }
 
+    // state should be saved before `End` changes it
+    SaveMemoizedStates();
+
+    // partial results of the shard are merged later
+    if (Nshards > 0) WriteShardState(shard_fingerprint);
+
     // run End
-    for (int i = 0; i < Modules.size(); i++) Modules.at(i)->End();
+    for (int i = 0; i < Modules.size(); i++) {
+        if ((Nshards == 0) || !IsMergedModule(Modules.at(i))) Modules.at(i)->End();
+    }
+
+    if (UseCheckpoint) std::remove(checkpoint_name.c_str());
+
+    // modules served by the memoization
+    for (int i = 0; i < served_modules.size(); i++) {
+        std::ifstream in_stream(memoized_states[served_modules.at(i)].first.c_str(), std::ios_base::in | std::ios_base::binary);
+        std::string fingerprint;
+        std::string state;
+        ReadBinary(in_stream, fingerprint);
+        ReadBinary(in_stream, state);
+        std::istringstream state_stream(state);
+
+        served_modules.at(i)->Start();
+        served_modules.at(i)->LoadState(state_stream);
+        served_modules.at(i)->End();
+        delete served_modules.at(i);
+    }
+    served_modules.clear();
 
     // delete all modules
     for (int i = 0; i < Modules.size(); i++) delete Modules.at(i);
@@ -439,6 +960,505 @@ void Loader::end() {
     printf("[Loader] loader %s is successfully done\n", loader_name.c_str());
 }
 
+/*
+* the checkpoint is valid only for the same modules and variables
+*/
+std::string Loader::ConfigurationFingerprint() {
+    std::ostringstream fingerprint;
+    fingerprint << TTree_name << "\n";
+    for (int i = 0; i < variable_names.size(); i++) fingerprint << variable_names.at(i) << " " << VariableTypes.at(i) << "\n";
+    for (int i = 0; i < Modules.size(); i++) fingerprint << typeid(*Modules.at(i)).name() << " " << Modules.at(i)->Fingerprint() << "\n";
+    return fingerprint.str();
+}
+
+const char* ShardMagic = "BELLE2_ANALYSIS_SHARD";
+
+std::string Loader::ShardStateName(int shard_index_) {
+    std::string name = loader_name.empty() ? std::string("loader") : loader_name;
+    return shard_directory + "/" + name + "_shard" + std::to_string(shard_index_) + "of" + std::to_string(Nshards) + ".bin";
+}
+
+/*
+* terminal modules without their own output are merged by `SaveState` and `LoadState`
+*/
+bool Loader::IsMergedModule(Module::Module* module_) {
+    return module_->IsTerminal() && !module_->HasOutputPerShard();
+}
+
+void Loader::PrepareShard() {
+    if (memoization_directory != "") {
+        printf("[Loader] memoization cannot be used with shards\n");
+        exit(1);
+    }
+
+    for (int i = 0; i < Modules.size(); i++) {
+        if (IsMergedModule(Modules.at(i)) && !Modules.at(i)->IsCheckpointable()) {
+            printf("[Loader] module %s cannot be merged, so it cannot be used with shards\n", typeid(*Modules.at(i)).name());
+            exit(1);
+        }
+    }
+
+    std::string suffix = "_shard" + std::to_string(shard_index) + "of" + std::to_string(Nshards);
+    for (int i = 0; i < Modules.size(); i++) {
+        Modules.at(i)->SelectShard(shard_index, Nshards);
+        if (Modules.at(i)->HasOutputPerShard()) Modules.at(i)->SetShardSuffix(suffix);
+    }
+    MakeCacheDirectory(shard_directory);
+
+    printf("[Loader] loader %s reads shard %d/%d\n", loader_name.c_str(), shard_index, Nshards);
+}
+
+void Loader::WriteShardState(const std::string& fingerprint_) {
+    std::string shard_name = ShardStateName(shard_index);
+
+    // write into the temporary file first, so that the merge step never reads an incomplete file
+    std::string temporary_name = shard_name + ".tmp";
+    std::ofstream out_stream(temporary_name.c_str(), std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+    WriteBinary(out_stream, std::string(ShardMagic));
+    WriteBinary(out_stream, fingerprint_);
+    WriteBinary(out_stream, shard_index);
+    WriteBinary(out_stream, Nshards);
+    WriteBinary(out_stream, static_cast<uint64_t>(Modules.size()));
+    for (int i = 0; i < Modules.size(); i++) {
+        std::ostringstream state;
+        if (IsMergedModule(Modules.at(i))) Modules.at(i)->SaveState(state);
+        WriteBinary(out_stream, state.str());
+    }
+    out_stream.close();
+
+    if (out_stream.fail() || (std::rename(temporary_name.c_str(), shard_name.c_str()) != 0)) {
+        printf("[Loader] cannot write %s\n", shard_name.c_str());
+        exit(1);
+    }
+}
+
+void Loader::MergeShards() {
+    std::string fingerprint = ConfigurationFingerprint();
+
+    for (int i = 0; i < Modules.size(); i++) {
+        if (IsMergedModule(Modules.at(i))) Modules.at(i)->Start();
+    }
+
+    for (int shard = 0; shard < Nshards; shard++) {
+        std::string shard_name = ShardStateName(shard);
+        std::ifstream in_stream(shard_name.c_str(), std::ios_base::in | std::ios_base::binary);
+        if (!in_stream.is_open()) {
+            printf("[Loader] cannot open %s. Is shard %d/%d done?\n", shard_name.c_str(), shard, Nshards);
+            exit(1);
+        }
+
+        std::string magic;
+        std::string saved_fingerprint;
+        int saved_shard_index;
+        int saved_Nshards;
+        uint64_t Nmodules;
+        ReadBinary(in_stream, magic);
+        ReadBinary(in_stream, saved_fingerprint);
+        ReadBinary(in_stream, saved_shard_index);
+        ReadBinary(in_stream, saved_Nshards);
+        ReadBinary(in_stream, Nmodules);
+        if (magic != ShardMagic) {
+            printf("[Loader] %s is not a result of shard\n", shard_name.c_str());
+            exit(1);
+        }
+        if ((saved_fingerprint != fingerprint) || (saved_shard_index != shard) || (saved_Nshards != Nshards) || (Nmodules != Modules.size())) {
+            printf("[Loader] configuration is different from the shard %s\n", shard_name.c_str());
+            exit(1);
+        }
+
+        for (int i = 0; i < Modules.size(); i++) {
+            std::string state;
+            ReadBinary(in_stream, state);
+            if (!IsMergedModule(Modules.at(i))) continue;
+
+            std::istringstream state_stream(state);
+            Modules.at(i)->LoadState(state_stream);
+        }
+    }
+
+    for (int i = 0; i < Modules.size(); i++) {
+        if (IsMergedModule(Modules.at(i))) Modules.at(i)->End();
+    }
+
+    printf("[Loader] loader %s merged %d shards\n", loader_name.c_str(), Nshards);
+}
+
+void Loader::ApplyMemoization() {
+    if (memoization_directory == "") {
+        if (materialization_index >= 0) {
+            printf("[Loader] `Materialize` requires `SetMemoization`\n");
+            exit(1);
+        }
+        return;
+    }
+    MakeCacheDirectory(memoization_directory);
+
+    // fingerprint of data given to each module: input files and all modules before it which change data.
+    // Empty means unknown
+    std::vector<std::string> data_fingerprints;
+    std::string data_fingerprint = MakeFingerprint("Loader", TTree_name);
+    for (int i = 0; i < Modules.size(); i++) {
+        data_fingerprints.push_back(data_fingerprint);
+        if ((data_fingerprint == "") || Modules.at(i)->IsTerminal()) continue;
+
+        std::string module_fingerprint = Modules.at(i)->Fingerprint();
+        if (module_fingerprint == "") data_fingerprint = "";
+        else data_fingerprint = data_fingerprint + "\n" + module_fingerprint;
+    }
+    data_fingerprints.push_back(data_fingerprint);
+
+    // find terminal modules whose state is already saved
+    std::vector<bool> IsServed(Modules.size(), false);
+    for (int i = 0; i < Modules.size(); i++) {
+        if (!Modules.at(i)->IsTerminal() || !Modules.at(i)->IsMemoizable()) continue;
+
+        std::string module_fingerprint = Modules.at(i)->Fingerprint();
+        if ((data_fingerprints.at(i) == "") || (module_fingerprint == "")) continue;
+
+        std::string fingerprint = data_fingerprints.at(i) + "\n" + module_fingerprint;
+        std::string state_name = memoization_directory + "/state_" + FingerprintKey(fingerprint) + ".bin";
+        memoized_states[Modules.at(i)] = std::make_pair(state_name, fingerprint);
+
+        std::ifstream in_stream(state_name.c_str(), std::ios_base::in | std::ios_base::binary);
+        if (!in_stream.is_open()) continue;
+        std::string saved_fingerprint;
+        ReadBinary(in_stream, saved_fingerprint);
+        if (saved_fingerprint == fingerprint) IsServed.at(i) = true;
+    }
+
+    // materialization point
+    int first_module = 0;
+    Module::Module* materialized_loader = nullptr;
+    Module::Module* materialized_writer = nullptr;
+    if ((materialization_index >= 0) && (data_fingerprints.at(materialization_index) != "")) {
+        std::string rows_name = memoization_directory + "/rows_" + FingerprintKey(data_fingerprints.at(materialization_index));
+
+        // schema.txt is written at the end of `SaveCache`, so the rows without it are incomplete
+        std::ifstream fingerprint_stream((rows_name + "/fingerprint.txt").c_str());
+        std::string saved_fingerprint((std::istreambuf_iterator<char>(fingerprint_stream)), std::istreambuf_iterator<char>());
+        bool IsMaterialized = std::ifstream((rows_name + "/schema.txt").c_str()).good() && (saved_fingerprint == data_fingerprints.at(materialization_index));
+
+        // terminal modules before the materialization point still need modules before them
+        bool IsPrefixNeeded = false;
+        for (int i = 0; i < materialization_index; i++) {
+            if (Modules.at(i)->IsTerminal() && !IsServed.at(i)) IsPrefixNeeded = true;
+        }
+
+        if (IsMaterialized && !IsPrefixNeeded) {
+            materialized_loader = new Module::LoadCache(rows_name.c_str(), "", &DataStructureDefined, &materialized_variable_names, &materialized_VariableTypes);
+            first_module = materialization_index;
+            printf("[Loader] modules before the materialization point are replaced by %s\n", rows_name.c_str());
+        }
+        else if (!IsMaterialized) {
+            MakeCacheDirectory(rows_name);
+            std::ofstream out_stream((rows_name + "/fingerprint.txt").c_str(), std::ios_base::out | std::ios_base::trunc);
+            out_stream << data_fingerprints.at(materialization_index);
+            materialized_writer = new Module::SaveCache(rows_name.c_str(), materialized_schema);
+        }
+    }
+
+    std::vector<Module::Module*> new_modules;
+    if (materialized_loader != nullptr) new_modules.push_back(materialized_loader);
+    for (int i = 0; i <= Modules.size(); i++) {
+        if ((i == materialization_index) && (materialized_writer != nullptr)) new_modules.push_back(materialized_writer);
+        if (i == Modules.size()) break;
+
+        if (IsServed.at(i)) served_modules.push_back(Modules.at(i));
+        else if (i < first_module) delete Modules.at(i);
+        else new_modules.push_back(Modules.at(i));
+    }
+
+    // modules which change data are not needed if there is no module which uses data after them
+    int last_needed = -1;
+    for (int i = 0; i < new_modules.size(); i++) {
+        if (new_modules.at(i)->IsTerminal() || (new_modules.at(i)->Fingerprint() == "")) last_needed = i;
+    }
+    for (int i = last_needed + 1; i < new_modules.size(); i++) delete new_modules.at(i);
+    new_modules.resize(last_needed + 1);
+
+    Modules = new_modules;
+
+    if (served_modules.size() != 0) printf("[Loader] %zu modules are served from %s\n", served_modules.size(), memoization_directory.c_str());
+}
+
+void Loader::SaveMemoizedStates() {
+    for (int i = 0; i < Modules.size(); i++) {
+        std::map<Module::Module*, std::pair<std::string, std::string>>::iterator iter = memoized_states.find(Modules.at(i));
+        if (iter == memoized_states.end()) continue;
+
+        std::ostringstream state;
+        Modules.at(i)->SaveState(state);
+
+        // write into the temporary file first, so that an incomplete state is never read
+        std::string temporary_name = iter->second.first + ".tmp";
+        std::ofstream out_stream(temporary_name.c_str(), std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+        WriteBinary(out_stream, iter->second.second);
+        WriteBinary(out_stream, state.str());
+        out_stream.close();
+        if (out_stream.fail() || (std::rename(temporary_name.c_str(), iter->second.first.c_str()) != 0)) {
+            printf("[Loader] cannot write %s\n", iter->second.first.c_str());
+            exit(1);
+        }
+    }
+}
+
+const char* CheckpointMagic = "BELLE2_ANALYSIS_CHECKPOINT";
+
+void Loader::WriteCheckpoint() {
+    // write into the temporary file first, so that the previous checkpoint survives the crash during writing
+    std::string temporary_name = checkpoint_name + ".tmp";
+    std::ofstream out_stream(temporary_name.c_str(), std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+    if (!out_stream.is_open()) {
+        printf("[Loader] cannot open %s\n", temporary_name.c_str());
+        exit(1);
+    }
+
+    WriteBinary(out_stream, std::string(CheckpointMagic));
+    WriteBinary(out_stream, checkpoint_fingerprint);
+
+    // each state is written with its size, so that a broken module state is detected
+    for (int i = 0; i < Modules.size(); i++) {
+        std::ostringstream state;
+        Modules.at(i)->SaveState(state);
+        WriteBinary(out_stream, state.str());
+    }
+
+    // random number generator is used to name histograms
+    std::ostringstream generator_state;
+    generator_state << generator;
+    WriteBinary(out_stream, generator_state.str());
+
+    out_stream.close();
+    if (out_stream.fail() || (std::rename(temporary_name.c_str(), checkpoint_name.c_str()) != 0)) {
+        printf("[Loader] cannot write the checkpoint %s\n", checkpoint_name.c_str());
+        exit(1);
+    }
+}
+
+/*
+* return false if there is no checkpoint
+*/
+bool Loader::ReadCheckpoint() {
+    std::ifstream in_stream(checkpoint_name.c_str(), std::ios_base::in | std::ios_base::binary);
+    if (!in_stream.is_open()) return false;
+
+    std::string magic;
+    std::string fingerprint;
+    ReadBinary(in_stream, magic);
+    ReadBinary(in_stream, fingerprint);
+    if (magic != CheckpointMagic) {
+        printf("[Loader] %s is not a checkpoint\n", checkpoint_name.c_str());
+        exit(1);
+    }
+    if (fingerprint != checkpoint_fingerprint) {
+        printf("[Loader] configuration is different from the checkpoint %s. Remove it to start from the beginning\n", checkpoint_name.c_str());
+        exit(1);
+    }
+
+    for (int i = 0; i < Modules.size(); i++) {
+        std::string state;
+        ReadBinary(in_stream, state);
+        std::istringstream state_stream(state);
+        Modules.at(i)->LoadState(state_stream);
+        if (state_stream.tellg() != (std::streampos)state.size()) {
+            printf("[Loader] state of module %s in the checkpoint is broken\n", typeid(*Modules.at(i)).name());
+            exit(1);
+        }
+    }
+
+    std::string generator_state;
+    ReadBinary(in_stream, generator_state);
+    std::istringstream generator_stream(generator_state);
+    generator_stream >> generator;
+
+    return true;
+}
+
+/*
+* return: true if all modules return 1
+*/
+bool Loader::ProcessModules(int first_module_, std::deque<Data>* shared_data_) {
+    bool AreAllFilesRead = true;
+    bool IsSelectionActive = false;
+
+    // offsets are computed again for the new data
+    bool IsEventOffsetValid = false;
+
+    // rows of this loader. They are `TotalData` unless they are the view of `shared_data_`
+    std::deque<Data>* rows = &TotalData;
+
+    auto StartSelection = [&]() {
+        if (IsSelectionActive) return;
+        selection.resize(rows->size());
+        for (size_t j = 0; j < selection.size(); j++) selection[j] = j;
+        IsSelectionActive = true;
+    };
+
+    auto CompactSelection = [&]() {
+        if (!IsSelectionActive) return;
+        if (rows != &TotalData) {
+            // shared rows are not changed, so selected rows are copied
+            TotalData.clear();
+            for (size_t j = 0; j < selection.size(); j++) TotalData.push_back((*rows)[selection[j]]);
+            rows = &TotalData;
+        }
+        else CompactRows(&TotalData, selection, IsEventOffsetValid ? &event_offsets : nullptr);
+        IsSelectionActive = false;
+    };
+
+    // terminal modules do not change rows, and cuts and selection-aware modules only remove indices from the selection
+    auto CanUseSharedData = [](Module::Module* module_) {
+        return module_->IsTerminal() || module_->IsSelectionAware() || (dynamic_cast<Module::Cut*>(module_) != nullptr);
+    };
+
+    if (shared_data_ != nullptr) {
+        rows = shared_data_;
+        StartSelection();
+    }
+
+    for (int i = first_module_; i < Modules.size(); i++) {
+        Module::Module* temp_module = Modules.at(i);
+
+        if ((rows != &TotalData) && !CanUseSharedData(temp_module)) CompactSelection();
+
+        if (temp_module->IsRowLocal()) {
+            // consecutive row-local modules are fused into one loop over rows
+            int last_module = i;
+            while ((last_module < Modules.size()) && Modules.at(last_module)->IsRowLocal() && ((rows == &TotalData) || CanUseSharedData(Modules.at(last_module)))) last_module++;
+
+            StartSelection();
+
+            size_t Nselected = 0;
+            for (size_t j = 0; j < selection.size(); j++) {
+                std::deque<Data>::iterator iter = rows->begin() + selection[j];
+
+                bool IsAccepted = true;
+                for (int k = i; (k < last_module) && IsAccepted; k++) IsAccepted = Modules.at(k)->ProcessRow(iter);
+                if (IsAccepted) selection[Nselected++] = selection[j];
+            }
+            selection.resize(Nselected);
+
+            // the view of shared rows is kept to avoid the copy
+            if ((rows == &TotalData) && (selection.size() < compaction_threshold * TotalData.size())) CompactSelection();
+
+            i = last_module - 1;
+        }
+        else if (temp_module->IsSelectionAware()) {
+            StartSelection();
+            if (temp_module->ProcessSelection(rows, &selection) == 0) AreAllFilesRead = false;
+
+            // later cuts evaluate only selected rows anyway, but sparse rows are slow to access
+            if ((rows == &TotalData) && (selection.size() < compaction_threshold * TotalData.size())) CompactSelection();
+        }
+        else if (temp_module->EventVariableIndices().size() != 0) {
+            CompactSelection();
+
+            // event boundaries are found once, and kept through cuts
+            std::vector<int> key_indices = temp_module->EventVariableIndices();
+            if (!IsEventOffsetValid || (event_offset_keys != key_indices)) {
+                ComputeEventOffsets(TotalData, key_indices, &event_offsets);
+                event_offset_keys = key_indices;
+                IsEventOffsetValid = true;
+            }
+            if (temp_module->ProcessEvents(&TotalData, &event_offsets) == 0) AreAllFilesRead = false;
+        }
+        else {
+            CompactSelection();
+            if (temp_module->Process(&TotalData) == 0) AreAllFilesRead = false;
+
+            // rows can be changed in any way
+            IsEventOffsetValid = false;
+        }
+    }
+
+    // rows after the last module are not used, so they are not compacted
+    return AreAllFilesRead;
+}
+
+int Loader::NLoadingModules() {
+    int Nloading = 0;
+    while (Nloading < Modules.size()) {
+        Module::Module* temp_module = Modules.at(Nloading);
+        if ((dynamic_cast<Module::Load*>(temp_module) == nullptr) && (dynamic_cast<Module::LoadWithCut*>(temp_module) == nullptr) && (dynamic_cast<Module::LoadCache*>(temp_module) == nullptr)) break;
+        Nloading++;
+    }
+    return Nloading;
+}
+
+void Loader::EndTogether(std::vector<Loader*> loaders_) {
+    if (loaders_.size() == 0) return;
+    Loader* reader = loaders_.at(0);
+
+    // every loader should read the same files in the same way
+    int Nloading = reader->NLoadingModules();
+    if (Nloading == 0) {
+        printf("[Loader] loader %s does not load anything\n", reader->loader_name.c_str());
+        exit(1);
+    }
+    for (int k = 0; k < loaders_.size(); k++) {
+        Loader* loader = loaders_.at(k);
+        if ((loader->checkpoint_name != "") || (loader->memoization_directory != "") || (loader->Nshards > 0)) {
+            printf("[Loader] checkpoint, memoization, and shards cannot be used in `EndTogether`: %s\n", loader->loader_name.c_str());
+            exit(1);
+        }
+        if ((loader->NLoadingModules() != Nloading) || (loader->variable_names != reader->variable_names) || (loader->VariableTypes != reader->VariableTypes)) {
+            printf("[Loader] loader %s does not load the same files as %s\n", loader->loader_name.c_str(), reader->loader_name.c_str());
+            exit(1);
+        }
+        for (int i = 0; i < Nloading; i++) {
+            if ((loader->Modules.at(i)->Fingerprint() != reader->Modules.at(i)->Fingerprint()) || (typeid(*loader->Modules.at(i)) != typeid(*reader->Modules.at(i)))) {
+                printf("[Loader] loader %s does not load the same files as %s\n", loader->loader_name.c_str(), reader->loader_name.c_str());
+                exit(1);
+            }
+        }
+    }
+
+    // only loading modules of the first loader are used
+    for (int k = 1; k < loaders_.size(); k++) {
+        for (int i = 0; i < Nloading; i++) delete loaders_.at(k)->Modules.at(i);
+        loaders_.at(k)->Modules.erase(loaders_.at(k)->Modules.begin(), loaders_.at(k)->Modules.begin() + Nloading);
+    }
+
+    // run Start
+    for (int k = 0; k < loaders_.size(); k++) {
+        for (int i = 0; i < loaders_.at(k)->Modules.size(); i++) loaders_.at(k)->Modules.at(i)->Start();
+    }
+    CompilePendingExpressions();
+
+    while (true) {
+        bool AreAllFilesRead = true;
+
+        // read one file
+        for (int i = 0; i < Nloading; i++) {
+            if (reader->Modules.at(i)->Process(&reader->TotalData) == 0) AreAllFilesRead = false;
+        }
+
+        // other loaders read rows of the first loader before it changes them. Each of them clears its copy before the next one
+        for (int k = 1; k < loaders_.size(); k++) {
+            if (loaders_.at(k)->ProcessModules(0, &reader->TotalData) == false) AreAllFilesRead = false;
+            loaders_.at(k)->TotalData.clear();
+        }
+
+        if (reader->ProcessModules(Nloading) == false) AreAllFilesRead = false;
+
+        // clear remaining data
+        reader->TotalData.clear();
+
+        // If all files are read, exit from while loop
+        if (AreAllFilesRead) break;
+    }
+
+    // run End and delete all modules
+    for (int k = 0; k < loaders_.size(); k++) {
+        Loader* loader = loaders_.at(k);
+        for (int i = 0; i < loader->Modules.size(); i++) loader->Modules.at(i)->End();
+        for (int i = 0; i < loader->Modules.size(); i++) delete loader->Modules.at(i);
+        loader->Modules.clear();
+
+        printf("[Loader] loader %s is successfully done\n", loader->loader_name.c_str());
+    }
+}
+
 std::vector<std::string>* Loader::Getvariable_names_address() {
     return (&variable_names);
 }
@@ -447,6 +1467,14 @@ std::vector<std::string>* Loader::VariableTypes_address() {
     return (&VariableTypes);
 }
 
+SchemaPtr Loader::GetSchema() {
+    if ((schema == nullptr) || !schema->IsSame(variable_names, VariableTypes)) {
+        unsigned long version = (schema == nullptr) ? 0 : (schema->Version() + 1);
+        schema = std::make_shared<const Schema>(variable_names, VariableTypes, version);
+    }
+    return schema;
+}
+
 std::vector<std::string>* Loader::SignalLabel_address() {
     return (&Signal_label_list);
 }
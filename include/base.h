@@ -3,6 +3,7 @@
 
 #include <string>
 #include <random>
+#include <vector>
 
 #include "TSystemDirectory.h"
 #include "TList.h"
@@ -37,6 +38,40 @@ bool hasEnding(std::string const& fullString, std::string const& ending) {
     }
 }
 
+/*
+* glob matching. `*` matches any string and `?` matches any character
+*/
+bool MatchGlob(std::string const& pattern, std::string const& text) {
+    size_t p = 0;
+    size_t t = 0;
+
+    // position of the last `*` and the text position matched by it
+    size_t star = std::string::npos;
+    size_t star_text = 0;
+
+    while (t < text.length()) {
+        if ((p < pattern.length()) && ((pattern.at(p) == '?') || (pattern.at(p) == text.at(t)))) {
+            p++;
+            t++;
+        }
+        else if ((p < pattern.length()) && (pattern.at(p) == '*')) {
+            star = p;
+            star_text = t;
+            p++;
+        }
+        else if (star != std::string::npos) {
+            // let the last `*` match one more character
+            p = star + 1;
+            star_text++;
+            t = star_text;
+        }
+        else return false;
+    }
+
+    while ((p < pattern.length()) && (pattern.at(p) == '*')) p++;
+
+    return (p == pattern.length());
+}
 
 void load_files(const char* dirname, std::vector<std::string>* names) {
     TSystemDirectory dir(dirname, dirname);
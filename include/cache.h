@@ -0,0 +1,197 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iomanip>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+* native cache format.
+* The cache is a directory which contains
+*     schema.txt: variable names and types, and the list of segments (the number of rows, label, filename)
+*     column_{i}.bin: raw values of i-th variable for all segments. For string variable, it has the end offset (uint64_t) of each string
+*     column_{i}.str: characters of i-th variable, only for string variable
+*     zonemap.bin: (optional) min and max (double) of every variable for each block of rows. Blocks do not cross segments
+* Columns are not compressed, so they can be memory-mapped and read without decoding.
+*/
+
+struct CacheSegment {
+    unsigned long long Nrows;
+    std::string label;
+    std::string filename;
+};
+
+struct CacheSchema {
+    std::vector<std::string> variable_names;
+    std::vector<std::string> VariableTypes;
+    std::vector<CacheSegment> segments;
+
+    // the number of rows in one block of zone map. 0 means there is no zone map
+    unsigned long long ZoneMapBlockSize = 0;
+};
+
+const char* CacheMagic = "BELLE2_ANALYSIS_CACHE";
+const int CacheVersion = 1;
+
+std::string CacheZoneMapPath(const std::string& path_) {
+    return path_ + "/zonemap.bin";
+}
+
+// the number of zone map blocks in the segment
+unsigned long long CacheNblocks(const CacheSegment& segment_, unsigned long long ZoneMapBlockSize_) {
+    return (segment_.Nrows + ZoneMapBlockSize_ - 1) / ZoneMapBlockSize_;
+}
+
+std::string CacheColumnPath(const std::string& path_, int index_, const char* extension_) {
+    return path_ + "/column_" + std::to_string(index_) + extension_;
+}
+
+// size of one value in `column_{i}.bin`
+size_t CacheValueSize(const std::string& VariableType_) {
+    if (VariableType_ == "Double_t") return sizeof(double);
+    else if (VariableType_ == "Int_t") return sizeof(int);
+    else if (VariableType_ == "UInt_t") return sizeof(unsigned int);
+    else if (VariableType_ == "Float_t") return sizeof(float);
+    else if (VariableType_ == "string") return sizeof(uint64_t);
+    else {
+        printf("[CacheValueSize] unexpected data type: %s\n", VariableType_.c_str());
+        exit(1);
+    }
+}
+
+void MakeCacheDirectory(const std::string& path_) {
+    if ((mkdir(path_.c_str(), 0755) != 0) && (errno != EEXIST)) {
+        printf("[MakeCacheDirectory] cannot make directory: %s\n", path_.c_str());
+        exit(1);
+    }
+}
+
+void WriteCacheSchema(const std::string& path_, const CacheSchema& schema_) {
+    std::ofstream out_stream((path_ + "/schema.txt").c_str(), std::ios_base::out | std::ios_base::trunc);
+    if (!out_stream.is_open()) {
+        printf("[WriteCacheSchema] cannot open %s/schema.txt\n", path_.c_str());
+        exit(1);
+    }
+
+    out_stream << CacheMagic << " " << CacheVersion << "\n";
+    out_stream << "NVARIABLES " << schema_.variable_names.size() << "\n";
+    for (int i = 0; i < schema_.variable_names.size(); i++) {
+        out_stream << std::quoted(schema_.variable_names.at(i)) << " " << schema_.VariableTypes.at(i) << "\n";
+    }
+    out_stream << "NSEGMENTS " << schema_.segments.size() << "\n";
+    for (int i = 0; i < schema_.segments.size(); i++) {
+        out_stream << schema_.segments.at(i).Nrows << " " << std::quoted(schema_.segments.at(i).label) << " " << std::quoted(schema_.segments.at(i).filename) << "\n";
+    }
+    if (schema_.ZoneMapBlockSize != 0) out_stream << "ZONEMAP " << schema_.ZoneMapBlockSize << "\n";
+}
+
+CacheSchema ReadCacheSchema(const std::string& path_) {
+    std::ifstream in_stream((path_ + "/schema.txt").c_str());
+    if (!in_stream.is_open()) {
+        printf("[ReadCacheSchema] cannot open %s/schema.txt\n", path_.c_str());
+        exit(1);
+    }
+
+    CacheSchema schema;
+    std::string magic;
+    int version;
+    in_stream >> magic >> version;
+    if ((magic != CacheMagic) || (version != CacheVersion)) {
+        printf("[ReadCacheSchema] %s is not a cache of version %d\n", path_.c_str(), CacheVersion);
+        exit(1);
+    }
+
+    std::string keyword;
+    size_t Nvariables;
+    in_stream >> keyword >> Nvariables;
+    for (size_t i = 0; i < Nvariables; i++) {
+        std::string variable_name;
+        std::string VariableType;
+        in_stream >> std::quoted(variable_name) >> VariableType;
+        schema.variable_names.push_back(variable_name);
+        schema.VariableTypes.push_back(VariableType);
+    }
+
+    size_t Nsegments;
+    in_stream >> keyword >> Nsegments;
+    for (size_t i = 0; i < Nsegments; i++) {
+        CacheSegment segment;
+        in_stream >> segment.Nrows >> std::quoted(segment.label) >> std::quoted(segment.filename);
+        schema.segments.push_back(segment);
+    }
+
+    if (in_stream.fail()) {
+        printf("[ReadCacheSchema] %s/schema.txt is broken\n", path_.c_str());
+        exit(1);
+    }
+
+    // zone map is optional
+    if ((in_stream >> keyword) && (keyword == "ZONEMAP")) in_stream >> schema.ZoneMapBlockSize;
+
+    return schema;
+}
+
+/*
+* read-only memory map of the whole file
+*/
+class MappedFile {
+private:
+    int fd;
+    void* address;
+    size_t length;
+
+public:
+    MappedFile() : fd(-1), address(nullptr), length(0) {}
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { Close(); }
+
+    void Open(const std::string& filename_) {
+        Close();
+
+        fd = open(filename_.c_str(), O_RDONLY);
+        if (fd < 0) {
+            printf("[MappedFile] cannot open %s\n", filename_.c_str());
+            exit(1);
+        }
+
+        struct stat file_status;
+        fstat(fd, &file_status);
+        length = file_status.st_size;
+
+        // mmap does not accept zero length
+        if (length == 0) return;
+
+        address = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        if (address == MAP_FAILED) {
+            printf("[MappedFile] cannot map %s\n", filename_.c_str());
+            exit(1);
+        }
+
+        // columns are read from the beginning to the end
+        madvise(address, length, MADV_SEQUENTIAL);
+    }
+
+    void Close() {
+        if ((address != nullptr) && (address != MAP_FAILED)) munmap(address, length);
+        if (fd >= 0) close(fd);
+        fd = -1;
+        address = nullptr;
+        length = 0;
+    }
+
+    const char* Data() const { return static_cast<const char*>(address); }
+    size_t Size() const { return length; }
+};
+
+#endif
@@ -3,7 +3,10 @@
 
 #include <variant>
 #include <vector>
+#include <deque>
 #include <string>
+#include <utility>
+#include <cstddef>
 
 typedef struct data {
     std::vector<std::variant<int, unsigned int, float, double, std::string*>> variable;
@@ -11,4 +14,48 @@ typedef struct data {
     std::string filename;
 } Data;
 
+/*
+* event offsets. Rows of the i-th event are [offsets[i], offsets[i + 1]), so there are `offsets.size() - 1` events.
+* Candidates from the same event should be consecutive.
+*/
+void ComputeEventOffsets(const std::deque<Data>& data_, const std::vector<int>& key_indices_, std::vector<size_t>* offsets_) {
+    offsets_->clear();
+    offsets_->push_back(0);
+    for (size_t i = 1; i < data_.size(); i++) {
+        for (size_t k = 0; k < key_indices_.size(); k++) {
+            if (data_[i].variable[key_indices_[k]] != data_[i - 1].variable[key_indices_[k]]) {
+                offsets_->push_back(i);
+                break;
+            }
+        }
+    }
+    if (data_.size() != 0) offsets_->push_back(data_.size());
+}
+
+/*
+* keep only rows in `selection_`, which has indices in ascending order.
+* Rows are moved forward in place, so there is no additional buffer.
+* If `offsets_` is given, event offsets are updated, and events without rows are removed.
+*/
+void CompactRows(std::deque<Data>* data_, const std::vector<size_t>& selection_, std::vector<size_t>* offsets_ = nullptr) {
+    if (offsets_ != nullptr) {
+        size_t Nevents = 0;
+        size_t j = 0;
+        for (size_t i = 0; i + 1 < offsets_->size(); i++) {
+            size_t event_end = (*offsets_)[i + 1];
+            size_t first_j = j;
+            while ((j < selection_.size()) && (selection_[j] < event_end)) j++;
+
+            // `Nevents + 1 <= i + 1`, so offsets not read yet are not overwritten
+            if (j != first_j) (*offsets_)[++Nevents] = j;
+        }
+        offsets_->resize(Nevents + 1);
+    }
+
+    for (size_t i = 0; i < selection_.size(); i++) {
+        if (selection_[i] != i) (*data_)[i] = std::move((*data_)[selection_[i]]);
+    }
+    data_->erase(data_->begin() + selection_.size(), data_->end());
+}
+
 #endif 
\ No newline at end of file
@@ -0,0 +1,261 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <memory>
+#include <cstdio>
+#include <fstream>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "TInterpreter.h"
+#include "TSystem.h"
+
+#include "string_equation.h"
+#include "cache.h"
+#include "module.h"
+
+/*
+* optional backend which compiles expressions into native functions with Cling.
+* When an expression is parsed, the postfix program is translated into one C++ function of the row and an `OpType::Compiled` token is appended to the program.
+* The function is declared through `gInterpreter` in `CompilePendingExpressions`, which is called when the modules are started, and the program is interpreted until then.
+* Compiled functions are cached by the generated code, which has the expression and the index and type of each used variable, so the same expression on the same schema is compiled only once in a process.
+* If `JITCacheDirectory` is given, each function is written into `<directory>/Belle2AnalysisExpression_<key>.C`, where the key is the hash of the generated code, and compiled with ACLiC.
+* ACLiC keeps the library next to the file and reuses it while the file is unchanged, so later processes (e.g. other shards) load it without compiling.
+* Otherwise functions are declared with Cling, which does not write the compiled code, so every process compiles its expressions again.
+* If the program cannot be translated (`argmax_k`, `select_nth`), the compilation fails, or a variable of the row has another type than the schema, the interpreter is used as before.
+*/
+
+// C++ literal which has exactly the same value
+std::string DoubleLiteral(double value_) {
+    std::ostringstream out_stream;
+    out_stream << std::hexfloat << value_;
+    return "(" + out_stream.str() + ")";
+}
+
+// statements of the function body. Return false if the program has a token which cannot be translated
+bool GenerateExpressionCode(const std::vector<Token>& postfix_expr_, std::string& code_) {
+    std::vector<std::string> values;
+
+    // type of each used variable, which is checked before the row is read
+    std::map<int, std::string> used_types;
+
+    // like `EvaluatePostfixExpressionBatch`, branches of `a ? b : c` are merged at the end of `c`
+    std::vector<int> ternary_ends;
+    auto MergeBranches = [&](int position_) {
+        while ((ternary_ends.size() != 0) && (ternary_ends.back() == position_)) {
+            std::string b = values.back(); values.pop_back();
+            std::string a = values.back(); values.pop_back();
+            std::string condition = values.back(); values.pop_back();
+            values.push_back("((" + condition + " != 0) ? " + a + " : " + b + ")");
+            ternary_ends.pop_back();
+        }
+    };
+
+    for (int i = 0; i < postfix_expr_.size(); i++) {
+        MergeBranches(i);
+
+        const Token& temp_token = postfix_expr_.at(i);
+
+        if (temp_token.type == OpType::Value) {
+            values.push_back(DoubleLiteral(temp_token.value));
+            continue;
+        }
+        else if (temp_token.type == OpType::Variable) {
+            std::string type;
+            switch (temp_token.variable_type) {
+            case VariableType::Double: type = "double"; break;
+            case VariableType::Int: type = "int"; break;
+            case VariableType::UInt: type = "unsigned int"; break;
+            case VariableType::Float: type = "float"; break;
+            case VariableType::String: return false;
+            }
+            used_types[temp_token.index] = type;
+            values.push_back("((double)*std::get_if<" + type + ">(&row[" + std::to_string(temp_token.index) + "]))");
+            continue;
+        }
+        else if (temp_token.type == OpType::JumpIfFalse) {
+            ternary_ends.push_back(postfix_expr_.at(temp_token.index - 1).index);
+            continue;
+        }
+        else if ((temp_token.type == OpType::Jump) || (temp_token.type == OpType::Compiled)) {
+            continue;
+        }
+        else if (IsVariadic(temp_token.type)) {
+            return false;
+        }
+
+        if (values.size() < Noperands(temp_token.type)) return false;
+
+        if (Noperands(temp_token.type) == 1) {
+            std::string a = values.back(); values.pop_back();
+            std::string result;
+
+            switch (temp_token.type) {
+            case OpType::UnaryMinus: result = "(-" + a + ")"; break;
+            case OpType::UnaryPlus: result = a; break;
+            case OpType::Abs: result = "std::fabs" + a; break;
+            case OpType::Sqrt: result = "std::sqrt" + a; break;
+            case OpType::Exp: result = "std::exp" + a; break;
+            case OpType::Log: result = "std::log" + a; break;
+            case OpType::Log10: result = "std::log10" + a; break;
+            case OpType::Sin: result = "std::sin" + a; break;
+            case OpType::Cos: result = "std::cos" + a; break;
+            case OpType::Tan: result = "std::tan" + a; break;
+            case OpType::Asin: result = "std::asin" + a; break;
+            case OpType::Acos: result = "std::acos" + a; break;
+            case OpType::Atan: result = "std::atan" + a; break;
+            case OpType::In: case OpType::NotIn: {
+                // sorted values are embedded into the function
+                const std::vector<double>& set_values = temp_token.set->Values();
+                std::string array = "{";
+                for (size_t j = 0; j < set_values.size(); j++) array += ((j == 0) ? "" : ", ") + DoubleLiteral(set_values[j]);
+                array += "}";
+
+                std::string is_in = "[](double x) { static const double set[] = " + array + "; return !std::isnan(x) && std::binary_search(set, set + " + std::to_string(set_values.size()) + ", x); }" + a;
+                if (temp_token.type == OpType::In) result = "(" + is_in + " ? 1.0 : 0.0)";
+                else result = "(" + is_in + " ? 0.0 : 1.0)";
+                break;
+            }
+            default: return false;
+            }
+
+            values.push_back(result);
+        }
+        else {
+            std::string b = values.back(); values.pop_back();
+            std::string a = values.back(); values.pop_back();
+            std::string result;
+
+            switch (temp_token.type) {
+            case OpType::Add: result = "(" + a + " + " + b + ")"; break;
+            case OpType::Sub: result = "(" + a + " - " + b + ")"; break;
+            case OpType::Mul: result = "(" + a + " * " + b + ")"; break;
+            case OpType::Div: result = "(" + a + " / " + b + ")"; break;
+            case OpType::Pow: result = "std::pow(" + a + ", " + b + ")"; break;
+            case OpType::GT: result = "((" + a + " > " + b + ") ? 1.0 : 0.0)"; break;
+            case OpType::LT: result = "((" + a + " < " + b + ") ? 1.0 : 0.0)"; break;
+            case OpType::GE: result = "((" + a + " >= " + b + ") ? 1.0 : 0.0)"; break;
+            case OpType::LE: result = "((" + a + " <= " + b + ") ? 1.0 : 0.0)"; break;
+            case OpType::EQ: result = "((" + a + " == " + b + ") ? 1.0 : 0.0)"; break;
+            case OpType::NE: result = "((" + a + " != " + b + ") ? 1.0 : 0.0)"; break;
+            // operands have no side effect, so short-circuit evaluation gives the same result
+            case OpType::And: result = "(((" + a + " != 0) && (" + b + " != 0)) ? 1.0 : 0.0)"; break;
+            case OpType::Or: result = "(((" + a + " != 0) || (" + b + " != 0)) ? 1.0 : 0.0)"; break;
+            case OpType::Min: result = "std::fmin(" + a + ", " + b + ")"; break;
+            case OpType::Max: result = "std::fmax(" + a + ", " + b + ")"; break;
+            case OpType::Atan2: result = "std::atan2(" + a + ", " + b + ")"; break;
+            default: return false;
+            }
+
+            values.push_back(result);
+        }
+    }
+    MergeBranches(postfix_expr_.size());
+
+    if (values.size() != 1) return false;
+
+    code_ = "";
+    for (std::map<int, std::string>::iterator iter = used_types.begin(); iter != used_types.end(); ++iter) {
+        code_ += "    if (!std::holds_alternative<" + iter->second + ">(row[" + std::to_string(iter->first) + "])) return false;\n";
+    }
+    code_ += "    *result = " + values.at(0) + ";\n    return true;\n";
+    return true;
+}
+
+// directory of compiled functions which are reused by later processes. Empty means that functions are compiled in memory by Cling
+std::string JITCacheDirectory;
+
+// programs whose function is not declared yet
+std::vector<std::shared_ptr<CompiledProgram>> PendingExpressions;
+std::mutex PendingExpressions_mutex;
+
+bool PrepareExpressionWithCling(std::vector<Token>& postfix_expr_) {
+    if ((postfix_expr_.size() == 0) || (postfix_expr_.back().type == OpType::Compiled)) return false;
+
+    std::string body;
+    if (!GenerateExpressionCode(postfix_expr_, body)) return false;
+
+    Token compiled_token = { OpType::Compiled, -1, -1 };
+    compiled_token.compiled = std::make_shared<CompiledProgram>();
+    compiled_token.compiled->code = body;
+    postfix_expr_.push_back(compiled_token);
+
+    std::lock_guard<std::mutex> lock(PendingExpressions_mutex);
+    PendingExpressions.push_back(compiled_token.compiled);
+
+    return true;
+}
+
+// source of the function `name_`
+std::string ExpressionSource(const std::string& name_, const std::string& body_) {
+    std::string code = "#include <variant>\n#include <string>\n#include <cmath>\n#include <algorithm>\n";
+    code += "bool " + name_ + "(const std::variant<int, unsigned int, float, double, std::string*>* row, double* result) {\n";
+    // same rounding as the interpreter
+    code += "#pragma clang fp contract(off)\n";
+    code += body_ + "}\n";
+    return code;
+}
+
+// compile `<JITCacheDirectory>/<name_>.C` with ACLiC. The file is written only if it does not exist, so the library of the previous process is reused
+bool CompileCachedExpression(const std::string& name_, const std::string& code_) {
+    MakeCacheDirectory(JITCacheDirectory);
+
+    std::string source_name = JITCacheDirectory + "/" + name_ + ".C";
+    struct stat file_status;
+    if (stat(source_name.c_str(), &file_status) != 0) {
+        // other processes can write the same file at the same time
+        std::string temporary_name = source_name + "." + std::to_string(getpid()) + ".tmp";
+        std::ofstream out_stream(temporary_name.c_str(), std::ios_base::out | std::ios_base::trunc);
+        out_stream << code_;
+        out_stream.close();
+        if (out_stream.fail() || (std::rename(temporary_name.c_str(), source_name.c_str()) != 0)) {
+            printf("[CompilePendingExpressions] cannot write %s\n", source_name.c_str());
+            std::remove(temporary_name.c_str());
+            return false;
+        }
+    }
+
+    return gSystem->CompileMacro(source_name.c_str(), "kO") == 1;
+}
+
+void CompilePendingExpressions() {
+    // compiled functions by their body. nullptr means that the compilation failed
+    static std::map<std::string, CompiledExpression> compiled_functions;
+
+    std::lock_guard<std::mutex> lock(PendingExpressions_mutex);
+
+    for (int i = 0; i < PendingExpressions.size(); i++) {
+        const std::string& body = PendingExpressions.at(i)->code;
+
+        CompiledExpression function = nullptr;
+        std::map<std::string, CompiledExpression>::iterator iter = compiled_functions.find(body);
+        if (iter != compiled_functions.end()) function = iter->second;
+        else {
+            // name of the cached function depends only on the code, so that the library can be found by later processes
+            std::string name;
+            if (JITCacheDirectory != "") name = "Belle2AnalysisExpression_" + FingerprintKey(body);
+            else name = "Belle2AnalysisExpression" + std::to_string(compiled_functions.size());
+            std::string code = ExpressionSource(name, body);
+
+            bool IsCompiled;
+            if (JITCacheDirectory != "") IsCompiled = CompileCachedExpression(name, code);
+            else IsCompiled = gInterpreter->Declare(code.c_str());
+
+            if (IsCompiled) function = (CompiledExpression)gInterpreter->Calc(("(long)&" + name).c_str());
+            if (function == nullptr) printf("[CompilePendingExpressions] cannot compile the expression. It is interpreted\n");
+
+            compiled_functions.insert(std::make_pair(body, function));
+        }
+
+        PendingExpressions.at(i)->function = function;
+    }
+    PendingExpressions.clear();
+}
+
+#endif
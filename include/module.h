@@ -11,10 +11,21 @@
 #include <set>
 #include <fstream>
 #include <memory>
+#include <tuple>
+#include <cmath>
+#include <cstdint>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <sstream>
+#include <iomanip>
 
 #include "data.h"
 #include "string_equation.h"
 #include "base.h"
+#include "thread_pool.h"
+#include "cache.h"
+#include "serialize.h"
 
 #include "Classifier.h"
 
@@ -24,6 +35,7 @@
 #include <TLine.h>
 #include <TPaveText.h>
 #include <TFile.h>
+#include <TROOT.h>
 #include <RooDataSet.h>
 #include <RooRealVar.h>
 #include <RooArgSet.h>
@@ -74,6 +86,287 @@ struct CompareHistory {
     }
 };
 
+/*
+* exact weighted AUC, i.e. Mann-Whitney U statistic, from (score, weight) of signal and background.
+* a tie between signal and background is counted as 1/2. Both input vectors are sorted in place, so scores should not be NaN.
+* if `roc_` is given, (cut, TPR, FPR) with `score >= cut` is filled for every distinct score in descending order of cut.
+*/
+double CalculateWeightedAUC(std::vector<std::pair<double, double>>& signal_, std::vector<std::pair<double, double>>& background_, std::vector<std::tuple<double, double, double>>* roc_ = nullptr) {
+    // only score is compared
+    auto compare_score = [](const std::pair<double, double>& a, const std::pair<double, double>& b) { return a.first < b.first; };
+    ParallelSort(signal_.begin(), signal_.end(), compare_score);
+    ParallelSort(background_.begin(), background_.end(), compare_score);
+
+    long double signal_total = 0;
+    long double background_total = 0;
+    for (size_t i = 0; i < signal_.size(); i++) signal_total = signal_total + signal_.at(i).second;
+    for (size_t i = 0; i < background_.size(); i++) background_total = background_total + background_.at(i).second;
+
+    if ((signal_total == 0) || (background_total == 0)) {
+        printf("[CalculateWeightedAUC] sum of signal or background weight is zero\n");
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+
+    if (roc_ != nullptr) roc_->clear();
+
+    // sweep over distinct scores in ascending order
+    long double signal_below = 0;
+    long double background_below = 0;
+    long double numerator = 0;
+    size_t i = 0;
+    size_t j = 0;
+    while ((i < signal_.size()) || (j < background_.size())) {
+        double current_score;
+        if (i == signal_.size()) current_score = background_.at(j).first;
+        else if (j == background_.size()) current_score = signal_.at(i).first;
+        else current_score = std::min(signal_.at(i).first, background_.at(j).first);
+
+        long double signal_here = 0;
+        long double background_here = 0;
+        while ((i < signal_.size()) && (signal_.at(i).first == current_score)) signal_here = signal_here + signal_.at(i++).second;
+        while ((j < background_.size()) && (background_.at(j).first == current_score)) background_here = background_here + background_.at(j++).second;
+
+        numerator = numerator + signal_here * (background_below + 0.5 * background_here);
+
+        if (roc_ != nullptr) roc_->push_back(std::make_tuple(current_score, (double)((signal_total - signal_below) / signal_total), (double)((background_total - background_below) / background_total)));
+
+        signal_below = signal_below + signal_here;
+        background_below = background_below + background_here;
+    }
+
+    if (roc_ != nullptr) std::reverse(roc_->begin(), roc_->end());
+
+    return (double)(numerator / (signal_total * background_total));
+}
+
+/*
+* find indices of `names_` in `schema_`
+*/
+std::vector<int> FindVariableIndices(const std::vector<std::string>& names_, const Schema& schema_) {
+    std::vector<int> indices;
+    for (int i = 0; i < names_.size(); i++) {
+        int index = schema_.Index(names_.at(i));
+
+        if (index < 0) {
+            printf("cannot find variable: %s\n", names_.at(i).c_str());
+            exit(1);
+        }
+
+        indices.push_back(index);
+    }
+    return indices;
+}
+
+/*
+* FNV-1a hash of event variables.
+* It does not depend on the order of files or the machine, so candidates from the same event always get the same hash.
+* It is used to split the sample (e.g. training and test) deterministically.
+*/
+uint64_t HashEventVariables(const std::vector<std::variant<int, unsigned int, float, double, std::string*>>& variables_, const std::vector<int>& event_variable_index_list_) {
+    uint64_t hash = 14695981039346656037ULL;
+
+    auto hash_bytes = [&hash](const void* bytes_, size_t length_) {
+        const unsigned char* bytes = static_cast<const unsigned char*>(bytes_);
+        for (size_t i = 0; i < length_; i++) {
+            hash = hash ^ bytes[i];
+            hash = hash * 1099511628211ULL;
+        }
+    };
+
+    for (int i = 0; i < event_variable_index_list_.size(); i++) {
+        const std::variant<int, unsigned int, float, double, std::string*>& value = variables_.at(event_variable_index_list_.at(i));
+
+        if (const int* temp = std::get_if<int>(&value)) hash_bytes(temp, sizeof(int));
+        else if (const unsigned int* temp = std::get_if<unsigned int>(&value)) hash_bytes(temp, sizeof(unsigned int));
+        else if (const float* temp = std::get_if<float>(&value)) hash_bytes(temp, sizeof(float));
+        else if (const double* temp = std::get_if<double>(&value)) hash_bytes(temp, sizeof(double));
+        else if (std::string* const* temp = std::get_if<std::string*>(&value)) hash_bytes((*temp)->data(), (*temp)->size());
+
+        // separator between variables
+        hash_bytes("\0", 1);
+    }
+
+    return hash;
+}
+
+/*
+* map hash into [0, 1). The upper 53 bits are used, because the lower bits of FNV-1a are less random
+*/
+double HashToUnitInterval(uint64_t hash_) {
+    return static_cast<double>(hash_ >> 11) / 9007199254740992.0;
+}
+
+/*
+* write bin contents, sum of squares of weights, statistics, and the number of entries of the histogram
+*/
+void SaveHistogramState(std::ostream& out_, TH1* hist_) {
+    int Ncells = hist_->GetNcells();
+    std::vector<double> contents(Ncells);
+    for (int i = 0; i < Ncells; i++) contents.at(i) = hist_->GetBinContent(i);
+
+    std::vector<double> sumw2;
+    if (hist_->GetSumw2N() != 0) {
+        for (int i = 0; i < Ncells; i++) sumw2.push_back((*hist_->GetSumw2())[i]);
+    }
+
+    std::vector<double> stats(TH1::kNstat, 0.0);
+    hist_->GetStats(stats.data());
+
+    WriteBinary(out_, Ncells);
+    WriteBinary(out_, contents);
+    WriteBinary(out_, sumw2);
+    WriteBinary(out_, stats);
+    WriteBinary(out_, hist_->GetEntries());
+}
+
+/*
+* add the histogram written by `SaveHistogramState` into `hist_`. Binning should be the same
+*/
+void AddHistogramState(std::istream& in_, TH1* hist_) {
+    int Ncells;
+    std::vector<double> contents;
+    std::vector<double> sumw2;
+    std::vector<double> stats;
+    double entries;
+    ReadBinary(in_, Ncells);
+    ReadBinary(in_, contents);
+    ReadBinary(in_, sumw2);
+    ReadBinary(in_, stats);
+    ReadBinary(in_, entries);
+
+    if (Ncells != hist_->GetNcells()) {
+        printf("[AddHistogramState] the number of bins is different: %d %d\n", Ncells, hist_->GetNcells());
+        exit(1);
+    }
+
+    // `SetBinContent` resets statistics, so they are read first
+    std::vector<double> current_stats(TH1::kNstat, 0.0);
+    hist_->GetStats(current_stats.data());
+    double current_entries = hist_->GetEntries();
+
+    if ((sumw2.size() != 0) && (hist_->GetSumw2N() == 0)) hist_->Sumw2();
+
+    for (int i = 0; i < Ncells; i++) hist_->SetBinContent(i, hist_->GetBinContent(i) + contents.at(i));
+    if (hist_->GetSumw2N() != 0) {
+        // without the sum of squares, the error is the square root of the content
+        for (int i = 0; i < Ncells; i++) (*hist_->GetSumw2())[i] = (*hist_->GetSumw2())[i] + ((sumw2.size() != 0) ? sumw2.at(i) : contents.at(i));
+    }
+
+    for (int i = 0; i < TH1::kNstat; i++) current_stats.at(i) = current_stats.at(i) + stats.at(i);
+    hist_->PutStats(current_stats.data());
+    hist_->SetEntries(current_entries + entries);
+}
+
+/*
+* fingerprint of module configuration, used by the memoization.
+* Floating point values are written in hexadecimal, so that they are exact
+*/
+template <class T> typename std::enable_if<std::is_arithmetic<T>::value>::type WriteFingerprintValue(std::ostream& out_, const T& value_) {
+    if (std::is_floating_point<T>::value) out_ << std::hexfloat << value_ << std::defaultfloat;
+    else out_ << value_;
+}
+void WriteFingerprintValue(std::ostream& out_, const std::string& value_) { out_ << std::quoted(value_); }
+void WriteFingerprintValue(std::ostream& out_, const char* value_) { out_ << std::quoted(value_ == nullptr ? "" : value_); }
+template <class T> void WriteFingerprintValue(std::ostream& out_, const std::vector<T>& value_);
+template <class K, class V> void WriteFingerprintValue(std::ostream& out_, const std::map<K, V>& value_);
+template <class... T> void WriteFingerprintValue(std::ostream& out_, const std::tuple<T...>& value_);
+
+template <class T> void WriteFingerprintValue(std::ostream& out_, const std::vector<T>& value_) {
+    out_ << "[";
+    for (size_t i = 0; i < value_.size(); i++) {
+        WriteFingerprintValue(out_, value_.at(i));
+        out_ << ",";
+    }
+    out_ << "]";
+}
+
+template <class K, class V> void WriteFingerprintValue(std::ostream& out_, const std::map<K, V>& value_) {
+    out_ << "{";
+    for (typename std::map<K, V>::const_iterator iter = value_.begin(); iter != value_.end(); ++iter) {
+        WriteFingerprintValue(out_, iter->first);
+        out_ << ":";
+        WriteFingerprintValue(out_, iter->second);
+        out_ << ",";
+    }
+    out_ << "}";
+}
+
+template <class Tuple, size_t... I> void WriteFingerprintTuple(std::ostream& out_, const Tuple& value_, std::index_sequence<I...>) {
+    int dummy[] = { 0, (WriteFingerprintValue(out_, std::get<I>(value_)), out_ << ",", 0)... };
+    (void)dummy;
+}
+
+template <class... T> void WriteFingerprintValue(std::ostream& out_, const std::tuple<T...>& value_) {
+    out_ << "(";
+    WriteFingerprintTuple(out_, value_, std::index_sequence_for<T...>());
+    out_ << ")";
+}
+
+void AppendFingerprint(std::ostream& out_) {}
+
+template <class T, class... Rest> void AppendFingerprint(std::ostream& out_, const T& value_, const Rest&... rest_) {
+    out_ << " ";
+    WriteFingerprintValue(out_, value_);
+    AppendFingerprint(out_, rest_...);
+}
+
+// module name followed by its parameters
+template <class... T> std::string MakeFingerprint(const char* module_name_, const T&... parameters_) {
+    std::ostringstream fingerprint;
+    fingerprint << module_name_;
+    AppendFingerprint(fingerprint, parameters_...);
+    return fingerprint.str();
+}
+
+/*
+* path, size and modification time of the file. Content is not read, so it is cheap even for large files
+*/
+std::string FileFingerprint(const std::string& filename_) {
+    struct stat file_status;
+    if (stat(filename_.c_str(), &file_status) != 0) return MakeFingerprint("File", filename_, "missing");
+    return MakeFingerprint("File", filename_, (long long)file_status.st_size, (long long)file_status.st_mtime);
+}
+
+/*
+* short key of the fingerprint, used as a file name. 128 bits from two FNV-1a hashes with different offsets
+*/
+std::string FingerprintKey(const std::string& fingerprint_) {
+    uint64_t hash_1 = 14695981039346656037ULL;
+    uint64_t hash_2 = 7809847782465536322ULL;
+    for (size_t i = 0; i < fingerprint_.size(); i++) {
+        hash_1 = (hash_1 ^ static_cast<unsigned char>(fingerprint_[i])) * 1099511628211ULL;
+        hash_2 = (hash_2 ^ static_cast<unsigned char>(fingerprint_[i])) * 1099511628211ULL;
+    }
+
+    char key[33];
+    snprintf(key, sizeof(key), "%016llx%016llx", (unsigned long long)hash_1, (unsigned long long)hash_2);
+    return std::string(key);
+}
+
+/*
+* keep files of `shard_index_`-th shard among `Nshards_` shards.
+* Files are sorted and assigned in turn, so every process gets the same assignment regardless of the order in the directory.
+*/
+void SelectShardFiles(std::vector<std::string>* filename_, int shard_index_, int Nshards_) {
+    std::vector<std::string> sorted_filename = (*filename_);
+    std::sort(sorted_filename.begin(), sorted_filename.end());
+
+    filename_->clear();
+    for (int i = 0; i < sorted_filename.size(); i++) {
+        if (i % Nshards_ == shard_index_) filename_->push_back(sorted_filename.at(i));
+    }
+}
+
+/*
+* insert `suffix_` before the extension of `filename_`
+*/
+std::string InsertSuffix(const std::string& filename_, const std::string& suffix_) {
+    size_t dotPos = filename_.find_last_of('.');
+    size_t slashPos = filename_.find_last_of('/');
+    if ((dotPos == std::string::npos) || ((slashPos != std::string::npos) && (dotPos < slashPos))) return filename_ + suffix_;
+    return filename_.substr(0, dotPos) + suffix_ + filename_.substr(dotPos);
+}
+
 /*
 * reserved function which always return 1.0
 */
@@ -93,6 +386,7 @@ namespace Module {
         /*
         * design philosophy:
         * 1. data structure should be modified in constructor. Do not touch data structure in `start`, `process`, and `End` function.
+        * 2. variables are given as the shared `Schema` of the Loader. Modules which add variables also get the lists of the Loader, and add new variables to them.
         */
         Module() {}
         virtual ~Module() {}
@@ -110,6 +404,54 @@ namespace Module {
         * `End` function is called after all ROOT files are read. It is called only once.
         */
         virtual void End() = 0;
+        /*
+        * checkpoint. `SaveState` writes everything kept between `Process` calls, and `LoadState` reads it back after `Start`.
+        * Accumulated values (histogram, yields, ...) are added to the current ones in `LoadState`.
+        * If a module keeps nothing between `Process` calls, it only needs to return true in `IsCheckpointable`.
+        * If any module returns false, which is the default, the Loader does not write the checkpoint.
+        */
+        virtual bool IsCheckpointable() { return false; }
+        virtual void SaveState(std::ostream& out_) {}
+        virtual void LoadState(std::istream& in_) {}
+        /*
+        * memoization. `Fingerprint` describes the configuration (type, expressions, parameters, input files) of the module.
+        * Empty fingerprint, which is the default, means that the configuration is unknown, so nothing after this module is memoized.
+        * A module with the fingerprint which changes data should not have any other effect.
+        * `IsTerminal` is true if the module does not change data. Its result is memoized if `IsMemoizable` is also true,
+        * which means that `End` only depends on the state from `SaveState`.
+        */
+        virtual std::string Fingerprint() { return ""; }
+        virtual bool IsTerminal() { return false; }
+        virtual bool IsMemoizable() { return false; }
+        /*
+        * sharded execution. `SelectShard` keeps only the input files of `shard_index_`-th shard among `Nshards_` shards.
+        * If `HasOutputPerShard` is true, each shard writes its own output, and `SetShardSuffix` makes the output name different for each shard.
+        * Otherwise, terminal modules are merged by `SaveState` in each shard and `LoadState` in the merge step.
+        */
+        virtual void SelectShard(int shard_index_, int Nshards_) {}
+        virtual bool HasOutputPerShard() { return false; }
+        virtual void SetShardSuffix(const std::string& suffix_) {}
+        /*
+        * selection. If `IsSelectionAware` is true, the Loader calls `ProcessSelection` instead of `Process`.
+        * `selection` has indices of rows passing the modules so far in ascending order, and the module removes indices of rows it rejects.
+        * Rows are not moved here. They are compacted by the Loader when the selection becomes sparse or the next module needs rows.
+        */
+        virtual bool IsSelectionAware() { return false; }
+        virtual int ProcessSelection(std::deque<Data>* data, std::vector<size_t>* selection) { return 1; }
+        /*
+        * row-local modules. If `IsRowLocal` is true, the result for a row does not depend on other rows.
+        * The Loader runs consecutive row-local modules in one loop over rows, so each row is visited once while it is in cache.
+        * `ProcessRow` handles one row, and returns false if the row is rejected. Later modules do not see rejected rows.
+        */
+        virtual bool IsRowLocal() { return false; }
+        virtual bool ProcessRow(std::deque<Data>::iterator iter) { return true; }
+        /*
+        * event-level modules. Rows of the i-th event are [offsets[i], offsets[i + 1]).
+        * If `EventVariableIndices` is not empty, the Loader finds event boundaries from these variables once,
+        * keeps them through cuts, and calls `ProcessEvents` instead of `Process`. `ProcessEvents` should keep offsets consistent if it removes rows.
+        */
+        virtual std::vector<int> EventVariableIndices() { return {}; }
+        virtual int ProcessEvents(std::deque<Data>* data, std::vector<size_t>* offsets) { return 1; }
     };
 
     class Load : public Module {
@@ -264,6 +606,36 @@ namespace Module {
         }
 
         void End() override {}
+
+        bool IsCheckpointable() override { return true; }
+
+        // files read so far
+        void SaveState(std::ostream& out_) override {
+            WriteBinary(out_, filename);
+            WriteBinary(out_, Currententry);
+        }
+
+        void LoadState(std::istream& in_) override {
+            std::vector<std::string> saved_filename;
+            ReadBinary(in_, saved_filename);
+            ReadBinary(in_, Currententry);
+
+            if (saved_filename != filename) {
+                printf("[Load] list of files in %s is different from the checkpoint\n", dirname.c_str());
+                exit(1);
+            }
+        }
+
+        std::string Fingerprint() override {
+            std::vector<std::string> file_fingerprints;
+            for (int i = 0; i < Nentry; i++) file_fingerprints.push_back(FileFingerprint(dirname + std::string("/") + filename.at(i)));
+            return MakeFingerprint("Load", dirname, label, TTree_name, file_fingerprints);
+        }
+
+        void SelectShard(int shard_index_, int Nshards_) override {
+            SelectShardFiles(&filename, shard_index_, Nshards_);
+            Nentry = filename.size();
+        }
     };
 
     class LoadWithCut : public Module {
@@ -404,7 +776,7 @@ namespace Module {
             for (unsigned int j = 0; j < temp_tree->GetEntries(); j++) {
                 temp_tree->GetEntry(j);
 
-                double result = EvaluatePostfixExpression(postfix_expr, temp_variable, &VariableTypes);
+                double result = EvaluatePostfixExpression(postfix_expr, temp_variable);
 
                 if (result > 0.5) {
                     Data temp;
@@ -429,168 +801,456 @@ namespace Module {
         }
 
         void End() override {}
-    };
-
-    class Cut : public Module {
-    private:
-        std::string cut_string;
-        std::string replaced_expr;
-        std::vector<Token> postfix_expr;
-        std::vector<std::string> variable_names;
-        std::vector<std::string> VariableTypes;
 
-    public:
-        Cut(const char* cut_string_, std::vector<std::string>* variable_names_, std::vector<std::string>* VariableTypes_) : Module(), cut_string(cut_string_), variable_names(*variable_names_), VariableTypes(*VariableTypes_) {}
-        ~Cut() {}
+        bool IsCheckpointable() override { return true; }
 
-        void Start() {
-            replaced_expr = replaceVariables(cut_string, &variable_names);
-            postfix_expr = PostfixExpression(replaced_expr, &VariableTypes);
+        // files read so far
+        void SaveState(std::ostream& out_) override {
+            WriteBinary(out_, filename);
+            WriteBinary(out_, Currententry);
         }
 
-        int Process(std::deque<Data>* data) override {
-            // Use std::stable_partition. 
-            // It reorders 'data' so that elements where the lambda returns 'true' come first.
-            // It returns an iterator to the first 'bad' element.
-            std::deque<Data>::iterator it_end_of_good = std::stable_partition(data->begin(), data->end(),
-                [&](const Data& d) {
-                    // Return true to KEEP the event
-                    double result = EvaluatePostfixExpression(postfix_expr, d.variable, &VariableTypes);
-                    return result > 0.5;
-                }
-            );
+        void LoadState(std::istream& in_) override {
+            std::vector<std::string> saved_filename;
+            ReadBinary(in_, saved_filename);
+            ReadBinary(in_, Currententry);
 
-            // Erase everything from the first bad element to the end
-            data->erase(it_end_of_good, data->end());
+            if (saved_filename != filename) {
+                printf("[LoadWithCut] list of files in %s is different from the checkpoint\n", dirname.c_str());
+                exit(1);
+            }
+        }
 
-            return 1;
+        std::string Fingerprint() override {
+            std::vector<std::string> file_fingerprints;
+            for (int i = 0; i < Nentry; i++) file_fingerprints.push_back(FileFingerprint(dirname + std::string("/") + filename.at(i)));
+            return MakeFingerprint("LoadWithCut", dirname, label, cut_string, TTree_name, file_fingerprints);
         }
 
-        void End() override {}
+        void SelectShard(int shard_index_, int Nshards_) override {
+            SelectShardFiles(&filename, shard_index_, Nshards_);
+            Nentry = filename.size();
+        }
     };
 
-    class PrintInformation : public Module {
+    class LoadCache : public Module {
         /*
-        * In this module, we assume that
-        * 1. candidates from the same event are in the same ROOT file
+        * read the cache written by `SaveCache`.
+        * Like `Load` reads one file per `Process`, it reads one segment per `Process`.
+        * Columns are memory-mapped, so there is no decompression. Values are copied directly into `Data`.
         */
     private:
-        std::string print_string;
-        std::vector<std::string> Event_variable_list;
-        double Nevt;
-        double Ncandidate;
+        std::string path;
+        std::string label; // if it is empty, label saved in the cache is used
 
-        // temporary variable to extract event variable
-        std::vector<std::variant<int, unsigned int, float, double, std::string*>> temp_event_variable;
+        CacheSchema schema;
+        int Nentry;
+        int Currententry;
 
-        // index of event variables in `variable_names`
-        std::vector<int> event_variable_index_list;
+        // first row of each segment
+        std::vector<unsigned long long> segment_offsets;
 
-        // event variable history
-        std::set<std::vector<std::variant<int, unsigned int, float, double, std::string*>>, CompareHistory> history_event_variable;
+        std::vector<std::unique_ptr<MappedFile>> columns;
+        std::vector<std::unique_ptr<MappedFile>> string_columns;
+        std::vector<int> type_codes;
 
-        std::shared_ptr<std::vector<double>> output_handle;
+        // strings of the current segment. `Data` only has pointers to them
+        std::deque<std::string> strings;
 
-        std::vector<std::string> variable_names;
-        std::vector<std::string> VariableTypes;
+        // zone map and cuts pushed down by `Loader`. Blocks which cannot pass the cuts are skipped
+        MappedFile zonemap;
+        std::vector<unsigned long long> segment_block_offsets;
+        std::vector<std::string> pushdown_cut_strings;
+        std::vector<std::vector<Token>> pushdown_postfix_exprs;
+        std::vector<std::pair<double, double>> ranges;
+        unsigned long long Nblocks_read;
+        unsigned long long Nblocks_skipped;
 
-    public:
-        PrintInformation(const char* print_string_, const std::vector<std::string> Event_variable_list_, std::shared_ptr<std::vector<double>> output_handle_, std::vector<std::string>* variable_names_, std::vector<std::string>* VariableTypes_) : Module(), print_string(print_string_), Event_variable_list(Event_variable_list_), output_handle(output_handle_), variable_names(*variable_names_), VariableTypes(*VariableTypes_), Nevt(0), Ncandidate(0){}
-        ~PrintInformation() {}
+        // segments are assigned to shards in turn
+        int shard_index;
+        int Nshards;
 
-        void Start() override {
-            // exception handling
-            if (Event_variable_list.size() == 0) {
-                printf("event variable for PrintInformation should exist.\n");
-                exit(1);
+        bool IsBlockSkipped(unsigned long long block_index_) {
+            if (pushdown_postfix_exprs.size() == 0) return false;
+
+            const char* zonemap_block = zonemap.Data() + block_index_ * VariableTypes.size() * 2 * sizeof(double);
+            for (int i = 0; i < VariableTypes.size(); i++) {
+                memcpy(&ranges[i].first, zonemap_block + (2 * i) * sizeof(double), sizeof(double));
+                memcpy(&ranges[i].second, zonemap_block + (2 * i + 1) * sizeof(double), sizeof(double));
             }
 
-            // fill `temp_event_variable` by dummy value. It is to set variable type beforehand.
-            for (int i = 0; i < Event_variable_list.size(); i++) {
-                int event_variable_index = std::find(variable_names.begin(), variable_names.end(), Event_variable_list.at(i)) - variable_names.begin();
+            // `Cut` keeps the row if result > 0.5
+            for (int i = 0; i < pushdown_postfix_exprs.size(); i++) {
+                if (EvaluatePostfixInterval(pushdown_postfix_exprs.at(i), ranges).second <= 0.5) return true;
+            }
+            return false;
+        }
 
-                if (event_variable_index == variable_names.size()) {
-                    printf("cannot find variable: %s\n", Event_variable_list.at(i).c_str());
-                    exit(1);
+        void AppendRows(std::deque<Data>* data, unsigned long long first_row_, unsigned long long last_row_, const std::string& row_label_, const CacheSegment& segment_) {
+            for (unsigned long long j = first_row_; j < last_row_; j++) {
+                Data temp;
+
+                // assing 50 more slots to avoid vector memory spike
+                temp.variable.reserve(VariableTypes.size() + 50);
+
+                for (int i = 0; i < type_codes.size(); i++) {
+                    const char* column = columns.at(i)->Data();
+                    switch (type_codes[i]) {
+                    case 0: { double value; memcpy(&value, column + j * sizeof(double), sizeof(double)); temp.variable.push_back(value); break; }
+                    case 1: { int value; memcpy(&value, column + j * sizeof(int), sizeof(int)); temp.variable.push_back(value); break; }
+                    case 2: { unsigned int value; memcpy(&value, column + j * sizeof(unsigned int), sizeof(unsigned int)); temp.variable.push_back(value); break; }
+                    case 3: { float value; memcpy(&value, column + j * sizeof(float), sizeof(float)); temp.variable.push_back(value); break; }
+                    case 4: {
+                        uint64_t begin = 0;
+                        uint64_t end;
+                        if (j != 0) memcpy(&begin, column + (j - 1) * sizeof(uint64_t), sizeof(uint64_t));
+                        memcpy(&end, column + j * sizeof(uint64_t), sizeof(uint64_t));
+                        strings.emplace_back(string_columns.at(i)->Data() + begin, end - begin);
+                        temp.variable.push_back(&strings.back());
+                        break;
+                    }
+                    }
                 }
 
-                event_variable_index_list.push_back(event_variable_index);
+                temp.label = row_label_;
+                temp.filename = segment_.filename;
+
+                // use std::move to avoid copy
+                data->push_back(std::move(temp));
+            }
+        }
+
+        bool* DataStructureDefined;
+        std::vector<std::string> variable_names;
+        std::vector<std::string> VariableTypes;
+    public:
+        LoadCache(const char* path_, const char* label_, bool* DataStructureDefined_, std::vector<std::string>* variable_names_, std::vector<std::string>* VariableTypes_) : Module(), path(path_), label(label_), shard_index(0), Nshards(1), DataStructureDefined(DataStructureDefined_) {
+            schema = ReadCacheSchema(path);
+            Nentry = schema.segments.size();
+            Currententry = 0;
 
-                if (strcmp(VariableTypes.at(event_variable_index).c_str(), "Double_t") == 0) {
-                    temp_event_variable.push_back(static_cast<double>(0.0));
+            // check data structure
+            if ((*DataStructureDefined) == false) {
+                for (int j = 0; j < schema.variable_names.size(); j++) {
+                    variable_names_->push_back(schema.variable_names.at(j));
+                    VariableTypes_->push_back(schema.VariableTypes.at(j));
                 }
-                else if (strcmp(VariableTypes.at(event_variable_index).c_str(), "Int_t") == 0) {
-                    temp_event_variable.push_back(static_cast<int>(0.0));
+                (*DataStructureDefined) = true;
+            }
+            else {
+                if (variable_names_->size() != schema.variable_names.size()) {
+                    printf("the number of variables is different: %zu %zu\n", variable_names_->size(), schema.variable_names.size());
+                    exit(1);
                 }
-                else if (strcmp(VariableTypes.at(event_variable_index).c_str(), "UInt_t") == 0) {
-                    temp_event_variable.push_back(static_cast<unsigned int>(0.0));
+                for (int j = 0; j < schema.variable_names.size(); j++) {
+                    if (variable_names_->at(j) != schema.variable_names.at(j)) {
+                        printf("variable name is different: %s %s\n", variable_names_->at(j).c_str(), schema.variable_names.at(j).c_str());
+                        exit(1);
+                    }
+                    else if (VariableTypes_->at(j) != schema.VariableTypes.at(j)) {
+                        printf("type is different: %s %s\n", VariableTypes_->at(j).c_str(), schema.VariableTypes.at(j).c_str());
+                        exit(1);
+                    }
                 }
-                else if (strcmp(VariableTypes.at(event_variable_index).c_str(), "Float_t") == 0) {
-                    temp_event_variable.push_back(static_cast<float>(0.0));
+            }
+
+            // copy variable name and variable type
+            variable_names = (*variable_names_);
+            VariableTypes = (*VariableTypes_);
+        }
+        ~LoadCache() {}
+
+        /*
+        * cuts which are applied right after loading. They are only used to skip blocks, so `Cut` should be still applied
+        */
+        void SetPushdownCuts(const std::vector<std::string>& cut_strings_) {
+            pushdown_cut_strings = cut_strings_;
+        }
+
+        void Start() override {
+            unsigned long long Nrows = 0;
+            unsigned long long Nblocks = 0;
+            for (int i = 0; i < schema.segments.size(); i++) {
+                segment_offsets.push_back(Nrows);
+                Nrows = Nrows + schema.segments.at(i).Nrows;
+                if (schema.ZoneMapBlockSize != 0) {
+                    segment_block_offsets.push_back(Nblocks);
+                    Nblocks = Nblocks + CacheNblocks(schema.segments.at(i), schema.ZoneMapBlockSize);
+                }
+            }
+
+            // zone map is used only when there is a cut
+            Nblocks_read = 0;
+            Nblocks_skipped = 0;
+            if ((schema.ZoneMapBlockSize != 0) && (pushdown_cut_strings.size() != 0)) {
+                zonemap.Open(CacheZoneMapPath(path));
+                if (zonemap.Size() != Nblocks * VariableTypes.size() * 2 * sizeof(double)) {
+                    printf("[LoadCache] size of %s is different from the schema\n", CacheZoneMapPath(path).c_str());
+                    exit(1);
                 }
-                else if (strcmp(VariableTypes.at(event_variable_index).c_str(), "string") == 0) {
-                    temp_event_variable.push_back(static_cast<std::string*>(nullptr));
+
+                for (int i = 0; i < pushdown_cut_strings.size(); i++) {
+                    std::string replaced_expr = replaceVariables(pushdown_cut_strings.at(i), &variable_names);
+                    pushdown_postfix_exprs.push_back(PostfixExpression(replaced_expr, &VariableTypes));
                 }
+                ranges.assign(VariableTypes.size(), std::make_pair(0.0, 0.0));
+            }
+
+            // map columns
+            for (int i = 0; i < VariableTypes.size(); i++) {
+                if (strcmp(VariableTypes.at(i).c_str(), "Double_t") == 0) type_codes.push_back(0);
+                else if (strcmp(VariableTypes.at(i).c_str(), "Int_t") == 0) type_codes.push_back(1);
+                else if (strcmp(VariableTypes.at(i).c_str(), "UInt_t") == 0) type_codes.push_back(2);
+                else if (strcmp(VariableTypes.at(i).c_str(), "Float_t") == 0) type_codes.push_back(3);
+                else if (strcmp(VariableTypes.at(i).c_str(), "string") == 0) type_codes.push_back(4);
                 else {
                     printf("unexpected data type: %s\n", VariableTypes.at(i).c_str());
                     exit(1);
                 }
+
+                columns.emplace_back(new MappedFile());
+                columns.back()->Open(CacheColumnPath(path, i, ".bin"));
+                if (columns.back()->Size() != Nrows * CacheValueSize(VariableTypes.at(i))) {
+                    printf("[LoadCache] size of %s is different from the schema\n", CacheColumnPath(path, i, ".bin").c_str());
+                    exit(1);
+                }
+
+                string_columns.emplace_back(new MappedFile());
+                if (type_codes.back() == 4) string_columns.back()->Open(CacheColumnPath(path, i, ".str"));
             }
         }
 
         int Process(std::deque<Data>* data) override {
-            for (std::deque<Data>::iterator iter = data->begin(); iter != data->end(); ) {
-                // get event variable
-                for (int i = 0; i < Event_variable_list.size(); i++) {
-                    int event_variable_index = event_variable_index_list.at(i);
+            // read Currententry'th segment. If there is not segment to read, just return 1
+            if (Currententry == Nentry) return 1;
 
-                    if (strcmp(VariableTypes.at(event_variable_index).c_str(), "Double_t") == 0) {
-                        temp_event_variable.at(i) = std::get<double>(iter->variable.at(event_variable_index));
-                    }
-                    else if (strcmp(VariableTypes.at(event_variable_index).c_str(), "Int_t") == 0) {
-                        temp_event_variable.at(i) = std::get<int>(iter->variable.at(event_variable_index));
-                    }
-                    else if (strcmp(VariableTypes.at(event_variable_index).c_str(), "UInt_t") == 0) {
-                        temp_event_variable.at(i) = std::get<unsigned int>(iter->variable.at(event_variable_index));
-                    }
-                    else if (strcmp(VariableTypes.at(event_variable_index).c_str(), "Float_t") == 0) {
-                        temp_event_variable.at(i) = std::get<float>(iter->variable.at(event_variable_index));
-                    }
-                    else if (strcmp(VariableTypes.at(event_variable_index).c_str(), "string") == 0) {
-                        temp_event_variable.at(i) = std::get<std::string*>(iter->variable.at(event_variable_index));
-                    }
-                    else {
-                        printf("unexpected data type: %s\n", VariableTypes.at(i).c_str());
-                        exit(1);
-                    }
+            // if there is remaining data, do not extract additional one
+            if (data->empty() == false) return 0;
+
+            // previous segment is not used anymore
+            strings.clear();
+
+            // if every block in the segment is skipped, go to the next segment
+            while ((Currententry != Nentry) && data->empty()) {
+                if (Currententry % Nshards != shard_index) {
+                    Currententry++;
+                    continue;
                 }
 
-                if (history_event_variable.find(temp_event_variable) == history_event_variable.end()) {
-                    history_event_variable.insert(temp_event_variable);
-                    Nevt = Nevt + ObtainWeight(iter, variable_names);
+                const CacheSegment& segment = schema.segments.at(Currententry);
+                printf("%s (%d/%d)\n", ("Read " + segment.filename + " from cache... ").c_str(), Currententry, Nentry);
+
+                unsigned long long first_row = segment_offsets.at(Currententry);
+                std::string row_label = label.empty() ? segment.label : label;
+
+                if (pushdown_postfix_exprs.size() == 0) AppendRows(data, first_row, first_row + segment.Nrows, row_label, segment);
+                else {
+                    for (unsigned long long block = 0; block < CacheNblocks(segment, schema.ZoneMapBlockSize); block++) {
+                        Nblocks_read++;
+                        if (IsBlockSkipped(segment_block_offsets.at(Currententry) + block)) {
+                            Nblocks_skipped++;
+                            continue;
+                        }
+                        unsigned long long block_first_row = first_row + block * schema.ZoneMapBlockSize;
+                        unsigned long long block_last_row = std::min(first_row + segment.Nrows, block_first_row + schema.ZoneMapBlockSize);
+                        AppendRows(data, block_first_row, block_last_row, row_label, segment);
+                    }
                 }
 
-                Ncandidate = Ncandidate + ObtainWeight(iter, variable_names);
-                ++iter;
+                Currententry++;
             }
 
-            // clear the vector under the assumption
-            history_event_variable.clear();
-
-            return 1;
+            return 0;
         }
 
         void End() override {
-            printf("%s\n", print_string.c_str());
-            printf("Number of event: %lf\n", Nevt);
-            printf("Number of candidate: %lf\n", Ncandidate);
-
-            output_handle->clear();
+            if (pushdown_postfix_exprs.size() != 0) printf("[LoadCache] %llu/%llu blocks are skipped by the cut\n", Nblocks_skipped, Nblocks_read);
 
-            output_handle->push_back(Nevt);
-            output_handle->push_back(Ncandidate);
+            columns.clear();
+            string_columns.clear();
+            zonemap.Close();
+            strings.clear();
         }
-    };
+
+        bool IsCheckpointable() override { return true; }
+
+        // segments read so far
+        void SaveState(std::ostream& out_) override {
+            WriteBinary(out_, Nentry);
+            WriteBinary(out_, Currententry);
+            WriteBinary(out_, Nblocks_read);
+            WriteBinary(out_, Nblocks_skipped);
+        }
+
+        void LoadState(std::istream& in_) override {
+            int saved_Nentry;
+            unsigned long long saved_Nblocks_read;
+            unsigned long long saved_Nblocks_skipped;
+            ReadBinary(in_, saved_Nentry);
+            ReadBinary(in_, Currententry);
+            ReadBinary(in_, saved_Nblocks_read);
+            ReadBinary(in_, saved_Nblocks_skipped);
+
+            if (saved_Nentry != Nentry) {
+                printf("[LoadCache] the number of segments in %s is different from the checkpoint\n", path.c_str());
+                exit(1);
+            }
+            Nblocks_read = Nblocks_read + saved_Nblocks_read;
+            Nblocks_skipped = Nblocks_skipped + saved_Nblocks_skipped;
+        }
+
+        std::string Fingerprint() override { return MakeFingerprint("LoadCache", path, label, FileFingerprint(path + "/schema.txt")); }
+
+        void SelectShard(int shard_index_, int Nshards_) override {
+            shard_index = shard_index_;
+            Nshards = Nshards_;
+        }
+    };
+
+    class Cut : public Module {
+    private:
+        std::string cut_string;
+        std::string replaced_expr;
+        std::vector<Token> postfix_expr;
+        SchemaPtr schema;
+
+        // rows passing the cut, used when `Process` is called directly
+        std::vector<size_t> selection;
+
+    public:
+        Cut(const char* cut_string_, SchemaPtr schema_) : Module(), cut_string(cut_string_), schema(schema_) {}
+        ~Cut() {}
+
+        std::string GetCutString() const {
+            return cut_string;
+        }
+
+        void Start() override {
+            replaced_expr = replaceVariables(cut_string, *schema);
+            postfix_expr = PostfixExpression(replaced_expr, *schema);
+        }
+
+        int Process(std::deque<Data>* data) override {
+            selection.clear();
+            for (size_t i = 0; i < data->size(); i++) {
+                if (ProcessRow(data->begin() + i)) selection.push_back(i);
+            }
+            CompactRows(data, selection);
+
+            return 1;
+        }
+
+        void End() override {}
+
+        bool IsCheckpointable() override { return true; }
+
+        std::string Fingerprint() override { return MakeFingerprint("Cut", cut_string); }
+
+        // the Loader runs cuts in the loop over selected rows, so rejected rows are only removed from the selection
+        bool IsRowLocal() override { return true; }
+
+        // keep the row if result > 0.5
+        bool ProcessRow(std::deque<Data>::iterator iter) override {
+            return EvaluatePostfixExpression(postfix_expr, iter->variable) > 0.5;
+        }
+    };
+
+    class PrintInformation : public Module {
+        /*
+        * In this module, we assume that
+        * 1. candidates from the same event are consecutive
+        * 2. candidates from the same event are in the same ROOT file
+        */
+    private:
+        std::string print_string;
+        std::vector<std::string> Event_variable_list;
+        double Nevt;
+        double Ncandidate;
+
+        // index of event variables in `variable_names`
+        std::vector<int> event_variable_index_list;
+
+        std::shared_ptr<std::vector<double>> output_handle;
+
+        SchemaPtr schema;
+
+    public:
+        PrintInformation(const char* print_string_, const std::vector<std::string> Event_variable_list_, std::shared_ptr<std::vector<double>> output_handle_, SchemaPtr schema_) : Module(), print_string(print_string_), Event_variable_list(Event_variable_list_), output_handle(output_handle_), schema(schema_), Nevt(0), Ncandidate(0){}
+        ~PrintInformation() {}
+
+        void Start() override {
+            // exception handling
+            if (Event_variable_list.size() == 0) {
+                printf("event variable for PrintInformation should exist.\n");
+                exit(1);
+            }
+
+            // find event variables
+            for (int i = 0; i < Event_variable_list.size(); i++) {
+                int event_variable_index = schema->Index(Event_variable_list.at(i));
+
+                if (event_variable_index < 0) {
+                    printf("cannot find variable: %s\n", Event_variable_list.at(i).c_str());
+                    exit(1);
+                }
+
+                event_variable_index_list.push_back(event_variable_index);
+            }
+        }
+
+        int Process(std::deque<Data>* data) override {
+            std::vector<size_t> offsets;
+            ComputeEventOffsets(*data, event_variable_index_list, &offsets);
+            return ProcessEvents(data, &offsets);
+        }
+
+        std::vector<int> EventVariableIndices() override { return event_variable_index_list; }
+
+        int ProcessEvents(std::deque<Data>* data, std::vector<size_t>* offsets) override {
+            // the first candidate gives the weight of the event
+            for (size_t i = 0; i + 1 < offsets->size(); i++) {
+                Nevt = Nevt + ObtainWeight(data->begin() + (*offsets)[i], schema->Names());
+            }
+
+            for (std::deque<Data>::iterator iter = data->begin(); iter != data->end(); ++iter) {
+                Ncandidate = Ncandidate + ObtainWeight(iter, schema->Names());
+            }
+
+            return 1;
+        }
+
+        void End() override {
+            printf("%s\n", print_string.c_str());
+            printf("Number of event: %lf\n", Nevt);
+            printf("Number of candidate: %lf\n", Ncandidate);
+
+            output_handle->clear();
+
+            output_handle->push_back(Nevt);
+            output_handle->push_back(Ncandidate);
+        }
+
+        bool IsCheckpointable() override { return true; }
+
+        void SaveState(std::ostream& out_) override {
+            WriteBinary(out_, Nevt);
+            WriteBinary(out_, Ncandidate);
+        }
+
+        void LoadState(std::istream& in_) override {
+            double saved_Nevt;
+            double saved_Ncandidate;
+            ReadBinary(in_, saved_Nevt);
+            ReadBinary(in_, saved_Ncandidate);
+
+            Nevt = Nevt + saved_Nevt;
+            Ncandidate = Ncandidate + saved_Ncandidate;
+        }
+
+        std::string Fingerprint() override { return MakeFingerprint("PrintInformation", print_string, Event_variable_list); }
+        bool IsTerminal() override { return true; }
+        bool IsMemoizable() override { return true; }
+    };
 
     class DrawTH1D : public Module {
     private:
@@ -602,8 +1262,10 @@ namespace Module {
         bool normalized;
         bool LogScale;
 
-        std::vector<std::string> variable_names;
-        std::vector<std::string> VariableTypes;
+        // range is determined from values. Then `x_low` and `x_high` change while processing
+        bool IsAutoRange;
+
+        SchemaPtr schema;
         std::string expression;
         std::string replaced_expr;
         std::vector<Token> postfix_expr;
@@ -613,10 +1275,10 @@ namespace Module {
         std::vector<double> x_variable;
         std::vector<double> weight;
     public:
-        DrawTH1D(const char* expression_, const char* hist_title_, int nbins_, double x_low_, double x_high_, const char* png_name_, std::vector<std::string>* variable_names_, std::vector<std::string>* VariableTypes_) : Module(), expression(expression_), hist_title(hist_title_), nbins(nbins_), x_low(x_low_), x_high(x_high_), png_name(png_name_), normalized(false), LogScale(false), variable_names(*variable_names_), VariableTypes(*VariableTypes_) {}
-        DrawTH1D(const char* expression_, const char* hist_title_, int nbins_, double x_low_, double x_high_, const char* png_name_, bool normalized_, bool LogScale_, std::vector<std::string>* variable_names_, std::vector<std::string>* VariableTypes_) : Module(), expression(expression_), hist_title(hist_title_), nbins(nbins_), x_low(x_low_), x_high(x_high_), png_name(png_name_), normalized(normalized_), LogScale(LogScale_), variable_names(*variable_names_), VariableTypes(*VariableTypes_) {}
-        DrawTH1D(const char* expression_, const char* hist_title_, const char* png_name_, std::vector<std::string>* variable_names_, std::vector<std::string>* VariableTypes_) : Module(), expression(expression_), hist_title(hist_title_), nbins(50), x_low(std::numeric_limits<double>::max()), x_high(std::numeric_limits<double>::max()), png_name(png_name_), normalized(false), LogScale(false), variable_names(*variable_names_), VariableTypes(*VariableTypes_) {}
-        DrawTH1D(const char* expression_, const char* hist_title_, const char* png_name_, bool normalized_, bool LogScale_, std::vector<std::string>* variable_names_, std::vector<std::string>* VariableTypes_) : Module(), expression(expression_), hist_title(hist_title_), nbins(50), x_low(std::numeric_limits<double>::max()), x_high(std::numeric_limits<double>::max()), png_name(png_name_), normalized(normalized_), LogScale(LogScale_), variable_names(*variable_names_), VariableTypes(*VariableTypes_) {}
+        DrawTH1D(const char* expression_, const char* hist_title_, int nbins_, double x_low_, double x_high_, const char* png_name_, SchemaPtr schema_) : Module(), expression(expression_), hist_title(hist_title_), nbins(nbins_), x_low(x_low_), x_high(x_high_), IsAutoRange(false), png_name(png_name_), normalized(false), LogScale(false), schema(schema_) {}
+        DrawTH1D(const char* expression_, const char* hist_title_, int nbins_, double x_low_, double x_high_, const char* png_name_, bool normalized_, bool LogScale_, SchemaPtr schema_) : Module(), expression(expression_), hist_title(hist_title_), nbins(nbins_), x_low(x_low_), x_high(x_high_), IsAutoRange(false), png_name(png_name_), normalized(normalized_), LogScale(LogScale_), schema(schema_) {}
+        DrawTH1D(const char* expression_, const char* hist_title_, const char* png_name_, SchemaPtr schema_) : Module(), expression(expression_), hist_title(hist_title_), nbins(50), x_low(std::numeric_limits<double>::max()), x_high(std::numeric_limits<double>::max()), IsAutoRange(true), png_name(png_name_), normalized(false), LogScale(false), schema(schema_) {}
+        DrawTH1D(const char* expression_, const char* hist_title_, const char* png_name_, bool normalized_, bool LogScale_, SchemaPtr schema_) : Module(), expression(expression_), hist_title(hist_title_), nbins(50), x_low(std::numeric_limits<double>::max()), x_high(std::numeric_limits<double>::max()), IsAutoRange(true), png_name(png_name_), normalized(normalized_), LogScale(LogScale_), schema(schema_) {}
 
         ~DrawTH1D() {
             delete hist;
@@ -626,8 +1288,8 @@ namespace Module {
             hist = nullptr;
 
             // change variable name into placeholder
-            replaced_expr = replaceVariables(expression, &variable_names);
-            postfix_expr = PostfixExpression(replaced_expr, &VariableTypes);
+            replaced_expr = replaceVariables(expression, *schema);
+            postfix_expr = PostfixExpression(replaced_expr, *schema);
 
             // if range is determined, make histogram first
             if ((x_low != std::numeric_limits<double>::max()) && (x_high != std::numeric_limits<double>::max())) {
@@ -637,43 +1299,46 @@ namespace Module {
         }
 
         int Process(std::deque<Data>* data) override {
-            for (std::deque<Data>::iterator iter = data->begin(); iter != data->end(); ) {
-                double result = EvaluatePostfixExpression(postfix_expr, iter->variable, &VariableTypes);
+            for (std::deque<Data>::iterator iter = data->begin(); iter != data->end(); ++iter) ProcessRow(iter);
+            return 1;
+        }
 
-                if (hist == nullptr) {
-                    x_variable.push_back(result);
-                    weight.push_back(ObtainWeight(iter, variable_names));
-                }
-                else {
-                    hist->Fill(result, ObtainWeight(iter, variable_names));
-                }
+        bool IsRowLocal() override { return true; }
 
-                // if saved variable exceed 10MB, calculate max, min and create histogram. It is to save memory
-                if ((sizeof(double) * x_variable.size() > 10000000.0) && (hist == nullptr)) {
-                    std::vector<double>::iterator min_it = std::min_element(x_variable.begin(), x_variable.end());
-                    std::vector<double>::iterator max_it = std::max_element(x_variable.begin(), x_variable.end());
+        bool ProcessRow(std::deque<Data>::iterator iter) override {
+            double result = EvaluatePostfixExpression(postfix_expr, iter->variable);
 
-                    x_low = *min_it;
-                    x_high = *max_it;
-                    
-                    std::string hist_name = generateRandomString(12);
-                    hist = new TH1D(hist_name.c_str(), hist_title.c_str(), nbins, x_low, x_high);
+            if (hist == nullptr) {
+                x_variable.push_back(result);
+                weight.push_back(ObtainWeight(iter, schema->Names()));
+            }
+            else {
+                hist->Fill(result, ObtainWeight(iter, schema->Names()));
+            }
 
-                    // fill histogram
-                    for (int i = 0; i < weight.size(); i++) {
-                        hist->Fill(x_variable.at(i), weight.at(i));
-                    }
+            // if saved variable exceed 10MB, calculate max, min and create histogram. It is to save memory
+            if ((sizeof(double) * x_variable.size() > 10000000.0) && (hist == nullptr)) {
+                std::vector<double>::iterator min_it = std::min_element(x_variable.begin(), x_variable.end());
+                std::vector<double>::iterator max_it = std::max_element(x_variable.begin(), x_variable.end());
 
-                    x_variable.clear();
-                    std::vector<double>().swap(x_variable);
-                    weight.clear();
-                    std::vector<double>().swap(weight);
+                x_low = *min_it;
+                x_high = *max_it;
+                
+                std::string hist_name = generateRandomString(12);
+                hist = new TH1D(hist_name.c_str(), hist_title.c_str(), nbins, x_low, x_high);
+
+                // fill histogram
+                for (int i = 0; i < weight.size(); i++) {
+                    hist->Fill(x_variable.at(i), weight.at(i));
                 }
 
-                ++iter;
+                x_variable.clear();
+                std::vector<double>().swap(x_variable);
+                weight.clear();
+                std::vector<double>().swap(weight);
             }
 
-            return 1;
+            return true;
         }
 
         void End() override {
@@ -713,6 +1378,67 @@ namespace Module {
             delete c_temp;
         }
 
+
+        bool IsCheckpointable() override { return true; }
+
+        // histogram if it is already created, and values which are not filled yet
+        void SaveState(std::ostream& out_) override {
+            WriteBinary(out_, hist != nullptr);
+            if (hist != nullptr) {
+                WriteBinary(out_, x_low);
+                WriteBinary(out_, x_high);
+                SaveHistogramState(out_, hist);
+            }
+            WriteBinary(out_, x_variable);
+            WriteBinary(out_, weight);
+        }
+
+        void LoadState(std::istream& in_) override {
+            bool IsHistCreated;
+            ReadBinary(in_, IsHistCreated);
+            if (IsHistCreated) {
+                double saved_x_low;
+                double saved_x_high;
+                ReadBinary(in_, saved_x_low);
+                ReadBinary(in_, saved_x_high);
+
+                // values which are not filled yet are filled in `End`
+                if (hist == nullptr) {
+                    x_low = saved_x_low;
+                    x_high = saved_x_high;
+                    std::string hist_name = generateRandomString(12);
+                    hist = new TH1D(hist_name.c_str(), hist_title.c_str(), nbins, x_low, x_high);
+                }
+                else if ((x_low != saved_x_low) || (x_high != saved_x_high)) {
+                    printf("[DrawTH1D] range of histogram is different from the saved one\n");
+                    exit(1);
+                }
+                AddHistogramState(in_, hist);
+            }
+
+            std::vector<double> saved_x_variable;
+            std::vector<double> saved_weight;
+            ReadBinary(in_, saved_x_variable);
+            ReadBinary(in_, saved_weight);
+            x_variable.insert(x_variable.end(), saved_x_variable.begin(), saved_x_variable.end());
+            weight.insert(weight.end(), saved_weight.begin(), saved_weight.end());
+        }
+
+        // only arguments of the constructor are used, because the range of auto-range histogram is changed while processing
+        std::string Fingerprint() override {
+            if (IsAutoRange) return MakeFingerprint("DrawTH1D", expression, hist_title, nbins, "auto", png_name, normalized, LogScale);
+            return MakeFingerprint("DrawTH1D", expression, hist_title, nbins, x_low, x_high, png_name, normalized, LogScale);
+        }
+        bool IsTerminal() override { return true; }
+        bool IsMemoizable() override { return true; }
+
+        // each shard would determine its own range, so histograms of shards cannot be merged
+        void SelectShard(int shard_index_, int Nshards_) override {
+            if (IsAutoRange) {
+                printf("[DrawTH1D] range of histogram should be given to use shards: %s\n", png_name.c_str());
+                exit(1);
+            }
+        }
     };
 
     class DrawTH2D : public Module {
@@ -726,8 +1452,10 @@ namespace Module {
         double y_low;
         double y_high;
 
-        std::vector<std::string> variable_names;
-        std::vector<std::string> VariableTypes;
+        // range is determined from values. Then the range changes while processing
+        bool IsAutoRange;
+
+        SchemaPtr schema;
         std::string x_expression;
         std::string x_replaced_expr;
         std::vector<Token> x_postfix_expr;
@@ -742,8 +1470,8 @@ namespace Module {
         std::vector<double> y_variable;
         std::vector<double> weight;
     public:
-        DrawTH2D(const char* x_expression_, const char* y_expression_, const char* hist_title_, int x_nbins_, double x_low_, double x_high_, int y_nbins_, double y_low_, double y_high_, const char* png_name_, const char* draw_option_, std::vector<std::string>* variable_names_, std::vector<std::string>* VariableTypes_) : Module(), x_expression(x_expression_), y_expression(y_expression_), hist_title(hist_title_), x_nbins(x_nbins_), x_low(x_low_), x_high(x_high_), y_nbins(y_nbins_), y_low(y_low_), y_high(y_high_), png_name(png_name_), draw_option(draw_option_), variable_names(*variable_names_), VariableTypes(*VariableTypes_) {}
-        DrawTH2D(const char* x_expression_, const char* y_expression_, const char* hist_title_, const char* png_name_, const char* draw_option_, std::vector<std::string>* variable_names_, std::vector<std::string>* VariableTypes_) : Module(), x_expression(x_expression_), y_expression(y_expression_), hist_title(hist_title_), x_nbins(50), x_low(std::numeric_limits<double>::max()), x_high(std::numeric_limits<double>::max()), y_nbins(50), y_low(std::numeric_limits<double>::max()), y_high(std::numeric_limits<double>::max()), png_name(png_name_), draw_option(draw_option_), variable_names(*variable_names_), VariableTypes(*VariableTypes_) {}
+        DrawTH2D(const char* x_expression_, const char* y_expression_, const char* hist_title_, int x_nbins_, double x_low_, double x_high_, int y_nbins_, double y_low_, double y_high_, const char* png_name_, const char* draw_option_, SchemaPtr schema_) : Module(), x_expression(x_expression_), y_expression(y_expression_), hist_title(hist_title_), x_nbins(x_nbins_), x_low(x_low_), x_high(x_high_), y_nbins(y_nbins_), y_low(y_low_), y_high(y_high_), IsAutoRange(false), png_name(png_name_), draw_option(draw_option_), schema(schema_) {}
+        DrawTH2D(const char* x_expression_, const char* y_expression_, const char* hist_title_, const char* png_name_, const char* draw_option_, SchemaPtr schema_) : Module(), x_expression(x_expression_), y_expression(y_expression_), hist_title(hist_title_), x_nbins(50), x_low(std::numeric_limits<double>::max()), x_high(std::numeric_limits<double>::max()), y_nbins(50), y_low(std::numeric_limits<double>::max()), y_high(std::numeric_limits<double>::max()), IsAutoRange(true), png_name(png_name_), draw_option(draw_option_), schema(schema_) {}
 
         ~DrawTH2D() {
             delete hist;
@@ -753,10 +1481,10 @@ namespace Module {
             hist = nullptr;
 
             // change variable name into placeholder
-            x_replaced_expr = replaceVariables(x_expression, &variable_names);
-            y_replaced_expr = replaceVariables(y_expression, &variable_names);
-            x_postfix_expr = PostfixExpression(x_replaced_expr, &VariableTypes);
-            y_postfix_expr = PostfixExpression(y_replaced_expr, &VariableTypes);
+            x_replaced_expr = replaceVariables(x_expression, *schema);
+            y_replaced_expr = replaceVariables(y_expression, *schema);
+            x_postfix_expr = PostfixExpression(x_replaced_expr, *schema);
+            y_postfix_expr = PostfixExpression(y_replaced_expr, *schema);
 
             // if range is determined, make histogram first
             if ((x_low != std::numeric_limits<double>::max()) && (x_high != std::numeric_limits<double>::max()) && (y_low != std::numeric_limits<double>::max()) && (y_high != std::numeric_limits<double>::max())) {
@@ -766,51 +1494,54 @@ namespace Module {
         }
 
         int Process(std::deque<Data>* data) override {
-            for (std::deque<Data>::iterator iter = data->begin(); iter != data->end(); ) {
-                double x_result = EvaluatePostfixExpression(x_postfix_expr, iter->variable, &VariableTypes);
-                double y_result = EvaluatePostfixExpression(y_postfix_expr, iter->variable, &VariableTypes);
+            for (std::deque<Data>::iterator iter = data->begin(); iter != data->end(); ++iter) ProcessRow(iter);
+            return 1;
+        }
 
-                if (hist == nullptr) {
-                    x_variable.push_back(x_result);
-                    y_variable.push_back(y_result);
-                    weight.push_back(ObtainWeight(iter, variable_names));
-                }
-                else {
-                    hist->Fill(x_result, y_result, ObtainWeight(iter, variable_names));
-                }
+        bool IsRowLocal() override { return true; }
 
-                // if saved variable exceed 40MB, calculate max, min and create histogram. It is to save memory
-                if ((sizeof(double) * x_variable.size() > 40000000.0) && (hist == nullptr)) {
-                    std::vector<double>::iterator x_min_it = std::min_element(x_variable.begin(), x_variable.end());
-                    std::vector<double>::iterator x_max_it = std::max_element(x_variable.begin(), x_variable.end());
-                    std::vector<double>::iterator y_min_it = std::min_element(y_variable.begin(), y_variable.end());
-                    std::vector<double>::iterator y_max_it = std::max_element(y_variable.begin(), y_variable.end());
+        bool ProcessRow(std::deque<Data>::iterator iter) override {
+            double x_result = EvaluatePostfixExpression(x_postfix_expr, iter->variable);
+            double y_result = EvaluatePostfixExpression(y_postfix_expr, iter->variable);
 
-                    x_low = *x_min_it;
-                    x_high = *x_max_it;
-                    y_low = *y_min_it;
-                    y_high = *y_max_it;
+            if (hist == nullptr) {
+                x_variable.push_back(x_result);
+                y_variable.push_back(y_result);
+                weight.push_back(ObtainWeight(iter, schema->Names()));
+            }
+            else {
+                hist->Fill(x_result, y_result, ObtainWeight(iter, schema->Names()));
+            }
 
-                    std::string hist_name = generateRandomString(12);
-                    hist = new TH2D(hist_name.c_str(), hist_title.c_str(), x_nbins, x_low, x_high, y_nbins, y_low, y_high);
+            // if saved variable exceed 40MB, calculate max, min and create histogram. It is to save memory
+            if ((sizeof(double) * x_variable.size() > 40000000.0) && (hist == nullptr)) {
+                std::vector<double>::iterator x_min_it = std::min_element(x_variable.begin(), x_variable.end());
+                std::vector<double>::iterator x_max_it = std::max_element(x_variable.begin(), x_variable.end());
+                std::vector<double>::iterator y_min_it = std::min_element(y_variable.begin(), y_variable.end());
+                std::vector<double>::iterator y_max_it = std::max_element(y_variable.begin(), y_variable.end());
 
-                    // fill histogram
-                    for (int i = 0; i < weight.size(); i++) {
-                        hist->Fill(x_variable.at(i), y_variable.at(i), weight.at(i));
-                    }
+                x_low = *x_min_it;
+                x_high = *x_max_it;
+                y_low = *y_min_it;
+                y_high = *y_max_it;
 
-                    x_variable.clear();
-                    std::vector<double>().swap(x_variable);
-                    y_variable.clear();
-                    std::vector<double>().swap(y_variable);
-                    weight.clear();
-                    std::vector<double>().swap(weight);
+                std::string hist_name = generateRandomString(12);
+                hist = new TH2D(hist_name.c_str(), hist_title.c_str(), x_nbins, x_low, x_high, y_nbins, y_low, y_high);
+
+                // fill histogram
+                for (int i = 0; i < weight.size(); i++) {
+                    hist->Fill(x_variable.at(i), y_variable.at(i), weight.at(i));
                 }
 
-                ++iter;
+                x_variable.clear();
+                std::vector<double>().swap(x_variable);
+                y_variable.clear();
+                std::vector<double>().swap(y_variable);
+                weight.clear();
+                std::vector<double>().swap(weight);
             }
 
-            return 1;
+            return true;
         }
 
         void End() override {
@@ -853,799 +1584,1168 @@ namespace Module {
             delete c_temp;
         }
 
-    };
-
-    class PrintSeparateRootFile : public Module {
-    private:
-        std::string path;
-        std::string prefix;
-        std::string suffix;
-
-        // temporary variable to save data into branch
-        std::vector<std::variant<int, unsigned int, float, double, std::string*>> temp_variable;
 
-        std::vector<std::string> variable_names;
-        std::vector<std::string> VariableTypes;
-        std::string TTree_name;
-    public:
-        PrintSeparateRootFile(const char* path_, const char* prefix_, const char* suffix_, std::vector<std::string>* variable_names_, std::vector<std::string>* VariableTypes_, const char* TTree_name_) : Module(), path(path_), prefix(prefix_), suffix(suffix_), variable_names(*variable_names_), VariableTypes(*VariableTypes_), TTree_name(TTree_name_){}
+        bool IsCheckpointable() override { return true; }
 
-        ~PrintSeparateRootFile() {}
+        // histogram if it is already created, and values which are not filled yet
+        void SaveState(std::ostream& out_) override {
+            WriteBinary(out_, hist != nullptr);
+            if (hist != nullptr) {
+                WriteBinary(out_, x_low);
+                WriteBinary(out_, x_high);
+                WriteBinary(out_, y_low);
+                WriteBinary(out_, y_high);
+                SaveHistogramState(out_, hist);
+            }
+            WriteBinary(out_, x_variable);
+            WriteBinary(out_, y_variable);
+            WriteBinary(out_, weight);
+        }
 
-        void Start() override {
-            // fill `temp_variable` by dummy value. It is to set variable type beforehand.
-            for (int i = 0; i < VariableTypes.size(); i++) {
-                if (strcmp(VariableTypes.at(i).c_str(), "Double_t") == 0) {
-                    temp_variable.push_back(static_cast<double>(0.0));
-                }
-                else if (strcmp(VariableTypes.at(i).c_str(), "Int_t") == 0) {
-                    temp_variable.push_back(static_cast<int>(0.0));
-                }
-                else if (strcmp(VariableTypes.at(i).c_str(), "UInt_t") == 0) {
-                    temp_variable.push_back(static_cast<unsigned int>(0.0));
-                }
-                else if (strcmp(VariableTypes.at(i).c_str(), "Float_t") == 0) {
-                    temp_variable.push_back(static_cast<float>(0.0));
-                }
-                else if (strcmp(VariableTypes.at(i).c_str(), "string") == 0) {
-                    temp_variable.push_back(static_cast<std::string*>(nullptr));
+        void LoadState(std::istream& in_) override {
+            bool IsHistCreated;
+            ReadBinary(in_, IsHistCreated);
+            if (IsHistCreated) {
+                double saved_x_low;
+                double saved_x_high;
+                double saved_y_low;
+                double saved_y_high;
+                ReadBinary(in_, saved_x_low);
+                ReadBinary(in_, saved_x_high);
+                ReadBinary(in_, saved_y_low);
+                ReadBinary(in_, saved_y_high);
+
+                // values which are not filled yet are filled in `End`
+                if (hist == nullptr) {
+                    x_low = saved_x_low;
+                    x_high = saved_x_high;
+                    y_low = saved_y_low;
+                    y_high = saved_y_high;
+                    std::string hist_name = generateRandomString(12);
+                    hist = new TH2D(hist_name.c_str(), hist_title.c_str(), x_nbins, x_low, x_high, y_nbins, y_low, y_high);
                 }
-                else {
-                    printf("unexpected data type: %s\n", VariableTypes.at(i).c_str());
+                else if ((x_low != saved_x_low) || (x_high != saved_x_high) || (y_low != saved_y_low) || (y_high != saved_y_high)) {
+                    printf("[DrawTH2D] range of histogram is different from the saved one\n");
                     exit(1);
                 }
+                AddHistogramState(in_, hist);
             }
-        }
 
-        int Process(std::deque<Data>* data) override {
-
-            std::string filename;
-            std::string basename;
-            std::string extension;
-            TFile* temp_file = nullptr;
-            TTree* temp_tree = nullptr;
-            for (int i = 0; i < data->size(); i++) {
-
-                // if filename changes
-                // 1. set basename and extension again
-                // 2. make ROOT file and TTree
-                if (filename != data->at(i).filename) {
-                    // save the previous file
-                    if (temp_file != nullptr) {
-                        temp_file->cd();
-                        temp_tree->Write();
-                        temp_file->Close();
-                        delete temp_file;
-                    }
-
-                    filename = data->at(i).filename;
+            std::vector<double> saved_x_variable;
+            std::vector<double> saved_y_variable;
+            std::vector<double> saved_weight;
+            ReadBinary(in_, saved_x_variable);
+            ReadBinary(in_, saved_y_variable);
+            ReadBinary(in_, saved_weight);
+            x_variable.insert(x_variable.end(), saved_x_variable.begin(), saved_x_variable.end());
+            y_variable.insert(y_variable.end(), saved_y_variable.begin(), saved_y_variable.end());
+            weight.insert(weight.end(), saved_weight.begin(), saved_weight.end());
+        }
 
-                    // separate basenamd and extension
-                    size_t dotPos = filename.find_last_of('.');
+        // only arguments of the constructor are used, because the range of auto-range histogram is changed while processing
+        std::string Fingerprint() override {
+            if (IsAutoRange) return MakeFingerprint("DrawTH2D", x_expression, y_expression, hist_title, x_nbins, y_nbins, "auto", png_name, draw_option);
+            return MakeFingerprint("DrawTH2D", x_expression, y_expression, hist_title, x_nbins, x_low, x_high, y_nbins, y_low, y_high, png_name, draw_option);
+        }
+        bool IsTerminal() override { return true; }
+        bool IsMemoizable() override { return true; }
 
-                    if (dotPos != std::string::npos) {
-                        // Split the filename into basename and extension
-                        basename = filename.substr(0, dotPos);
-                        extension = filename.substr(dotPos + 1);
-                    }
-                    else {
-                        // If no dot is found, the entire filename is the basename
-                        basename = filename;
-                        extension = "";
-                    }
-
-                    // make ROOT file
-                    temp_file = new TFile((path + "/" + prefix + basename + suffix + "." + extension).c_str(), "recreate");
-                    temp_file->cd();
-                    temp_tree = new TTree(TTree_name.c_str(), "");
+        // each shard would determine its own range, so histograms of shards cannot be merged
+        void SelectShard(int shard_index_, int Nshards_) override {
+            if (IsAutoRange) {
+                printf("[DrawTH2D] range of histogram should be given to use shards: %s\n", png_name.c_str());
+                exit(1);
+            }
+        }
+    };
 
-                    // set Branch
-                    for (int j = 0; j < VariableTypes.size(); j++) {
-                        if (strcmp(VariableTypes.at(j).c_str(), "Double_t") == 0) {
-                            temp_tree->Branch(variable_names.at(j).c_str(), &std::get<double>(temp_variable.at(j)));
-                        }
-                        else if (strcmp(VariableTypes.at(j).c_str(), "Int_t") == 0) {
-                            temp_tree->Branch(variable_names.at(j).c_str(), &std::get<int>(temp_variable.at(j)));
-                        }
-                        else if (strcmp(VariableTypes.at(j).c_str(), "UInt_t") == 0) {
-                            temp_tree->Branch(variable_names.at(j).c_str(), &std::get<unsigned int>(temp_variable.at(j)));
-                        }
-                        else if (strcmp(VariableTypes.at(j).c_str(), "Float_t") == 0) {
-                            temp_tree->Branch(variable_names.at(j).c_str(), &std::get<float>(temp_variable.at(j)));
-                        }
-                        else if (strcmp(VariableTypes.at(j).c_str(), "string") == 0) {
-                            temp_tree->Branch(variable_names.at(j).c_str(), &std::get<std::string*>(temp_variable.at(j)));
-                        }
+    struct OutputColumns {
+        /*
+        * columns written by the ROOT writers.
+        * If `include` is empty, every variable is included. `exclude` is applied after `include`. Both accept glob patterns.
+        * `narrowing` maps the glob pattern of variables into the type in the output file. Only Double_t variables can be narrowed into Float_t.
+        */
+        std::vector<int> indices; // index in `variable_names`
+        std::vector<std::string> names;
+        std::vector<std::string> types; // type in the output file
+        std::vector<bool> narrowed; // Double_t -> Float_t
+
+        void Resolve(const std::vector<std::string>& variable_names_, const std::vector<std::string>& VariableTypes_, const std::vector<std::string>& include_, const std::vector<std::string>& exclude_, const std::map<std::string, std::string>& narrowing_) {
+            indices.clear();
+            names.clear();
+            types.clear();
+            narrowed.clear();
+
+            for (int i = 0; i < variable_names_.size(); i++) {
+                bool IsIncluded = (include_.size() == 0);
+                for (int j = 0; j < include_.size(); j++) {
+                    if (MatchGlob(include_.at(j), variable_names_.at(i))) IsIncluded = true;
+                }
+                for (int j = 0; j < exclude_.size(); j++) {
+                    if (MatchGlob(exclude_.at(j), variable_names_.at(i))) IsIncluded = false;
+                }
+                if (!IsIncluded) continue;
+
+                // narrowing is applied only to Double_t variables
+                std::string output_type = VariableTypes_.at(i);
+                for (std::map<std::string, std::string>::const_iterator iter = narrowing_.begin(); iter != narrowing_.end(); ++iter) {
+                    if (iter->second != "Float_t") {
+                        printf("[OutputColumns] only Float_t is supported for narrowing: %s\n", iter->second.c_str());
+                        exit(1);
+                    }
+                    if ((VariableTypes_.at(i) == "Double_t") && MatchGlob(iter->first, variable_names_.at(i))) {
+                        output_type = iter->second;
+                        break;
                     }
-
-                }
-
-                temp_file->cd();
-
-                if (temp_variable.size() != data->at(i).variable.size()) {
-                    printf("Error: [PrintSeparateRootFile] size mismatch!\n");
-                    exit(1);
                 }
-                for (size_t j = 0; j < temp_variable.size(); j++) temp_variable.at(j) = data->at(i).variable.at(j);
+                narrowed.push_back(output_type != VariableTypes_.at(i));
 
-                temp_tree->Fill();
+                indices.push_back(i);
+                names.push_back(variable_names_.at(i));
+                types.push_back(output_type);
             }
 
-            // save branches and file
-            if (temp_file != nullptr) {
-                temp_file->cd();
-                temp_tree->Write();
-                temp_file->Close();
-                delete temp_file;
+            if (indices.size() == 0) {
+                printf("[OutputColumns] there is no variable to write\n");
+                exit(1);
             }
-
-            return 1;
         }
 
-        void End() override {}
-    };
-
-    class PrintRootFile : public Module {
-    private:
-        std::string output_name;
-        TFile* temp_file = nullptr;
-        TTree* temp_tree = nullptr;
-
-        // temporary variable to save data into branch
-        std::vector<std::variant<int, unsigned int, float, double, std::string*>> temp_variable;
-
-        std::vector<std::string> variable_names;
-        std::vector<std::string> VariableTypes;
-        std::string TTree_name;
-    public:
-        PrintRootFile(const char* output_name_, std::vector<std::string>* variable_names_, std::vector<std::string>* VariableTypes_, const char* TTree_name_) : Module(), output_name(output_name_), variable_names(*variable_names_), VariableTypes(*VariableTypes_), TTree_name(TTree_name_) {}
-
-        ~PrintRootFile() {}
-
-        void Start() override {
-            // fill `temp_variable` by dummy value. It is to set variable type beforehand.
-            for (int i = 0; i < VariableTypes.size(); i++) {
-                if (strcmp(VariableTypes.at(i).c_str(), "Double_t") == 0) {
-                    temp_variable.push_back(static_cast<double>(0.0));
+        // fill `temp_variable_` by dummy value. It is to set variable type beforehand.
+        void MakeBuffer(std::vector<std::variant<int, unsigned int, float, double, std::string*>>& temp_variable_) const {
+            temp_variable_.clear();
+            for (int i = 0; i < types.size(); i++) {
+                if (strcmp(types.at(i).c_str(), "Double_t") == 0) {
+                    temp_variable_.push_back(static_cast<double>(0.0));
                 }
-                else if (strcmp(VariableTypes.at(i).c_str(), "Int_t") == 0) {
-                    temp_variable.push_back(static_cast<int>(0.0));
+                else if (strcmp(types.at(i).c_str(), "Int_t") == 0) {
+                    temp_variable_.push_back(static_cast<int>(0.0));
                 }
-                else if (strcmp(VariableTypes.at(i).c_str(), "UInt_t") == 0) {
-                    temp_variable.push_back(static_cast<unsigned int>(0.0));
+                else if (strcmp(types.at(i).c_str(), "UInt_t") == 0) {
+                    temp_variable_.push_back(static_cast<unsigned int>(0.0));
                 }
-                else if (strcmp(VariableTypes.at(i).c_str(), "Float_t") == 0) {
-                    temp_variable.push_back(static_cast<float>(0.0));
+                else if (strcmp(types.at(i).c_str(), "Float_t") == 0) {
+                    temp_variable_.push_back(static_cast<float>(0.0));
                 }
-                else if (strcmp(VariableTypes.at(i).c_str(), "string") == 0) {
-                    temp_variable.push_back(static_cast<std::string*>(nullptr));
+                else if (strcmp(types.at(i).c_str(), "string") == 0) {
+                    temp_variable_.push_back(static_cast<std::string*>(nullptr));
                 }
                 else {
-                    printf("unexpected data type: %s\n", VariableTypes.at(i).c_str());
+                    printf("unexpected data type: %s\n", types.at(i).c_str());
                     exit(1);
                 }
             }
+        }
 
-            temp_file = new TFile(output_name.c_str(), "recreate");
-            temp_file->cd();
-            temp_tree = new TTree(TTree_name.c_str(), "");
-
-            // set Branch
-            for (int j = 0; j < VariableTypes.size(); j++) {
-                if (strcmp(VariableTypes.at(j).c_str(), "Double_t") == 0) {
-                    temp_tree->Branch(variable_names.at(j).c_str(), &std::get<double>(temp_variable.at(j)));
+        void SetBranches(TTree* temp_tree_, std::vector<std::variant<int, unsigned int, float, double, std::string*>>& temp_variable_) const {
+            for (int j = 0; j < types.size(); j++) {
+                if (strcmp(types.at(j).c_str(), "Double_t") == 0) {
+                    temp_tree_->Branch(names.at(j).c_str(), &std::get<double>(temp_variable_.at(j)));
                 }
-                else if (strcmp(VariableTypes.at(j).c_str(), "Int_t") == 0) {
-                    temp_tree->Branch(variable_names.at(j).c_str(), &std::get<int>(temp_variable.at(j)));
+                else if (strcmp(types.at(j).c_str(), "Int_t") == 0) {
+                    temp_tree_->Branch(names.at(j).c_str(), &std::get<int>(temp_variable_.at(j)));
                 }
-                else if (strcmp(VariableTypes.at(j).c_str(), "UInt_t") == 0) {
-                    temp_tree->Branch(variable_names.at(j).c_str(), &std::get<unsigned int>(temp_variable.at(j)));
+                else if (strcmp(types.at(j).c_str(), "UInt_t") == 0) {
+                    temp_tree_->Branch(names.at(j).c_str(), &std::get<unsigned int>(temp_variable_.at(j)));
                 }
-                else if (strcmp(VariableTypes.at(j).c_str(), "Float_t") == 0) {
-                    temp_tree->Branch(variable_names.at(j).c_str(), &std::get<float>(temp_variable.at(j)));
+                else if (strcmp(types.at(j).c_str(), "Float_t") == 0) {
+                    temp_tree_->Branch(names.at(j).c_str(), &std::get<float>(temp_variable_.at(j)));
                 }
-                else if (strcmp(VariableTypes.at(j).c_str(), "string") == 0) {
-                    temp_tree->Branch(variable_names.at(j).c_str(), &std::get<std::string*>(temp_variable.at(j)));
+                else if (strcmp(types.at(j).c_str(), "string") == 0) {
+                    temp_tree_->Branch(names.at(j).c_str(), &std::get<std::string*>(temp_variable_.at(j)));
                 }
             }
         }
 
-        int Process(std::deque<Data>* data) override {
-            for (std::deque<Data>::iterator iter = data->begin(); iter != data->end(); ) {
-                temp_file->cd();
-                if (temp_variable.size() != iter->variable.size()) {
-                    printf("Error: [PrintRootFile] size mismatch!\n");
-                    exit(1);
-                }
-                for (size_t j = 0; j < temp_variable.size(); j++) temp_variable.at(j) = iter->variable.at(j);
-                temp_tree->Fill();
-                ++iter;
+        // copy the row into `temp_variable_`. If `projected_` is true, the row only has output columns
+        void Fill(const std::vector<std::variant<int, unsigned int, float, double, std::string*>>& row_, bool projected_, std::vector<std::variant<int, unsigned int, float, double, std::string*>>& temp_variable_) const {
+            for (size_t j = 0; j < indices.size(); j++) {
+                const std::variant<int, unsigned int, float, double, std::string*>& value = projected_ ? row_[j] : row_[indices[j]];
+                if (narrowed[j]) temp_variable_[j] = static_cast<float>(std::get<double>(value));
+                else temp_variable_[j] = value;
             }
-
-            return 1;
         }
+    };
 
-        void End() override {
-            // save branches and file
-            if (temp_file != nullptr) {
-                temp_file->cd();
-                temp_tree->Write();
-                temp_file->Close();
-                delete temp_file;
+    struct OwnedRows {
+        /*
+        * copy of rows which does not depend on `TotalData`. Only the output columns are copied.
+        * `std::string*` in rows points to `strings`, so it is valid until this object is deleted
+        */
+        std::vector<std::vector<std::variant<int, unsigned int, float, double, std::string*>>> rows;
+        std::deque<std::string> strings;
+
+        void Append(const std::vector<std::variant<int, unsigned int, float, double, std::string*>>& variable_, const OutputColumns& columns_) {
+            rows.emplace_back();
+            rows.back().reserve(columns_.indices.size());
+            for (size_t j = 0; j < columns_.indices.size(); j++) {
+                rows.back().push_back(variable_.at(columns_.indices[j]));
+                if (std::string** temp = std::get_if<std::string*>(&rows.back().back())) {
+                    if ((*temp) == nullptr) continue;
+                    strings.push_back(**temp);
+                    (*temp) = &strings.back();
+                }
             }
         }
     };
 
-    class BCS : public Module {
+    class PrintSeparateRootFile : public Module {
         /*
-        * In this module, we assume that 
-        * 1. candidates from the same event are consecutive
-        * 2. candidates from the same event are in the same ROOT file
+        * rows from the same input file are written into one output file.
+        * In the parallel mode, rows of each input file are copied and moved into the task of the thread pool, which writes the output file.
+        * Tasks writing the same output file are executed in order, so the result is the same as the sequential mode.
         */
     private:
-        std::string equation;
-        std::string criteria;
-        std::vector<std::string> Event_variable_list;
+        std::string path;
+        std::string prefix;
+        std::string suffix;
 
-        // temporary variable to extract event variable
-        std::vector<std::variant<int, unsigned int, float, double, std::string*>> temp_event_variable;
+        bool parallel;
 
-        // index of event variables in `variable_names`
-        std::vector<int> event_variable_index_list;
+        // output columns
+        std::vector<std::string> include;
+        std::vector<std::string> exclude;
+        std::map<std::string, std::string> narrowing;
+        OutputColumns columns;
 
-        std::string replaced_expr;
-        std::vector<Token> postfix_expr;
+        // temporary variable to save data into branch
+        std::vector<std::variant<int, unsigned int, float, double, std::string*>> temp_variable;
 
-        std::vector<std::string> variable_names;
-        std::vector<std::string> VariableTypes;
+        // tasks in the thread pool
+        std::deque<std::shared_future<void>> tasks;
+        std::map<std::string, std::shared_future<void>> last_task_of_output;
+        size_t MaxTasks;
 
-        static char to_upper(char c) {
-            return std::toupper(static_cast<unsigned char>(c));
+        SchemaPtr schema;
+        std::string TTree_name;
+
+        std::string OutputName(const std::string& filename_) const {
+            std::string basename;
+            std::string extension;
+
+            // separate basenamd and extension
+            size_t dotPos = filename_.find_last_of('.');
+
+            if (dotPos != std::string::npos) {
+                // Split the filename into basename and extension
+                basename = filename_.substr(0, dotPos);
+                extension = filename_.substr(dotPos + 1);
+            }
+            else {
+                // If no dot is found, the entire filename is the basename
+                basename = filename_;
+                extension = "";
+            }
+
+            return path + "/" + prefix + basename + suffix + "." + extension;
         }
-    public:
-        BCS(const char* equation_, const char* criteria_, const std::vector<std::string> Event_variable_list_, std::vector<std::string>* variable_names_, std::vector<std::string>* VariableTypes_) : Module(), equation(equation_), criteria(criteria_), Event_variable_list(Event_variable_list_), variable_names(*variable_names_), VariableTypes(*VariableTypes_) {}
-        
-        ~BCS() {}
 
-        void Start() override {
-            // exception handling
-            if (Event_variable_list.size() == 0) {
-                printf("event variable for BCS should exist.\n");
-                exit(1);
+        // `temp_variable_` is given by the caller, because each thread needs its own one
+        // If `projected_` is true, rows only have output columns
+        void WriteFile(const std::string& output_name_, const std::vector<const std::vector<std::variant<int, unsigned int, float, double, std::string*>>*>& rows_, bool projected_, std::vector<std::variant<int, unsigned int, float, double, std::string*>>& temp_variable_) const {
+            // make ROOT file
+            TFile* temp_file = new TFile(output_name_.c_str(), "recreate");
+            temp_file->cd();
+            TTree* temp_tree = new TTree(TTree_name.c_str(), "");
+
+            // set Branch
+            columns.SetBranches(temp_tree, temp_variable_);
+
+            for (size_t i = 0; i < rows_.size(); i++) {
+                columns.Fill(*rows_.at(i), projected_, temp_variable_);
+                temp_tree->Fill();
             }
 
-            // convert `criteria` into upper case
-            std::transform(criteria.begin(), criteria.end(), criteria.begin(), to_upper);
+            // save branches and file
+            temp_file->cd();
+            temp_tree->Write();
+            temp_file->Close();
+            delete temp_file;
+        }
 
-            if ((criteria != "HIGHEST") && (criteria != "LOWEST")) {
-                printf("criteria for BCS should be `highest` or `lowest`\n");
-                exit(1);
+        void Submit(const std::string& output_name_, std::unique_ptr<OwnedRows> batch_) {
+            // limit the number of rows in memory
+            while (tasks.size() >= MaxTasks) {
+                tasks.front().get();
+                tasks.pop_front();
             }
 
-            // fill `temp_event_variable` by dummy value. It is to set variable type beforehand.
-            for (int i = 0; i < Event_variable_list.size(); i++) {
-                int event_variable_index = std::find(variable_names.begin(), variable_names.end(), Event_variable_list.at(i)) - variable_names.begin();
+            // previous task writing the same file should be done first
+            std::shared_future<void> previous_task;
+            if (last_task_of_output.find(output_name_) != last_task_of_output.end()) previous_task = last_task_of_output[output_name_];
 
-                if (event_variable_index == variable_names.size()) {
-                    printf("cannot find variable: %s\n", Event_variable_list.at(i).c_str());
-                    exit(1);
-                }
+            std::shared_ptr<OwnedRows> batch(std::move(batch_));
+            std::shared_future<void> task = GetThreadPool()->Enqueue([this, output_name_, batch, previous_task]() {
+                if (previous_task.valid()) previous_task.wait();
 
-                event_variable_index_list.push_back(event_variable_index);
+                std::vector<const std::vector<std::variant<int, unsigned int, float, double, std::string*>>*> rows;
+                for (size_t i = 0; i < batch->rows.size(); i++) rows.push_back(&batch->rows.at(i));
 
-                if (strcmp(VariableTypes.at(event_variable_index).c_str(), "Double_t") == 0) {
-                    temp_event_variable.push_back(static_cast<double>(0.0));
-                }
-                else if (strcmp(VariableTypes.at(event_variable_index).c_str(), "Int_t") == 0) {
-                    temp_event_variable.push_back(static_cast<int>(0.0));
-                }
-                else if (strcmp(VariableTypes.at(event_variable_index).c_str(), "UInt_t") == 0) {
-                    temp_event_variable.push_back(static_cast<unsigned int>(0.0));
-                }
-                else if (strcmp(VariableTypes.at(event_variable_index).c_str(), "Float_t") == 0) {
-                    temp_event_variable.push_back(static_cast<float>(0.0));
-                }
-                else if (strcmp(VariableTypes.at(event_variable_index).c_str(), "string") == 0) {
-                    temp_event_variable.push_back(static_cast<std::string*>(nullptr));
-                }
-                else {
-                    printf("unexpected data type: %s\n", VariableTypes.at(i).c_str());
-                    exit(1);
-                }
-            }
+                std::vector<std::variant<int, unsigned int, float, double, std::string*>> local_variable = temp_variable;
+                WriteFile(output_name_, rows, true, local_variable);
+            }).share();
 
-            replaced_expr = replaceVariables(equation, &variable_names);
-            postfix_expr = PostfixExpression(replaced_expr, &VariableTypes);
+            tasks.push_back(task);
+            last_task_of_output[output_name_] = task;
         }
 
-        int Process(std::deque<Data>* data) override {
+    public:
+        PrintSeparateRootFile(const char* path_, const char* prefix_, const char* suffix_, SchemaPtr schema_, const char* TTree_name_) : PrintSeparateRootFile(path_, prefix_, suffix_, false, schema_, TTree_name_) {}
 
-            // It is temporary data to save Data before/after BCS is done.
-            std::deque<Data> temp_data;
-            std::deque<Data> temp_data_after_BCS;
+        PrintSeparateRootFile(const char* path_, const char* prefix_, const char* suffix_, bool parallel_, SchemaPtr schema_, const char* TTree_name_) : PrintSeparateRootFile(path_, prefix_, suffix_, parallel_, {}, {}, {}, schema_, TTree_name_) {}
 
-            // initialize extreme value/index
-            double extreme_value;
-            if (criteria == "HIGHEST") extreme_value = -std::numeric_limits<double>::max();
-            else if (criteria == "LOWEST") extreme_value = std::numeric_limits<double>::max();
-            else {
-                printf("criteria for BCS should be `highest` or `lowest`\n");
-                exit(1);
-            }
-            std::vector<int> selected_indices;
+        PrintSeparateRootFile(const char* path_, const char* prefix_, const char* suffix_, bool parallel_, std::vector<std::string> include_, std::vector<std::string> exclude_, std::map<std::string, std::string> narrowing_, SchemaPtr schema_, const char* TTree_name_) : Module(), path(path_), prefix(prefix_), suffix(suffix_), parallel(parallel_), include(include_), exclude(exclude_), narrowing(narrowing_), schema(schema_), TTree_name(TTree_name_) {}
 
-            // initialization flag previous event variable
-            bool ItIsTheFirstData = true; // we erase data from std::deque<Data>. we should avoid the comparison with data->begin()
-            std::vector<std::variant<int, unsigned int, float, double, std::string*>> previous_event_variable = temp_event_variable;
+        ~PrintSeparateRootFile() {}
 
-            for (std::deque<Data>::iterator iter = data->begin(); iter != data->end(); iter++) {
-                // get event variable
-                for (int i = 0; i < Event_variable_list.size(); i++) {
-                    int event_variable_index = event_variable_index_list.at(i);
+        void Start() override {
+            columns.Resolve(schema->Names(), schema->TypeNames(), include, exclude, narrowing);
 
-                    if (strcmp(VariableTypes.at(event_variable_index).c_str(), "Double_t") == 0) {
-                        temp_event_variable.at(i) = std::get<double>(iter->variable.at(event_variable_index));
-                    }
-                    else if (strcmp(VariableTypes.at(event_variable_index).c_str(), "Int_t") == 0) {
-                        temp_event_variable.at(i) = std::get<int>(iter->variable.at(event_variable_index));
-                    }
-                    else if (strcmp(VariableTypes.at(event_variable_index).c_str(), "UInt_t") == 0) {
-                        temp_event_variable.at(i) = std::get<unsigned int>(iter->variable.at(event_variable_index));
-                    }
-                    else if (strcmp(VariableTypes.at(event_variable_index).c_str(), "Float_t") == 0) {
-                        temp_event_variable.at(i) = std::get<float>(iter->variable.at(event_variable_index));
-                    }
-                    else if (strcmp(VariableTypes.at(event_variable_index).c_str(), "string") == 0) {
-                        temp_event_variable.at(i) = std::get<std::string*>(iter->variable.at(event_variable_index));
-                    }
-                    else {
-                        printf("unexpected data type: %s\n", VariableTypes.at(i).c_str());
-                        exit(1);
-                    }
-                }
-                if (ItIsTheFirstData) {
-                    previous_event_variable = temp_event_variable;
-                    ItIsTheFirstData = false;
-                }
+            // fill `temp_variable` by dummy value. It is to set variable type beforehand.
+            columns.MakeBuffer(temp_variable);
 
-                // if event variable changes, do BCS
-                if (previous_event_variable != temp_event_variable) {
-                    if (selected_indices.size() != 0) {
-                        for (int i = 0; i < selected_indices.size(); i++) {
-                            Data temp = temp_data.at(selected_indices.at(i));
-                            temp_data_after_BCS.push_back(temp);
-                        }
+            if (parallel) {
+                // ROOT is used in more than one thread
+                ROOT::EnableThreadSafety();
+
+                // two tasks per thread are enough to keep threads busy
+                MaxTasks = 2 * GetThreadPool()->Size();
+            }
+        }
 
-                        temp_data.clear();
+        int Process(std::deque<Data>* data) override {
 
-                        // reset extreme value/index
-                        if (criteria == "HIGHEST") extreme_value = -std::numeric_limits<double>::max();
-                        else if (criteria == "LOWEST") extreme_value = std::numeric_limits<double>::max();
-                        else {
-                            printf("criteria for BCS should be `highest` or `lowest`\n");
-                            exit(1);
-                        }
-                        selected_indices.clear();
-                    }
-                    else {
-                        printf("[BCS] unexpected error");
+            for (std::deque<Data>::iterator group_begin = data->begin(); group_begin != data->end(); ) {
+
+                // rows from the same file
+                std::deque<Data>::iterator group_end = group_begin;
+                while ((group_end != data->end()) && (group_end->filename == group_begin->filename)) {
+                    if (schema->Size() != group_end->variable.size()) {
+                        printf("Error: [PrintSeparateRootFile] size mismatch!\n");
                         exit(1);
                     }
+                    ++group_end;
                 }
 
-                // get BCS variable
-                double result = EvaluatePostfixExpression(postfix_expr, iter->variable, &VariableTypes);
-                
-                // check the BCS criteria
-                if (criteria == "HIGHEST") {
-                    if (result > extreme_value) {
-                        extreme_value = result;
-                        selected_indices.clear();
-                        selected_indices.push_back(temp_data.size());
-                    }
-                    else if (result == extreme_value) {
-                        selected_indices.push_back(temp_data.size());
-                    }
+                if (parallel) {
+                    std::unique_ptr<OwnedRows> batch(new OwnedRows());
+                    for (std::deque<Data>::iterator iter = group_begin; iter != group_end; ++iter) batch->Append(iter->variable, columns);
+                    Submit(OutputName(group_begin->filename), std::move(batch));
                 }
-                else if (criteria == "LOWEST") {
-                    if (result < extreme_value) {
-                        extreme_value = result;
-                        selected_indices.clear();
-                        selected_indices.push_back(temp_data.size());
-                    }
-                    else if (result == extreme_value) {
-                        selected_indices.push_back(temp_data.size());
-                    }
+                else {
+                    std::vector<const std::vector<std::variant<int, unsigned int, float, double, std::string*>>*> rows;
+                    for (std::deque<Data>::iterator iter = group_begin; iter != group_end; ++iter) rows.push_back(&(iter->variable));
+                    WriteFile(OutputName(group_begin->filename), rows, false, temp_variable);
                 }
 
-                // get Data
-                temp_data.push_back(*iter);
-
-                previous_event_variable = temp_event_variable;
-
+                group_begin = group_end;
             }
 
-            // do BCS for the final dataset
-            if (selected_indices.size() != 0) {
-                for (int i = 0; i < selected_indices.size(); i++) {
-                    Data temp = temp_data.at(selected_indices.at(i));
-                    temp_data_after_BCS.push_back(temp);
-                }
-
-                temp_data.clear();
+            return 1;
+        }
 
-                // reset extreme value/index
-                if (criteria == "HIGHEST") extreme_value = -std::numeric_limits<double>::max();
-                else if (criteria == "LOWEST") extreme_value = std::numeric_limits<double>::max();
-                else {
-                    printf("criteria for BCS should be `highest` or `lowest`\n");
-                    exit(1);
-                }
-                selected_indices.clear();
+        void End() override {
+            // wait for all tasks
+            while (!tasks.empty()) {
+                tasks.front().get();
+                tasks.pop_front();
             }
+            last_task_of_output.clear();
+        }
 
-            // use swap instead of copy to save computing resource
-            data->clear();
-            data->swap(temp_data_after_BCS);
+        // output files are complete once the tasks are done, so nothing is saved
+        bool IsCheckpointable() override { return true; }
 
-            return 1;
+        void SaveState(std::ostream& out_) override {
+            while (!tasks.empty()) {
+                tasks.front().get();
+                tasks.pop_front();
+            }
         }
 
-        void End() override {}
+        std::string Fingerprint() override { return MakeFingerprint("PrintSeparateRootFile", path, prefix, suffix, parallel, include, exclude, narrowing, TTree_name); }
+        bool IsTerminal() override { return true; }
+
+        // input files of shards are different, so output files are also different
+        bool HasOutputPerShard() override { return true; }
     };
 
-    class RandomBCS : public Module {
+    class PrintRootFile : public Module {
         /*
-        * In this module, we assume that
-        * 1. candidates from the same event are consecutive
-        * 2. candidates from the same event are in the same ROOT file
+        * rows are copied into batches and given to the writer thread through the bounded queue.
+        * TFile and TTree are created, filled, and written only in the writer thread, so compression does not block the other modules.
         */
     private:
-        std::vector<std::string> Event_variable_list;
+        std::string output_name;
 
-        // temporary variable to extract event variable
-        std::vector<std::variant<int, unsigned int, float, double, std::string*>> temp_event_variable;
+        // -1 means the default of ROOT
+        int compression_algorithm;
+        int compression_level;
+        int basket_size;
 
-        // index of event variables in `variable_names`
-        std::vector<int> event_variable_index_list;
+        // output columns
+        std::vector<std::string> include;
+        std::vector<std::string> exclude;
+        std::map<std::string, std::string> narrowing;
+        OutputColumns columns;
 
-        std::vector<std::string> variable_names;
-        std::vector<std::string> VariableTypes;
+        // temporary variable to save data into branch. It is used only in the writer thread
+        std::vector<std::variant<int, unsigned int, float, double, std::string*>> temp_variable;
 
-    public:
-        RandomBCS(const std::vector<std::string> Event_variable_list_, std::vector<std::string>* variable_names_, std::vector<std::string>* VariableTypes_) : Module(), Event_variable_list(Event_variable_list_), variable_names(*variable_names_), VariableTypes(*VariableTypes_) {}
+        // bounded queue between `Process` and the writer thread
+        std::thread writer;
+        std::mutex queue_mutex;
+        std::condition_variable queue_not_full;
+        std::condition_variable queue_not_empty;
+        std::deque<std::unique_ptr<OwnedRows>> queue;
+        bool finished;
+        size_t BatchSize;
+        size_t MaxQueuedBatches;
+
+        SchemaPtr schema;
+        std::string TTree_name;
 
-        ~RandomBCS() {}
+        void Push(std::unique_ptr<OwnedRows> batch_) {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            queue_not_full.wait(lock, [this] { return queue.size() < MaxQueuedBatches; });
+            queue.push_back(std::move(batch_));
+            queue_not_empty.notify_one();
+        }
 
-        void Start() override {
-            // exception handling
-            if (Event_variable_list.size() == 0) {
-                printf("event variable for RandomBCS should exist.\n");
-                exit(1);
-            }
+        void Write() {
+            TFile* temp_file = new TFile(output_name.c_str(), "recreate");
+            if (compression_algorithm >= 0) temp_file->SetCompressionAlgorithm(compression_algorithm);
+            if (compression_level >= 0) temp_file->SetCompressionLevel(compression_level);
+            temp_file->cd();
+            TTree* temp_tree = new TTree(TTree_name.c_str(), "");
 
-            // fill `temp_event_variable` by dummy value. It is to set variable type beforehand.
-            for (int i = 0; i < Event_variable_list.size(); i++) {
-                int event_variable_index = std::find(variable_names.begin(), variable_names.end(), Event_variable_list.at(i)) - variable_names.begin();
+            // set Branch
+            columns.SetBranches(temp_tree, temp_variable);
+            if (basket_size > 0) temp_tree->SetBasketSize("*", basket_size);
 
-                if (event_variable_index == variable_names.size()) {
-                    printf("cannot find variable: %s\n", Event_variable_list.at(i).c_str());
-                    exit(1);
+            while (true) {
+                std::unique_ptr<OwnedRows> batch;
+                {
+                    std::unique_lock<std::mutex> lock(queue_mutex);
+                    queue_not_empty.wait(lock, [this] { return finished || !queue.empty(); });
+                    if (queue.empty()) break;
+                    batch = std::move(queue.front());
+                    queue.pop_front();
+                    queue_not_full.notify_one();
                 }
 
-                event_variable_index_list.push_back(event_variable_index);
-
-                if (strcmp(VariableTypes.at(event_variable_index).c_str(), "Double_t") == 0) {
-                    temp_event_variable.push_back(static_cast<double>(0.0));
-                }
-                else if (strcmp(VariableTypes.at(event_variable_index).c_str(), "Int_t") == 0) {
-                    temp_event_variable.push_back(static_cast<int>(0.0));
-                }
-                else if (strcmp(VariableTypes.at(event_variable_index).c_str(), "UInt_t") == 0) {
-                    temp_event_variable.push_back(static_cast<unsigned int>(0.0));
-                }
-                else if (strcmp(VariableTypes.at(event_variable_index).c_str(), "Float_t") == 0) {
-                    temp_event_variable.push_back(static_cast<float>(0.0));
-                }
-                else if (strcmp(VariableTypes.at(event_variable_index).c_str(), "string") == 0) {
-                    temp_event_variable.push_back(static_cast<std::string*>(nullptr));
-                }
-                else {
-                    printf("unexpected data type: %s\n", VariableTypes.at(i).c_str());
-                    exit(1);
+                for (size_t i = 0; i < batch->rows.size(); i++) {
+                    columns.Fill(batch->rows.at(i), true, temp_variable);
+                    temp_tree->Fill();
                 }
             }
 
+            // save branches and file
+            temp_file->cd();
+            temp_tree->Write();
+            temp_file->Close();
+            delete temp_file;
         }
 
-        int Process(std::deque<Data>* data) override {
+    public:
+        PrintRootFile(const char* output_name_, SchemaPtr schema_, const char* TTree_name_) : PrintRootFile(output_name_, -1, -1, -1, schema_, TTree_name_) {}
 
-            // Convert the string to a size_t hash value
-            std::hash<std::string> hasher;
-            size_t hashValue;
-            if (data->size() > 0) hashValue = hasher(data->at(0).filename);
-            else hashValue = 42;
+        PrintRootFile(const char* output_name_, int compression_algorithm_, int compression_level_, int basket_size_, SchemaPtr schema_, const char* TTree_name_) : PrintRootFile(output_name_, compression_algorithm_, compression_level_, basket_size_, {}, {}, {}, schema_, TTree_name_) {}
 
-            // Initialize the random number generator with the hash value
-            std::mt19937 rng(static_cast<unsigned int>(hashValue));
-            std::uniform_real_distribution<double> dist(0.0, 1.0);
+        PrintRootFile(const char* output_name_, int compression_algorithm_, int compression_level_, int basket_size_, std::vector<std::string> include_, std::vector<std::string> exclude_, std::map<std::string, std::string> narrowing_, SchemaPtr schema_, const char* TTree_name_) : Module(), output_name(output_name_), compression_algorithm(compression_algorithm_), compression_level(compression_level_), basket_size(basket_size_), include(include_), exclude(exclude_), narrowing(narrowing_), finished(false), schema(schema_), TTree_name(TTree_name_) {
+            // 65536 rows per batch, and at most 8 batches are waiting
+            BatchSize = 65536;
+            MaxQueuedBatches = 8;
+        }
 
-            // It is temporary data to save Data before/after BCS is done.
-            std::deque<Data> temp_data;
-            std::deque<Data> temp_data_after_BCS;
+        ~PrintRootFile() {}
 
-            // initialize extreme value/index
-            double extreme_value = -std::numeric_limits<double>::max();
-            std::vector<int> selected_indices;
+        void Start() override {
+            columns.Resolve(schema->Names(), schema->TypeNames(), include, exclude, narrowing);
 
-            // initialization flag previous event variable
-            bool ItIsTheFirstData = true; // we erase data from std::deque<Data>. we should avoid the comparison with data->begin()
-            std::vector<std::variant<int, unsigned int, float, double, std::string*>> previous_event_variable = temp_event_variable;
+            // fill `temp_variable` by dummy value. It is to set variable type beforehand.
+            columns.MakeBuffer(temp_variable);
 
-            for (std::deque<Data>::iterator iter = data->begin(); iter != data->end(); iter++) {
-                // get event variable
-                for (int i = 0; i < Event_variable_list.size(); i++) {
-                    int event_variable_index = event_variable_index_list.at(i);
+            // ROOT is used in more than one thread
+            ROOT::EnableThreadSafety();
 
-                    if (strcmp(VariableTypes.at(event_variable_index).c_str(), "Double_t") == 0) {
-                        temp_event_variable.at(i) = std::get<double>(iter->variable.at(event_variable_index));
-                    }
-                    else if (strcmp(VariableTypes.at(event_variable_index).c_str(), "Int_t") == 0) {
-                        temp_event_variable.at(i) = std::get<int>(iter->variable.at(event_variable_index));
-                    }
-                    else if (strcmp(VariableTypes.at(event_variable_index).c_str(), "UInt_t") == 0) {
-                        temp_event_variable.at(i) = std::get<unsigned int>(iter->variable.at(event_variable_index));
-                    }
-                    else if (strcmp(VariableTypes.at(event_variable_index).c_str(), "Float_t") == 0) {
-                        temp_event_variable.at(i) = std::get<float>(iter->variable.at(event_variable_index));
-                    }
-                    else if (strcmp(VariableTypes.at(event_variable_index).c_str(), "string") == 0) {
-                        temp_event_variable.at(i) = std::get<std::string*>(iter->variable.at(event_variable_index));
-                    }
-                    else {
-                        printf("unexpected data type: %s\n", VariableTypes.at(i).c_str());
-                        exit(1);
-                    }
+            finished = false;
+            writer = std::thread(&PrintRootFile::Write, this);
+        }
+
+        int Process(std::deque<Data>* data) override {
+            std::unique_ptr<OwnedRows> batch(new OwnedRows());
+            for (std::deque<Data>::iterator iter = data->begin(); iter != data->end(); ) {
+                if (schema->Size() != iter->variable.size()) {
+                    printf("Error: [PrintRootFile] size mismatch!\n");
+                    exit(1);
                 }
-                if (ItIsTheFirstData) {
-                    previous_event_variable = temp_event_variable;
-                    ItIsTheFirstData = false;
+                batch->Append(iter->variable, columns);
+
+                if (batch->rows.size() == BatchSize) {
+                    Push(std::move(batch));
+                    batch.reset(new OwnedRows());
                 }
+                ++iter;
+            }
+            if (batch->rows.size() != 0) Push(std::move(batch));
 
-                // if event variable changes, do BCS
-                if (previous_event_variable != temp_event_variable) {
-                    if (selected_indices.size() != 0) {
-                        for (int i = 0; i < selected_indices.size(); i++) {
-                            Data temp = temp_data.at(selected_indices.at(i));
-                            temp_data_after_BCS.push_back(temp);
-                        }
+            return 1;
+        }
+
+        void End() override {
+            // wait until the writer thread writes everything
+            {
+                std::unique_lock<std::mutex> lock(queue_mutex);
+                finished = true;
+            }
+            queue_not_empty.notify_one();
+            if (writer.joinable()) writer.join();
+        }
 
-                        temp_data.clear();
+        // ROOT files written from a checkpoint would not be the same as the ones of an uninterrupted run, so the checkpoint is disabled
+        bool IsCheckpointable() override { return false; }
 
-                        // reset extreme value/index
-                        extreme_value = -std::numeric_limits<double>::max();
-                        selected_indices.clear();
-                    }
-                    else {
-                        printf("[RandomBCS] unexpected error");
+        std::string Fingerprint() override { return MakeFingerprint("PrintRootFile", output_name, compression_algorithm, compression_level, basket_size, include, exclude, narrowing, TTree_name); }
+        bool IsTerminal() override { return true; }
+
+        bool HasOutputPerShard() override { return true; }
+
+        void SetShardSuffix(const std::string& suffix_) override { output_name = InsertSuffix(output_name, suffix_); }
+    };
+
+    class SaveCache : public Module {
+        /*
+        * write the data into the cache, which can be read by `LoadCache`.
+        * Rows from the same label and file in one `Process` become one segment.
+        * schema.txt is written at the end, so the cache without schema.txt is incomplete.
+        */
+    private:
+        std::string path;
+        CacheSchema cache_schema;
+
+        std::vector<FILE*> column_files;
+        std::vector<FILE*> string_files;
+
+        // end offset of strings written so far
+        std::vector<uint64_t> string_offsets;
+
+        // buffer for each column. It is written in the end of `Process`
+        std::vector<std::vector<char>> column_buffers;
+        std::vector<std::vector<char>> string_buffers;
+
+        // zone map of the current block
+        FILE* zonemap_file;
+        std::vector<char> zonemap_buffer;
+        std::vector<std::pair<double, double>> block_ranges;
+        unsigned long long block_Nrows;
+
+        void ResetBlock() {
+            const double inf = std::numeric_limits<double>::infinity();
+            block_ranges.assign(schema->Size(), std::make_pair(inf, -inf));
+            block_Nrows = 0;
+        }
+
+        void CloseBlock() {
+            if (block_Nrows == 0) return;
+
+            const double inf = std::numeric_limits<double>::infinity();
+            for (int i = 0; i < schema->Size(); i++) {
+                // string or NaN, range is unknown
+                if ((schema->Type(i) == VariableType::String) || std::isnan(block_ranges[i].first)) block_ranges[i] = std::make_pair(-inf, inf);
+                AppendValue(zonemap_buffer, block_ranges[i].first);
+                AppendValue(zonemap_buffer, block_ranges[i].second);
+            }
+
+            ResetBlock();
+        }
+
+        void UpdateRange(int index_, double value_) {
+            // once NaN is found, the range stays NaN
+            if (std::isnan(value_) || std::isnan(block_ranges[index_].first)) block_ranges[index_].first = std::numeric_limits<double>::quiet_NaN();
+            else {
+                block_ranges[index_].first = std::min(block_ranges[index_].first, value_);
+                block_ranges[index_].second = std::max(block_ranges[index_].second, value_);
+            }
+        }
+
+        SchemaPtr schema;
+
+        template <typename T> static void AppendValue(std::vector<char>& buffer_, const T& value_) {
+            const char* bytes = reinterpret_cast<const char*>(&value_);
+            buffer_.insert(buffer_.end(), bytes, bytes + sizeof(T));
+        }
+    public:
+        SaveCache(const char* path_, SchemaPtr schema_) : Module(), path(path_), schema(schema_) {}
+
+        ~SaveCache() {}
+
+        void Start() override {
+            MakeCacheDirectory(path);
+
+            // remove old schema. It is written again in the end
+            std::remove((path + "/schema.txt").c_str());
+
+            cache_schema.variable_names = schema->Names();
+            cache_schema.VariableTypes = schema->TypeNames();
+            cache_schema.segments.clear();
+
+            // check type
+            for (int i = 0; i < schema->Size(); i++) CacheValueSize(schema->TypeName(i));
+
+            string_offsets.assign(schema->Size(), 0);
+            column_buffers.assign(schema->Size(), std::vector<char>());
+            string_buffers.assign(schema->Size(), std::vector<char>());
+
+            cache_schema.ZoneMapBlockSize = EvaluationBlockSize;
+            ResetBlock();
+
+            // files are opened in the first `Process`, because the cache of the previous run may be resumed in `LoadState`
+            zonemap_file = nullptr;
+        }
+
+        /*
+        * open column files. If `append_` is true, they are written after the existing contents
+        */
+        void OpenFiles(bool append_) {
+            const char* mode = append_ ? "ab" : "wb";
+
+            for (int i = 0; i < schema->Size(); i++) {
+                column_files.push_back(fopen(CacheColumnPath(path, i, ".bin").c_str(), mode));
+                if (column_files.back() == nullptr) {
+                    printf("[SaveCache] cannot open %s\n", CacheColumnPath(path, i, ".bin").c_str());
+                    exit(1);
+                }
+
+                if (schema->Type(i) == VariableType::String) {
+                    string_files.push_back(fopen(CacheColumnPath(path, i, ".str").c_str(), mode));
+                    if (string_files.back() == nullptr) {
+                        printf("[SaveCache] cannot open %s\n", CacheColumnPath(path, i, ".str").c_str());
                         exit(1);
                     }
                 }
+                else string_files.push_back(nullptr);
+            }
+
+            zonemap_file = fopen(CacheZoneMapPath(path).c_str(), mode);
+            if (zonemap_file == nullptr) {
+                printf("[SaveCache] cannot open %s\n", CacheZoneMapPath(path).c_str());
+                exit(1);
+            }
+        }
+
+        int Process(std::deque<Data>* data) override {
+            if (zonemap_file == nullptr) OpenFiles(false);
+
+            // new segment always starts in new `Process`
+            bool NewSegment = true;
 
-                // get random variable
-                double result = dist(rng);
+            for (std::deque<Data>::iterator iter = data->begin(); iter != data->end(); ) {
+                if (iter->variable.size() != schema->Size()) {
+                    printf("Error: [SaveCache] size mismatch!\n");
+                    exit(1);
+                }
+
+                // block of zone map does not cross segments
+                if (NewSegment || (cache_schema.segments.back().label != iter->label) || (cache_schema.segments.back().filename != iter->filename)) {
+                    CloseBlock();
+                    cache_schema.segments.push_back({ 0, iter->label, iter->filename });
+                    NewSegment = false;
+                }
+                cache_schema.segments.back().Nrows++;
 
-                // check the BCS criteria
-                if (result > extreme_value) {
-                    extreme_value = result;
-                    selected_indices.clear();
-                    selected_indices.push_back(temp_data.size());
+                for (int i = 0; i < schema->Size(); i++) {
+                    const std::variant<int, unsigned int, float, double, std::string*>& value = iter->variable.at(i);
+                    if (const double* temp = std::get_if<double>(&value)) { AppendValue(column_buffers[i], *temp); UpdateRange(i, *temp); }
+                    else if (const int* temp = std::get_if<int>(&value)) { AppendValue(column_buffers[i], *temp); UpdateRange(i, *temp); }
+                    else if (const unsigned int* temp = std::get_if<unsigned int>(&value)) { AppendValue(column_buffers[i], *temp); UpdateRange(i, *temp); }
+                    else if (const float* temp = std::get_if<float>(&value)) { AppendValue(column_buffers[i], *temp); UpdateRange(i, *temp); }
+                    else {
+                        const std::string* temp_string = std::get<std::string*>(value);
+                        if (temp_string != nullptr) {
+                            string_buffers[i].insert(string_buffers[i].end(), temp_string->begin(), temp_string->end());
+                            string_offsets[i] = string_offsets[i] + temp_string->size();
+                        }
+                        AppendValue(column_buffers[i], string_offsets[i]);
+                    }
                 }
-                else if (result == extreme_value) {
-                    selected_indices.push_back(temp_data.size());
+
+                block_Nrows++;
+                if (block_Nrows == cache_schema.ZoneMapBlockSize) CloseBlock();
+
+                ++iter;
+            }
+            CloseBlock();
+
+            // write buffers
+            for (int i = 0; i < schema->Size(); i++) {
+                fwrite(column_buffers[i].data(), 1, column_buffers[i].size(), column_files.at(i));
+                column_buffers[i].clear();
+                if (string_files.at(i) != nullptr) {
+                    fwrite(string_buffers[i].data(), 1, string_buffers[i].size(), string_files.at(i));
+                    string_buffers[i].clear();
                 }
+            }
+            fwrite(zonemap_buffer.data(), 1, zonemap_buffer.size(), zonemap_file);
+            zonemap_buffer.clear();
 
-                // get Data
-                temp_data.push_back(*iter);
+            return 1;
+        }
 
-                previous_event_variable = temp_event_variable;
+        void End() override {
+            if (zonemap_file == nullptr) OpenFiles(false);
 
+            for (int i = 0; i < column_files.size(); i++) {
+                fclose(column_files.at(i));
+                if (string_files.at(i) != nullptr) fclose(string_files.at(i));
             }
+            fclose(zonemap_file);
+
+            WriteCacheSchema(path, cache_schema);
+        }
+
+        bool IsCheckpointable() override { return true; }
 
-            // do BCS for the final dataset
-            if (selected_indices.size() != 0) {
-                for (int i = 0; i < selected_indices.size(); i++) {
-                    Data temp = temp_data.at(selected_indices.at(i));
-                    temp_data_after_BCS.push_back(temp);
+        // segments and size of files written so far. Buffers are always empty after `Process`
+        void SaveState(std::ostream& out_) override {
+            if (zonemap_file == nullptr) OpenFiles(false);
+
+            std::vector<long long> column_sizes;
+            std::vector<long long> string_sizes;
+            for (int i = 0; i < schema->Size(); i++) {
+                fflush(column_files.at(i));
+                column_sizes.push_back(ftell(column_files.at(i)));
+                if (string_files.at(i) != nullptr) {
+                    fflush(string_files.at(i));
+                    string_sizes.push_back(ftell(string_files.at(i)));
                 }
+                else string_sizes.push_back(0);
+            }
+            fflush(zonemap_file);
 
-                temp_data.clear();
+            WriteBinary(out_, static_cast<uint64_t>(cache_schema.segments.size()));
+            for (int i = 0; i < cache_schema.segments.size(); i++) {
+                WriteBinary(out_, cache_schema.segments.at(i).Nrows);
+                WriteBinary(out_, cache_schema.segments.at(i).label);
+                WriteBinary(out_, cache_schema.segments.at(i).filename);
+            }
+            WriteBinary(out_, string_offsets);
+            WriteBinary(out_, column_sizes);
+            WriteBinary(out_, string_sizes);
+            WriteBinary(out_, static_cast<long long>(ftell(zonemap_file)));
+        }
 
-                // reset extreme value/index
-                extreme_value = -std::numeric_limits<double>::max();
-                selected_indices.clear();
+        void LoadState(std::istream& in_) override {
+            if (zonemap_file != nullptr) {
+                printf("[SaveCache] state should be loaded before the first `Process`\n");
+                exit(1);
             }
 
-            // use swap instead of copy to save computing resource
-            data->clear();
-            data->swap(temp_data_after_BCS);
+            uint64_t Nsegments;
+            ReadBinary(in_, Nsegments);
+            cache_schema.segments.clear();
+            for (uint64_t i = 0; i < Nsegments; i++) {
+                CacheSegment segment;
+                ReadBinary(in_, segment.Nrows);
+                ReadBinary(in_, segment.label);
+                ReadBinary(in_, segment.filename);
+                cache_schema.segments.push_back(segment);
+            }
+
+            std::vector<long long> column_sizes;
+            std::vector<long long> string_sizes;
+            long long zonemap_size;
+            ReadBinary(in_, string_offsets);
+            ReadBinary(in_, column_sizes);
+            ReadBinary(in_, string_sizes);
+            ReadBinary(in_, zonemap_size);
+
+            // contents written after the checkpoint are dropped
+            auto truncate_file = [](const std::string& filename_, long long size_) {
+                if (truncate(filename_.c_str(), size_) != 0) {
+                    printf("[SaveCache] cannot resume %s\n", filename_.c_str());
+                    exit(1);
+                }
+            };
+            for (int i = 0; i < schema->Size(); i++) {
+                truncate_file(CacheColumnPath(path, i, ".bin"), column_sizes.at(i));
+                if (schema->Type(i) == VariableType::String) truncate_file(CacheColumnPath(path, i, ".str"), string_sizes.at(i));
+            }
+            truncate_file(CacheZoneMapPath(path), zonemap_size);
 
-            return 1;
+            OpenFiles(true);
         }
 
-        void End() override {}
+        std::string Fingerprint() override { return MakeFingerprint("SaveCache", path); }
+        bool IsTerminal() override { return true; }
+
+        bool HasOutputPerShard() override { return true; }
+
+        void SetShardSuffix(const std::string& suffix_) override { path = path + suffix_; }
     };
 
-    class IsBCSValid : public Module {
+    class BCS : public Module {
         /*
-        * In this module, we assume that
-        * 1. candidates from the same event are in the same ROOT file
+        * In this module, we assume that 
+        * 1. candidates from the same event are consecutive
+        * 2. candidates from the same event are in the same ROOT file
         */
     private:
+        std::string equation;
+        std::string criteria;
         std::vector<std::string> Event_variable_list;
 
-        // temporary variable to extract event variable
-        std::vector<std::variant<int, unsigned int, float, double, std::string*>> temp_event_variable;
-
         // index of event variables in `variable_names`
         std::vector<int> event_variable_index_list;
 
-        // event variable history
-        std::set<std::vector<std::variant<int, unsigned int, float, double, std::string*>>, CompareHistory> history_event_variable;
+        // candidates which are kept
+        std::vector<size_t> selection;
 
-        std::vector<std::string> variable_names;
-        std::vector<std::string> VariableTypes;
+        std::string replaced_expr;
+        std::vector<Token> postfix_expr;
 
-    public:
-        IsBCSValid(const std::vector<std::string> Event_variable_list_, std::vector<std::string>* variable_names_, std::vector<std::string>* VariableTypes_) : Module(), Event_variable_list(Event_variable_list_), variable_names(*variable_names_), VariableTypes(*VariableTypes_) {}
+        SchemaPtr schema;
 
-        ~IsBCSValid() {}
+        static char to_upper(char c) {
+            return std::toupper(static_cast<unsigned char>(c));
+        }
+    public:
+        BCS(const char* equation_, const char* criteria_, const std::vector<std::string> Event_variable_list_, SchemaPtr schema_) : Module(), equation(equation_), criteria(criteria_), Event_variable_list(Event_variable_list_), schema(schema_) {}
+        
+        ~BCS() {}
 
         void Start() override {
             // exception handling
             if (Event_variable_list.size() == 0) {
-                printf("event variable for IsBCSValid should exist.\n");
+                printf("event variable for BCS should exist.\n");
                 exit(1);
             }
 
-            // fill `temp_event_variable` by dummy value. It is to set variable type beforehand.
+            // convert `criteria` into upper case
+            std::transform(criteria.begin(), criteria.end(), criteria.begin(), to_upper);
+
+            if ((criteria != "HIGHEST") && (criteria != "LOWEST")) {
+                printf("criteria for BCS should be `highest` or `lowest`\n");
+                exit(1);
+            }
+
+            // find event variables
             for (int i = 0; i < Event_variable_list.size(); i++) {
-                int event_variable_index = std::find(variable_names.begin(), variable_names.end(), Event_variable_list.at(i)) - variable_names.begin();
+                int event_variable_index = schema->Index(Event_variable_list.at(i));
 
-                if (event_variable_index == variable_names.size()) {
+                if (event_variable_index < 0) {
                     printf("cannot find variable: %s\n", Event_variable_list.at(i).c_str());
                     exit(1);
                 }
 
                 event_variable_index_list.push_back(event_variable_index);
-
-                if (strcmp(VariableTypes.at(event_variable_index).c_str(), "Double_t") == 0) {
-                    temp_event_variable.push_back(static_cast<double>(0.0));
-                }
-                else if (strcmp(VariableTypes.at(event_variable_index).c_str(), "Int_t") == 0) {
-                    temp_event_variable.push_back(static_cast<int>(0.0));
-                }
-                else if (strcmp(VariableTypes.at(event_variable_index).c_str(), "UInt_t") == 0) {
-                    temp_event_variable.push_back(static_cast<unsigned int>(0.0));
-                }
-                else if (strcmp(VariableTypes.at(event_variable_index).c_str(), "Float_t") == 0) {
-                    temp_event_variable.push_back(static_cast<float>(0.0));
-                }
-                else if (strcmp(VariableTypes.at(event_variable_index).c_str(), "string") == 0) {
-                    temp_event_variable.push_back(static_cast<std::string*>(nullptr));
-                }
-                else {
-                    printf("unexpected data type: %s\n", VariableTypes.at(i).c_str());
-                    exit(1);
-                }
             }
+
+            replaced_expr = replaceVariables(equation, *schema);
+            postfix_expr = PostfixExpression(replaced_expr, *schema);
         }
 
         int Process(std::deque<Data>* data) override {
-            for (std::deque<Data>::iterator iter = data->begin(); iter != data->end(); ) {
-                // get event variable
-                for (int i = 0; i < Event_variable_list.size(); i++) {
-                    int event_variable_index = event_variable_index_list.at(i);
+            std::vector<size_t> offsets;
+            ComputeEventOffsets(*data, event_variable_index_list, &offsets);
+            return ProcessEvents(data, &offsets);
+        }
 
-                    if (strcmp(VariableTypes.at(event_variable_index).c_str(), "Double_t") == 0) {
-                        temp_event_variable.at(i) = std::get<double>(iter->variable.at(event_variable_index));
-                    }
-                    else if (strcmp(VariableTypes.at(event_variable_index).c_str(), "Int_t") == 0) {
-                        temp_event_variable.at(i) = std::get<int>(iter->variable.at(event_variable_index));
-                    }
-                    else if (strcmp(VariableTypes.at(event_variable_index).c_str(), "UInt_t") == 0) {
-                        temp_event_variable.at(i) = std::get<unsigned int>(iter->variable.at(event_variable_index));
-                    }
-                    else if (strcmp(VariableTypes.at(event_variable_index).c_str(), "Float_t") == 0) {
-                        temp_event_variable.at(i) = std::get<float>(iter->variable.at(event_variable_index));
-                    }
-                    else if (strcmp(VariableTypes.at(event_variable_index).c_str(), "string") == 0) {
-                        temp_event_variable.at(i) = std::get<std::string*>(iter->variable.at(event_variable_index));
+        std::vector<int> EventVariableIndices() override { return event_variable_index_list; }
+
+        int ProcessEvents(std::deque<Data>* data, std::vector<size_t>* offsets) override {
+            selection.clear();
+
+            for (size_t i = 0; i + 1 < offsets->size(); i++) {
+                // initialize extreme value
+                double extreme_value;
+                if (criteria == "HIGHEST") extreme_value = -std::numeric_limits<double>::max();
+                else extreme_value = std::numeric_limits<double>::max();
+                size_t first_selected = selection.size();
+
+                for (size_t j = (*offsets)[i]; j < (*offsets)[i + 1]; j++) {
+                    // get BCS variable
+                    double result = EvaluatePostfixExpression(postfix_expr, (*data)[j].variable);
+
+                    // check the BCS criteria. Every candidate with the extreme value is kept
+                    bool IsBetter = (criteria == "HIGHEST") ? (result > extreme_value) : (result < extreme_value);
+                    if (IsBetter) {
+                        extreme_value = result;
+                        selection.resize(first_selected);
+                        selection.push_back(j);
                     }
-                    else {
-                        printf("unexpected data type: %s\n", VariableTypes.at(i).c_str());
-                        exit(1);
+                    else if (result == extreme_value) {
+                        selection.push_back(j);
                     }
                 }
 
-                if (history_event_variable.find(temp_event_variable) == history_event_variable.end()) {
-                    history_event_variable.insert(temp_event_variable);
-                }
-                else {
-                    printf("BCS is not valid\n");
+                if (selection.size() == first_selected) {
+                    printf("[BCS] unexpected error");
                     exit(1);
                 }
-
-                ++iter;
             }
 
-            // clear the vector under the assumption
-            history_event_variable.clear();
+            CompactRows(data, selection, offsets);
 
             return 1;
         }
 
         void End() override {}
+
+        bool IsCheckpointable() override { return true; }
+
+        std::string Fingerprint() override { return MakeFingerprint("BCS", equation, criteria, Event_variable_list); }
     };
 
-    class DrawFOM : public Module {
+    class RandomBCS : public Module {
+        /*
+        * In this module, we assume that
+        * 1. candidates from the same event are consecutive
+        * 2. candidates from the same event are in the same ROOT file
+        */
     private:
-        std::string equation;
-        std::string replaced_expr;
-        std::vector<Token> postfix_expr;
+        std::vector<std::string> Event_variable_list;
 
-        std::vector<std::string> Signal_label_list;
-        std::vector<std::string> Background_label_list;
+        // index of event variables in `variable_names`
+        std::vector<int> event_variable_index_list;
 
-        // For the O(1) look-up
-        std::unordered_set<std::string> Signal_label_set;
-        std::unordered_set<std::string> Background_label_set;
+        // candidates which are kept
+        std::vector<size_t> selection;
 
-        // FOM range/bin
-        int NBin;
-        double MIN;
-        double MAX;
+        SchemaPtr schema;
 
-        /*
-        * print point when FOM value is `rank`'th, counting from maximum point to negative direction
-        * this option is useful if you do not want to highly optimize the result
-        */
-        int rank;
+    public:
+        RandomBCS(const std::vector<std::string> Event_variable_list_, SchemaPtr schema_) : Module(), Event_variable_list(Event_variable_list_), schema(schema_) {}
 
-        double* Cuts;
-        double* NSIGs;
-        double* NSIGs_cumulative;
-        double* NBKGs;
-        double* NBKGs_cumulative;
-        double* FOMs;
+        ~RandomBCS() {}
 
-        std::shared_ptr<std::vector<double>> output_handle;
+        void Start() override {
+            // exception handling
+            if (Event_variable_list.size() == 0) {
+                printf("event variable for RandomBCS should exist.\n");
+                exit(1);
+            }
 
-        std::vector<std::string> variable_names;
-        std::vector<std::string> VariableTypes;
+            // find event variables
+            for (int i = 0; i < Event_variable_list.size(); i++) {
+                int event_variable_index = schema->Index(Event_variable_list.at(i));
 
-        std::string png_name;
+                if (event_variable_index < 0) {
+                    printf("cannot find variable: %s\n", Event_variable_list.at(i).c_str());
+                    exit(1);
+                }
 
-        double MyEPSILON;
-    public:
-        DrawFOM(const char* equation_, double MIN_, double MAX_, const char* png_name_, std::vector<std::string> Signal_label_list_, std::vector<std::string> Background_label_list_, std::shared_ptr<std::vector<double>> output_handle_, std::vector<std::string>* variable_names_, std::vector<std::string>* VariableTypes_) : Module(), equation(equation_), MIN(MIN_), MAX(MAX_), rank(0), png_name(png_name_), Signal_label_list(Signal_label_list_), Background_label_list(Background_label_list_), output_handle(output_handle_), variable_names(*variable_names_), VariableTypes(*VariableTypes_) {
-            // just 50
-            NBin = 50;
+                event_variable_index_list.push_back(event_variable_index);
+            }
 
-            // just 0.000001
-            MyEPSILON = 0.000001;
         }
-        DrawFOM(const char* equation_, double MIN_, double MAX_, int NBin_, int rank_, const char* png_name_, std::vector<std::string> Signal_label_list_, std::vector<std::string> Background_label_list_, std::shared_ptr<std::vector<double>> output_handle_, std::vector<std::string>* variable_names_, std::vector<std::string>* VariableTypes_) : Module(), equation(equation_), MIN(MIN_), MAX(MAX_), NBin(NBin_), rank(rank_), png_name(png_name_), Signal_label_list(Signal_label_list_), Background_label_list(Background_label_list_), output_handle(output_handle_), variable_names(*variable_names_), VariableTypes(*VariableTypes_) {
-            // just 0.000001
-            MyEPSILON = 0.000001;
+
+        int Process(std::deque<Data>* data) override {
+            std::vector<size_t> offsets;
+            ComputeEventOffsets(*data, event_variable_index_list, &offsets);
+            return ProcessEvents(data, &offsets);
         }
 
-        ~DrawFOM() {}
+        std::vector<int> EventVariableIndices() override { return event_variable_index_list; }
 
-        void Start() {
+        int ProcessEvents(std::deque<Data>* data, std::vector<size_t>* offsets) override {
+
+            // Convert the string to a size_t hash value
+            std::hash<std::string> hasher;
+            size_t hashValue;
+            if (data->size() > 0) hashValue = hasher(data->at(0).filename);
+            else hashValue = 42;
+
+            // Initialize the random number generator with the hash value
+            std::mt19937 rng(static_cast<unsigned int>(hashValue));
+            std::uniform_real_distribution<double> dist(0.0, 1.0);
+
+            selection.clear();
+
+            for (size_t i = 0; i + 1 < offsets->size(); i++) {
+                double extreme_value = -std::numeric_limits<double>::max();
+                size_t first_selected = selection.size();
+
+                for (size_t j = (*offsets)[i]; j < (*offsets)[i + 1]; j++) {
+                    // get random variable
+                    double result = dist(rng);
+
+                    // check the BCS criteria
+                    if (result > extreme_value) {
+                        extreme_value = result;
+                        selection.resize(first_selected);
+                        selection.push_back(j);
+                    }
+                    else if (result == extreme_value) {
+                        selection.push_back(j);
+                    }
+                }
+
+                if (selection.size() == first_selected) {
+                    printf("[RandomBCS] unexpected error");
+                    exit(1);
+                }
+            }
+
+            CompactRows(data, selection, offsets);
+
+            return 1;
+        }
+
+        void End() override {}
+
+        bool IsCheckpointable() override { return true; }
+
+        std::string Fingerprint() override { return MakeFingerprint("RandomBCS", Event_variable_list); }
+    };
+
+    class IsBCSValid : public Module {
+        /*
+        * In this module, we assume that
+        * 1. candidates from the same event are in the same ROOT file
+        */
+    private:
+        std::vector<std::string> Event_variable_list;
+
+        // temporary variable to extract event variable
+        std::vector<std::variant<int, unsigned int, float, double, std::string*>> temp_event_variable;
+
+        // index of event variables in `variable_names`
+        std::vector<int> event_variable_index_list;
+
+        // event variable history
+        std::set<std::vector<std::variant<int, unsigned int, float, double, std::string*>>, CompareHistory> history_event_variable;
+
+        SchemaPtr schema;
+
+    public:
+        IsBCSValid(const std::vector<std::string> Event_variable_list_, SchemaPtr schema_) : Module(), Event_variable_list(Event_variable_list_), schema(schema_) {}
+
+        ~IsBCSValid() {}
+
+        void Start() override {
+            // exception handling
+            if (Event_variable_list.size() == 0) {
+                printf("event variable for IsBCSValid should exist.\n");
+                exit(1);
+            }
+
+            // fill `temp_event_variable` by dummy value. It is to set variable type beforehand.
+            for (int i = 0; i < Event_variable_list.size(); i++) {
+                int event_variable_index = schema->Index(Event_variable_list.at(i));
+
+                if (event_variable_index < 0) {
+                    printf("cannot find variable: %s\n", Event_variable_list.at(i).c_str());
+                    exit(1);
+                }
+
+                event_variable_index_list.push_back(event_variable_index);
+
+                temp_event_variable.push_back(DefaultValue(schema->Type(event_variable_index)));
+            }
+        }
+
+        int Process(std::deque<Data>* data) override {
+            std::vector<size_t> offsets;
+            ComputeEventOffsets(*data, event_variable_index_list, &offsets);
+            return ProcessEvents(data, &offsets);
+        }
+
+        std::vector<int> EventVariableIndices() override { return event_variable_index_list; }
+
+        int ProcessEvents(std::deque<Data>* data, std::vector<size_t>* offsets) override {
+            for (size_t i = 0; i + 1 < offsets->size(); i++) {
+                if ((*offsets)[i + 1] - (*offsets)[i] != 1) {
+                    printf("BCS is not valid\n");
+                    exit(1);
+                }
+
+                // the same event can also appear later in the file
+                std::deque<Data>::iterator iter = data->begin() + (*offsets)[i];
+                for (int k = 0; k < Event_variable_list.size(); k++) {
+                    // the variant keeps its type, so there is no need to check the type
+                    temp_event_variable[k] = iter->variable[event_variable_index_list[k]];
+                }
+
+                if (history_event_variable.find(temp_event_variable) == history_event_variable.end()) {
+                    history_event_variable.insert(temp_event_variable);
+                }
+                else {
+                    printf("BCS is not valid\n");
+                    exit(1);
+                }
+            }
+
+            // clear the vector under the assumption
+            history_event_variable.clear();
+
+            return 1;
+        }
+
+        void End() override {}
+
+        bool IsCheckpointable() override { return true; }
+
+        std::string Fingerprint() override { return MakeFingerprint("IsBCSValid", Event_variable_list); }
+    };
+
+    class DrawFOM : public Module {
+    private:
+        std::string equation;
+        std::string replaced_expr;
+        std::vector<Token> postfix_expr;
+
+        std::vector<std::string> Signal_label_list;
+        std::vector<std::string> Background_label_list;
+
+        // For the O(1) look-up
+        std::unordered_set<std::string> Signal_label_set;
+        std::unordered_set<std::string> Background_label_set;
+
+        // FOM range/bin
+        int NBin;
+        double MIN;
+        double MAX;
+
+        /*
+        * print point when FOM value is `rank`'th, counting from maximum point to negative direction
+        * this option is useful if you do not want to highly optimize the result
+        */
+        int rank;
+
+        double* Cuts;
+        double* NSIGs;
+        double* NSIGs_cumulative;
+        double* NBKGs;
+        double* NBKGs_cumulative;
+        double* FOMs;
+
+        std::shared_ptr<std::vector<double>> output_handle;
+
+        SchemaPtr schema;
+
+        std::string png_name;
+
+        double MyEPSILON;
+    public:
+        DrawFOM(const char* equation_, double MIN_, double MAX_, const char* png_name_, std::vector<std::string> Signal_label_list_, std::vector<std::string> Background_label_list_, std::shared_ptr<std::vector<double>> output_handle_, SchemaPtr schema_) : Module(), equation(equation_), MIN(MIN_), MAX(MAX_), rank(0), png_name(png_name_), Signal_label_list(Signal_label_list_), Background_label_list(Background_label_list_), output_handle(output_handle_), schema(schema_) {
+            // just 50
+            NBin = 50;
+
+            // just 0.000001
+            MyEPSILON = 0.000001;
+        }
+        DrawFOM(const char* equation_, double MIN_, double MAX_, int NBin_, int rank_, const char* png_name_, std::vector<std::string> Signal_label_list_, std::vector<std::string> Background_label_list_, std::shared_ptr<std::vector<double>> output_handle_, SchemaPtr schema_) : Module(), equation(equation_), MIN(MIN_), MAX(MAX_), NBin(NBin_), rank(rank_), png_name(png_name_), Signal_label_list(Signal_label_list_), Background_label_list(Background_label_list_), output_handle(output_handle_), schema(schema_) {
+            // just 0.000001
+            MyEPSILON = 0.000001;
+        }
+
+        ~DrawFOM() {}
+
+        void Start() override {
             // change variable name into placeholder
-            replaced_expr = replaceVariables(equation, &variable_names);
-            postfix_expr = PostfixExpression(replaced_expr, &VariableTypes);
+            replaced_expr = replaceVariables(equation, *schema);
+            postfix_expr = PostfixExpression(replaced_expr, *schema);
 
             if (Signal_label_list.size() == 0) {
                 printf("signal should be defined. Use `SetSignal`\n");
@@ -1689,28 +2789,29 @@ namespace Module {
             }
         }
 
-        int Process(std::deque<Data>* data) {
-
-            for (std::deque<Data>::iterator iter = data->begin(); iter != data->end(); ) {
+        int Process(std::deque<Data>* data) override {
+            for (std::deque<Data>::iterator iter = data->begin(); iter != data->end(); ++iter) ProcessRow(iter);
+            return 1;
+        }
 
-                double result = EvaluatePostfixExpression(postfix_expr, iter->variable, &VariableTypes);
+        bool IsRowLocal() override { return true; }
 
-                int first_bin = -1;
-                if (result < MIN) first_bin = -1;
-                else if (result >= MAX) first_bin = NBin - 1;
-                else first_bin = std::min(NBin - 1, int(std::floor((result - MIN) / ((MAX - MIN) / NBin))));
-                if (first_bin >= 0) {
-                    if (Signal_label_set.find(iter->label) != Signal_label_set.end()) NSIGs[first_bin] = NSIGs[first_bin] + ObtainWeight(iter, variable_names);
-                    if (Background_label_set.find(iter->label) != Background_label_set.end()) NBKGs[first_bin] = NBKGs[first_bin] + ObtainWeight(iter, variable_names);
-                }
+        bool ProcessRow(std::deque<Data>::iterator iter) override {
+            double result = EvaluatePostfixExpression(postfix_expr, iter->variable);
 
-                ++iter;
+            int first_bin = -1;
+            if (result < MIN) first_bin = -1;
+            else if (result >= MAX) first_bin = NBin - 1;
+            else first_bin = std::min(NBin - 1, int(std::floor((result - MIN) / ((MAX - MIN) / NBin))));
+            if (first_bin >= 0) {
+                if (Signal_label_set.find(iter->label) != Signal_label_set.end()) NSIGs[first_bin] = NSIGs[first_bin] + ObtainWeight(iter, schema->Names());
+                if (Background_label_set.find(iter->label) != Background_label_set.end()) NBKGs[first_bin] = NBKGs[first_bin] + ObtainWeight(iter, schema->Names());
             }
 
-            return 1;
+            return true;
         }
 
-        void End() {
+        void End() override {
 
             // calculate cumulative sum
             for (int i = NBin - 1; i >= 0; i--) {
@@ -1803,6 +2904,34 @@ namespace Module {
 
             delete c_temp;
         }
+
+        bool IsCheckpointable() override { return true; }
+
+        // yields in each bin. Cumulative yields are calculated in `End`
+        void SaveState(std::ostream& out_) override {
+            WriteBinary(out_, std::vector<double>(NSIGs, NSIGs + NBin));
+            WriteBinary(out_, std::vector<double>(NBKGs, NBKGs + NBin));
+        }
+
+        void LoadState(std::istream& in_) override {
+            std::vector<double> saved_NSIGs;
+            std::vector<double> saved_NBKGs;
+            ReadBinary(in_, saved_NSIGs);
+            ReadBinary(in_, saved_NBKGs);
+
+            if ((saved_NSIGs.size() != NBin) || (saved_NBKGs.size() != NBin)) {
+                printf("[DrawFOM] the number of bins is different from the saved one\n");
+                exit(1);
+            }
+            for (int i = 0; i < NBin; i++) {
+                NSIGs[i] = NSIGs[i] + saved_NSIGs.at(i);
+                NBKGs[i] = NBKGs[i] + saved_NBKGs.at(i);
+            }
+        }
+
+        std::string Fingerprint() override { return MakeFingerprint("DrawFOM", equation, Signal_label_list, Background_label_list, NBin, MIN, MAX, rank, png_name); }
+        bool IsTerminal() override { return true; }
+        bool IsMemoizable() override { return true; }
     };
 
     class DrawPunziFOM : public Module {
@@ -1842,31 +2971,30 @@ namespace Module {
 
         std::shared_ptr<std::vector<double>> output_handle;
 
-        std::vector<std::string> variable_names;
-        std::vector<std::string> VariableTypes;
+        SchemaPtr schema;
 
         std::string png_name;
 
         double MyEPSILON;
     public:
-        DrawPunziFOM(const char* equation_, double MIN_, double MAX_, double NSIG_initial_, double alpha_, const char* png_name_, std::vector<std::string> Signal_label_list_, std::vector<std::string> Background_label_list_, std::shared_ptr<std::vector<double>> output_handle_, std::vector<std::string>* variable_names_, std::vector<std::string>* VariableTypes_) : Module(), equation(equation_), MIN(MIN_), MAX(MAX_), NSIG_initial(NSIG_initial_), alpha(alpha_), rank(0), png_name(png_name_), Signal_label_list(Signal_label_list_), Background_label_list(Background_label_list_), output_handle(output_handle_), variable_names(*variable_names_), VariableTypes(*VariableTypes_) {
+        DrawPunziFOM(const char* equation_, double MIN_, double MAX_, double NSIG_initial_, double alpha_, const char* png_name_, std::vector<std::string> Signal_label_list_, std::vector<std::string> Background_label_list_, std::shared_ptr<std::vector<double>> output_handle_, SchemaPtr schema_) : Module(), equation(equation_), MIN(MIN_), MAX(MAX_), NSIG_initial(NSIG_initial_), alpha(alpha_), rank(0), png_name(png_name_), Signal_label_list(Signal_label_list_), Background_label_list(Background_label_list_), output_handle(output_handle_), schema(schema_) {
             // just 50
             NBin = 50;
 
             // just 0.000001
             MyEPSILON = 0.000001;
         }
-        DrawPunziFOM(const char* equation_, double MIN_, double MAX_, double NBin_, double NSIG_initial_, double alpha_, int rank_, const char* png_name_, std::vector<std::string> Signal_label_list_, std::vector<std::string> Background_label_list_, std::shared_ptr<std::vector<double>> output_handle_, std::vector<std::string>* variable_names_, std::vector<std::string>* VariableTypes_) : Module(), equation(equation_), MIN(MIN_), MAX(MAX_), NBin(NBin_), NSIG_initial(NSIG_initial_), alpha(alpha_), rank(rank_), png_name(png_name_), Signal_label_list(Signal_label_list_), Background_label_list(Background_label_list_), output_handle(output_handle_), variable_names(*variable_names_), VariableTypes(*VariableTypes_) {
+        DrawPunziFOM(const char* equation_, double MIN_, double MAX_, double NBin_, double NSIG_initial_, double alpha_, int rank_, const char* png_name_, std::vector<std::string> Signal_label_list_, std::vector<std::string> Background_label_list_, std::shared_ptr<std::vector<double>> output_handle_, SchemaPtr schema_) : Module(), equation(equation_), MIN(MIN_), MAX(MAX_), NBin(NBin_), NSIG_initial(NSIG_initial_), alpha(alpha_), rank(rank_), png_name(png_name_), Signal_label_list(Signal_label_list_), Background_label_list(Background_label_list_), output_handle(output_handle_), schema(schema_) {
             // just 0.000001
             MyEPSILON = 0.000001;
         }
 
         ~DrawPunziFOM() {}
 
-        void Start() {
+        void Start() override {
             // change variable name into placeholder
-            replaced_expr = replaceVariables(equation, &variable_names);
-            postfix_expr = PostfixExpression(replaced_expr, &VariableTypes);
+            replaced_expr = replaceVariables(equation, *schema);
+            postfix_expr = PostfixExpression(replaced_expr, *schema);
 
             if (Signal_label_list.size() == 0) {
                 printf("signal should be defined. Use `SetSignal`\n");
@@ -1910,28 +3038,29 @@ namespace Module {
             }
         }
 
-        int Process(std::deque<Data>* data) {
-
-            for (std::deque<Data>::iterator iter = data->begin(); iter != data->end(); ) {
+        int Process(std::deque<Data>* data) override {
+            for (std::deque<Data>::iterator iter = data->begin(); iter != data->end(); ++iter) ProcessRow(iter);
+            return 1;
+        }
 
-                double result = EvaluatePostfixExpression(postfix_expr, iter->variable, &VariableTypes);
+        bool IsRowLocal() override { return true; }
 
-                int first_bin = -1;
-                if (result < MIN) first_bin = -1;
-                else if (result >= MAX) first_bin = NBin - 1;
-                else first_bin = std::min(NBin - 1, int(std::floor((result - MIN) / ((MAX - MIN) / NBin))));
-                if (first_bin >= 0) {
-                    if (Signal_label_set.find(iter->label) != Signal_label_set.end()) NSIGs[first_bin] = NSIGs[first_bin] + ObtainWeight(iter, variable_names);
-                    if (Background_label_set.find(iter->label) != Background_label_set.end()) NBKGs[first_bin] = NBKGs[first_bin] + ObtainWeight(iter, variable_names);
-                }
+        bool ProcessRow(std::deque<Data>::iterator iter) override {
+            double result = EvaluatePostfixExpression(postfix_expr, iter->variable);
 
-                ++iter;
+            int first_bin = -1;
+            if (result < MIN) first_bin = -1;
+            else if (result >= MAX) first_bin = NBin - 1;
+            else first_bin = std::min(NBin - 1, int(std::floor((result - MIN) / ((MAX - MIN) / NBin))));
+            if (first_bin >= 0) {
+                if (Signal_label_set.find(iter->label) != Signal_label_set.end()) NSIGs[first_bin] = NSIGs[first_bin] + ObtainWeight(iter, schema->Names());
+                if (Background_label_set.find(iter->label) != Background_label_set.end()) NBKGs[first_bin] = NBKGs[first_bin] + ObtainWeight(iter, schema->Names());
             }
 
-            return 1;
+            return true;
         }
 
-        void End() {
+        void End() override {
 
             // calculate cumulative sum
             for (int i = NBin - 1; i >= 0; i--) {
@@ -2023,6 +3152,34 @@ namespace Module {
 
             delete c_temp;
         }
+
+        bool IsCheckpointable() override { return true; }
+
+        // yields in each bin. Cumulative yields are calculated in `End`
+        void SaveState(std::ostream& out_) override {
+            WriteBinary(out_, std::vector<double>(NSIGs, NSIGs + NBin));
+            WriteBinary(out_, std::vector<double>(NBKGs, NBKGs + NBin));
+        }
+
+        void LoadState(std::istream& in_) override {
+            std::vector<double> saved_NSIGs;
+            std::vector<double> saved_NBKGs;
+            ReadBinary(in_, saved_NSIGs);
+            ReadBinary(in_, saved_NBKGs);
+
+            if ((saved_NSIGs.size() != NBin) || (saved_NBKGs.size() != NBin)) {
+                printf("[DrawPunziFOM] the number of bins is different from the saved one\n");
+                exit(1);
+            }
+            for (int i = 0; i < NBin; i++) {
+                NSIGs[i] = NSIGs[i] + saved_NSIGs.at(i);
+                NBKGs[i] = NBKGs[i] + saved_NBKGs.at(i);
+            }
+        }
+
+        std::string Fingerprint() override { return MakeFingerprint("DrawPunziFOM", equation, Signal_label_list, Background_label_list, NBin, MIN, MAX, rank, NSIG_initial, alpha, png_name); }
+        bool IsTerminal() override { return true; }
+        bool IsMemoizable() override { return true; }
     };
 
     class Draw2DPunziFOM : public Module {
@@ -2078,37 +3235,36 @@ namespace Module {
 
         std::shared_ptr<std::vector<double>> output_handle;
 
-        std::vector<std::string> variable_names;
-        std::vector<std::string> VariableTypes;
+        SchemaPtr schema;
 
         std::string png_name;
 
         double MyEPSILON;
     public:
-        Draw2DPunziFOM(std::vector<std::tuple<const char*, double, double, int>> scan_conditions_, double NSIG_initial_, double alpha_, const char* png_name_, std::vector<std::string> Signal_label_list_, std::vector<std::string> Background_label_list_, std::shared_ptr<std::vector<double>> output_handle_, std::vector<std::string>* variable_names_, std::vector<std::string>* VariableTypes_) : Module(), scan_conditions(scan_conditions_), preselection_equation_x("1"), preselection_equation_y("1"), NSIG_initial(NSIG_initial_), alpha(alpha_), png_name(png_name_), Signal_label_list(Signal_label_list_), Background_label_list(Background_label_list_), output_handle(output_handle_), variable_names(*variable_names_), VariableTypes(*VariableTypes_) {
+        Draw2DPunziFOM(std::vector<std::tuple<const char*, double, double, int>> scan_conditions_, double NSIG_initial_, double alpha_, const char* png_name_, std::vector<std::string> Signal_label_list_, std::vector<std::string> Background_label_list_, std::shared_ptr<std::vector<double>> output_handle_, SchemaPtr schema_) : Module(), scan_conditions(scan_conditions_), preselection_equation_x("1"), preselection_equation_y("1"), NSIG_initial(NSIG_initial_), alpha(alpha_), png_name(png_name_), Signal_label_list(Signal_label_list_), Background_label_list(Background_label_list_), output_handle(output_handle_), schema(schema_) {
             // just 0.000001
             MyEPSILON = 0.000001;
         }
-        Draw2DPunziFOM(std::vector<std::tuple<const char*, double, double, int>> scan_conditions_, const char* preselection_x_, const char* preselection_y_, double NSIG_initial_, double alpha_, const char* png_name_, std::vector<std::string> Signal_label_list_, std::vector<std::string> Background_label_list_, std::shared_ptr<std::vector<double>> output_handle_, std::vector<std::string>* variable_names_, std::vector<std::string>* VariableTypes_) : Module(), scan_conditions(scan_conditions_), preselection_equation_x(preselection_x_), preselection_equation_y(preselection_y_), NSIG_initial(NSIG_initial_), alpha(alpha_), png_name(png_name_), Signal_label_list(Signal_label_list_), Background_label_list(Background_label_list_), output_handle(output_handle_), variable_names(*variable_names_), VariableTypes(*VariableTypes_) {
+        Draw2DPunziFOM(std::vector<std::tuple<const char*, double, double, int>> scan_conditions_, const char* preselection_x_, const char* preselection_y_, double NSIG_initial_, double alpha_, const char* png_name_, std::vector<std::string> Signal_label_list_, std::vector<std::string> Background_label_list_, std::shared_ptr<std::vector<double>> output_handle_, SchemaPtr schema_) : Module(), scan_conditions(scan_conditions_), preselection_equation_x(preselection_x_), preselection_equation_y(preselection_y_), NSIG_initial(NSIG_initial_), alpha(alpha_), png_name(png_name_), Signal_label_list(Signal_label_list_), Background_label_list(Background_label_list_), output_handle(output_handle_), schema(schema_) {
             // just 0.000001
             MyEPSILON = 0.000001;
         }
 
         ~Draw2DPunziFOM() {}
 
-        void Start() {
+        void Start() override {
             // change variable name into placeholder
             for (std::vector<std::tuple<const char*, double, double, int>>::const_iterator iter = scan_conditions.begin(); iter != scan_conditions.end(); ++iter) {
                 const char* equation = std::get<0>(*iter);
 
-                std::string replaced_expr = replaceVariables(std::string(equation), &variable_names);
-                std::vector<Token> postfix_expr = PostfixExpression(replaced_expr, &VariableTypes);
+                std::string replaced_expr = replaceVariables(std::string(equation), *schema);
+                std::vector<Token> postfix_expr = PostfixExpression(replaced_expr, *schema);
                 postfix_exprs.push_back(postfix_expr);
             }
-            preselection_replaced_expr_x = replaceVariables(preselection_equation_x, &variable_names);
-            preselection_replaced_expr_y = replaceVariables(preselection_equation_y, &variable_names);
-            postfix_expr_x = PostfixExpression(preselection_replaced_expr_x, &VariableTypes);
-            postfix_expr_y = PostfixExpression(preselection_replaced_expr_y, &VariableTypes);
+            preselection_replaced_expr_x = replaceVariables(preselection_equation_x, *schema);
+            preselection_replaced_expr_y = replaceVariables(preselection_equation_y, *schema);
+            postfix_expr_x = PostfixExpression(preselection_replaced_expr_x, *schema);
+            postfix_expr_y = PostfixExpression(preselection_replaced_expr_y, *schema);
 
             if (scan_conditions.size() != 2) {
                 printf("Draw2DPunziFOM requires 2 element. Currently there are %d element(s)\n", scan_conditions.size());
@@ -2176,51 +3332,52 @@ namespace Module {
             }
         }
 
-        int Process(std::deque<Data>* data) {
+        int Process(std::deque<Data>* data) override {
+            for (std::deque<Data>::iterator iter = data->begin(); iter != data->end(); ++iter) ProcessRow(iter);
+            return 1;
+        }
 
-            for (std::deque<Data>::iterator iter = data->begin(); iter != data->end(); ) {
+        bool IsRowLocal() override { return true; }
 
-                double result_preselection_x = EvaluatePostfixExpression(postfix_expr_x, iter->variable, &VariableTypes);
-                double result_preselection_y = EvaluatePostfixExpression(postfix_expr_y, iter->variable, &VariableTypes);
-                double result_x = EvaluatePostfixExpression(postfix_exprs.at(0), iter->variable, &VariableTypes);
-                double result_y = EvaluatePostfixExpression(postfix_exprs.at(1), iter->variable, &VariableTypes);
-
-                int first_bin_x = -1;
-                if (result_x < MIN_x) first_bin_x = -1;
-                else if (result_x >= MAX_x) first_bin_x = NBin_x - 1;
-                else first_bin_x = std::min(NBin_x - 1, int(std::floor((result_x - MIN_x) / ((MAX_x - MIN_x) / (NBin_x - 1)))));
-
-                int first_bin_y = -1;
-                if (result_y < MIN_y) first_bin_y = -1;
-                else if (result_y >= MAX_y) first_bin_y = NBin_y - 1;
-                else first_bin_y = std::min(NBin_y - 1, int(std::floor((result_y - MIN_y) / ((MAX_y - MIN_y) / (NBin_y - 1)))));
-
-                if ((result_preselection_x > 0.5) && (result_preselection_y > 0.5)) {
-                    if ((first_bin_x >= 0) && (first_bin_y >= 0)) {
-                        if (Signal_label_set.find(iter->label) != Signal_label_set.end()) NSIGs[first_bin_x][first_bin_y] = NSIGs[first_bin_x][first_bin_y] + ObtainWeight(iter, variable_names);
-                        if (Background_label_set.find(iter->label) != Background_label_set.end()) NBKGs[first_bin_x][first_bin_y] = NBKGs[first_bin_x][first_bin_y] + ObtainWeight(iter, variable_names);
-                    }
+        bool ProcessRow(std::deque<Data>::iterator iter) override {
+            double result_preselection_x = EvaluatePostfixExpression(postfix_expr_x, iter->variable);
+            double result_preselection_y = EvaluatePostfixExpression(postfix_expr_y, iter->variable);
+            double result_x = EvaluatePostfixExpression(postfix_exprs.at(0), iter->variable);
+            double result_y = EvaluatePostfixExpression(postfix_exprs.at(1), iter->variable);
+
+            int first_bin_x = -1;
+            if (result_x < MIN_x) first_bin_x = -1;
+            else if (result_x >= MAX_x) first_bin_x = NBin_x - 1;
+            else first_bin_x = std::min(NBin_x - 1, int(std::floor((result_x - MIN_x) / ((MAX_x - MIN_x) / (NBin_x - 1)))));
+
+            int first_bin_y = -1;
+            if (result_y < MIN_y) first_bin_y = -1;
+            else if (result_y >= MAX_y) first_bin_y = NBin_y - 1;
+            else first_bin_y = std::min(NBin_y - 1, int(std::floor((result_y - MIN_y) / ((MAX_y - MIN_y) / (NBin_y - 1)))));
+
+            if ((result_preselection_x > 0.5) && (result_preselection_y > 0.5)) {
+                if ((first_bin_x >= 0) && (first_bin_y >= 0)) {
+                    if (Signal_label_set.find(iter->label) != Signal_label_set.end()) NSIGs[first_bin_x][first_bin_y] = NSIGs[first_bin_x][first_bin_y] + ObtainWeight(iter, schema->Names());
+                    if (Background_label_set.find(iter->label) != Background_label_set.end()) NBKGs[first_bin_x][first_bin_y] = NBKGs[first_bin_x][first_bin_y] + ObtainWeight(iter, schema->Names());
                 }
-                else if ((result_preselection_x > 0.5) && (result_preselection_y < 0.5)) {
-                    if (first_bin_x >= 0) {
-                        if (Signal_label_set.find(iter->label) != Signal_label_set.end()) NSIGs[first_bin_x][NBin_y - 1] = NSIGs[first_bin_x][NBin_y - 1] + ObtainWeight(iter, variable_names);
-                        if (Background_label_set.find(iter->label) != Background_label_set.end()) NBKGs[first_bin_x][NBin_y - 1] = NBKGs[first_bin_x][NBin_y - 1] + ObtainWeight(iter, variable_names);
-                    }
+            }
+            else if ((result_preselection_x > 0.5) && (result_preselection_y < 0.5)) {
+                if (first_bin_x >= 0) {
+                    if (Signal_label_set.find(iter->label) != Signal_label_set.end()) NSIGs[first_bin_x][NBin_y - 1] = NSIGs[first_bin_x][NBin_y - 1] + ObtainWeight(iter, schema->Names());
+                    if (Background_label_set.find(iter->label) != Background_label_set.end()) NBKGs[first_bin_x][NBin_y - 1] = NBKGs[first_bin_x][NBin_y - 1] + ObtainWeight(iter, schema->Names());
                 }
-                else if ((result_preselection_x < 0.5) && (result_preselection_y > 0.5)) {
-                    if (first_bin_y >= 0) {
-                        if (Signal_label_set.find(iter->label) != Signal_label_set.end()) NSIGs[NBin_x - 1][first_bin_y] = NSIGs[NBin_x - 1][first_bin_y] + ObtainWeight(iter, variable_names);
-                        if (Background_label_set.find(iter->label) != Background_label_set.end()) NBKGs[NBin_x - 1][first_bin_y] = NBKGs[NBin_x - 1][first_bin_y] + ObtainWeight(iter, variable_names);
-                    }
+            }
+            else if ((result_preselection_x < 0.5) && (result_preselection_y > 0.5)) {
+                if (first_bin_y >= 0) {
+                    if (Signal_label_set.find(iter->label) != Signal_label_set.end()) NSIGs[NBin_x - 1][first_bin_y] = NSIGs[NBin_x - 1][first_bin_y] + ObtainWeight(iter, schema->Names());
+                    if (Background_label_set.find(iter->label) != Background_label_set.end()) NBKGs[NBin_x - 1][first_bin_y] = NBKGs[NBin_x - 1][first_bin_y] + ObtainWeight(iter, schema->Names());
                 }
-
-                ++iter;
             }
 
-            return 1;
+            return true;
         }
 
-        void End() {
+        void End() override {
 
             // calculate cumulative sum
             for (int i = NBin_x - 1; i >= 0; i--) {
@@ -2324,9 +3481,47 @@ namespace Module {
 
             delete c_temp;
         }
+
+        bool IsCheckpointable() override { return true; }
+
+        // yields in each bin. Cumulative yields are calculated in `End`
+        void SaveState(std::ostream& out_) override {
+            for (int i = 0; i < NBin_x; i++) {
+                WriteBinary(out_, std::vector<double>(NSIGs[i], NSIGs[i] + NBin_y));
+                WriteBinary(out_, std::vector<double>(NBKGs[i], NBKGs[i] + NBin_y));
+            }
+        }
+
+        void LoadState(std::istream& in_) override {
+            for (int i = 0; i < NBin_x; i++) {
+                std::vector<double> saved_NSIGs;
+                std::vector<double> saved_NBKGs;
+                ReadBinary(in_, saved_NSIGs);
+                ReadBinary(in_, saved_NBKGs);
+
+                if ((saved_NSIGs.size() != NBin_y) || (saved_NBKGs.size() != NBin_y)) {
+                    printf("[Draw2DPunziFOM] the number of bins is different from the saved one\n");
+                    exit(1);
+                }
+                for (int j = 0; j < NBin_y; j++) {
+                    NSIGs[i][j] = NSIGs[i][j] + saved_NSIGs.at(j);
+                    NBKGs[i][j] = NBKGs[i][j] + saved_NBKGs.at(j);
+                }
+            }
+        }
+
+        std::string Fingerprint() override { return MakeFingerprint("Draw2DPunziFOM", scan_conditions, preselection_equation_x, preselection_equation_y, Signal_label_list, Background_label_list, NSIG_initial, alpha, png_name); }
+        bool IsTerminal() override { return true; }
+        bool IsMemoizable() override { return true; }
     };
 
     class CalculateAUC : public Module {
+        /*
+        * AUC is calculated exactly from (score, weight) of every signal and background candidate.
+        * If the number of stored candidates exceeds `MaxEntries`, they are folded into a fine histogram (`NSketchBin` bins in [MIN, MAX]) to save memory.
+        * After that, AUC is approximated by the histogram, where candidates in the same bin are regarded as a tie.
+        * Candidates with NaN or infinite score cannot be ordered, so they are not used.
+        */
     private:
         std::string equation;
         std::string replaced_expr;
@@ -2339,44 +3534,67 @@ namespace Module {
         std::unordered_set<std::string> Signal_label_set;
         std::unordered_set<std::string> Background_label_set;
 
-        // FOM range/bin
-        int NBin;
+        // range of the fallback histogram
         double MIN;
         double MAX;
 
-        double* Cuts;
-        double* NSIGs;
-        double* NSIGs_cumulative;
-        double* NBKGs;
-        double* NBKGs_cumulative;
+        // (score, weight)
+        std::vector<std::pair<double, double>> signal_entries;
+        std::vector<std::pair<double, double>> background_entries;
 
-        double NSIGs_total;
-        double NBKGs_total;
+        // the number of candidates which are not used because of NaN or infinite score
+        unsigned long Nnonfinite;
+
+        // fallback histogram
+        size_t MaxEntries;
+        int NSketchBin;
+        std::vector<double> signal_sketch;
+        std::vector<double> background_sketch;
 
         std::shared_ptr<double> output_handle;
 
-        std::vector<std::string> variable_names;
-        std::vector<std::string> VariableTypes;
+        SchemaPtr schema;
 
         std::string output_name;
         std::string write_option;
+        std::string roc_output_name;
+
+        void FillSketch(std::vector<std::pair<double, double>>& entries_, std::vector<double>& sketch_) {
+            for (size_t i = 0; i < entries_.size(); i++) {
+                int bin;
+                if (entries_.at(i).first < MIN) bin = 0;
+                else if (entries_.at(i).first >= MAX) bin = NSketchBin - 1;
+                else bin = std::min(NSketchBin - 1, int(std::floor((entries_.at(i).first - MIN) / ((MAX - MIN) / NSketchBin))));
+                sketch_.at(bin) = sketch_.at(bin) + entries_.at(i).second;
+            }
+            entries_.clear();
+            std::vector<std::pair<double, double>>().swap(entries_);
+        }
+
+        void SketchToEntries(const std::vector<double>& sketch_, std::vector<std::pair<double, double>>& entries_) {
+            for (int i = 0; i < NSketchBin; i++) {
+                if (sketch_.at(i) != 0) entries_.push_back(std::make_pair(MIN + (i + 0.5) * (MAX - MIN) / NSketchBin, sketch_.at(i)));
+            }
+        }
 
-        double MyEPSILON;
     public:
-        CalculateAUC(const char* equation_, double MIN_, double MAX_, const char* output_name_, const char* write_option_, std::vector<std::string> Signal_label_list_, std::vector<std::string> Background_label_list_, std::shared_ptr<double> output_handle_, std::vector<std::string>* variable_names_, std::vector<std::string>* VariableTypes_) : Module(), equation(equation_), MIN(MIN_), MAX(MAX_), output_name(output_name_), write_option(write_option_), Signal_label_list(Signal_label_list_), Background_label_list(Background_label_list_), output_handle(output_handle_), variable_names(*variable_names_), VariableTypes(*VariableTypes_) {
-            // just 100
-            NBin = 100;
+        CalculateAUC(const char* equation_, double MIN_, double MAX_, const char* output_name_, const char* write_option_, std::vector<std::string> Signal_label_list_, std::vector<std::string> Background_label_list_, std::shared_ptr<double> output_handle_, SchemaPtr schema_) : CalculateAUC(equation_, MIN_, MAX_, output_name_, write_option_, "", Signal_label_list_, Background_label_list_, output_handle_, schema_) {}
+        CalculateAUC(const char* equation_, double MIN_, double MAX_, const char* output_name_, const char* write_option_, const char* roc_output_name_, std::vector<std::string> Signal_label_list_, std::vector<std::string> Background_label_list_, std::shared_ptr<double> output_handle_, SchemaPtr schema_) : Module(), equation(equation_), MIN(MIN_), MAX(MAX_), output_name(output_name_), write_option(write_option_), roc_output_name(roc_output_name_), Signal_label_list(Signal_label_list_), Background_label_list(Background_label_list_), output_handle(output_handle_), schema(schema_) {
+            // 16 bytes per candidate, so 1.6 GB
+            MaxEntries = 100000000;
 
-            NSIGs_total = 0;
-            NBKGs_total = 0;
+            // just 100000
+            NSketchBin = 100000;
         }
 
         ~CalculateAUC() {}
 
-        void Start() {
+        void Start() override {
+            Nnonfinite = 0;
+
             // change variable name into placeholder
-            replaced_expr = replaceVariables(equation, &variable_names);
-            postfix_expr = PostfixExpression(replaced_expr, &VariableTypes);
+            replaced_expr = replaceVariables(equation, *schema);
+            postfix_expr = PostfixExpression(replaced_expr, *schema);
 
             if (Signal_label_list.size() == 0) {
                 printf("signal should be defined. Use `SetSignal`\n");
@@ -2393,24 +3611,9 @@ namespace Module {
             Background_label_set.clear();
             Background_label_set.insert(Background_label_list.begin(), Background_label_list.end());
 
-            // malloc history
-            Cuts = (double*)malloc(sizeof(double) * NBin);
-            NSIGs = (double*)malloc(sizeof(double) * NBin);
-            NSIGs_cumulative = (double*)malloc(sizeof(double) * NBin);
-            NBKGs = (double*)malloc(sizeof(double) * NBin);
-            NBKGs_cumulative = (double*)malloc(sizeof(double) * NBin);
-            for (int i = 0; i < NBin; i++) {
-                Cuts[i] = 0.0;
-                NSIGs[i] = 0.0;
-                NSIGs_cumulative[i] = 0.0;
-                NBKGs[i] = 0.0;
-                NBKGs_cumulative[i] = 0.0;
-            }
-
-            // initialize cuts
-            for (int i = 0; i < NBin; i++) {
-                double variable_value = MIN + ((double)i) * (MAX - MIN) / NBin;
-                Cuts[i] = variable_value;
+            if (MAX <= MIN) {
+                printf("[CalculateAUC] MAX should be larger than MIN\n");
+                exit(1);
             }
 
             // check write option
@@ -2422,76 +3625,121 @@ namespace Module {
             }
         }
 
-        int Process(std::deque<Data>* data) {
+        int Process(std::deque<Data>* data) override {
 
             for (std::deque<Data>::iterator iter = data->begin(); iter != data->end(); ) {
 
-                double result = EvaluatePostfixExpression(postfix_expr, iter->variable, &VariableTypes);
+                bool IsSignal = (Signal_label_set.find(iter->label) != Signal_label_set.end());
+                bool IsBackground = (Background_label_set.find(iter->label) != Background_label_set.end());
+
+                if (IsSignal || IsBackground) {
+                    double result = EvaluatePostfixExpression(postfix_expr, iter->variable);
+                    double weight = ObtainWeight(iter, schema->Names());
 
-                int first_bin = -1;
-                if (result < MIN) first_bin = -1;
-                else if (result >= MAX) first_bin = NBin - 1;
-                else first_bin = std::min(NBin - 1, int(std::floor((result - MIN) / ((MAX - MIN) / NBin))));
-                if (first_bin >= 0) {
-                    if (Signal_label_set.find(iter->label) != Signal_label_set.end()) NSIGs[first_bin] = NSIGs[first_bin] + ObtainWeight(iter, variable_names);
-                    if (Background_label_set.find(iter->label) != Background_label_set.end()) NBKGs[first_bin] = NBKGs[first_bin] + ObtainWeight(iter, variable_names);
+                    if (!std::isfinite(result)) Nnonfinite++;
+                    else {
+                        if (IsSignal) signal_entries.push_back(std::make_pair(result, weight));
+                        if (IsBackground) background_entries.push_back(std::make_pair(result, weight));
+                    }
                 }
 
                 ++iter;
             }
 
-            for (std::deque<Data>::iterator iter = data->begin(); iter != data->end(); ) {
-                if (Signal_label_set.find(iter->label) != Signal_label_set.end()) NSIGs_total = NSIGs_total + ObtainWeight(iter, variable_names);
-                if (Background_label_set.find(iter->label) != Background_label_set.end()) NBKGs_total = NBKGs_total + ObtainWeight(iter, variable_names);
-
-                ++iter;
+            // if stored candidates are too many, fold them into the histogram. It is to save memory
+            if ((signal_entries.size() + background_entries.size() > MaxEntries) || (signal_sketch.size() != 0)) {
+                if (signal_sketch.size() == 0) {
+                    printf("[CalculateAUC] too many candidates. AUC is approximated by %d bins within [%lf, %lf]\n", NSketchBin, MIN, MAX);
+                    signal_sketch.assign(NSketchBin, 0.0);
+                    background_sketch.assign(NSketchBin, 0.0);
+                }
+                FillSketch(signal_entries, signal_sketch);
+                FillSketch(background_entries, background_sketch);
             }
 
             return 1;
         }
 
-        void End() {
+        void End() override {
+            if (Nnonfinite != 0) printf("[CalculateAUC] %lu candidates with NaN or infinite score are not used\n", Nnonfinite);
 
-            // calculate cumulative sum
-            for (int i = NBin - 1; i >= 0; i--) {
-                if (i == (NBin - 1)) {
-                    NSIGs_cumulative[i] = NSIGs[i];
-                    NBKGs_cumulative[i] = NBKGs[i];
-                }
-                else {
-                    NSIGs_cumulative[i] = NSIGs_cumulative[i + 1] + NSIGs[i];
-                    NBKGs_cumulative[i] = NBKGs_cumulative[i + 1] + NBKGs[i];
-                }
+            if (signal_sketch.size() != 0) {
+                SketchToEntries(signal_sketch, signal_entries);
+                SketchToEntries(background_sketch, background_entries);
             }
 
-            // get AUC
-            double AUC = 0;
-            for (int i = 0; i < NBin; i++) {
-                if (i != (NBin - 1)) {
-                    double del_FPR = (NBKGs_cumulative[i] / NBKGs_total) - (NBKGs_cumulative[i + 1] / NBKGs_total);
-                    double avg_TPR = ((NSIGs_cumulative[i + 1] / NSIGs_total) + (NSIGs_cumulative[i] / NSIGs_total)) / 2.0;
-                    AUC = AUC + del_FPR * avg_TPR;
-                }
-                else {
-                    double del_FPR = (NBKGs_cumulative[i] / NBKGs_total) - 0.0;
-                    double avg_TPR = ((NSIGs_cumulative[i] / NSIGs_total) + 0.0) / 2.0;
-                    AUC = AUC + del_FPR * avg_TPR;
-                }
-            }
+            std::vector<std::tuple<double, double, double>> roc;
+            double AUC = CalculateWeightedAUC(signal_entries, background_entries, roc_output_name.empty() ? nullptr : &roc);
 
             // print AUC
             FILE* fp = fopen(output_name.c_str(), write_option.c_str());
             fprintf(fp, "%lf ", AUC);
             fclose(fp);
 
+            // print ROC curve
+            if (!roc_output_name.empty()) {
+                FILE* fp_roc = fopen(roc_output_name.c_str(), "w");
+                fprintf(fp_roc, "# cut TPR FPR\n");
+                for (size_t i = 0; i < roc.size(); i++) {
+                    fprintf(fp_roc, "%.10g %.10g %.10g\n", std::get<0>(roc.at(i)), std::get<1>(roc.at(i)), std::get<2>(roc.at(i)));
+                }
+                fclose(fp_roc);
+            }
+
             (*output_handle) = AUC;
 
-            free(Cuts);
-            free(NSIGs);
-            free(NSIGs_cumulative);
-            free(NBKGs);
-            free(NBKGs_cumulative);
+            // free memory
+            std::vector<std::pair<double, double>>().swap(signal_entries);
+            std::vector<std::pair<double, double>>().swap(background_entries);
+            std::vector<double>().swap(signal_sketch);
+            std::vector<double>().swap(background_sketch);
         }
+
+        bool IsCheckpointable() override { return true; }
+
+        void SaveState(std::ostream& out_) override {
+            WriteBinary(out_, signal_entries);
+            WriteBinary(out_, background_entries);
+            WriteBinary(out_, signal_sketch);
+            WriteBinary(out_, background_sketch);
+            WriteBinary(out_, Nnonfinite);
+        }
+
+        void LoadState(std::istream& in_) override {
+            std::vector<std::pair<double, double>> saved_signal_entries;
+            std::vector<std::pair<double, double>> saved_background_entries;
+            std::vector<double> saved_signal_sketch;
+            std::vector<double> saved_background_sketch;
+            ReadBinary(in_, saved_signal_entries);
+            ReadBinary(in_, saved_background_entries);
+            ReadBinary(in_, saved_signal_sketch);
+            ReadBinary(in_, saved_background_sketch);
+
+            unsigned long saved_Nnonfinite;
+            ReadBinary(in_, saved_Nnonfinite);
+            Nnonfinite = Nnonfinite + saved_Nnonfinite;
+
+            signal_entries.insert(signal_entries.end(), saved_signal_entries.begin(), saved_signal_entries.end());
+            background_entries.insert(background_entries.end(), saved_background_entries.begin(), saved_background_entries.end());
+
+            // once the histogram is used, candidates are always folded into it
+            if ((saved_signal_sketch.size() != 0) || (signal_sketch.size() != 0)) {
+                if (signal_sketch.size() == 0) {
+                    signal_sketch.assign(NSketchBin, 0.0);
+                    background_sketch.assign(NSketchBin, 0.0);
+                }
+                for (int i = 0; i < saved_signal_sketch.size(); i++) {
+                    signal_sketch.at(i) = signal_sketch.at(i) + saved_signal_sketch.at(i);
+                    background_sketch.at(i) = background_sketch.at(i) + saved_background_sketch.at(i);
+                }
+                FillSketch(signal_entries, signal_sketch);
+                FillSketch(background_entries, background_sketch);
+            }
+        }
+
+        std::string Fingerprint() override { return MakeFingerprint("CalculateAUC", equation, Signal_label_list, Background_label_list, MIN, MAX, output_name, write_option, roc_output_name); }
+        bool IsTerminal() override { return true; }
+        bool IsMemoizable() override { return true; }
     };
 
     class DrawStack : public Module {
@@ -2505,11 +3753,12 @@ namespace Module {
         int nbins;
         double x_low;
         double x_high;
+        // range is determined from values. Then `x_low` and `x_high` change while processing
+        bool IsAutoRange;
         bool normalized;
         bool LogScale;
 
-        std::vector<std::string> variable_names;
-        std::vector<std::string> VariableTypes;
+        SchemaPtr schema;
         std::string expression;
         std::string replaced_expr;
         std::vector<Token> postfix_expr;
@@ -2537,10 +3786,10 @@ namespace Module {
         int hist_draw_option;
 
     public:
-        DrawStack(const char* expression_, const char* stack_title_, int nbins_, double x_low_, double x_high_, const char* png_name_, std::vector<std::string> Signal_label_list_, std::vector<std::string> Background_label_list_, std::vector<std::string> data_label_list_, std::vector<std::string> MC_label_list_, std::vector<std::string>* variable_names_, std::vector<std::string>* VariableTypes_) : Module(), expression(expression_), stack_title(stack_title_), nbins(nbins_), x_low(x_low_), x_high(x_high_), png_name(png_name_), normalized(false), LogScale(false), Signal_label_list(Signal_label_list_), Background_label_list(Background_label_list_), data_label_list(data_label_list_), MC_label_list(MC_label_list_), variable_names(*variable_names_), VariableTypes(*VariableTypes_) {}
-        DrawStack(const char* expression_, const char* stack_title_, int nbins_, double x_low_, double x_high_, const char* png_name_, bool normalized_, bool LogScale_, std::vector<std::string> Signal_label_list_, std::vector<std::string> Background_label_list_, std::vector<std::string> data_label_list_, std::vector<std::string> MC_label_list_, std::vector<std::string>* variable_names_, std::vector<std::string>* VariableTypes_) : Module(), expression(expression_), stack_title(stack_title_), nbins(nbins_), x_low(x_low_), x_high(x_high_), png_name(png_name_), normalized(normalized_), LogScale(LogScale_), Signal_label_list(Signal_label_list_), Background_label_list(Background_label_list_), data_label_list(data_label_list_), MC_label_list(MC_label_list_), variable_names(*variable_names_), VariableTypes(*VariableTypes_) {}
-        DrawStack(const char* expression_, const char* stack_title_, const char* png_name_, std::vector<std::string> Signal_label_list_, std::vector<std::string> Background_label_list_, std::vector<std::string> data_label_list_, std::vector<std::string> MC_label_list_, std::vector<std::string>* variable_names_, std::vector<std::string>* VariableTypes_) : Module(), expression(expression_), stack_title(stack_title_), nbins(50), x_low(std::numeric_limits<double>::max()), x_high(std::numeric_limits<double>::max()), png_name(png_name_), normalized(false), LogScale(false), Signal_label_list(Signal_label_list_), Background_label_list(Background_label_list_), data_label_list(data_label_list_), MC_label_list(MC_label_list_), variable_names(*variable_names_), VariableTypes(*VariableTypes_) {}
-        DrawStack(const char* expression_, const char* stack_title_, const char* png_name_, bool normalized_, bool LogScale_, std::vector<std::string> Signal_label_list_, std::vector<std::string> Background_label_list_, std::vector<std::string> data_label_list_, std::vector<std::string> MC_label_list_, std::vector<std::string>* variable_names_, std::vector<std::string>* VariableTypes_) : Module(), expression(expression_), stack_title(stack_title_), nbins(50), x_low(std::numeric_limits<double>::max()), x_high(std::numeric_limits<double>::max()), png_name(png_name_), normalized(normalized_), LogScale(LogScale_), Signal_label_list(Signal_label_list_), Background_label_list(Background_label_list_), data_label_list(data_label_list_), MC_label_list(MC_label_list_), variable_names(*variable_names_), VariableTypes(*VariableTypes_) {}
+        DrawStack(const char* expression_, const char* stack_title_, int nbins_, double x_low_, double x_high_, const char* png_name_, std::vector<std::string> Signal_label_list_, std::vector<std::string> Background_label_list_, std::vector<std::string> data_label_list_, std::vector<std::string> MC_label_list_, SchemaPtr schema_) : Module(), expression(expression_), stack_title(stack_title_), nbins(nbins_), x_low(x_low_), x_high(x_high_), IsAutoRange(false), png_name(png_name_), normalized(false), LogScale(false), Signal_label_list(Signal_label_list_), Background_label_list(Background_label_list_), data_label_list(data_label_list_), MC_label_list(MC_label_list_), schema(schema_) {}
+        DrawStack(const char* expression_, const char* stack_title_, int nbins_, double x_low_, double x_high_, const char* png_name_, bool normalized_, bool LogScale_, std::vector<std::string> Signal_label_list_, std::vector<std::string> Background_label_list_, std::vector<std::string> data_label_list_, std::vector<std::string> MC_label_list_, SchemaPtr schema_) : Module(), expression(expression_), stack_title(stack_title_), nbins(nbins_), x_low(x_low_), x_high(x_high_), IsAutoRange(false), png_name(png_name_), normalized(normalized_), LogScale(LogScale_), Signal_label_list(Signal_label_list_), Background_label_list(Background_label_list_), data_label_list(data_label_list_), MC_label_list(MC_label_list_), schema(schema_) {}
+        DrawStack(const char* expression_, const char* stack_title_, const char* png_name_, std::vector<std::string> Signal_label_list_, std::vector<std::string> Background_label_list_, std::vector<std::string> data_label_list_, std::vector<std::string> MC_label_list_, SchemaPtr schema_) : Module(), expression(expression_), stack_title(stack_title_), nbins(50), x_low(std::numeric_limits<double>::max()), x_high(std::numeric_limits<double>::max()), IsAutoRange(true), png_name(png_name_), normalized(false), LogScale(false), Signal_label_list(Signal_label_list_), Background_label_list(Background_label_list_), data_label_list(data_label_list_), MC_label_list(MC_label_list_), schema(schema_) {}
+        DrawStack(const char* expression_, const char* stack_title_, const char* png_name_, bool normalized_, bool LogScale_, std::vector<std::string> Signal_label_list_, std::vector<std::string> Background_label_list_, std::vector<std::string> data_label_list_, std::vector<std::string> MC_label_list_, SchemaPtr schema_) : Module(), expression(expression_), stack_title(stack_title_), nbins(50), x_low(std::numeric_limits<double>::max()), x_high(std::numeric_limits<double>::max()), IsAutoRange(true), png_name(png_name_), normalized(normalized_), LogScale(LogScale_), Signal_label_list(Signal_label_list_), Background_label_list(Background_label_list_), data_label_list(data_label_list_), MC_label_list(MC_label_list_), schema(schema_) {}
 
         ~DrawStack() {
             delete stack;
@@ -2590,8 +3839,8 @@ namespace Module {
             }
 
             // change variable name into placeholder
-            replaced_expr = replaceVariables(expression, &variable_names);
-            postfix_expr = PostfixExpression(replaced_expr, &VariableTypes);
+            replaced_expr = replaceVariables(expression, *schema);
+            postfix_expr = PostfixExpression(replaced_expr, *schema);
 
             if ((x_low != std::numeric_limits<double>::max()) && (x_high != std::numeric_limits<double>::max())) {
                 std::string hist_name = generateRandomString(12);
@@ -2613,81 +3862,84 @@ namespace Module {
         }
 
         int Process(std::deque<Data>* data) override {
-            for (std::deque<Data>::iterator iter = data->begin(); iter != data->end(); ) {
-                double result = EvaluatePostfixExpression(postfix_expr, iter->variable, &VariableTypes);
-                if ( (std::find(stack_label_list.begin(), stack_label_list.end(), iter->label) != stack_label_list.end()) || (std::find(hist_label_list.begin(), hist_label_list.end(), iter->label) != hist_label_list.end())) {
+            for (std::deque<Data>::iterator iter = data->begin(); iter != data->end(); ++iter) ProcessRow(iter);
+            return 1;
+        }
+
+        bool IsRowLocal() override { return true; }
 
-                    if (stack_hist == nullptr) {
-                        x_variable.push_back(result);
-                        weight.push_back(ObtainWeight(iter, variable_names));
-                        label.push_back(iter->label);
+        bool ProcessRow(std::deque<Data>::iterator iter) override {
+            double result = EvaluatePostfixExpression(postfix_expr, iter->variable);
+            if ( (std::find(stack_label_list.begin(), stack_label_list.end(), iter->label) != stack_label_list.end()) || (std::find(hist_label_list.begin(), hist_label_list.end(), iter->label) != hist_label_list.end())) {
+
+                if (stack_hist == nullptr) {
+                    x_variable.push_back(result);
+                    weight.push_back(ObtainWeight(iter, schema->Names()));
+                    label.push_back(iter->label);
+                }
+                else {
+                    if (std::find(stack_label_list.begin(), stack_label_list.end(), iter->label) != stack_label_list.end()) {
+                        int label_index = std::find(stack_label_list.begin(), stack_label_list.end(), iter->label) - stack_label_list.begin();
+                        stack_hist[label_index]->Fill(result, ObtainWeight(iter, schema->Names()));
+                        stack_error->Fill(result, ObtainWeight(iter, schema->Names()));
                     }
-                    else {
-                        if (std::find(stack_label_list.begin(), stack_label_list.end(), iter->label) != stack_label_list.end()) {
-                            int label_index = std::find(stack_label_list.begin(), stack_label_list.end(), iter->label) - stack_label_list.begin();
-                            stack_hist[label_index]->Fill(result, ObtainWeight(iter, variable_names));
-                            stack_error->Fill(result, ObtainWeight(iter, variable_names));
-                        }
-                        else if (std::find(hist_label_list.begin(), hist_label_list.end(), iter->label) != hist_label_list.end()) {
-                            hist->Fill(result, ObtainWeight(iter, variable_names));
-                        }
+                    else if (std::find(hist_label_list.begin(), hist_label_list.end(), iter->label) != hist_label_list.end()) {
+                        hist->Fill(result, ObtainWeight(iter, schema->Names()));
                     }
+                }
 
-                    // if saved variable exceed 10MB, calculate max, min and create histogram. It is to save memory
-                    if ((sizeof(double) * x_variable.size() > 10000000.0) && (stack_hist == nullptr)) {
-                        std::vector<double>::iterator min_it = std::min_element(x_variable.begin(), x_variable.end());
-                        std::vector<double>::iterator max_it = std::max_element(x_variable.begin(), x_variable.end());
+                // if saved variable exceed 10MB, calculate max, min and create histogram. It is to save memory
+                if ((sizeof(double) * x_variable.size() > 10000000.0) && (stack_hist == nullptr)) {
+                    std::vector<double>::iterator min_it = std::min_element(x_variable.begin(), x_variable.end());
+                    std::vector<double>::iterator max_it = std::max_element(x_variable.begin(), x_variable.end());
 
-                        x_low = *min_it;
-                        x_high = *max_it;
+                    x_low = *min_it;
+                    x_high = *max_it;
 
-                        // create histogram
+                    // create histogram
+                    std::string hist_name = generateRandomString(12);
+                    hist = new TH1D(hist_name.c_str(), stack_title.c_str(), nbins, x_low, x_high);
+
+                    // create histogram for stack
+                    stack_hist = (TH1D**)malloc(sizeof(TH1D*) * stack_label_list.size());
+                    for (int i = 0; i < stack_label_list.size(); i++) {
                         std::string hist_name = generateRandomString(12);
-                        hist = new TH1D(hist_name.c_str(), stack_title.c_str(), nbins, x_low, x_high);
+                        stack_hist[i] = new TH1D(hist_name.c_str(), stack_title.c_str(), nbins, x_low, x_high);
+                    }
+                    hist_name = generateRandomString(12);
+                    stack_error = new TH1D(hist_name.c_str(), stack_title.c_str(), nbins, x_low, x_high);
 
-                        // create histogram for stack
-                        stack_hist = (TH1D**)malloc(sizeof(TH1D*) * stack_label_list.size());
-                        for (int i = 0; i < stack_label_list.size(); i++) {
-                            std::string hist_name = generateRandomString(12);
-                            stack_hist[i] = new TH1D(hist_name.c_str(), stack_title.c_str(), nbins, x_low, x_high);
-                        }
-                        hist_name = generateRandomString(12);
-                        stack_error = new TH1D(hist_name.c_str(), stack_title.c_str(), nbins, x_low, x_high);
-
-                        // create pull or ratio histogram
-                        hist_name = generateRandomString(12);
-                        RatioorPull = new TH1D(hist_name.c_str(), stack_title.c_str(), nbins, x_low, x_high);
-
-                        // fill histogram
-                        for (int i = 0; i < weight.size(); i++) {
-                            if (std::find(hist_label_list.begin(), hist_label_list.end(), label.at(i)) != hist_label_list.end()) {
-                                hist->Fill(x_variable.at(i), weight.at(i));
-                            }
-                        }
+                    // create pull or ratio histogram
+                    hist_name = generateRandomString(12);
+                    RatioorPull = new TH1D(hist_name.c_str(), stack_title.c_str(), nbins, x_low, x_high);
 
-                        // fill histogram for stack
-                        for (int i = 0; i < weight.size(); i++) {
-                            if (std::find(stack_label_list.begin(), stack_label_list.end(), label.at(i)) != stack_label_list.end()) {
-                                int label_index = std::find(stack_label_list.begin(), stack_label_list.end(), label.at(i)) - stack_label_list.begin();
-                                stack_hist[label_index]->Fill(x_variable.at(i), weight.at(i));
-                                stack_error->Fill(x_variable.at(i), weight.at(i));
-                            }
+                    // fill histogram
+                    for (int i = 0; i < weight.size(); i++) {
+                        if (std::find(hist_label_list.begin(), hist_label_list.end(), label.at(i)) != hist_label_list.end()) {
+                            hist->Fill(x_variable.at(i), weight.at(i));
                         }
+                    }
 
-                        x_variable.clear();
-                        std::vector<double>().swap(x_variable);
-                        weight.clear();
-                        std::vector<double>().swap(weight);
-                        label.clear();
-                        std::vector<std::string>().swap(label);
+                    // fill histogram for stack
+                    for (int i = 0; i < weight.size(); i++) {
+                        if (std::find(stack_label_list.begin(), stack_label_list.end(), label.at(i)) != stack_label_list.end()) {
+                            int label_index = std::find(stack_label_list.begin(), stack_label_list.end(), label.at(i)) - stack_label_list.begin();
+                            stack_hist[label_index]->Fill(x_variable.at(i), weight.at(i));
+                            stack_error->Fill(x_variable.at(i), weight.at(i));
+                        }
                     }
 
+                    x_variable.clear();
+                    std::vector<double>().swap(x_variable);
+                    weight.clear();
+                    std::vector<double>().swap(weight);
+                    label.clear();
+                    std::vector<std::string>().swap(label);
                 }
 
-                ++iter;
             }
 
-            return 1;
+            return true;
         }
 
         void End() override {
@@ -2925,38 +4177,385 @@ namespace Module {
             }
 
         }
+
+        bool IsCheckpointable() override { return true; }
+
+        // histograms if they are already created, and values which are not filled yet
+        void SaveState(std::ostream& out_) override {
+            WriteBinary(out_, stack_hist != nullptr);
+            if (stack_hist != nullptr) {
+                WriteBinary(out_, x_low);
+                WriteBinary(out_, x_high);
+                SaveHistogramState(out_, hist);
+                for (int i = 0; i < stack_label_list.size(); i++) SaveHistogramState(out_, stack_hist[i]);
+                SaveHistogramState(out_, stack_error);
+            }
+            WriteBinary(out_, x_variable);
+            WriteBinary(out_, weight);
+            WriteBinary(out_, label);
+        }
+
+        void LoadState(std::istream& in_) override {
+            bool IsHistCreated;
+            ReadBinary(in_, IsHistCreated);
+            if (IsHistCreated) {
+                double saved_x_low;
+                double saved_x_high;
+                ReadBinary(in_, saved_x_low);
+                ReadBinary(in_, saved_x_high);
+
+                // values which are not filled yet are filled in `End`
+                if (stack_hist == nullptr) {
+                    x_low = saved_x_low;
+                    x_high = saved_x_high;
+
+                    // create histogram
+                    std::string hist_name = generateRandomString(12);
+                    hist = new TH1D(hist_name.c_str(), stack_title.c_str(), nbins, x_low, x_high);
+
+                    // create histogram for stack
+                    stack_hist = (TH1D**)malloc(sizeof(TH1D*) * stack_label_list.size());
+                    for (int i = 0; i < stack_label_list.size(); i++) {
+                        std::string hist_name = generateRandomString(12);
+                        stack_hist[i] = new TH1D(hist_name.c_str(), stack_title.c_str(), nbins, x_low, x_high);
+                    }
+                    hist_name = generateRandomString(12);
+                    stack_error = new TH1D(hist_name.c_str(), stack_title.c_str(), nbins, x_low, x_high);
+
+                    // create pull or ratio histogram
+                    hist_name = generateRandomString(12);
+                    RatioorPull = new TH1D(hist_name.c_str(), stack_title.c_str(), nbins, x_low, x_high);
+                }
+                else if ((x_low != saved_x_low) || (x_high != saved_x_high)) {
+                    printf("[DrawStack] range of histogram is different from the saved one\n");
+                    exit(1);
+                }
+                AddHistogramState(in_, hist);
+                for (int i = 0; i < stack_label_list.size(); i++) AddHistogramState(in_, stack_hist[i]);
+                AddHistogramState(in_, stack_error);
+            }
+
+            std::vector<double> saved_x_variable;
+            std::vector<double> saved_weight;
+            std::vector<std::string> saved_label;
+            ReadBinary(in_, saved_x_variable);
+            ReadBinary(in_, saved_weight);
+            ReadBinary(in_, saved_label);
+            x_variable.insert(x_variable.end(), saved_x_variable.begin(), saved_x_variable.end());
+            weight.insert(weight.end(), saved_weight.begin(), saved_weight.end());
+            label.insert(label.end(), saved_label.begin(), saved_label.end());
+        }
+
+        // only arguments of the constructor are used, because the range of auto-range histogram is changed while processing
+        std::string Fingerprint() override {
+            if (IsAutoRange) return MakeFingerprint("DrawStack", expression, stack_title, nbins, "auto", png_name, normalized, LogScale, Signal_label_list, Background_label_list, data_label_list, MC_label_list);
+            return MakeFingerprint("DrawStack", expression, stack_title, nbins, x_low, x_high, png_name, normalized, LogScale, Signal_label_list, Background_label_list, data_label_list, MC_label_list);
+        }
+        bool IsTerminal() override { return true; }
+        bool IsMemoizable() override { return true; }
+
+        // each shard would determine its own range, so histograms of shards cannot be merged
+        void SelectShard(int shard_index_, int Nshards_) override {
+            if (IsAutoRange) {
+                printf("[DrawStack] range of histogram should be given to use shards: %s\n", png_name.c_str());
+                exit(1);
+            }
+        }
     };
 
-    class FastBDTTrain : public Module {
+    /*
+    * set hyperparameters of FastBDT. Missing hyperparameters are filled by default values
+    */
+    void FillDefaultFastBDTHyperparameters(std::map<std::string, double>& hyperparameters_) {
+        if (hyperparameters_.find("NTrees") == hyperparameters_.end()) hyperparameters_["NTrees"] = 100;
+        if (hyperparameters_.find("Depth") == hyperparameters_.end()) hyperparameters_["Depth"] = 3;
+        if (hyperparameters_.find("Shrinkage") == hyperparameters_.end()) hyperparameters_["Shrinkage"] = 0.1;
+        if (hyperparameters_.find("Subsample") == hyperparameters_.end()) hyperparameters_["Subsample"] = 0.5;
+        if (hyperparameters_.find("Binning") == hyperparameters_.end()) hyperparameters_["Binning"] = 8;
+    }
+
+    void SetFastBDTHyperparameters(FastBDT::Classifier& classifier_, std::map<std::string, double>& hyperparameters_, int Nvariables_) {
+        FillDefaultFastBDTHyperparameters(hyperparameters_);
+
+        classifier_.SetNTrees(static_cast<unsigned int>(hyperparameters_["NTrees"]));
+        classifier_.SetDepth(static_cast<unsigned int>(hyperparameters_["Depth"]));
+        classifier_.SetShrinkage(static_cast<double>(hyperparameters_["Shrinkage"]));
+        classifier_.SetSubsample(static_cast<double>(hyperparameters_["Subsample"]));
+        std::vector<unsigned int> binning(Nvariables_, static_cast<unsigned int>(hyperparameters_["Binning"]));
+        classifier_.SetBinning(binning);
+    }
+
+    /*
+    * default name of weightfile
+    */
+    std::string FastBDTWeightfileName(std::map<std::string, double>& hyperparameters_) {
+        return std::to_string(hyperparameters_["NTrees"]) + "_" + std::to_string(hyperparameters_["Depth"]) + "_" + std::to_string(hyperparameters_["Shrinkage"]) + "_" + std::to_string(hyperparameters_["Subsample"]) + "_" + std::to_string(hyperparameters_["Binning"]) + ".weightfile";
+    }
+
+    /*
+    * name of weightfile of k-th fold. `_fold{k}` is inserted before `.weightfile`
+    */
+    std::string KFoldWeightfileName(const std::string& weightfile_name_, int fold_) {
+        if (hasEnding(weightfile_name_, ".weightfile")) return weightfile_name_.substr(0, weightfile_name_.size() - std::string(".weightfile").size()) + "_fold" + std::to_string(fold_) + ".weightfile";
+        else return weightfile_name_ + "_fold" + std::to_string(fold_);
+    }
+
+    /*
+    * fold index of the event, from the hash of event variables
+    */
+    int KFoldIndex(uint64_t hash_, int K_) {
+        return std::min(K_ - 1, static_cast<int>(HashToUnitInterval(hash_) * K_));
+    }
+
+    class FastBDTSample {
+        /*
+        * training sample of FastBDT. It is not a module, but used by the FastBDT training modules.
+        * InputVariables.at(i) is the column of i-th input variable, which is given to FastBDT as it is.
+        */
+    public:
+        std::vector<std::vector<float>> InputVariables;
+        std::vector<bool> IsItSignal;
+        std::vector<float> weight;
+
+        // hash of event variables. It is filled only if event variables are given
+        std::vector<uint64_t> EventHash;
+
     private:
-        std::vector<std::string> equations;
         std::vector<std::vector<Token>> postfix_exprs;
 
-        std::string Signal_equation;
         std::string Signal_replaced_expr;
         std::vector<Token> Signal_postfix_expr;
 
-        std::string Background_equation;
         std::string Background_replaced_expr;
         std::vector<Token> Background_postfix_expr;
 
-        std::vector<std::string> Signal_label_list;
-        std::vector<std::string> Background_label_list;
-
         // For the O(1) look-up
         std::unordered_set<std::string> Signal_label_set;
         std::unordered_set<std::string> Background_label_set;
 
-        std::vector<std::string> variable_names;
-        std::vector<std::string> VariableTypes;
+        std::vector<int> event_variable_index_list;
+
+        SchemaPtr schema;
+
+        // buffers for the block evaluation
+        std::vector<const std::vector<std::variant<int, unsigned int, float, double, std::string*>>*> block_rows;
+        std::vector<size_t> block_positions; // position of `block_rows` in the block
+        std::vector<char> row_selection; // 0: not selected, 1: signal, 2: background. Index is the position in the block
+        std::vector<const std::vector<std::variant<int, unsigned int, float, double, std::string*>>*> selected_rows;
+        std::vector<std::deque<Data>::iterator> selected_iters;
+        std::vector<bool> selected_IsItSignal;
+        std::vector<double> block_results;
+
+        // evaluate preselection of rows in `block_rows` and mark selected rows in `row_selection`
+        void SelectBlock(const std::string& replaced_expr_, const std::vector<Token>& postfix_expr_, bool IsSignal_) {
+            if (block_rows.size() == 0) return;
+
+            if (replaced_expr_ != "") {
+                block_results.resize(block_rows.size());
+                EvaluatePostfixExpressionBatch(postfix_expr_, block_rows, block_results.data());
+            }
+
+            for (size_t k = 0; k < block_rows.size(); k++) {
+                if ((replaced_expr_ == "") || (block_results.at(k) > 0.5)) row_selection.at(block_positions.at(k)) = IsSignal_ ? 1 : 2;
+            }
+
+            block_rows.clear();
+            block_positions.clear();
+        }
+
+    public:
+        FastBDTSample() {}
+
+        void Initialize(const std::vector<std::string>& equations_, const std::string& Signal_equation_, const std::string& Background_equation_, const std::vector<std::string>& Signal_label_list_, const std::vector<std::string>& Background_label_list_, const std::vector<std::string>& Event_variable_list_, SchemaPtr schema_) {
+            if (Signal_label_list_.size() == 0) {
+                printf("signal should be defined. Use `SetSignal`\n");
+                exit(1);
+            }
+            else if (Background_label_list_.size() == 0) {
+                printf("background should be defined. Use `SetBackground`\n");
+                exit(1);
+            }
+
+            schema = schema_;
+
+            // Convert from vector to set
+            Signal_label_set.clear();
+            Signal_label_set.insert(Signal_label_list_.begin(), Signal_label_list_.end());
+            Background_label_set.clear();
+            Background_label_set.insert(Background_label_list_.begin(), Background_label_list_.end());
+
+            // change variable name into placeholder
+            postfix_exprs.clear();
+            for (int i = 0; i < equations_.size(); i++) {
+                std::string replaced_expr = replaceVariables(equations_.at(i), *schema);
+                postfix_exprs.push_back(PostfixExpression(replaced_expr, *schema));
+            }
+            Signal_replaced_expr = replaceVariables(Signal_equation_, *schema);
+            Background_replaced_expr = replaceVariables(Background_equation_, *schema);
+            Signal_postfix_expr = PostfixExpression(Signal_replaced_expr, *schema);
+            Background_postfix_expr = PostfixExpression(Background_replaced_expr, *schema);
+
+            event_variable_index_list = FindVariableIndices(Event_variable_list_, *schema);
+
+            // columns of input variables
+            InputVariables.assign(postfix_exprs.size(), std::vector<float>());
+        }
+
+        void Fill(std::deque<Data>* data) {
+
+            for (std::deque<Data>::iterator block_begin = data->begin(); block_begin != data->end(); ) {
+                std::deque<Data>::iterator block_end = block_begin + std::min<std::ptrdiff_t>(EvaluationBlockSize, data->end() - block_begin);
+
+                row_selection.assign(block_end - block_begin, 0);
+
+                // care about preselection first. Signal and background have different preselection
+                for (std::deque<Data>::iterator iter = block_begin; iter != block_end; ++iter) {
+                    if (Signal_label_set.find(iter->label) != Signal_label_set.end()) {
+                        block_rows.push_back(&(iter->variable));
+                        block_positions.push_back(iter - block_begin);
+                    }
+                }
+                SelectBlock(Signal_replaced_expr, Signal_postfix_expr, true);
+
+                for (std::deque<Data>::iterator iter = block_begin; iter != block_end; ++iter) {
+                    if (Signal_label_set.find(iter->label) != Signal_label_set.end()) continue;
+                    if (Background_label_set.find(iter->label) != Background_label_set.end()) {
+                        block_rows.push_back(&(iter->variable));
+                        block_positions.push_back(iter - block_begin);
+                    }
+                }
+                SelectBlock(Background_replaced_expr, Background_postfix_expr, false);
+
+                // selected rows are kept in the order of input rows, so the sample is the same as filling row by row
+                selected_rows.clear();
+                selected_iters.clear();
+                selected_IsItSignal.clear();
+                for (size_t k = 0; k < row_selection.size(); k++) {
+                    if (row_selection[k] == 0) continue;
+                    selected_rows.push_back(&((block_begin + k)->variable));
+                    selected_iters.push_back(block_begin + k);
+                    selected_IsItSignal.push_back(row_selection[k] == 1);
+                }
+
+                // put input variables directly into the columns
+                block_results.resize(selected_rows.size());
+                for (int i = 0; i < postfix_exprs.size(); i++) {
+                    EvaluatePostfixExpressionBatch(postfix_exprs.at(i), selected_rows, block_results.data());
+                    InputVariables.at(i).insert(InputVariables.at(i).end(), block_results.begin(), block_results.end());
+                }
+
+                // put answer, weight, and event hash
+                for (size_t k = 0; k < selected_rows.size(); k++) {
+                    IsItSignal.push_back(selected_IsItSignal.at(k));
+                    weight.push_back(static_cast<float>(ObtainWeight(selected_iters.at(k), schema->Names())));
+                    if (event_variable_index_list.size() != 0) EventHash.push_back(HashEventVariables(*selected_rows.at(k), event_variable_index_list));
+                }
+
+                block_begin = block_end;
+            }
+        }
+
+        size_t size() const {
+            return weight.size();
+        }
+
+        // copy of the selected rows. Event hash is not copied
+        FastBDTSample Subset(const std::vector<size_t>& indices_) const {
+            FastBDTSample subset;
+            subset.InputVariables.assign(InputVariables.size(), std::vector<float>());
+            for (int i = 0; i < InputVariables.size(); i++) {
+                subset.InputVariables.at(i).reserve(indices_.size());
+                for (size_t k = 0; k < indices_.size(); k++) subset.InputVariables.at(i).push_back(InputVariables.at(i)[indices_[k]]);
+            }
+            subset.IsItSignal.reserve(indices_.size());
+            subset.weight.reserve(indices_.size());
+            for (size_t k = 0; k < indices_.size(); k++) {
+                subset.IsItSignal.push_back(IsItSignal[indices_[k]]);
+                subset.weight.push_back(weight[indices_[k]]);
+            }
+            return subset;
+        }
+
+        // input variables of `index_`-th row
+        void GetRow(size_t index_, std::vector<float>& row_) const {
+            row_.resize(InputVariables.size());
+            for (int i = 0; i < InputVariables.size(); i++) row_[i] = InputVariables.at(i)[index_];
+        }
+
+        // the number of signal is reweighted to the number of background
+        void BalanceWeight() {
+            double sum_bkgs = 0.0;
+            double sum_signal = 0.0;
+
+            for (size_t i = 0; i < weight.size(); i++) {
+                if (IsItSignal.at(i)) sum_signal = sum_signal + weight.at(i);
+                else sum_bkgs = sum_bkgs + weight.at(i);
+            }
+
+            if (sum_signal == 0) {
+                printf("[FastBDTSample] there is zero signal\n");
+                exit(1);
+            }
+
+            double reweight_factor = sum_bkgs / sum_signal;
+
+            for (size_t i = 0; i < weight.size(); i++) {
+                if (IsItSignal.at(i)) weight.at(i) = weight.at(i) * reweight_factor;
+            }
+        }
+
+        // free memory
+        void Clear() {
+            std::vector<std::vector<float>>().swap(InputVariables);
+            std::vector<bool>().swap(IsItSignal);
+            std::vector<float>().swap(weight);
+            std::vector<uint64_t>().swap(EventHash);
+        }
+
+        // candidates filled so far. `LoadState` appends the saved candidates
+        void SaveState(std::ostream& out_) const {
+            WriteBinary(out_, InputVariables);
+            WriteBinary(out_, IsItSignal);
+            WriteBinary(out_, weight);
+            WriteBinary(out_, EventHash);
+        }
+
+        void LoadState(std::istream& in_) {
+            std::vector<std::vector<float>> saved_InputVariables;
+            std::vector<bool> saved_IsItSignal;
+            std::vector<float> saved_weight;
+            std::vector<uint64_t> saved_EventHash;
+            ReadBinary(in_, saved_InputVariables);
+            ReadBinary(in_, saved_IsItSignal);
+            ReadBinary(in_, saved_weight);
+            ReadBinary(in_, saved_EventHash);
+
+            if (saved_InputVariables.size() != InputVariables.size()) {
+                printf("[FastBDTSample] the number of input variables is different from the saved one\n");
+                exit(1);
+            }
+            for (int i = 0; i < InputVariables.size(); i++) InputVariables.at(i).insert(InputVariables.at(i).end(), saved_InputVariables.at(i).begin(), saved_InputVariables.at(i).end());
+            IsItSignal.insert(IsItSignal.end(), saved_IsItSignal.begin(), saved_IsItSignal.end());
+            weight.insert(weight.end(), saved_weight.begin(), saved_weight.end());
+            EventHash.insert(EventHash.end(), saved_EventHash.begin(), saved_EventHash.end());
+        }
+    };
+
+    class FastBDTTrain : public Module {
+    private:
+        std::vector<std::string> equations;
+        std::string Signal_equation;
+        std::string Background_equation;
+
+        std::vector<std::string> Signal_label_list;
+        std::vector<std::string> Background_label_list;
+
+        SchemaPtr schema;
 
         std::map<std::string, double> hyperparameters;
 
         // input variables
-        std::vector<std::vector<float>> InputVariables;
-        std::vector<float>* InputVariable;
-        std::vector<bool> IsItSignal;
-        std::vector<float> weight;
+        FastBDTSample sample;
 
         std::string path;
         std::string output_name;
@@ -2971,212 +4570,572 @@ namespace Module {
         bool balanced_weight;
 
     public:
-        FastBDTTrain(std::vector<std::string> input_variables_, const char* Signal_preselection_, const char* Background_preselection_, std::map<std::string, double> hyperparameters_, const char* path_, const char* output_name_, std::vector<std::string> Signal_label_list_, std::vector<std::string> Background_label_list_, std::vector<std::string>* variable_names_, std::vector<std::string>* VariableTypes_) : Module(), equations(input_variables_), Signal_equation(Signal_preselection_), Background_equation(Background_preselection_), hyperparameters(hyperparameters_), balanced_weight(false), path(path_), output_name(output_name_), Signal_label_list(Signal_label_list_), Background_label_list(Background_label_list_), variable_names(*variable_names_), VariableTypes(*VariableTypes_) {
+        FastBDTTrain(std::vector<std::string> input_variables_, const char* Signal_preselection_, const char* Background_preselection_, std::map<std::string, double> hyperparameters_, const char* path_, const char* output_name_, std::vector<std::string> Signal_label_list_, std::vector<std::string> Background_label_list_, SchemaPtr schema_) : Module(), equations(input_variables_), Signal_equation(Signal_preselection_), Background_equation(Background_preselection_), hyperparameters(hyperparameters_), balanced_weight(false), path(path_), output_name(output_name_), Signal_label_list(Signal_label_list_), Background_label_list(Background_label_list_), schema(schema_) {
         }
 
-        FastBDTTrain(std::vector<std::string> input_variables_, const char* Signal_preselection_, const char* Background_preselection_, std::map<std::string, double> hyperparameters_, bool balanced_weight_, const char* path_, const char* output_name_, std::vector<std::string> Signal_label_list_, std::vector<std::string> Background_label_list_, std::vector<std::string>* variable_names_, std::vector<std::string>* VariableTypes_) : Module(), equations(input_variables_), Signal_equation(Signal_preselection_), Background_equation(Background_preselection_), hyperparameters(hyperparameters_), balanced_weight(balanced_weight_), path(path_), output_name(output_name_), Signal_label_list(Signal_label_list_), Background_label_list(Background_label_list_), variable_names(*variable_names_), VariableTypes(*VariableTypes_) {
+        FastBDTTrain(std::vector<std::string> input_variables_, const char* Signal_preselection_, const char* Background_preselection_, std::map<std::string, double> hyperparameters_, bool balanced_weight_, const char* path_, const char* output_name_, std::vector<std::string> Signal_label_list_, std::vector<std::string> Background_label_list_, SchemaPtr schema_) : Module(), equations(input_variables_), Signal_equation(Signal_preselection_), Background_equation(Background_preselection_), hyperparameters(hyperparameters_), balanced_weight(balanced_weight_), path(path_), output_name(output_name_), Signal_label_list(Signal_label_list_), Background_label_list(Background_label_list_), schema(schema_) {
         }
 
         ~FastBDTTrain() {}
 
-        void Start() {
-            if (Signal_label_list.size() == 0) {
-                printf("signal should be defined. Use `SetSignal`\n");
+        void Start() override {
+            sample.Initialize(equations, Signal_equation, Background_equation, Signal_label_list, Background_label_list, {}, schema);
+
+            // set hyperparmater
+            SetFastBDTHyperparameters(classifier, hyperparameters, equations.size());
+        }
+
+        int Process(std::deque<Data>* data) override {
+            sample.Fill(data);
+            return 1;
+        }
+
+        void End() override {
+            // reweight, if balanced_weight == true
+            if (balanced_weight) sample.BalanceWeight();
+
+            // fit
+            classifier.fit(sample.InputVariables, sample.IsItSignal, sample.weight);
+
+            // free memory
+            sample.Clear();
+
+            // save model
+            std::fstream out_stream;
+            if (output_name.empty()) out_stream.open((path + "/" + FastBDTWeightfileName(hyperparameters)).c_str(), std::ios_base::out | std::ios_base::trunc);
+            else out_stream.open((path + "/" + output_name).c_str(), std::ios_base::out | std::ios_base::trunc);
+            out_stream << classifier << std::endl;
+            out_stream.close();
+        }
+
+        bool IsCheckpointable() override { return true; }
+
+        void SaveState(std::ostream& out_) override {
+            sample.SaveState(out_);
+        }
+
+        void LoadState(std::istream& in_) override {
+            sample.LoadState(in_);
+        }
+
+        std::string Fingerprint() override { return MakeFingerprint("FastBDTTrain", equations, Signal_equation, Background_equation, Signal_label_list, Background_label_list, hyperparameters, balanced_weight, path, output_name); }
+        bool IsTerminal() override { return true; }
+        bool IsMemoizable() override { return true; }
+    };
+
+    class FastBDTGridSearch : public Module {
+        /*
+        * training sample is collected once and shared by all hyperparameter sets.
+        * Candidates are split into training and test sample by the hash of event variables, so that candidates from the same event are in the same sample.
+        * Each hyperparameter set is trained in the thread pool, and AUC is calculated with the test sample.
+        */
+    private:
+        std::vector<std::string> equations;
+        std::string Signal_equation;
+        std::string Background_equation;
+
+        std::vector<std::string> Signal_label_list;
+        std::vector<std::string> Background_label_list;
+        std::vector<std::string> Event_variable_list;
+
+        SchemaPtr schema;
+
+        // key is one of NTrees, Depth, Shrinkage, Subsample, and Binning
+        std::map<std::string, std::vector<double>> hyperparameter_grid;
+        std::vector<std::map<std::string, double>> hyperparameter_sets;
+
+        double test_fraction;
+        bool balanced_weight;
+
+        FastBDTSample sample;
+
+        std::string path;
+        std::string summary_name;
+
+        std::shared_ptr<std::vector<double>> output_handle;
+
+    public:
+        FastBDTGridSearch(std::vector<std::string> input_variables_, const char* Signal_preselection_, const char* Background_preselection_, std::map<std::string, std::vector<double>> hyperparameter_grid_, double test_fraction_, bool balanced_weight_, const char* path_, const char* summary_name_, const std::vector<std::string> Event_variable_list_, std::vector<std::string> Signal_label_list_, std::vector<std::string> Background_label_list_, std::shared_ptr<std::vector<double>> output_handle_, SchemaPtr schema_) : Module(), equations(input_variables_), Signal_equation(Signal_preselection_), Background_equation(Background_preselection_), hyperparameter_grid(hyperparameter_grid_), test_fraction(test_fraction_), balanced_weight(balanced_weight_), path(path_), summary_name(summary_name_), Event_variable_list(Event_variable_list_), Signal_label_list(Signal_label_list_), Background_label_list(Background_label_list_), output_handle(output_handle_), schema(schema_) {}
+
+        ~FastBDTGridSearch() {}
+
+        void Start() override {
+            if ((test_fraction <= 0) || (test_fraction >= 1)) {
+                printf("[FastBDTGridSearch] fraction of test sample should be in (0, 1)\n");
                 exit(1);
             }
-            else if (Background_label_list.size() == 0) {
-                printf("background should be defined. Use `SetBackground`\n");
+
+            if (Event_variable_list.size() == 0) {
+                printf("[FastBDTGridSearch] event variable should exist to split the sample\n");
                 exit(1);
             }
 
-            // Convert from vector to set
-            Signal_label_set.clear();
-            Signal_label_set.insert(Signal_label_list.begin(), Signal_label_list.end());
-            Background_label_set.clear();
-            Background_label_set.insert(Background_label_list.begin(), Background_label_list.end());
+            for (std::map<std::string, std::vector<double>>::iterator iter = hyperparameter_grid.begin(); iter != hyperparameter_grid.end(); ++iter) {
+                if ((iter->first != "NTrees") && (iter->first != "Depth") && (iter->first != "Shrinkage") && (iter->first != "Subsample") && (iter->first != "Binning")) {
+                    printf("[FastBDTGridSearch] unknown hyperparameter: %s\n", iter->first.c_str());
+                    exit(1);
+                }
+                if (iter->second.size() == 0) {
+                    printf("[FastBDTGridSearch] there is no value for %s\n", iter->first.c_str());
+                    exit(1);
+                }
+            }
 
-            // change variable name into placeholder
-            for (int i = 0; i < equations.size(); i++) {
-                std::string replaced_expr = replaceVariables(equations.at(i), &variable_names);
-                postfix_exprs.push_back(PostfixExpression(replaced_expr, &VariableTypes));
+            // cartesian product of the grid
+            hyperparameter_sets.clear();
+            hyperparameter_sets.push_back(std::map<std::string, double>());
+            for (std::map<std::string, std::vector<double>>::iterator iter = hyperparameter_grid.begin(); iter != hyperparameter_grid.end(); ++iter) {
+                std::vector<std::map<std::string, double>> temp_sets;
+                for (int i = 0; i < hyperparameter_sets.size(); i++) {
+                    for (int j = 0; j < iter->second.size(); j++) {
+                        std::map<std::string, double> temp_set = hyperparameter_sets.at(i);
+                        temp_set[iter->first] = iter->second.at(j);
+                        temp_sets.push_back(temp_set);
+                    }
+                }
+                hyperparameter_sets.swap(temp_sets);
             }
-            Signal_replaced_expr = replaceVariables(Signal_equation, &variable_names);
-            Background_replaced_expr = replaceVariables(Background_equation, &variable_names);
-            Signal_postfix_expr = PostfixExpression(Signal_replaced_expr, &VariableTypes);
-            Background_postfix_expr = PostfixExpression(Background_replaced_expr, &VariableTypes);
+            for (int j = 0; j < hyperparameter_sets.size(); j++) FillDefaultFastBDTHyperparameters(hyperparameter_sets.at(j));
 
-            // set hyperparmater
-            if (hyperparameters.find("NTrees") == hyperparameters.end()) hyperparameters["NTrees"] = 100;
-            if (hyperparameters.find("Depth") == hyperparameters.end()) hyperparameters["Depth"] = 3;
-            if (hyperparameters.find("Shrinkage") == hyperparameters.end()) hyperparameters["Shrinkage"] = 0.1;
-            if (hyperparameters.find("Subsample") == hyperparameters.end()) hyperparameters["Subsample"] = 0.5;
-            if (hyperparameters.find("Binning") == hyperparameters.end()) hyperparameters["Binning"] = 8;
+            sample.Initialize(equations, Signal_equation, Background_equation, Signal_label_list, Background_label_list, Event_variable_list, schema);
+        }
+
+        int Process(std::deque<Data>* data) override {
+            sample.Fill(data);
+            return 1;
+        }
 
-            classifier.SetNTrees(static_cast<unsigned int>(hyperparameters["NTrees"]));
-            classifier.SetDepth(static_cast<unsigned int>(hyperparameters["Depth"]));
-            classifier.SetShrinkage(static_cast<double>(hyperparameters["Shrinkage"]));
-            classifier.SetSubsample(static_cast<double>(hyperparameters["Subsample"]));
-            std::vector<unsigned int> binning(postfix_exprs.size(), static_cast<unsigned int>(hyperparameters["Binning"]));
-            classifier.SetBinning(binning);
+        void End() override {
+            // split sample
+            std::vector<size_t> train_indices;
+            std::vector<size_t> test_indices;
+            for (size_t i = 0; i < sample.size(); i++) {
+                if (HashToUnitInterval(sample.EventHash.at(i)) < test_fraction) test_indices.push_back(i);
+                else train_indices.push_back(i);
+            }
+
+            FastBDTSample train_sample = sample.Subset(train_indices);
+            FastBDTSample test_sample = sample.Subset(test_indices);
+            sample.Clear();
+
+            // reweight, if balanced_weight == true. Test sample keeps the original weight
+            if (balanced_weight) train_sample.BalanceWeight();
+
+            printf("[FastBDTGridSearch] %zu hyperparameter sets, %zu training candidates, %zu test candidates\n", hyperparameter_sets.size(), train_sample.size(), test_sample.size());
+
+            // train every hyperparameter set. Training sample is read-only, so it is shared
+            std::vector<double> AUCs(hyperparameter_sets.size(), 0.0);
+            std::vector<std::string> weightfiles(hyperparameter_sets.size());
+            std::vector<std::future<void>> results;
+            for (int j = 0; j < hyperparameter_sets.size(); j++) {
+                results.push_back(GetThreadPool()->Enqueue([this, j, &train_sample, &test_sample, &AUCs, &weightfiles]() {
+                    std::map<std::string, double> hyperparameters = hyperparameter_sets.at(j);
+
+                    FastBDT::Classifier classifier;
+                    SetFastBDTHyperparameters(classifier, hyperparameters, equations.size());
+                    classifier.fit(train_sample.InputVariables, train_sample.IsItSignal, train_sample.weight);
+
+                    // evaluate test sample
+                    std::vector<std::pair<double, double>> signal_entries;
+                    std::vector<std::pair<double, double>> background_entries;
+                    std::vector<float> row;
+                    for (size_t k = 0; k < test_sample.size(); k++) {
+                        test_sample.GetRow(k, row);
+                        float Output_FBDT = classifier.predict(row);
+                        if (test_sample.IsItSignal.at(k)) signal_entries.push_back(std::make_pair(Output_FBDT, test_sample.weight.at(k)));
+                        else background_entries.push_back(std::make_pair(Output_FBDT, test_sample.weight.at(k)));
+                    }
+                    AUCs.at(j) = CalculateWeightedAUC(signal_entries, background_entries);
+
+                    // save model
+                    weightfiles.at(j) = FastBDTWeightfileName(hyperparameters);
+                    std::fstream out_stream((path + "/" + weightfiles.at(j)).c_str(), std::ios_base::out | std::ios_base::trunc);
+                    out_stream << classifier << std::endl;
+                    out_stream.close();
+                }));
+            }
+            for (int j = 0; j < results.size(); j++) results.at(j).get();
 
-            // malloc input variables
-            InputVariable = new std::vector<float>[postfix_exprs.size()];
+            // print summary
+            int best_index = std::max_element(AUCs.begin(), AUCs.end()) - AUCs.begin();
+            FILE* fp = fopen((path + "/" + summary_name).c_str(), "w");
+            fprintf(fp, "# NTrees Depth Shrinkage Subsample Binning AUC weightfile\n");
+            for (int j = 0; j < hyperparameter_sets.size(); j++) {
+                std::map<std::string, double>& hyperparameters = hyperparameter_sets.at(j);
+                fprintf(fp, "%lf %lf %lf %lf %lf %lf %s\n", hyperparameters["NTrees"], hyperparameters["Depth"], hyperparameters["Shrinkage"], hyperparameters["Subsample"], hyperparameters["Binning"], AUCs.at(j), weightfiles.at(j).c_str());
+            }
+            fclose(fp);
+
+            printf("[FastBDTGridSearch] best AUC: %lf (%s)\n", AUCs.at(best_index), weightfiles.at(best_index).c_str());
+
+            (*output_handle) = AUCs;
         }
 
-        int Process(std::deque<Data>* data) {
+        bool IsCheckpointable() override { return true; }
 
-            for (std::deque<Data>::iterator iter = data->begin(); iter != data->end(); ) {
+        void SaveState(std::ostream& out_) override {
+            sample.SaveState(out_);
+        }
 
-                // care about preselection first
-                double preselection_result = -1;
+        void LoadState(std::istream& in_) override {
+            sample.LoadState(in_);
+        }
 
-                if (Signal_label_set.find(iter->label) != Signal_label_set.end()) {
-                    if (Signal_replaced_expr == "") preselection_result = 1;
-                    else {
-                        preselection_result = EvaluatePostfixExpression(Signal_postfix_expr, iter->variable, &VariableTypes);
-                    }
-                }
-                else if (Background_label_set.find(iter->label) != Background_label_set.end()) {
-                    if (Background_replaced_expr == "") preselection_result = 1;
-                    else {
-                        preselection_result = EvaluatePostfixExpression(Background_postfix_expr, iter->variable, &VariableTypes);
-                    }
-                }
-                else {
-                    preselection_result = -1; // label is not registered. Do not use this data
-                }
+        std::string Fingerprint() override { return MakeFingerprint("FastBDTGridSearch", equations, Signal_equation, Background_equation, Signal_label_list, Background_label_list, Event_variable_list, hyperparameter_grid, test_fraction, balanced_weight, path, summary_name); }
+        bool IsTerminal() override { return true; }
+        bool IsMemoizable() override { return true; }
+    };
 
-                if (preselection_result > 0.5) { // put input variables
-                    for (int i = 0; i < postfix_exprs.size(); i++) {
-                        double result = EvaluatePostfixExpression(postfix_exprs.at(i), iter->variable, &VariableTypes);
-                        InputVariable[i].push_back(result);
-                    }
+    class FastBDTKFoldTrain : public Module {
+        /*
+        * each event is assigned to one of K folds by the hash of event variables.
+        * k-th classifier is trained without k-th fold, so it can be applied to k-th fold without bias (see `FastBDTKFoldApplication`).
+        * K classifiers are trained in the thread pool. Each of them has its own copy of the training sample, because FastBDT takes whole columns.
+        * A copy is (K-1)/K of the sample, so the number of folds trained at the same time is limited by `MaxCopyBytes`. At least one fold is trained at a time.
+        */
+    private:
+        std::vector<std::string> equations;
+        std::string Signal_equation;
+        std::string Background_equation;
 
-                    // put answer
-                    if (Signal_label_set.find(iter->label) != Signal_label_set.end()) IsItSignal.push_back(true);
-                    else if (Background_label_set.find(iter->label) != Background_label_set.end()) IsItSignal.push_back(false);
+        std::vector<std::string> Signal_label_list;
+        std::vector<std::string> Background_label_list;
+        std::vector<std::string> Event_variable_list;
 
-                    // put weight
-                    weight.push_back(static_cast<float>(ObtainWeight(iter, variable_names)));
-                }
+        SchemaPtr schema;
 
-                ++iter;
+        std::map<std::string, double> hyperparameters;
+
+        int K;
+        bool balanced_weight;
+
+        FastBDTSample sample;
+
+        // total size of copies of the training sample at the same time
+        size_t MaxCopyBytes;
+
+        std::string path;
+        std::string output_name;
+
+    public:
+        FastBDTKFoldTrain(std::vector<std::string> input_variables_, const char* Signal_preselection_, const char* Background_preselection_, std::map<std::string, double> hyperparameters_, int K_, bool balanced_weight_, const char* path_, const char* output_name_, const std::vector<std::string> Event_variable_list_, std::vector<std::string> Signal_label_list_, std::vector<std::string> Background_label_list_, SchemaPtr schema_) : Module(), equations(input_variables_), Signal_equation(Signal_preselection_), Background_equation(Background_preselection_), hyperparameters(hyperparameters_), K(K_), balanced_weight(balanced_weight_), path(path_), output_name(output_name_), Event_variable_list(Event_variable_list_), Signal_label_list(Signal_label_list_), Background_label_list(Background_label_list_), schema(schema_) {
+            // 4 GB
+            MaxCopyBytes = 4000000000;
+        }
+
+        ~FastBDTKFoldTrain() {}
+
+        void Start() override {
+            if (K < 2) {
+                printf("[FastBDTKFoldTrain] the number of folds should be larger than 1\n");
+                exit(1);
             }
 
+            if (Event_variable_list.size() == 0) {
+                printf("[FastBDTKFoldTrain] event variable should exist to split the sample\n");
+                exit(1);
+            }
+
+            FillDefaultFastBDTHyperparameters(hyperparameters);
+
+            sample.Initialize(equations, Signal_equation, Background_equation, Signal_label_list, Background_label_list, Event_variable_list, schema);
+        }
+
+        int Process(std::deque<Data>* data) override {
+            sample.Fill(data);
             return 1;
         }
 
-        void End() {
-            // reweight, if balanced_weight == true
-            if (balanced_weight) {
-                double sum_bkgs = 0.0;
-                double sum_signal = 0.0;
+        void End() override {
+            std::vector<int> folds(sample.size());
+            for (size_t i = 0; i < sample.size(); i++) folds.at(i) = KFoldIndex(sample.EventHash.at(i), K);
+
+            std::string weightfile_name = output_name.empty() ? FastBDTWeightfileName(hyperparameters) : output_name;
+
+            // each task trains folds one by one, so there are `Nconcurrent` copies at most
+            size_t copy_bytes = (sample.size() / K * (K - 1) + 1) * (equations.size() * sizeof(float) + sizeof(float) + 1);
+            int Nconcurrent = (int)std::max<size_t>(1, std::min<size_t>(K, MaxCopyBytes / copy_bytes));
+            if (Nconcurrent < K) printf("[FastBDTKFoldTrain] %d of %d folds are trained at the same time to save memory\n", Nconcurrent, K);
+
+            std::vector<std::future<void>> results;
+            for (int task = 0; task < Nconcurrent; task++) {
+                results.push_back(GetThreadPool()->Enqueue([this, task, Nconcurrent, &folds, &weightfile_name]() {
+                    for (int k = task; k < K; k = k + Nconcurrent) {
+                        std::vector<size_t> train_indices;
+                        for (size_t i = 0; i < folds.size(); i++) {
+                            if (folds.at(i) != k) train_indices.push_back(i);
+                        }
 
-                for (int i = 0; i < weight.size(); i++) {
-                    if (IsItSignal.at(i)) sum_signal = sum_signal + weight.at(i);
-                    else sum_bkgs = sum_bkgs + weight.at(i);
-                }
+                        FastBDTSample train_sample = sample.Subset(train_indices);
+                        std::vector<size_t>().swap(train_indices);
 
-                if (sum_signal == 0) {
-                    printf("[FastBDTTrain] there is zero signal\n");
-                    exit(1);
+                        // reweight, if balanced_weight == true
+                        if (balanced_weight) train_sample.BalanceWeight();
+
+                        std::map<std::string, double> temp_hyperparameters = hyperparameters;
+                        FastBDT::Classifier classifier;
+                        SetFastBDTHyperparameters(classifier, temp_hyperparameters, equations.size());
+                        classifier.fit(train_sample.InputVariables, train_sample.IsItSignal, train_sample.weight);
+                        train_sample.Clear();
+
+                        // save model
+                        std::fstream out_stream((path + "/" + KFoldWeightfileName(weightfile_name, k)).c_str(), std::ios_base::out | std::ios_base::trunc);
+                        out_stream << classifier << std::endl;
+                        out_stream.close();
+                    }
+                }));
+            }
+            for (int k = 0; k < results.size(); k++) results.at(k).get();
+
+            // free memory
+            sample.Clear();
+        }
+
+        bool IsCheckpointable() override { return true; }
+
+        void SaveState(std::ostream& out_) override {
+            sample.SaveState(out_);
+        }
+
+        void LoadState(std::istream& in_) override {
+            sample.LoadState(in_);
+        }
+
+        std::string Fingerprint() override { return MakeFingerprint("FastBDTKFoldTrain", equations, Signal_equation, Background_equation, Signal_label_list, Background_label_list, Event_variable_list, hyperparameters, K, balanced_weight, path, output_name); }
+        bool IsTerminal() override { return true; }
+        bool IsMemoizable() override { return true; }
+    };
+
+    class FastBDTApplication : public Module {
+        /*
+        * input variables are evaluated once per block and shared by all classifiers.
+        * Blocks of rows are processed by the thread pool. Each block only touches its own rows, so no lock is needed.
+        */
+    private:
+        std::vector<std::string> equations;
+        std::vector<std::vector<Token>> postfix_exprs;
+
+
+        // FBDT class
+        std::vector<std::string> classifier_paths;
+        std::vector<FastBDT::Classifier> classifiers;
+
+        std::vector<std::string> branch_names;
+
+        void ProcessBlock(std::deque<Data>::iterator block_begin_, std::deque<Data>::iterator block_end_) {
+            // buffers are reused over blocks processed by the same thread
+            static thread_local std::vector<const std::vector<std::variant<int, unsigned int, float, double, std::string*>>*> rows;
+            static thread_local std::vector<double> features;
+            static thread_local std::vector<float> inputs;
+
+            rows.clear();
+            for (std::deque<Data>::iterator iter = block_begin_; iter != block_end_; ++iter) rows.push_back(&(iter->variable));
+            size_t N = rows.size();
+
+            // column-wise evaluation, features[i * N + k] is i-th input of k-th row
+            features.resize(postfix_exprs.size() * N);
+            for (int i = 0; i < postfix_exprs.size(); i++) {
+                EvaluatePostfixExpressionBatch(postfix_exprs.at(i), rows, features.data() + i * N);
+            }
+
+            inputs.resize(postfix_exprs.size());
+            size_t k = 0;
+            for (std::deque<Data>::iterator iter = block_begin_; iter != block_end_; ++iter) {
+                for (int i = 0; i < postfix_exprs.size(); i++) inputs[i] = static_cast<float>(features[i * N + k]);
+
+                for (int j = 0; j < classifiers.size(); j++) {
+                    float Output_FBDT = classifiers.at(j).predict(inputs);
+                    iter->variable.push_back(static_cast<float>(Output_FBDT));
                 }
 
-                double reweight_factor = sum_bkgs / sum_signal;
+                k++;
+            }
+        }
 
-                for (int i = 0; i < weight.size(); i++) {
-                    if (IsItSignal.at(i)) weight.at(i) = weight.at(i) * reweight_factor;
+    public:
+        FastBDTApplication(std::vector<std::string> input_variables_, const char* classifier_path_, const char* branch_name_, SchemaPtr schema_, std::vector<std::string>* variable_names_, std::vector<std::string>* VariableTypes_) : FastBDTApplication(input_variables_, std::vector<std::string>{ classifier_path_ }, std::vector<std::string>{ branch_name_ }, schema_, variable_names_, VariableTypes_) {}
+
+        FastBDTApplication(std::vector<std::string> input_variables_, std::vector<std::string> classifier_paths_, std::vector<std::string> branch_names_, SchemaPtr schema_, std::vector<std::string>* variable_names_, std::vector<std::string>* VariableTypes_) : Module(), equations(input_variables_), classifier_paths(classifier_paths_), branch_names(branch_names_) {
+            if (classifier_paths.size() != branch_names.size()) {
+                printf("[FastBDTApplication] the number of classifiers and branch names are different\n");
+                exit(1);
+            }
+
+            // change variable name into placeholder
+            for (int i = 0; i < equations.size(); i++) {
+                std::string replaced_expr = replaceVariables(equations.at(i), *schema_);
+                postfix_exprs.push_back(PostfixExpression(replaced_expr, *schema_));
+            }
+
+            // check there is the same branch name or not
+            for (int j = 0; j < branch_names.size(); j++) {
+                if ((schema_->Index(branch_names.at(j)) >= 0) || (std::find(branch_names.begin(), branch_names.begin() + j, branch_names.at(j)) != branch_names.begin() + j)) {
+                    printf("[FastBDTApplication] there is already %s variable\n", branch_names.at(j).c_str());
+                    exit(1);
                 }
             }
 
-            // fill
-            for (int i = 0; i < postfix_exprs.size(); i++) {
-                InputVariables.push_back(InputVariable[i]);
+            // add variable
+            for (int j = 0; j < branch_names.size(); j++) {
+                variable_names_->push_back(branch_names.at(j));
+                VariableTypes_->push_back("Float_t");
             }
+        }
+
+        ~FastBDTApplication() {}
+
+        void Start() override {
+
+            // load FBDT
+            classifiers.clear();
+            for (int j = 0; j < classifier_paths.size(); j++) {
+                std::fstream in_stream(classifier_paths.at(j).c_str(), std::ios_base::in);
+                classifiers.push_back(FastBDT::Classifier(in_stream));
+            }
+
+        }
+
+        int Process(std::deque<Data>* data) override {
+
+            std::deque<Data>::iterator data_begin = data->begin();
+            ParallelFor(0, data->size(), EvaluationBlockSize, [this, data_begin](size_t begin, size_t end) {
+                for (size_t block_begin = begin; block_begin < end; block_begin += EvaluationBlockSize) {
+                    size_t block_end = std::min(end, block_begin + EvaluationBlockSize);
+                    ProcessBlock(data_begin + block_begin, data_begin + block_end);
+                }
+            });
+
+            return 1;
+        }
+
+        void End() override {
 
-            // fit
-            classifier.fit(InputVariables, IsItSignal, weight);
+        }
 
-            // free memory
-            delete[] InputVariable;
+        bool IsCheckpointable() override { return true; }
 
-            // save model
-            std::fstream out_stream;
-            if (output_name.empty()) out_stream.open((path + "/" + std::to_string(hyperparameters["NTrees"]) + "_" + std::to_string(hyperparameters["Depth"]) + "_" + std::to_string(hyperparameters["Shrinkage"]) + "_" + std::to_string(hyperparameters["Subsample"]) + "_" + std::to_string(hyperparameters["Binning"]) + ".weightfile").c_str(), std::ios_base::out | std::ios_base::trunc);
-            else out_stream.open((path + "/" + output_name).c_str(), std::ios_base::out | std::ios_base::trunc);
-            out_stream << classifier << std::endl;
-            out_stream.close();
+        std::string Fingerprint() override {
+            std::vector<std::string> classifier_fingerprints;
+            for (int i = 0; i < classifier_paths.size(); i++) classifier_fingerprints.push_back(FileFingerprint(classifier_paths.at(i)));
+            return MakeFingerprint("FastBDTApplication", equations, classifier_fingerprints, branch_names);
         }
     };
 
-    class FastBDTApplication : public Module {
+    class FastBDTKFoldApplication : public Module {
+        /*
+        * out-of-fold application of the classifiers from `FastBDTKFoldTrain`.
+        * The candidate in k-th fold gets the output of k-th classifier, which did not see k-th fold during the training.
+        */
     private:
         std::vector<std::string> equations;
         std::vector<std::vector<Token>> postfix_exprs;
 
-        std::vector<std::string> variable_names;
-        std::vector<std::string> VariableTypes;
+        std::vector<std::string> Event_variable_list;
+        std::vector<int> event_variable_index_list;
+
 
         // FBDT class
         std::string classifier_path;
-        FastBDT::Classifier classifier;
+        int K;
+        std::vector<FastBDT::Classifier> classifiers;
 
         std::string branch_name;
 
+        void ProcessBlock(std::deque<Data>::iterator block_begin_, std::deque<Data>::iterator block_end_) {
+            // buffers are reused over blocks processed by the same thread
+            static thread_local std::vector<const std::vector<std::variant<int, unsigned int, float, double, std::string*>>*> rows;
+            static thread_local std::vector<double> features;
+            static thread_local std::vector<float> inputs;
+
+            rows.clear();
+            for (std::deque<Data>::iterator iter = block_begin_; iter != block_end_; ++iter) rows.push_back(&(iter->variable));
+            size_t N = rows.size();
+
+            // column-wise evaluation, features[i * N + k] is i-th input of k-th row
+            features.resize(postfix_exprs.size() * N);
+            for (int i = 0; i < postfix_exprs.size(); i++) {
+                EvaluatePostfixExpressionBatch(postfix_exprs.at(i), rows, features.data() + i * N);
+            }
+
+            inputs.resize(postfix_exprs.size());
+            size_t k = 0;
+            for (std::deque<Data>::iterator iter = block_begin_; iter != block_end_; ++iter) {
+                for (int i = 0; i < postfix_exprs.size(); i++) inputs[i] = static_cast<float>(features[i * N + k]);
+
+                int fold = KFoldIndex(HashEventVariables(iter->variable, event_variable_index_list), K);
+                float Output_FBDT = classifiers.at(fold).predict(inputs);
+                iter->variable.push_back(static_cast<float>(Output_FBDT));
+
+                k++;
+            }
+        }
+
     public:
-        FastBDTApplication(std::vector<std::string> input_variables_, const char* classifier_path_, const char* branch_name_, std::vector<std::string>* variable_names_, std::vector<std::string>* VariableTypes_) : Module(), equations(input_variables_), classifier_path(classifier_path_), branch_name(branch_name_) {
+        FastBDTKFoldApplication(std::vector<std::string> input_variables_, const char* classifier_path_, int K_, const char* branch_name_, const std::vector<std::string> Event_variable_list_, SchemaPtr schema_, std::vector<std::string>* variable_names_, std::vector<std::string>* VariableTypes_) : Module(), equations(input_variables_), classifier_path(classifier_path_), K(K_), branch_name(branch_name_), Event_variable_list(Event_variable_list_) {
+            if (K < 2) {
+                printf("[FastBDTKFoldApplication] the number of folds should be larger than 1\n");
+                exit(1);
+            }
+
             // change variable name into placeholder
             for (int i = 0; i < equations.size(); i++) {
-                std::string replaced_expr = replaceVariables(equations.at(i), variable_names_);
-                postfix_exprs.push_back(PostfixExpression(replaced_expr, VariableTypes_));
+                std::string replaced_expr = replaceVariables(equations.at(i), *schema_);
+                postfix_exprs.push_back(PostfixExpression(replaced_expr, *schema_));
             }
 
             // check there is the same branch name or not
-            if (std::find(variable_names_->begin(), variable_names_->end(), branch_name) != variable_names_->end()) {
-                printf("[FastBDTApplication] there is already %s variable\n", branch_name.c_str());
+            if (schema_->Index(branch_name) >= 0) {
+                printf("[FastBDTKFoldApplication] there is already %s variable\n", branch_name.c_str());
                 exit(1);
             }
 
-            // copy variable list first, because we use it inside the module
-            variable_names = (*variable_names_);
-            VariableTypes = (*VariableTypes_);
+            event_variable_index_list = FindVariableIndices(Event_variable_list, *schema_);
 
             // add variable
             variable_names_->push_back(branch_name);
             VariableTypes_->push_back("Float_t");
         }
 
-        ~FastBDTApplication() {}
+        ~FastBDTKFoldApplication() {}
 
-        void Start() {
+        void Start() override {
 
             // load FBDT
-            std::fstream in_stream(classifier_path.c_str(), std::ios_base::in);
-            classifier = FastBDT::Classifier(in_stream);
+            classifiers.clear();
+            for (int k = 0; k < K; k++) {
+                std::fstream in_stream(KFoldWeightfileName(classifier_path, k).c_str(), std::ios_base::in);
+                if (!in_stream.is_open()) {
+                    printf("[FastBDTKFoldApplication] cannot open %s\n", KFoldWeightfileName(classifier_path, k).c_str());
+                    exit(1);
+                }
+                classifiers.push_back(FastBDT::Classifier(in_stream));
+            }
 
         }
 
-        int Process(std::deque<Data>* data) {
-
-            for (std::deque<Data>::iterator iter = data->begin(); iter != data->end(); ) {
+        int Process(std::deque<Data>* data) override {
 
-                std::vector<float> inputs;
-                for (int i = 0; i < postfix_exprs.size(); i++) {
-                    double result = EvaluatePostfixExpression(postfix_exprs.at(i), iter->variable, &VariableTypes);
-                    inputs.push_back(result);
+            std::deque<Data>::iterator data_begin = data->begin();
+            ParallelFor(0, data->size(), EvaluationBlockSize, [this, data_begin](size_t begin, size_t end) {
+                for (size_t block_begin = begin; block_begin < end; block_begin += EvaluationBlockSize) {
+                    size_t block_end = std::min(end, block_begin + EvaluationBlockSize);
+                    ProcessBlock(data_begin + block_begin, data_begin + block_end);
                 }
+            });
 
-                float Output_FBDT = classifier.predict(inputs);
-                iter->variable.push_back(static_cast<float>(Output_FBDT));
+            return 1;
+        }
 
-                ++iter;
-            }
+        void End() override {
 
-            return 1;
         }
 
-        void End() {
+        bool IsCheckpointable() override { return true; }
 
+        std::string Fingerprint() override {
+            std::vector<std::string> classifier_fingerprints;
+            for (int k = 0; k < K; k++) classifier_fingerprints.push_back(FileFingerprint(KFoldWeightfileName(classifier_path, k)));
+            return MakeFingerprint("FastBDTKFoldApplication", equations, classifier_fingerprints, K, branch_name, Event_variable_list);
         }
     };
 
@@ -3192,21 +5151,20 @@ namespace Module {
     private:
         std::vector<std::string> Event_variable_list;
 
-        // temporary variable to extract event variable
-        std::vector<std::variant<int, unsigned int, float, double, std::string*>> temp_event_variable;
-
         // index of event variables in `variable_names`
         std::vector<int> event_variable_index_list;
 
-        std::vector<std::string> variable_names;
-        std::vector<std::string> VariableTypes;
+        // candidates which are kept
+        std::vector<size_t> selection;
+
+        SchemaPtr schema;
 
         // the number of split and which one do you want to select?
         int split_num;
         int selected_index;
 
     public:
-        RandomEventSelection(int split_num_, int selected_index_, const std::vector<std::string> Event_variable_list_, std::vector<std::string>* variable_names_, std::vector<std::string>* VariableTypes_) : Module(), split_num(split_num_), selected_index(selected_index_), Event_variable_list(Event_variable_list_), variable_names(*variable_names_), VariableTypes(*VariableTypes_) {}
+        RandomEventSelection(int split_num_, int selected_index_, const std::vector<std::string> Event_variable_list_, SchemaPtr schema_) : Module(), split_num(split_num_), selected_index(selected_index_), Event_variable_list(Event_variable_list_), schema(schema_) {}
 
         ~RandomEventSelection() {}
 
@@ -3232,42 +5190,30 @@ namespace Module {
                 exit(1);
             }
 
-            // fill `temp_event_variable` by dummy value. It is to set variable type beforehand.
+            // find event variables
             for (int i = 0; i < Event_variable_list.size(); i++) {
-                int event_variable_index = std::find(variable_names.begin(), variable_names.end(), Event_variable_list.at(i)) - variable_names.begin();
+                int event_variable_index = schema->Index(Event_variable_list.at(i));
 
-                if (event_variable_index == variable_names.size()) {
+                if (event_variable_index < 0) {
                     printf("[RandomSplit] cannot find variable: %s\n", Event_variable_list.at(i).c_str());
                     exit(1);
                 }
 
                 event_variable_index_list.push_back(event_variable_index);
-
-                if (strcmp(VariableTypes.at(event_variable_index).c_str(), "Double_t") == 0) {
-                    temp_event_variable.push_back(static_cast<double>(0.0));
-                }
-                else if (strcmp(VariableTypes.at(event_variable_index).c_str(), "Int_t") == 0) {
-                    temp_event_variable.push_back(static_cast<int>(0.0));
-                }
-                else if (strcmp(VariableTypes.at(event_variable_index).c_str(), "UInt_t") == 0) {
-                    temp_event_variable.push_back(static_cast<unsigned int>(0.0));
-                }
-                else if (strcmp(VariableTypes.at(event_variable_index).c_str(), "Float_t") == 0) {
-                    temp_event_variable.push_back(static_cast<float>(0.0));
-                }
-                else if (strcmp(VariableTypes.at(event_variable_index).c_str(), "string") == 0) {
-                    temp_event_variable.push_back(static_cast<std::string*>(nullptr));
-                }
-                else {
-                    printf("[RandomSplit] unexpected data type: %s\n", VariableTypes.at(i).c_str());
-                    exit(1);
-                }
             }
 
 
         }
 
         int Process(std::deque<Data>* data) override {
+            std::vector<size_t> offsets;
+            ComputeEventOffsets(*data, event_variable_index_list, &offsets);
+            return ProcessEvents(data, &offsets);
+        }
+
+        std::vector<int> EventVariableIndices() override { return event_variable_index_list; }
+
+        int ProcessEvents(std::deque<Data>* data, std::vector<size_t>* offsets) override {
 
             // Convert the string to a size_t hash value
             std::hash<std::string> hasher;
@@ -3279,539 +5225,562 @@ namespace Module {
             std::mt19937 rng(static_cast<unsigned int>(hashValue));
             std::uniform_real_distribution<double> dist(0.0, 1.0);
 
-            // It is temporary data to save Data before/after selection is done.
-            std::deque<Data> temp_data;
-            std::deque<Data> temp_data_after_selection;
-
-            // initialization flag previous event variable
-            bool ItIsTheFirstData = true; // we erase data from std::deque<Data>. we should avoid the comparison with data->begin()
-            std::vector<std::variant<int, unsigned int, float, double, std::string*>> previous_event_variable = temp_event_variable;
-
-            for (std::deque<Data>::iterator iter = data->begin(); iter != data->end(); iter++) {
-                // get event variable
-                for (int i = 0; i < Event_variable_list.size(); i++) {
-                    int event_variable_index = event_variable_index_list.at(i);
-
-                    if (strcmp(VariableTypes.at(event_variable_index).c_str(), "Double_t") == 0) {
-                        temp_event_variable.at(i) = std::get<double>(iter->variable.at(event_variable_index));
-                    }
-                    else if (strcmp(VariableTypes.at(event_variable_index).c_str(), "Int_t") == 0) {
-                        temp_event_variable.at(i) = std::get<int>(iter->variable.at(event_variable_index));
-                    }
-                    else if (strcmp(VariableTypes.at(event_variable_index).c_str(), "UInt_t") == 0) {
-                        temp_event_variable.at(i) = std::get<unsigned int>(iter->variable.at(event_variable_index));
-                    }
-                    else if (strcmp(VariableTypes.at(event_variable_index).c_str(), "Float_t") == 0) {
-                        temp_event_variable.at(i) = std::get<float>(iter->variable.at(event_variable_index));
-                    }
-                    else if (strcmp(VariableTypes.at(event_variable_index).c_str(), "string") == 0) {
-                        temp_event_variable.at(i) = std::get<std::string*>(iter->variable.at(event_variable_index));
-                    }
-                    else {
-                        printf("unexpected data type: %s\n", VariableTypes.at(i).c_str());
-                        exit(1);
-                    }
-                }
-                if (ItIsTheFirstData) {
-                    previous_event_variable = temp_event_variable;
-                    ItIsTheFirstData = false;
-                }
-
-                // if event variable changes, do random selection
-                if (previous_event_variable != temp_event_variable) {
-                    double MIN_threshold = (1.0 / split_num) * selected_index;
-                    double MAX_threshold = (1.0 / split_num) * (selected_index + 1.0);
-                    double random_number = dist(rng);
-
-                    if ((random_number > MIN_threshold) && (random_number <= MAX_threshold)) {
-                        for (int i = 0; i < temp_data.size(); i++) {
-                            Data temp = temp_data.at(i);
-                            temp_data_after_selection.push_back(temp);
-                        }
-
-                    }
-                    temp_data.clear();
-                }
-
-                // get Data
-                temp_data.push_back(*iter);
-
-                previous_event_variable = temp_event_variable;
-
-            }
-
-            // do random selection for the final dataset
             double MIN_threshold = (1.0 / split_num) * selected_index;
             double MAX_threshold = (1.0 / split_num) * (selected_index + 1.0);
-            double random_number = dist(rng);
 
-            if ((random_number > MIN_threshold) && (random_number <= MAX_threshold)) {
-                for (int i = 0; i < temp_data.size(); i++) {
-                    Data temp = temp_data.at(i);
-                    temp_data_after_selection.push_back(temp);
-                }
+            // one random number for each event
+            selection.clear();
+            for (size_t i = 0; i + 1 < offsets->size(); i++) {
+                double random_number = dist(rng);
 
+                if ((random_number > MIN_threshold) && (random_number <= MAX_threshold)) {
+                    for (size_t j = (*offsets)[i]; j < (*offsets)[i + 1]; j++) selection.push_back(j);
+                }
             }
-            temp_data.clear();
 
-            // use swap instead of copy to save computing resource
-            data->clear();
-            data->swap(temp_data_after_selection);
+            CompactRows(data, selection, offsets);
 
             return 1;
         }
 
         void End() override {}
-    };
-
-    class DefineNewVariable : public Module {
-    private:
-        std::string equation;
-        std::string replaced_expr;
-        std::vector<Token> postfix_expr;
-
-        std::vector<std::string> variable_names;
-        std::vector<std::string> VariableTypes;
-
-        // FBDT class
-        std::string new_variable_name;
-
-    public:
-        DefineNewVariable(const char* equation_, const char* new_variable_name_, std::vector<std::string>* variable_names_, std::vector<std::string>* VariableTypes_) : Module(), equation(equation_), new_variable_name(new_variable_name_) {
-            // change variable name into placeholder
-            replaced_expr = replaceVariables(equation, variable_names_);
-            postfix_expr = PostfixExpression(replaced_expr, VariableTypes_);
-
-            // check there is the same branch name or not
-            if (std::find(variable_names_->begin(), variable_names_->end(), new_variable_name) != variable_names_->end()) {
-                printf("[DefineNewVariable] there is already %s variable\n", new_variable_name.c_str());
-                exit(1);
-            }
-
-            // copy variable list first, because we use it inside the module
-            variable_names = (*variable_names_);
-            VariableTypes = (*VariableTypes_);
-
-            // add variable
-            variable_names_->push_back(new_variable_name);
-            VariableTypes_->push_back("Double_t");
-        }
-
-        ~DefineNewVariable() {}
-
-        void Start() {
-
-        }
-
-        int Process(std::deque<Data>* data) {
-
-            for (std::deque<Data>::iterator iter = data->begin(); iter != data->end(); ) {
-
-                double result = EvaluatePostfixExpression(postfix_expr, iter->variable, &VariableTypes);
-
-                iter->variable.push_back(static_cast<double>(result));
-
-                ++iter;
-            }
 
-            return 1;
-        }
+        bool IsCheckpointable() override { return true; }
 
-        void End() {
+        std::string Fingerprint() override { return MakeFingerprint("RandomEventSelection", split_num, selected_index, Event_variable_list); }
+    };
 
-        }
+    /*
+    * a column added by `EventAggregate`. `function` is one of
+    *     count: the number of candidates in the event. `expressions` should be empty
+    *     sum, min, max, mean: of `expressions[0]` over candidates in the event
+    *     rank_highest, rank_lowest: rank of the candidate in the event, starting from 1. Later expressions break ties.
+    *         Candidates with the same values have the same rank, so `rank == 1` keeps the same candidates as `BCS`
+    */
+    struct EventAggregateColumn {
+        std::string name;
+        std::string function;
+        std::vector<std::string> expressions;
     };
 
-    class ConditionalPairDefineNewVariable : public Module {
+    class EventAggregate : public Module {
+        /*
+        * per-event aggregates and per-candidate ranks are added as new Double_t variables in one pass over events. Rows are not removed.
+        * In this module, we assume that
+        * 1. candidates from the same event are consecutive
+        * 2. candidates from the same event are in the same ROOT file
+        */
     private:
-        std::map<std::string, std::string> condition_equation__criteria_equation_list;
-        std::vector<std::pair<std::vector<Token>, std::vector<Token>>> condition_postfix_expr__criteria_postfix_expr_list;
+        enum class AggregateFunction { Count, Sum, Min, Max, Mean, RankHighest, RankLowest };
 
-        int condition_order; // start from 0. 0 means highest
-
-        std::vector<std::string> variable_names;
-        std::vector<std::string> VariableTypes;
+        std::vector<EventAggregateColumn> columns;
+        std::vector<AggregateFunction> functions;
+        std::vector<std::vector<std::vector<Token>>> postfix_exprs;
 
-        // FBDT class
-        std::string new_variable_name;
+        std::vector<std::string> Event_variable_list;
 
-    public:
-        ConditionalPairDefineNewVariable(std::map<std::string, std::string> condition_equation__criteria_equation_list_, int condition_order_, const char* new_variable_name_, std::vector<std::string>* variable_names_, std::vector<std::string>* VariableTypes_) : Module(), condition_equation__criteria_equation_list(condition_equation__criteria_equation_list_), condition_order(condition_order_), new_variable_name(new_variable_name_) {
-            // change variable name into placeholder
-            for (std::map<std::string, std::string>::iterator iter_eq = condition_equation__criteria_equation_list.begin(); iter_eq != condition_equation__criteria_equation_list.end(); ++iter_eq) {
-                std::string condition_replaced_expr = replaceVariables(iter_eq->first, variable_names_);
-                std::string criteria_replaced_expr = replaceVariables(iter_eq->second, variable_names_);
+        // index of event variables in `variable_names`
+        std::vector<int> event_variable_index_list;
 
-                condition_postfix_expr__criteria_postfix_expr_list.push_back(std::make_pair(PostfixExpression(condition_replaced_expr, VariableTypes_), PostfixExpression(criteria_replaced_expr, VariableTypes_)));
-            }
+        // values of expressions and results for candidates of the current event. They are kept to avoid re-allocation
+        std::vector<std::vector<std::vector<double>>> values;
+        std::vector<std::vector<double>> results;
+        std::vector<size_t> order;
 
-            // check `condition_order` is valid
-            if (condition_order >= condition_equation__criteria_equation_list.size()) {
-                printf("[ConditionalPairDefineNewVariable] condition order (%d) should be smaller than size of condition_equation__criteria_equation_list (%d)\n", condition_order, condition_equation__criteria_equation_list.size());
-                exit(1);
-            }
-            if (condition_order < 0) {
-                printf("[ConditionalPairDefineNewVariable] condition order (%d) should be larger or equal to 0.\n", condition_order);
-                exit(1);
-            }
+        SchemaPtr schema;
 
-            // check there is the same branch name or not
-            if (std::find(variable_names_->begin(), variable_names_->end(), new_variable_name) != variable_names_->end()) {
-                printf("[ConditionalPairDefineNewVariable] there is already %s variable\n", new_variable_name.c_str());
-                exit(1);
+        // compare values of two candidates for the rank. NaN is worse than any number
+        static int CompareRankValues(const std::vector<std::vector<double>>& values_, size_t lhs_, size_t rhs_, bool highest_) {
+            for (int i = 0; i < values_.size(); i++) {
+                double lhs = values_[i][lhs_];
+                double rhs = values_[i][rhs_];
+                if (std::isnan(lhs) || std::isnan(rhs)) {
+                    if (std::isnan(lhs) && std::isnan(rhs)) continue;
+                    return std::isnan(lhs) ? 1 : -1;
+                }
+                if (lhs == rhs) continue;
+                if (highest_) return (lhs > rhs) ? -1 : 1;
+                else return (lhs < rhs) ? -1 : 1;
             }
-
-            // copy variable list first, because we use it inside the module
-            variable_names = (*variable_names_);
-            VariableTypes = (*VariableTypes_);
-
-            // add variable
-            variable_names_->push_back(new_variable_name);
-            VariableTypes_->push_back("Double_t");
+            return 0;
         }
 
-        ~ConditionalPairDefineNewVariable() {}
-
-        void Start() {
+        void FillRanks(size_t Ncandidates_, const std::vector<std::vector<double>>& values_, bool highest_, std::vector<double>& ranks_) {
+            order.resize(Ncandidates_);
+            for (size_t j = 0; j < Ncandidates_; j++) order[j] = j;
+            std::stable_sort(order.begin(), order.end(), [&](size_t lhs, size_t rhs) { return CompareRankValues(values_, lhs, rhs, highest_) < 0; });
 
+            for (size_t k = 0; k < Ncandidates_; k++) {
+                if ((k != 0) && (CompareRankValues(values_, order[k - 1], order[k], highest_) == 0)) ranks_[order[k]] = ranks_[order[k - 1]];
+                else ranks_[order[k]] = k + 1;
+            }
         }
 
-        int Process(std::deque<Data>* data) {
-
-            for (std::deque<Data>::iterator iter = data->begin(); iter != data->end(); ) {
-
-                double condition_result = -1;
-                std::vector<double> condition_results;
-                double criteria_result = std::numeric_limits<double>::max();
-                std::vector<std::vector<Token>> criteria_postfix_exprs;
-
-                for (std::vector<std::pair<std::vector<Token>, std::vector<Token>>>::iterator iter_eq = condition_postfix_expr__criteria_postfix_expr_list.begin(); iter_eq != condition_postfix_expr__criteria_postfix_expr_list.end(); ++iter_eq) {
-                    double temp_ = EvaluatePostfixExpression(iter_eq->first, iter->variable, &VariableTypes);
-                    condition_results.push_back(temp_);
-                    criteria_postfix_exprs.push_back(iter_eq->second);
+    public:
+        EventAggregate(const std::vector<EventAggregateColumn> columns_, const std::vector<std::string> Event_variable_list_, SchemaPtr schema_, std::vector<std::string>* variable_names_, std::vector<std::string>* VariableTypes_) : Module(), columns(columns_), Event_variable_list(Event_variable_list_) {
+            for (int i = 0; i < columns.size(); i++) {
+                const EventAggregateColumn& column = columns.at(i);
+
+                if (column.function == "count") functions.push_back(AggregateFunction::Count);
+                else if (column.function == "sum") functions.push_back(AggregateFunction::Sum);
+                else if (column.function == "min") functions.push_back(AggregateFunction::Min);
+                else if (column.function == "max") functions.push_back(AggregateFunction::Max);
+                else if (column.function == "mean") functions.push_back(AggregateFunction::Mean);
+                else if (column.function == "rank_highest") functions.push_back(AggregateFunction::RankHighest);
+                else if (column.function == "rank_lowest") functions.push_back(AggregateFunction::RankLowest);
+                else {
+                    printf("[EventAggregate] unknown function: %s\n", column.function.c_str());
+                    exit(1);
                 }
 
-                std::vector<double> temp_condition_results = condition_results;
-                std::nth_element(temp_condition_results.begin(), temp_condition_results.begin() + condition_order, temp_condition_results.end(), std::greater<double>());
-
-                // The n-th largest value
-                condition_result = temp_condition_results.at(condition_order);
-
-                // Find the original index of the n-th largest value
-                std::vector<double>::iterator iter_condition_results = std::find(condition_results.begin(), condition_results.end(), condition_result);
-                std::size_t index = std::distance(condition_results.begin(), iter_condition_results);
-
-                criteria_result = EvaluatePostfixExpression(criteria_postfix_exprs.at(index), iter->variable, &VariableTypes);
-
-                iter->variable.push_back(static_cast<double>(criteria_result));
+                // check the number of expressions
+                bool IsRank = (functions.back() == AggregateFunction::RankHighest) || (functions.back() == AggregateFunction::RankLowest);
+                if ((functions.back() == AggregateFunction::Count) && (column.expressions.size() != 0)) {
+                    printf("[EventAggregate] count does not need expression: %s\n", column.name.c_str());
+                    exit(1);
+                }
+                else if ((functions.back() != AggregateFunction::Count) && !IsRank && (column.expressions.size() != 1)) {
+                    printf("[EventAggregate] %s needs one expression: %s\n", column.function.c_str(), column.name.c_str());
+                    exit(1);
+                }
+                else if (IsRank && (column.expressions.size() == 0)) {
+                    printf("[EventAggregate] %s needs at least one expression: %s\n", column.function.c_str(), column.name.c_str());
+                    exit(1);
+                }
 
-                ++iter;
+                // expressions can use only variables defined before this module
+                std::vector<std::vector<Token>> temp_postfix_exprs;
+                for (int j = 0; j < column.expressions.size(); j++) {
+                    std::string replaced_expr = replaceVariables(column.expressions.at(j), *schema_);
+                    temp_postfix_exprs.push_back(PostfixExpression(replaced_expr, *schema_));
+                }
+                postfix_exprs.push_back(temp_postfix_exprs);
             }
 
-            return 1;
-        }
+            schema = schema_;
 
-        void End() {
+            // add variables
+            for (int i = 0; i < columns.size(); i++) {
+                // variables added by this module are after the variables of `schema_`
+                if ((schema_->Index(columns.at(i).name) >= 0) || (std::find(variable_names_->begin() + schema_->Size(), variable_names_->end(), columns.at(i).name) != variable_names_->end())) {
+                    printf("[EventAggregate] there is already %s variable\n", columns.at(i).name.c_str());
+                    exit(1);
+                }
+                variable_names_->push_back(columns.at(i).name);
+                VariableTypes_->push_back("Double_t");
+            }
 
+            values.resize(columns.size());
+            for (int i = 0; i < columns.size(); i++) values.at(i).resize(columns.at(i).expressions.size());
+            results.resize(columns.size());
         }
-    };
-
-    class GetAverage : public Module {
-    private:
-        std::vector<std::string> equations;
-        std::vector<std::vector<Token>> postfix_exprs;
-
-        std::vector<std::string> variable_names;
-        std::vector<std::string> VariableTypes;
-
-        std::string new_variable_name;
 
-    public:
-        GetAverage(std::vector<std::string> equations_, const char* new_variable_name_, std::vector<std::string>* variable_names_, std::vector<std::string>* VariableTypes_) : Module(), equations(equations_), new_variable_name(new_variable_name_) {
-            // change variable name into placeholder
-            for (int i = 0; i < equations.size(); i++) {
-                std::string replaced_expr = replaceVariables(equations.at(i), variable_names_);
-                postfix_exprs.push_back(PostfixExpression(replaced_expr, VariableTypes_));
-            }
+        ~EventAggregate() {}
 
-            // check there is the same branch name or not
-            if (std::find(variable_names_->begin(), variable_names_->end(), new_variable_name) != variable_names_->end()) {
-                printf("[GetAverage] there is already %s variable\n", new_variable_name.c_str());
+        void Start() override {
+            // exception handling
+            if (Event_variable_list.size() == 0) {
+                printf("[EventAggregate] event variable should exist.\n");
                 exit(1);
             }
 
-            // copy variable list first, because we use it inside the module
-            variable_names = (*variable_names_);
-            VariableTypes = (*VariableTypes_);
-
-            // add variable
-            variable_names_->push_back(new_variable_name);
-            VariableTypes_->push_back("Double_t");
-        }
+            // find event variables
+            for (int i = 0; i < Event_variable_list.size(); i++) {
+                int event_variable_index = schema->Index(Event_variable_list.at(i));
 
-        ~GetAverage() {}
+                if (event_variable_index < 0) {
+                    printf("[EventAggregate] cannot find variable: %s\n", Event_variable_list.at(i).c_str());
+                    exit(1);
+                }
 
-        void Start() {
+                event_variable_index_list.push_back(event_variable_index);
+            }
+        }
 
+        int Process(std::deque<Data>* data) override {
+            std::vector<size_t> offsets;
+            ComputeEventOffsets(*data, event_variable_index_list, &offsets);
+            return ProcessEvents(data, &offsets);
         }
 
-        int Process(std::deque<Data>* data) {
+        std::vector<int> EventVariableIndices() override { return event_variable_index_list; }
 
-            for (std::deque<Data>::iterator iter = data->begin(); iter != data->end(); ) {
+        int ProcessEvents(std::deque<Data>* data, std::vector<size_t>* offsets) override {
+            for (size_t i = 0; i + 1 < offsets->size(); i++) {
+                size_t first = (*offsets)[i];
+                size_t Ncandidates = (*offsets)[i + 1] - first;
 
-                double avg = 0;
-                for (int i = 0; i < postfix_exprs.size(); i++) {
-                    double result = EvaluatePostfixExpression(postfix_exprs.at(i), iter->variable, &VariableTypes);
-                    avg = avg + result;
-                }
-                avg = avg / postfix_exprs.size();
+                for (int c = 0; c < columns.size(); c++) {
+                    // evaluate expressions for all candidates
+                    for (int k = 0; k < postfix_exprs[c].size(); k++) {
+                        values[c][k].resize(Ncandidates);
+                        for (size_t j = 0; j < Ncandidates; j++) values[c][k][j] = EvaluatePostfixExpression(postfix_exprs[c][k], (*data)[first + j].variable);
+                    }
 
-                iter->variable.push_back(avg);
+                    results[c].resize(Ncandidates);
+                    double aggregate = 0;
+                    switch (functions[c]) {
+                    case AggregateFunction::Count: aggregate = Ncandidates; break;
+                    case AggregateFunction::Sum: case AggregateFunction::Mean:
+                        for (size_t j = 0; j < Ncandidates; j++) aggregate = aggregate + values[c][0][j];
+                        if (functions[c] == AggregateFunction::Mean) aggregate = aggregate / Ncandidates;
+                        break;
+                    case AggregateFunction::Min: aggregate = *std::min_element(values[c][0].begin(), values[c][0].end()); break;
+                    case AggregateFunction::Max: aggregate = *std::max_element(values[c][0].begin(), values[c][0].end()); break;
+                    case AggregateFunction::RankHighest: FillRanks(Ncandidates, values[c], true, results[c]); continue;
+                    case AggregateFunction::RankLowest: FillRanks(Ncandidates, values[c], false, results[c]); continue;
+                    }
+                    std::fill(results[c].begin(), results[c].end(), aggregate);
+                }
 
-                ++iter;
+                // add new variables
+                for (size_t j = 0; j < Ncandidates; j++) {
+                    for (int c = 0; c < columns.size(); c++) (*data)[first + j].variable.push_back(results[c][j]);
+                }
             }
 
             return 1;
         }
 
-        void End() {
+        void End() override {}
+
+        bool IsCheckpointable() override { return true; }
 
+        std::string Fingerprint() override {
+            std::vector<std::string> names;
+            std::vector<std::string> function_names;
+            std::vector<std::vector<std::string>> expressions;
+            for (int i = 0; i < columns.size(); i++) {
+                names.push_back(columns.at(i).name);
+                function_names.push_back(columns.at(i).function);
+                expressions.push_back(columns.at(i).expressions);
+            }
+            return MakeFingerprint("EventAggregate", names, function_names, expressions, Event_variable_list);
         }
     };
 
-    class GetStdDev : public Module {
+    class DefineNewVariable : public Module {
     private:
-        std::vector<std::string> equations;
-        std::vector<std::vector<Token>> postfix_exprs;
+        std::string equation;
+        std::string replaced_expr;
+        std::vector<Token> postfix_expr;
 
-        std::vector<std::string> variable_names;
-        std::vector<std::string> VariableTypes;
 
+        // FBDT class
         std::string new_variable_name;
 
     public:
-        GetStdDev(std::vector<std::string> equations_, const char* new_variable_name_, std::vector<std::string>* variable_names_, std::vector<std::string>* VariableTypes_) : Module(), equations(equations_), new_variable_name(new_variable_name_) {
+        DefineNewVariable(const char* equation_, const char* new_variable_name_, SchemaPtr schema_, std::vector<std::string>* variable_names_, std::vector<std::string>* VariableTypes_) : Module(), equation(equation_), new_variable_name(new_variable_name_) {
             // change variable name into placeholder
-            for (int i = 0; i < equations.size(); i++) {
-                std::string replaced_expr = replaceVariables(equations.at(i), variable_names_);
-                postfix_exprs.push_back(PostfixExpression(replaced_expr, VariableTypes_));
-            }
+            replaced_expr = replaceVariables(equation, *schema_);
+            postfix_expr = PostfixExpression(replaced_expr, *schema_);
 
             // check there is the same branch name or not
-            if (std::find(variable_names_->begin(), variable_names_->end(), new_variable_name) != variable_names_->end()) {
-                printf("[GetStdDev] there is already %s variable\n", new_variable_name.c_str());
+            if (schema_->Index(new_variable_name) >= 0) {
+                printf("[DefineNewVariable] there is already %s variable\n", new_variable_name.c_str());
                 exit(1);
             }
 
-            // copy variable list first, because we use it inside the module
-            variable_names = (*variable_names_);
-            VariableTypes = (*VariableTypes_);
-
             // add variable
             variable_names_->push_back(new_variable_name);
             VariableTypes_->push_back("Double_t");
         }
 
-        ~GetStdDev() {}
+        ~DefineNewVariable() {}
 
-        void Start() {
+        void Start() override {
 
         }
 
-        int Process(std::deque<Data>* data) {
+        int Process(std::deque<Data>* data) override {
+            for (std::deque<Data>::iterator iter = data->begin(); iter != data->end(); ++iter) ProcessRow(iter);
+            return 1;
+        }
 
-            for (std::deque<Data>::iterator iter = data->begin(); iter != data->end(); ) {
+        bool IsRowLocal() override { return true; }
 
-                double avg = 0;
-                for (int i = 0; i < postfix_exprs.size(); i++) {
-                    double result = EvaluatePostfixExpression(postfix_exprs.at(i), iter->variable, &VariableTypes);
-                    avg = avg + result;
-                }
-                avg = avg / postfix_exprs.size();
+        bool ProcessRow(std::deque<Data>::iterator iter) override {
+            double result = EvaluatePostfixExpression(postfix_expr, iter->variable);
 
-                double std = 0;
-                for (int i = 0; i < postfix_exprs.size(); i++) {
-                    double result = EvaluatePostfixExpression(postfix_exprs.at(i), iter->variable, &VariableTypes);
-                    std = std + (result - avg) * (result - avg);
-                }
-                std = std / postfix_exprs.size();
-                std = std::sqrt(std);
+            iter->variable.push_back(static_cast<double>(result));
 
-                iter->variable.push_back(std);
+            return true;
+        }
 
-                ++iter;
-            }
+        void End() override {
 
-            return 1;
         }
 
-        void End() {
+        bool IsCheckpointable() override { return true; }
 
-        }
+        std::string Fingerprint() override { return MakeFingerprint("DefineNewVariable", equation, new_variable_name); }
     };
 
-    class GetDiff : public Module {
+    class ConditionalPairDefineNewVariable : public Module {
     private:
-        std::vector<std::string> equations;
-        std::vector<std::vector<Token>> postfix_exprs;
+        std::map<std::string, std::string> condition_equation__criteria_equation_list;
+        std::vector<std::vector<Token>> condition_postfix_exprs;
+        std::vector<std::vector<Token>> criteria_postfix_exprs;
 
-        std::vector<std::string> variable_names;
-        std::vector<std::string> VariableTypes;
+        int condition_order; // start from 0. 0 means highest
 
-        int order;
+        // results of conditions for the current row. It is kept to avoid allocation for every row
+        std::vector<double> condition_results;
 
+
+        // FBDT class
         std::string new_variable_name;
 
     public:
-        GetDiff(std::vector<std::string> equations_, int order_, const char* new_variable_name_, std::vector<std::string>* variable_names_, std::vector<std::string>* VariableTypes_) : Module(), equations(equations_), order(order_), new_variable_name(new_variable_name_) {
+        ConditionalPairDefineNewVariable(std::map<std::string, std::string> condition_equation__criteria_equation_list_, int condition_order_, const char* new_variable_name_, SchemaPtr schema_, std::vector<std::string>* variable_names_, std::vector<std::string>* VariableTypes_) : Module(), condition_equation__criteria_equation_list(condition_equation__criteria_equation_list_), condition_order(condition_order_), new_variable_name(new_variable_name_) {
             // change variable name into placeholder
-            for (int i = 0; i < equations.size(); i++) {
-                std::string replaced_expr = replaceVariables(equations.at(i), variable_names_);
-                postfix_exprs.push_back(PostfixExpression(replaced_expr, VariableTypes_));
+            for (std::map<std::string, std::string>::iterator iter_eq = condition_equation__criteria_equation_list.begin(); iter_eq != condition_equation__criteria_equation_list.end(); ++iter_eq) {
+                std::string condition_replaced_expr = replaceVariables(iter_eq->first, *schema_);
+                std::string criteria_replaced_expr = replaceVariables(iter_eq->second, *schema_);
+
+                condition_postfix_exprs.push_back(PostfixExpression(condition_replaced_expr, *schema_));
+                criteria_postfix_exprs.push_back(PostfixExpression(criteria_replaced_expr, *schema_));
             }
+            condition_results.resize(condition_postfix_exprs.size());
 
-            // check there is the same branch name or not
-            if (std::find(variable_names_->begin(), variable_names_->end(), new_variable_name) != variable_names_->end()) {
-                printf("[GetDiff] there is already %s variable\n", new_variable_name.c_str());
+            // check `condition_order` is valid
+            if (condition_order >= condition_equation__criteria_equation_list.size()) {
+                printf("[ConditionalPairDefineNewVariable] condition order (%d) should be smaller than size of condition_equation__criteria_equation_list (%d)\n", condition_order, condition_equation__criteria_equation_list.size());
                 exit(1);
             }
-
-            int N_comb = postfix_exprs.size() * (postfix_exprs.size() - 1) / 2;
-            if ((order < 0) || (order > (N_comb - 1))) {
-                printf("[GetDiff] order should be within [%d,%d]\n", 0, N_comb - 1);
+            if (condition_order < 0) {
+                printf("[ConditionalPairDefineNewVariable] condition order (%d) should be larger or equal to 0.\n", condition_order);
                 exit(1);
             }
 
-            // copy variable list first, because we use it inside the module
-            variable_names = (*variable_names_);
-            VariableTypes = (*VariableTypes_);
+            // check there is the same branch name or not
+            if (schema_->Index(new_variable_name) >= 0) {
+                printf("[ConditionalPairDefineNewVariable] there is already %s variable\n", new_variable_name.c_str());
+                exit(1);
+            }
 
             // add variable
             variable_names_->push_back(new_variable_name);
             VariableTypes_->push_back("Double_t");
         }
 
-        ~GetDiff() {}
+        ~ConditionalPairDefineNewVariable() {}
 
-        void Start() {
+        void Start() override {
 
         }
 
-        int Process(std::deque<Data>* data) {
-
-            for (std::deque<Data>::iterator iter = data->begin(); iter != data->end(); ) {
+        int Process(std::deque<Data>* data) override {
+            for (std::deque<Data>::iterator iter = data->begin(); iter != data->end(); ++iter) ProcessRow(iter);
+            return 1;
+        }
 
-                std::vector<double> inputs;
-                for (int i = 0; i < postfix_exprs.size(); i++) {
-                    double result = EvaluatePostfixExpression(postfix_exprs.at(i), iter->variable, &VariableTypes);
-                    inputs.push_back(result);
-                }
+        bool IsRowLocal() override { return true; }
 
-                std::vector<double> Diffs;
-                for (int i = 0; i < postfix_exprs.size(); i++) {
-                    double result_i = EvaluatePostfixExpression(postfix_exprs.at(i), iter->variable, &VariableTypes);
-                    for (int j = i + 1; j < postfix_exprs.size(); j++) {
-                        double result_j = EvaluatePostfixExpression(postfix_exprs.at(j), iter->variable, &VariableTypes);
-                        Diffs.push_back(std::abs(result_i - result_j));
-                    }
-                }
+        bool ProcessRow(std::deque<Data>::iterator iter) override {
+            for (int i = 0; i < condition_postfix_exprs.size(); i++) condition_results[i] = EvaluatePostfixExpression(condition_postfix_exprs[i], iter->variable);
 
-                std::sort(Diffs.begin(), Diffs.end(), std::greater<double>());
+            // the first condition which is the n-th largest one. Only its criteria is evaluated
+            int index = KthLargestIndex(condition_results.data(), condition_results.size(), condition_order);
 
-                iter->variable.push_back(Diffs.at(order));
+            double criteria_result = std::numeric_limits<double>::quiet_NaN();
+            if (index >= 0) criteria_result = EvaluatePostfixExpression(criteria_postfix_exprs[index], iter->variable);
 
-                ++iter;
-            }
+            iter->variable.push_back(static_cast<double>(criteria_result));
 
-            return 1;
+            return true;
         }
 
-        void End() {
+        void End() override {
 
         }
+
+        bool IsCheckpointable() override { return true; }
+
+        std::string Fingerprint() override { return MakeFingerprint("ConditionalPairDefineNewVariable", condition_equation__criteria_equation_list, condition_order, new_variable_name); }
+    };
+
+    /*
+    * an output of `Reduce`. `function` is one of
+    *     mean, std, sum, min, max: of all inputs
+    *     diff: `order`-th largest |x_i - x_j| among all pairs of inputs (0 is the largest)
+    *     add: `order`-th largest x_i + x_j among all pairs of inputs (0 is the largest)
+    */
+    struct ReductionOutput {
+        std::string name;
+        std::string function;
+        int order = 0;
     };
 
-    class GetAdd : public Module {
+    class Reduce : public Module {
+        /*
+        * inputs are evaluated only once for each row, and all outputs are computed from them. All new variables are Double_t.
+        */
     private:
+        enum class ReductionFunction { Mean, StdDev, Sum, Min, Max, Diff, Add };
+
         std::vector<std::string> equations;
         std::vector<std::vector<Token>> postfix_exprs;
 
-        std::vector<std::string> variable_names;
-        std::vector<std::string> VariableTypes;
+        std::vector<ReductionOutput> outputs;
+        std::vector<ReductionFunction> functions;
 
-        int order;
+        // values of the current row. They are kept to avoid allocation for every row
+        std::vector<double> inputs;
+        std::vector<double> pairs;
 
-        std::string new_variable_name;
+
+        double Mean() const {
+            double sum = 0;
+            for (int i = 0; i < inputs.size(); i++) sum = sum + inputs[i];
+            return sum / inputs.size();
+        }
+
+        // `order`-th largest value of the pairs
+        double SelectPair(bool IsDiff_, int order_) {
+            pairs.clear();
+            for (int i = 0; i < inputs.size(); i++) {
+                for (int j = i + 1; j < inputs.size(); j++) {
+                    if (IsDiff_) pairs.push_back(std::abs(inputs[i] - inputs[j]));
+                    else pairs.push_back(inputs[i] + inputs[j]);
+                }
+            }
+            std::nth_element(pairs.begin(), pairs.begin() + order_, pairs.end(), std::greater<double>());
+            return pairs[order_];
+        }
 
     public:
-        GetAdd(std::vector<std::string> equations_, int order_, const char* new_variable_name_, std::vector<std::string>* variable_names_, std::vector<std::string>* VariableTypes_) : Module(), equations(equations_), order(order_), new_variable_name(new_variable_name_) {
+        Reduce(std::vector<std::string> equations_, std::vector<ReductionOutput> outputs_, SchemaPtr schema_, std::vector<std::string>* variable_names_, std::vector<std::string>* VariableTypes_) : Module(), equations(equations_), outputs(outputs_) {
             // change variable name into placeholder
             for (int i = 0; i < equations.size(); i++) {
-                std::string replaced_expr = replaceVariables(equations.at(i), variable_names_);
-                postfix_exprs.push_back(PostfixExpression(replaced_expr, VariableTypes_));
-            }
-
-            // check there is the same branch name or not
-            if (std::find(variable_names_->begin(), variable_names_->end(), new_variable_name) != variable_names_->end()) {
-                printf("[GetAdd] there is already %s variable\n", new_variable_name.c_str());
-                exit(1);
+                std::string replaced_expr = replaceVariables(equations.at(i), *schema_);
+                postfix_exprs.push_back(PostfixExpression(replaced_expr, *schema_));
             }
 
             int N_comb = postfix_exprs.size() * (postfix_exprs.size() - 1) / 2;
-            if ((order < 0) || (order > (N_comb - 1))) {
-                printf("[GetAdd] order should be within [%d,%d]\n", 0, N_comb - 1);
-                exit(1);
+            for (int i = 0; i < outputs.size(); i++) {
+                const std::string& function = outputs.at(i).function;
+                if (function == "mean") functions.push_back(ReductionFunction::Mean);
+                else if (function == "std") functions.push_back(ReductionFunction::StdDev);
+                else if (function == "sum") functions.push_back(ReductionFunction::Sum);
+                else if (function == "min") functions.push_back(ReductionFunction::Min);
+                else if (function == "max") functions.push_back(ReductionFunction::Max);
+                else if (function == "diff") functions.push_back(ReductionFunction::Diff);
+                else if (function == "add") functions.push_back(ReductionFunction::Add);
+                else {
+                    printf("[Reduce] unknown function: %s\n", function.c_str());
+                    exit(1);
+                }
+
+                if ((functions.back() == ReductionFunction::Diff) || (functions.back() == ReductionFunction::Add)) {
+                    if ((outputs.at(i).order < 0) || (outputs.at(i).order > (N_comb - 1))) {
+                        printf("[Reduce] order of %s should be within [%d,%d]\n", outputs.at(i).name.c_str(), 0, N_comb - 1);
+                        exit(1);
+                    }
+                }
+                else if (((functions.back() == ReductionFunction::Min) || (functions.back() == ReductionFunction::Max)) && (postfix_exprs.size() == 0)) {
+                    printf("[Reduce] %s needs at least one input\n", outputs.at(i).name.c_str());
+                    exit(1);
+                }
             }
 
-            // copy variable list first, because we use it inside the module
-            variable_names = (*variable_names_);
-            VariableTypes = (*VariableTypes_);
+            // add variables
+            for (int i = 0; i < outputs.size(); i++) {
+                // variables added by this module are after the variables of `schema_`
+                if ((schema_->Index(outputs.at(i).name) >= 0) || (std::find(variable_names_->begin() + schema_->Size(), variable_names_->end(), outputs.at(i).name) != variable_names_->end())) {
+                    printf("[Reduce] there is already %s variable\n", outputs.at(i).name.c_str());
+                    exit(1);
+                }
+                variable_names_->push_back(outputs.at(i).name);
+                VariableTypes_->push_back("Double_t");
+            }
 
-            // add variable
-            variable_names_->push_back(new_variable_name);
-            VariableTypes_->push_back("Double_t");
+            inputs.resize(postfix_exprs.size());
+            pairs.reserve(N_comb);
         }
 
-        ~GetAdd() {}
+        ~Reduce() {}
 
-        void Start() {
+        void Start() override {
 
         }
 
-        int Process(std::deque<Data>* data) {
+        int Process(std::deque<Data>* data) override {
+            for (std::deque<Data>::iterator iter = data->begin(); iter != data->end(); ++iter) ProcessRow(iter);
+            return 1;
+        }
 
-            for (std::deque<Data>::iterator iter = data->begin(); iter != data->end(); ) {
+        bool IsRowLocal() override { return true; }
 
-                std::vector<double> inputs;
-                for (int i = 0; i < postfix_exprs.size(); i++) {
-                    double result = EvaluatePostfixExpression(postfix_exprs.at(i), iter->variable, &VariableTypes);
-                    inputs.push_back(result);
-                }
+        bool ProcessRow(std::deque<Data>::iterator iter) override {
+            for (int i = 0; i < postfix_exprs.size(); i++) inputs[i] = EvaluatePostfixExpression(postfix_exprs[i], iter->variable);
 
-                std::vector<double> Adds;
-                for (int i = 0; i < postfix_exprs.size(); i++) {
-                    double result_i = EvaluatePostfixExpression(postfix_exprs.at(i), iter->variable, &VariableTypes);
-                    for (int j = i + 1; j < postfix_exprs.size(); j++) {
-                        double result_j = EvaluatePostfixExpression(postfix_exprs.at(j), iter->variable, &VariableTypes);
-                        Adds.push_back(result_i + result_j);
-                    }
+            for (int i = 0; i < outputs.size(); i++) {
+                double result = 0;
+                switch (functions[i]) {
+                case ReductionFunction::Mean: result = Mean(); break;
+                case ReductionFunction::StdDev: {
+                    double avg = Mean();
+                    for (int j = 0; j < inputs.size(); j++) result = result + (inputs[j] - avg) * (inputs[j] - avg);
+                    result = std::sqrt(result / inputs.size());
+                    break;
+                }
+                case ReductionFunction::Sum: for (int j = 0; j < inputs.size(); j++) result = result + inputs[j]; break;
+                case ReductionFunction::Min: result = *std::min_element(inputs.begin(), inputs.end()); break;
+                case ReductionFunction::Max: result = *std::max_element(inputs.begin(), inputs.end()); break;
+                case ReductionFunction::Diff: result = SelectPair(true, outputs[i].order); break;
+                case ReductionFunction::Add: result = SelectPair(false, outputs[i].order); break;
                 }
 
-                std::sort(Adds.begin(), Adds.end(), std::greater<double>());
+                iter->variable.push_back(result);
+            }
 
-                iter->variable.push_back(Adds.at(order));
+            return true;
+        }
 
-                ++iter;
-            }
+        void End() override {
 
-            return 1;
         }
 
-        void End() {
+        bool IsCheckpointable() override { return true; }
 
+        std::string Fingerprint() override {
+            std::vector<std::string> names;
+            std::vector<std::string> function_names;
+            std::vector<int> orders;
+            for (int i = 0; i < outputs.size(); i++) {
+                names.push_back(outputs.at(i).name);
+                function_names.push_back(outputs.at(i).function);
+                orders.push_back(outputs.at(i).order);
+            }
+            return MakeFingerprint("Reduce", equations, names, function_names, orders);
         }
     };
 
+    // the average of inputs
+    class GetAverage : public Reduce {
+    public:
+        GetAverage(std::vector<std::string> equations_, const char* new_variable_name_, SchemaPtr schema_, std::vector<std::string>* variable_names_, std::vector<std::string>* VariableTypes_) : Reduce(equations_, { { new_variable_name_, "mean" } }, schema_, variable_names_, VariableTypes_) {}
+    };
+
+    // the standard deviation of inputs
+    class GetStdDev : public Reduce {
+    public:
+        GetStdDev(std::vector<std::string> equations_, const char* new_variable_name_, SchemaPtr schema_, std::vector<std::string>* variable_names_, std::vector<std::string>* VariableTypes_) : Reduce(equations_, { { new_variable_name_, "std" } }, schema_, variable_names_, VariableTypes_) {}
+    };
+
+    // `order_`-th largest difference between two inputs
+    class GetDiff : public Reduce {
+    public:
+        GetDiff(std::vector<std::string> equations_, int order_, const char* new_variable_name_, SchemaPtr schema_, std::vector<std::string>* variable_names_, std::vector<std::string>* VariableTypes_) : Reduce(equations_, { { new_variable_name_, "diff", order_ } }, schema_, variable_names_, VariableTypes_) {}
+    };
+
+    // `order_`-th largest sum of two inputs
+    class GetAdd : public Reduce {
+    public:
+        GetAdd(std::vector<std::string> equations_, int order_, const char* new_variable_name_, SchemaPtr schema_, std::vector<std::string>* variable_names_, std::vector<std::string>* VariableTypes_) : Reduce(equations_, { { new_variable_name_, "add", order_ } }, schema_, variable_names_, VariableTypes_) {}
+    };
+
     class FillDataSet : public Module {
         /*
         * This module is used to fill RooDataSet
@@ -3824,38 +5793,47 @@ namespace Module {
         std::vector<std::string> equations;
         std::vector<std::vector<Token>> postfix_exprs;
 
-        std::vector<std::string> variable_names;
-        std::vector<std::string> VariableTypes;
+        SchemaPtr schema;
 
     public:
-        FillDataSet(RooDataSet* dataset_, std::vector<RooRealVar*> realvars_, std::vector<std::string> equations_, std::vector<std::string>* variable_names_, std::vector<std::string>* VariableTypes_) : Module(), dataset(dataset_), realvars(realvars_), equations(equations_), variable_names(*variable_names_), VariableTypes(*VariableTypes_) {}
+        FillDataSet(RooDataSet* dataset_, std::vector<RooRealVar*> realvars_, std::vector<std::string> equations_, SchemaPtr schema_) : Module(), dataset(dataset_), realvars(realvars_), equations(equations_), schema(schema_) {}
         ~FillDataSet() {}
-        void Start() {
+        void Start() override {
             for (int i = 0; i < equations.size(); i++) {
                 std::string equation = equations.at(i);
-                std::string replaced_expr = replaceVariables(equation, &variable_names);
-                postfix_exprs.push_back(PostfixExpression(replaced_expr, &VariableTypes));
+                std::string replaced_expr = replaceVariables(equation, *schema);
+                postfix_exprs.push_back(PostfixExpression(replaced_expr, *schema));
             }
 
         }
         int Process(std::deque<Data>* data) override {
-            for (std::deque<Data>::iterator iter = data->begin(); iter != data->end(); ) {
-                for (int i = 0; i < postfix_exprs.size(); i++) {
-                    std::vector<Token> postfix_expr = postfix_exprs.at(i);
-                    double result = EvaluatePostfixExpression(postfix_expr, iter->variable, &VariableTypes);
-                    *(realvars.at(i)) = result;
-                }
-
-                RooArgSet temp_;
-                for (int i = 0; i < postfix_exprs.size(); i++) temp_.add(*(realvars.at(i)));
+            for (std::deque<Data>::iterator iter = data->begin(); iter != data->end(); ++iter) ProcessRow(iter);
+            return 1;
+        }
 
-                dataset->add(temp_, ObtainWeight(iter, variable_names));
+        bool IsRowLocal() override { return true; }
 
-                ++iter;
+        bool ProcessRow(std::deque<Data>::iterator iter) override {
+            for (int i = 0; i < postfix_exprs.size(); i++) {
+                double result = EvaluatePostfixExpression(postfix_exprs.at(i), iter->variable);
+                *(realvars.at(i)) = result;
             }
-            return 1;
+
+            RooArgSet temp_;
+            for (int i = 0; i < postfix_exprs.size(); i++) temp_.add(*(realvars.at(i)));
+
+            dataset->add(temp_, ObtainWeight(iter, schema->Names()));
+
+            return true;
         }
         void End() override {}
+
+        std::string Fingerprint() override {
+            std::vector<std::string> realvar_names;
+            for (int i = 0; i < realvars.size(); i++) realvar_names.push_back(realvars.at(i)->GetName());
+            return MakeFingerprint("FillDataSet", std::string(dataset->GetName()), realvar_names, equations);
+        }
+        bool IsTerminal() override { return true; }
     };
 
     class FillTProfile : public Module {
@@ -3877,30 +5855,36 @@ namespace Module {
         std::string replaced_expr_y;
         std::vector<Token> postfix_expr_y;
 
-        std::vector<std::string> variable_names;
-        std::vector<std::string> VariableTypes;
+        SchemaPtr schema;
 
     public:
-        FillTProfile(TProfile* tprofile_, std::string equation_x_, std::string equation_y_, std::vector<std::string>* variable_names_, std::vector<std::string>* VariableTypes_) : Module(), tprofile(tprofile_), equation_x(equation_x_), equation_y(equation_y_), variable_names(*variable_names_), VariableTypes(*VariableTypes_) {}
+        FillTProfile(TProfile* tprofile_, std::string equation_x_, std::string equation_y_, SchemaPtr schema_) : Module(), tprofile(tprofile_), equation_x(equation_x_), equation_y(equation_y_), schema(schema_) {}
         ~FillTProfile() {}
-        void Start() {
-            replaced_expr_x = replaceVariables(equation_x, &variable_names);
-            replaced_expr_y = replaceVariables(equation_y, &variable_names);
-            postfix_expr_x = PostfixExpression(replaced_expr_x, &VariableTypes);
-            postfix_expr_y = PostfixExpression(replaced_expr_y, &VariableTypes);
+        void Start() override {
+            replaced_expr_x = replaceVariables(equation_x, *schema);
+            replaced_expr_y = replaceVariables(equation_y, *schema);
+            postfix_expr_x = PostfixExpression(replaced_expr_x, *schema);
+            postfix_expr_y = PostfixExpression(replaced_expr_y, *schema);
         }
         int Process(std::deque<Data>* data) override {
-            for (std::deque<Data>::iterator iter = data->begin(); iter != data->end(); ) {
-                double result_x = EvaluatePostfixExpression(postfix_expr_x, iter->variable, &VariableTypes);
-                double result_y = EvaluatePostfixExpression(postfix_expr_y, iter->variable, &VariableTypes);
+            for (std::deque<Data>::iterator iter = data->begin(); iter != data->end(); ++iter) ProcessRow(iter);
+            return 1;
+        }
 
-                tprofile->Fill(result_x, result_y, ObtainWeight(iter, variable_names));
+        bool IsRowLocal() override { return true; }
 
-                ++iter;
-            }
-            return 1;
+        bool ProcessRow(std::deque<Data>::iterator iter) override {
+            double result_x = EvaluatePostfixExpression(postfix_expr_x, iter->variable);
+            double result_y = EvaluatePostfixExpression(postfix_expr_y, iter->variable);
+
+            tprofile->Fill(result_x, result_y, ObtainWeight(iter, schema->Names()));
+
+            return true;
         }
         void End() override {}
+
+        std::string Fingerprint() override { return MakeFingerprint("FillTProfile", std::string(tprofile->GetName()), equation_x, equation_y); }
+        bool IsTerminal() override { return true; }
     };
 
     class FillTH1D : public Module {
@@ -3915,27 +5899,44 @@ namespace Module {
         std::string replaced_expr;
         std::vector<Token> postfix_expr;
 
-        std::vector<std::string> variable_names;
-        std::vector<std::string> VariableTypes;
+        SchemaPtr schema;
 
     public:
-        FillTH1D(TH1D* th1d_, std::string equation_, std::vector<std::string>* variable_names_, std::vector<std::string>* VariableTypes_) : Module(), th1d(th1d_), equation(equation_), variable_names(*variable_names_), VariableTypes(*VariableTypes_) {}
+        FillTH1D(TH1D* th1d_, std::string equation_, SchemaPtr schema_) : Module(), th1d(th1d_), equation(equation_), schema(schema_) {}
         ~FillTH1D() {}
-        void Start() {
-            replaced_expr = replaceVariables(equation, &variable_names);
-            postfix_expr = PostfixExpression(replaced_expr, &VariableTypes);
+        void Start() override {
+            replaced_expr = replaceVariables(equation, *schema);
+            postfix_expr = PostfixExpression(replaced_expr, *schema);
         }
         int Process(std::deque<Data>* data) override {
-            for (std::deque<Data>::iterator iter = data->begin(); iter != data->end(); ) {
-                double result = EvaluatePostfixExpression(postfix_expr, iter->variable, &VariableTypes);
+            for (std::deque<Data>::iterator iter = data->begin(); iter != data->end(); ++iter) ProcessRow(iter);
+            return 1;
+        }
 
-                th1d->Fill(result, ObtainWeight(iter, variable_names));
+        bool IsRowLocal() override { return true; }
 
-                ++iter;
-            }
-            return 1;
+        bool ProcessRow(std::deque<Data>::iterator iter) override {
+            double result = EvaluatePostfixExpression(postfix_expr, iter->variable);
+
+            th1d->Fill(result, ObtainWeight(iter, schema->Names()));
+
+            return true;
         }
         void End() override {}
+
+        // the histogram is owned by the user, but it is filled only by this module
+        bool IsCheckpointable() override { return true; }
+
+        void SaveState(std::ostream& out_) override {
+            SaveHistogramState(out_, th1d);
+        }
+
+        void LoadState(std::istream& in_) override {
+            AddHistogramState(in_, th1d);
+        }
+
+        std::string Fingerprint() override { return MakeFingerprint("FillTH1D", std::string(th1d->GetName()), equation); }
+        bool IsTerminal() override { return true; }
     };
 
     class FillCustomizedTH1D : public Module {
@@ -3950,34 +5951,52 @@ namespace Module {
         std::vector<std::string> equations;
         std::vector<std::vector<Token>> postfix_exprs;
 
-        std::vector<std::string> variable_names;
-        std::vector<std::string> VariableTypes;
+        SchemaPtr schema;
 
     public:
-        FillCustomizedTH1D(TH1D* th1d_, std::vector<std::string> equations_, double (*custom_function_)(std::vector<double>), std::vector<std::string>* variable_names_, std::vector<std::string>* VariableTypes_) : Module(), th1d(th1d_), equations(equations_), custom_function(custom_function_), variable_names(*variable_names_), VariableTypes(*VariableTypes_) {}
+        FillCustomizedTH1D(TH1D* th1d_, std::vector<std::string> equations_, double (*custom_function_)(std::vector<double>), SchemaPtr schema_) : Module(), th1d(th1d_), equations(equations_), custom_function(custom_function_), schema(schema_) {}
         ~FillCustomizedTH1D() {}
-        void Start() {
+        void Start() override {
             for (int i = 0; i < equations.size(); i++) {
-                std::string replaced_expr = replaceVariables(equations.at(i), &variable_names);
-                postfix_exprs.push_back(PostfixExpression(replaced_expr, &VariableTypes));
+                std::string replaced_expr = replaceVariables(equations.at(i), *schema);
+                postfix_exprs.push_back(PostfixExpression(replaced_expr, *schema));
             }
         }
         int Process(std::deque<Data>* data) override {
-            for (std::deque<Data>::iterator iter = data->begin(); iter != data->end(); ) {
-                std::vector<double> results;
-                for (int i = 0; i < postfix_exprs.size(); i++) {
-                    double result = EvaluatePostfixExpression(postfix_exprs.at(i), iter->variable, &VariableTypes);
-                    results.push_back(result);
-                }
+            for (std::deque<Data>::iterator iter = data->begin(); iter != data->end(); ++iter) ProcessRow(iter);
+            return 1;
+        }
 
-                double filled_value = custom_function(results);
-                if(std::isnan(filled_value) == false) th1d->Fill(custom_function(results), ObtainWeight(iter, variable_names));
+        bool IsRowLocal() override { return true; }
 
-                ++iter;
+        bool ProcessRow(std::deque<Data>::iterator iter) override {
+            std::vector<double> results;
+            for (int i = 0; i < postfix_exprs.size(); i++) {
+                double result = EvaluatePostfixExpression(postfix_exprs.at(i), iter->variable);
+                results.push_back(result);
             }
-            return 1;
+
+            double filled_value = custom_function(results);
+            if(std::isnan(filled_value) == false) th1d->Fill(custom_function(results), ObtainWeight(iter, schema->Names()));
+
+            return true;
         }
         void End() override {}
+
+        // the histogram is owned by the user, but it is filled only by this module
+        bool IsCheckpointable() override { return true; }
+
+        void SaveState(std::ostream& out_) override {
+            SaveHistogramState(out_, th1d);
+        }
+
+        void LoadState(std::istream& in_) override {
+            AddHistogramState(in_, th1d);
+        }
+
+        // the custom function cannot be compared, so only its inputs are used
+        std::string Fingerprint() override { return MakeFingerprint("FillCustomizedTH1D", std::string(th1d->GetName()), equations); }
+        bool IsTerminal() override { return true; }
     };
 
     class FillTH2D : public Module {
@@ -3995,30 +6014,47 @@ namespace Module {
         std::string y_replaced_expr;
         std::vector<Token> y_postfix_expr;
 
-        std::vector<std::string> variable_names;
-        std::vector<std::string> VariableTypes;
+        SchemaPtr schema;
 
     public:
-        FillTH2D(TH2D* th2d_, const char* x_expression_, const char* y_expression_, std::vector<std::string>* variable_names_, std::vector<std::string>* VariableTypes_) : Module(), th2d(th2d_), x_expression(x_expression_), y_expression(y_expression_), variable_names(*variable_names_), VariableTypes(*VariableTypes_) {}
+        FillTH2D(TH2D* th2d_, const char* x_expression_, const char* y_expression_, SchemaPtr schema_) : Module(), th2d(th2d_), x_expression(x_expression_), y_expression(y_expression_), schema(schema_) {}
         ~FillTH2D() {}
-        void Start() {
-            x_replaced_expr = replaceVariables(x_expression, &variable_names);
-            y_replaced_expr = replaceVariables(y_expression, &variable_names);
-            x_postfix_expr = PostfixExpression(x_replaced_expr, &VariableTypes);
-            y_postfix_expr = PostfixExpression(y_replaced_expr, &VariableTypes);
+        void Start() override {
+            x_replaced_expr = replaceVariables(x_expression, *schema);
+            y_replaced_expr = replaceVariables(y_expression, *schema);
+            x_postfix_expr = PostfixExpression(x_replaced_expr, *schema);
+            y_postfix_expr = PostfixExpression(y_replaced_expr, *schema);
         }
         int Process(std::deque<Data>* data) override {
-            for (std::deque<Data>::iterator iter = data->begin(); iter != data->end(); ) {
-                double x_result = EvaluatePostfixExpression(x_postfix_expr, iter->variable, &VariableTypes);
-                double y_result = EvaluatePostfixExpression(y_postfix_expr, iter->variable, &VariableTypes);
+            for (std::deque<Data>::iterator iter = data->begin(); iter != data->end(); ++iter) ProcessRow(iter);
+            return 1;
+        }
 
-                th2d->Fill(x_result, y_result, ObtainWeight(iter, variable_names));
+        bool IsRowLocal() override { return true; }
 
-                ++iter;
-            }
-            return 1;
+        bool ProcessRow(std::deque<Data>::iterator iter) override {
+            double x_result = EvaluatePostfixExpression(x_postfix_expr, iter->variable);
+            double y_result = EvaluatePostfixExpression(y_postfix_expr, iter->variable);
+
+            th2d->Fill(x_result, y_result, ObtainWeight(iter, schema->Names()));
+
+            return true;
         }
         void End() override {}
+
+        // the histogram is owned by the user, but it is filled only by this module
+        bool IsCheckpointable() override { return true; }
+
+        void SaveState(std::ostream& out_) override {
+            SaveHistogramState(out_, th2d);
+        }
+
+        void LoadState(std::istream& in_) override {
+            AddHistogramState(in_, th2d);
+        }
+
+        std::string Fingerprint() override { return MakeFingerprint("FillTH2D", std::string(th2d->GetName()), x_expression, y_expression); }
+        bool IsTerminal() override { return true; }
     };
 
     class FillCustomizedTH2D : public Module {
@@ -4034,53 +6070,70 @@ namespace Module {
         std::vector<std::string> equations;
         std::vector<std::vector<Token>> postfix_exprs;
 
-        std::vector<std::string> variable_names;
-        std::vector<std::string> VariableTypes;
+        SchemaPtr schema;
 
     public:
-        FillCustomizedTH2D(TH2D* th2d_, std::vector<std::string> equations_, double (*x_custom_function_)(std::vector<double>), double (*y_custom_function_)(std::vector<double>), std::vector<std::string>* variable_names_, std::vector<std::string>* VariableTypes_) : Module(), th2d(th2d_), equations(equations_), x_custom_function(x_custom_function_), y_custom_function(y_custom_function_), variable_names(*variable_names_), VariableTypes(*VariableTypes_) {}
+        FillCustomizedTH2D(TH2D* th2d_, std::vector<std::string> equations_, double (*x_custom_function_)(std::vector<double>), double (*y_custom_function_)(std::vector<double>), SchemaPtr schema_) : Module(), th2d(th2d_), equations(equations_), x_custom_function(x_custom_function_), y_custom_function(y_custom_function_), schema(schema_) {}
         ~FillCustomizedTH2D() {}
-        void Start() {
+        void Start() override {
             for (int i = 0; i < equations.size(); i++) {
-                std::string replaced_expr = replaceVariables(equations.at(i), &variable_names);
-                postfix_exprs.push_back(PostfixExpression(replaced_expr, &VariableTypes));
+                std::string replaced_expr = replaceVariables(equations.at(i), *schema);
+                postfix_exprs.push_back(PostfixExpression(replaced_expr, *schema));
             }
         }
         int Process(std::deque<Data>* data) override {
-            for (std::deque<Data>::iterator iter = data->begin(); iter != data->end(); ) {
-                std::vector<double> results;
-                for (int i = 0; i < postfix_exprs.size(); i++) {
-                    double result = EvaluatePostfixExpression(postfix_exprs.at(i), iter->variable, &VariableTypes);
-                    results.push_back(result);
-                }
+            for (std::deque<Data>::iterator iter = data->begin(); iter != data->end(); ++iter) ProcessRow(iter);
+            return 1;
+        }
 
-                double filled_value_x = x_custom_function(results);
-                double filled_value_y = y_custom_function(results);
-                if ((std::isnan(filled_value_x) == false) && (std::isnan(filled_value_y) == false)) th2d->Fill(filled_value_x, filled_value_y, ObtainWeight(iter, variable_names));
+        bool IsRowLocal() override { return true; }
 
-                ++iter;
+        bool ProcessRow(std::deque<Data>::iterator iter) override {
+            std::vector<double> results;
+            for (int i = 0; i < postfix_exprs.size(); i++) {
+                double result = EvaluatePostfixExpression(postfix_exprs.at(i), iter->variable);
+                results.push_back(result);
             }
-            return 1;
+
+            double filled_value_x = x_custom_function(results);
+            double filled_value_y = y_custom_function(results);
+            if ((std::isnan(filled_value_x) == false) && (std::isnan(filled_value_y) == false)) th2d->Fill(filled_value_x, filled_value_y, ObtainWeight(iter, schema->Names()));
+
+            return true;
         }
         void End() override {}
+
+        // the histogram is owned by the user, but it is filled only by this module
+        bool IsCheckpointable() override { return true; }
+
+        void SaveState(std::ostream& out_) override {
+            SaveHistogramState(out_, th2d);
+        }
+
+        void LoadState(std::istream& in_) override {
+            AddHistogramState(in_, th2d);
+        }
+
+        // the custom functions cannot be compared, so only their inputs are used
+        std::string Fingerprint() override { return MakeFingerprint("FillCustomizedTH2D", std::string(th2d->GetName()), equations); }
+        bool IsTerminal() override { return true; }
     };
 
     class PrintEvent : public Module {
     private:
         std::vector<std::string> printed_values;
         std::vector<std::vector<Token>> postfix_exprs;
-        std::vector<std::string> variable_names;
-        std::vector<std::string> VariableTypes;
+        SchemaPtr schema;
 
     public:
-        PrintEvent(std::vector<std::string> printed_values_, std::vector<std::string>* variable_names_, std::vector<std::string>* VariableTypes_) : Module(), printed_values(printed_values_), variable_names(*variable_names_), VariableTypes(*VariableTypes_) {}
+        PrintEvent(std::vector<std::string> printed_values_, SchemaPtr schema_) : Module(), printed_values(printed_values_), schema(schema_) {}
         ~PrintEvent() {}
 
-        void Start() {
+        void Start() override {
             // change variable name into placeholder
             for (int i = 0; i < printed_values.size(); i++) {
-                std::string replaced_expr = replaceVariables(printed_values.at(i), &variable_names);
-                postfix_exprs.push_back(PostfixExpression(replaced_expr, &VariableTypes));
+                std::string replaced_expr = replaceVariables(printed_values.at(i), *schema);
+                postfix_exprs.push_back(PostfixExpression(replaced_expr, *schema));
             }
         }
 
@@ -4089,7 +6142,7 @@ namespace Module {
                 std::vector<double> results;
 
                 for (int i = 0; i < postfix_exprs.size(); i++) {
-                    double result = EvaluatePostfixExpression(postfix_exprs.at(i), iter->variable, &VariableTypes);
+                    double result = EvaluatePostfixExpression(postfix_exprs.at(i), iter->variable);
                     results.push_back(result);
                 }
 
@@ -4106,6 +6159,13 @@ namespace Module {
         }
 
         void End() override {}
+
+        bool IsCheckpointable() override { return true; }
+
+        std::string Fingerprint() override { return MakeFingerprint("PrintEvent", printed_values); }
+        bool IsTerminal() override { return true; }
+
+        bool HasOutputPerShard() override { return true; }
     };
 
     class ABCDmethod : public Module {
@@ -4113,8 +6173,7 @@ namespace Module {
 
         // N_A = N_B * (N_C/N_D)
 
-        std::vector<std::string> variable_names;
-        std::vector<std::string> VariableTypes;
+        SchemaPtr schema;
 
         TH1D* th1d_ABCD;
         std::string expression_A;
@@ -4150,30 +6209,30 @@ namespace Module {
         std::shared_ptr<std::vector<double>> output_handle;
 
     public:
-        ABCDmethod(const char* region_A_, const char* region_B_, const char* region_C_, const char* region_D_, bool WeightSumError_, std::shared_ptr<std::vector<double>> output_handle_, std::vector<std::string>* variable_names_, std::vector<std::string>* VariableTypes_) : Module(), expression_A(region_A_), expression_B(region_B_), expression_C(region_C_), expression_D(region_D_), expression_Aprime(""), expression_Bprime(""), expression_Cprime(""), expression_Dprime(""), validation(false), WeightSumError(WeightSumError_), output_handle(output_handle_), variable_names(*variable_names_), VariableTypes(*VariableTypes_) {}
-        ABCDmethod(const char* region_A_, const char* region_B_, const char* region_C_, const char* region_D_, const char* region_Aprime_, const char* region_Bprime_, const char* region_Cprime_, const char* region_Dprime_, bool WeightSumError_, std::shared_ptr<std::vector<double>> output_handle_, std::vector<std::string>* variable_names_, std::vector<std::string>* VariableTypes_) : Module(), expression_A(region_A_), expression_B(region_B_), expression_C(region_C_), expression_D(region_D_), expression_Aprime(region_Aprime_), expression_Bprime(region_Bprime_), expression_Cprime(region_Cprime_), expression_Dprime(region_Dprime_), WeightSumError(WeightSumError_), validation(true), output_handle(output_handle_), variable_names(*variable_names_), VariableTypes(*VariableTypes_) {}
+        ABCDmethod(const char* region_A_, const char* region_B_, const char* region_C_, const char* region_D_, bool WeightSumError_, std::shared_ptr<std::vector<double>> output_handle_, SchemaPtr schema_) : Module(), expression_A(region_A_), expression_B(region_B_), expression_C(region_C_), expression_D(region_D_), expression_Aprime(""), expression_Bprime(""), expression_Cprime(""), expression_Dprime(""), validation(false), WeightSumError(WeightSumError_), output_handle(output_handle_), schema(schema_) {}
+        ABCDmethod(const char* region_A_, const char* region_B_, const char* region_C_, const char* region_D_, const char* region_Aprime_, const char* region_Bprime_, const char* region_Cprime_, const char* region_Dprime_, bool WeightSumError_, std::shared_ptr<std::vector<double>> output_handle_, SchemaPtr schema_) : Module(), expression_A(region_A_), expression_B(region_B_), expression_C(region_C_), expression_D(region_D_), expression_Aprime(region_Aprime_), expression_Bprime(region_Bprime_), expression_Cprime(region_Cprime_), expression_Dprime(region_Dprime_), WeightSumError(WeightSumError_), validation(true), output_handle(output_handle_), schema(schema_) {}
 
         ~ABCDmethod() {}
 
         void Start() override {
-            replaced_expr_A = replaceVariables(expression_A, &variable_names);
-            replaced_expr_B = replaceVariables(expression_B, &variable_names);
-            replaced_expr_C = replaceVariables(expression_C, &variable_names);
-            replaced_expr_D = replaceVariables(expression_D, &variable_names);
-            postfix_expr_A = PostfixExpression(replaced_expr_A, &VariableTypes);
-            postfix_expr_B = PostfixExpression(replaced_expr_B, &VariableTypes);
-            postfix_expr_C = PostfixExpression(replaced_expr_C, &VariableTypes);
-            postfix_expr_D = PostfixExpression(replaced_expr_D, &VariableTypes);
+            replaced_expr_A = replaceVariables(expression_A, *schema);
+            replaced_expr_B = replaceVariables(expression_B, *schema);
+            replaced_expr_C = replaceVariables(expression_C, *schema);
+            replaced_expr_D = replaceVariables(expression_D, *schema);
+            postfix_expr_A = PostfixExpression(replaced_expr_A, *schema);
+            postfix_expr_B = PostfixExpression(replaced_expr_B, *schema);
+            postfix_expr_C = PostfixExpression(replaced_expr_C, *schema);
+            postfix_expr_D = PostfixExpression(replaced_expr_D, *schema);
 
             if (validation) {
-                replaced_expr_Aprime = replaceVariables(expression_Aprime, &variable_names);
-                replaced_expr_Bprime = replaceVariables(expression_Bprime, &variable_names);
-                replaced_expr_Cprime = replaceVariables(expression_Cprime, &variable_names);
-                replaced_expr_Dprime = replaceVariables(expression_Dprime, &variable_names);
-                postfix_expr_Aprime = PostfixExpression(replaced_expr_Aprime, &VariableTypes);
-                postfix_expr_Bprime = PostfixExpression(replaced_expr_Bprime, &VariableTypes);
-                postfix_expr_Cprime = PostfixExpression(replaced_expr_Cprime, &VariableTypes);
-                postfix_expr_Dprime = PostfixExpression(replaced_expr_Dprime, &VariableTypes);
+                replaced_expr_Aprime = replaceVariables(expression_Aprime, *schema);
+                replaced_expr_Bprime = replaceVariables(expression_Bprime, *schema);
+                replaced_expr_Cprime = replaceVariables(expression_Cprime, *schema);
+                replaced_expr_Dprime = replaceVariables(expression_Dprime, *schema);
+                postfix_expr_Aprime = PostfixExpression(replaced_expr_Aprime, *schema);
+                postfix_expr_Bprime = PostfixExpression(replaced_expr_Bprime, *schema);
+                postfix_expr_Cprime = PostfixExpression(replaced_expr_Cprime, *schema);
+                postfix_expr_Dprime = PostfixExpression(replaced_expr_Dprime, *schema);
             }
 
             // create histogram
@@ -4188,30 +6247,30 @@ namespace Module {
 
         int Process(std::deque<Data>* data) override {
             for (std::deque<Data>::iterator iter = data->begin(); iter != data->end(); ) {
-                double result = EvaluatePostfixExpression(postfix_expr_A, iter->variable, &VariableTypes);
-                if (result > 0.5) th1d_ABCD->Fill(0.5, ObtainWeight(iter, variable_names));
+                double result = EvaluatePostfixExpression(postfix_expr_A, iter->variable);
+                if (result > 0.5) th1d_ABCD->Fill(0.5, ObtainWeight(iter, schema->Names()));
 
-                result = EvaluatePostfixExpression(postfix_expr_B, iter->variable, &VariableTypes);
-                if (result > 0.5) th1d_ABCD->Fill(1.5, ObtainWeight(iter, variable_names));
+                result = EvaluatePostfixExpression(postfix_expr_B, iter->variable);
+                if (result > 0.5) th1d_ABCD->Fill(1.5, ObtainWeight(iter, schema->Names()));
 
-                result = EvaluatePostfixExpression(postfix_expr_C, iter->variable, &VariableTypes);
-                if (result > 0.5) th1d_ABCD->Fill(2.5, ObtainWeight(iter, variable_names));
+                result = EvaluatePostfixExpression(postfix_expr_C, iter->variable);
+                if (result > 0.5) th1d_ABCD->Fill(2.5, ObtainWeight(iter, schema->Names()));
 
-                result = EvaluatePostfixExpression(postfix_expr_D, iter->variable, &VariableTypes);
-                if (result > 0.5) th1d_ABCD->Fill(3.5, ObtainWeight(iter, variable_names));
+                result = EvaluatePostfixExpression(postfix_expr_D, iter->variable);
+                if (result > 0.5) th1d_ABCD->Fill(3.5, ObtainWeight(iter, schema->Names()));
 
                 if (validation) {
-                    result = EvaluatePostfixExpression(postfix_expr_Aprime, iter->variable, &VariableTypes);
-                    if (result > 0.5) th1d_ABCD_validation->Fill(0.5, ObtainWeight(iter, variable_names));
+                    result = EvaluatePostfixExpression(postfix_expr_Aprime, iter->variable);
+                    if (result > 0.5) th1d_ABCD_validation->Fill(0.5, ObtainWeight(iter, schema->Names()));
 
-                    result = EvaluatePostfixExpression(postfix_expr_Bprime, iter->variable, &VariableTypes);
-                    if (result > 0.5) th1d_ABCD_validation->Fill(1.5, ObtainWeight(iter, variable_names));
+                    result = EvaluatePostfixExpression(postfix_expr_Bprime, iter->variable);
+                    if (result > 0.5) th1d_ABCD_validation->Fill(1.5, ObtainWeight(iter, schema->Names()));
 
-                    result = EvaluatePostfixExpression(postfix_expr_Cprime, iter->variable, &VariableTypes);
-                    if (result > 0.5) th1d_ABCD_validation->Fill(2.5, ObtainWeight(iter, variable_names));
+                    result = EvaluatePostfixExpression(postfix_expr_Cprime, iter->variable);
+                    if (result > 0.5) th1d_ABCD_validation->Fill(2.5, ObtainWeight(iter, schema->Names()));
 
-                    result = EvaluatePostfixExpression(postfix_expr_Dprime, iter->variable, &VariableTypes);
-                    if (result > 0.5) th1d_ABCD_validation->Fill(3.5, ObtainWeight(iter, variable_names));
+                    result = EvaluatePostfixExpression(postfix_expr_Dprime, iter->variable);
+                    if (result > 0.5) th1d_ABCD_validation->Fill(3.5, ObtainWeight(iter, schema->Names()));
                 }
 
                 ++iter;
@@ -4319,6 +6378,22 @@ namespace Module {
             if (validation) { delete th1d_ABCD_validation; }
         }
 
+
+        bool IsCheckpointable() override { return true; }
+
+        void SaveState(std::ostream& out_) override {
+            SaveHistogramState(out_, th1d_ABCD);
+            if (validation) SaveHistogramState(out_, th1d_ABCD_validation);
+        }
+
+        void LoadState(std::istream& in_) override {
+            AddHistogramState(in_, th1d_ABCD);
+            if (validation) AddHistogramState(in_, th1d_ABCD_validation);
+        }
+
+        std::string Fingerprint() override { return MakeFingerprint("ABCDmethod", expression_A, expression_B, expression_C, expression_D, expression_Aprime, expression_Bprime, expression_Cprime, expression_Dprime, WeightSumError, validation); }
+        bool IsTerminal() override { return true; }
+        bool IsMemoizable() override { return true; }
     };
 
 }
@@ -0,0 +1,127 @@
+#ifndef SCHEMA_H
+#define SCHEMA_H
+
+#include <string>
+#include <vector>
+#include <variant>
+#include <memory>
+#include <unordered_map>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+
+/*
+* type of variable. Type names ("Double_t", ...) are converted only once, and per-row code uses this enum
+*/
+enum class VariableType {
+    Double, // Double_t
+    Int,    // Int_t
+    UInt,   // UInt_t
+    Float,  // Float_t
+    String  // string
+};
+
+VariableType ParseVariableType(const std::string& type_name_) {
+    if (type_name_ == "Double_t") return VariableType::Double;
+    else if (type_name_ == "Int_t") return VariableType::Int;
+    else if (type_name_ == "UInt_t") return VariableType::UInt;
+    else if (type_name_ == "Float_t") return VariableType::Float;
+    else if (type_name_ == "string") return VariableType::String;
+    else {
+        printf("[ParseVariableType] unexpected data type: %s\n", type_name_.c_str());
+        exit(1);
+    }
+}
+
+std::vector<VariableType> ParseVariableTypes(const std::vector<std::string>& type_names_) {
+    std::vector<VariableType> types;
+    types.reserve(type_names_.size());
+    for (size_t i = 0; i < type_names_.size(); i++) types.push_back(ParseVariableType(type_names_.at(i)));
+    return types;
+}
+
+const char* VariableTypeName(VariableType type_) {
+    switch (type_) {
+    case VariableType::Double: return "Double_t";
+    case VariableType::Int: return "Int_t";
+    case VariableType::UInt: return "UInt_t";
+    case VariableType::Float: return "Float_t";
+    case VariableType::String: return "string";
+    }
+    return "";
+}
+
+/*
+* dummy value of the type. It is to set variable type beforehand.
+*/
+std::variant<int, unsigned int, float, double, std::string*> DefaultValue(VariableType type_) {
+    switch (type_) {
+    case VariableType::Double: return static_cast<double>(0.0);
+    case VariableType::Int: return static_cast<int>(0);
+    case VariableType::UInt: return static_cast<unsigned int>(0);
+    case VariableType::Float: return static_cast<float>(0.0);
+    case VariableType::String: return static_cast<std::string*>(nullptr);
+    }
+    return static_cast<double>(0.0);
+}
+
+/*
+* immutable list of variables and their types, shared by modules.
+* The Loader makes a new snapshot with the next version whenever modules add variables, so each module keeps the snapshot it was made with and nothing is copied per module.
+* Names are found through a hash map, so resolving a name does not depend on the number of variables.
+*/
+class Schema {
+private:
+    const std::vector<std::string> names;
+    const std::vector<std::string> type_names;
+    const std::vector<VariableType> types;
+    const unsigned long version;
+    std::unordered_map<std::string, int> index_of_name;
+
+    // true if all names are made of letters, digits and `_`, so names in expressions can be found token by token
+    bool identifier_only;
+
+public:
+    Schema(const std::vector<std::string>& names_, const std::vector<std::string>& type_names_, unsigned long version_) : names(names_), type_names(type_names_), types(ParseVariableTypes(type_names_)), version(version_), identifier_only(true) {
+        if (names.size() != type_names.size()) {
+            printf("[Schema] the number of names and types are different: %zu %zu\n", names.size(), type_names.size());
+            exit(1);
+        }
+
+        // if the name is duplicated, the first one is used like `std::find`
+        for (int i = 0; i < names.size(); i++) {
+            index_of_name.insert(std::make_pair(names.at(i), i));
+            for (size_t j = 0; j < names.at(i).size(); j++) {
+                if (!std::isalnum(static_cast<unsigned char>(names.at(i)[j])) && (names.at(i)[j] != '_')) identifier_only = false;
+            }
+            if (names.at(i).size() == 0) identifier_only = false;
+        }
+    }
+
+    size_t Size() const { return names.size(); }
+    unsigned long Version() const { return version; }
+    bool IsIdentifierOnly() const { return identifier_only; }
+
+    const std::string& Name(int index_) const { return names.at(index_); }
+    const std::string& TypeName(int index_) const { return type_names.at(index_); }
+    VariableType Type(int index_) const { return types.at(index_); }
+
+    const std::vector<std::string>& Names() const { return names; }
+    const std::vector<std::string>& TypeNames() const { return type_names; }
+    const std::vector<VariableType>& Types() const { return types; }
+
+    // return -1 if there is no such variable
+    int Index(const std::string& name_) const {
+        std::unordered_map<std::string, int>::const_iterator iter = index_of_name.find(name_);
+        if (iter == index_of_name.end()) return -1;
+        return iter->second;
+    }
+
+    bool IsSame(const std::vector<std::string>& names_, const std::vector<std::string>& type_names_) const {
+        return (names == names_) && (type_names == type_names_);
+    }
+};
+
+typedef std::shared_ptr<const Schema> SchemaPtr;
+
+#endif
@@ -0,0 +1,139 @@
+#ifndef SERIALIZE_H
+#define SERIALIZE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <utility>
+#include <istream>
+#include <ostream>
+#include <type_traits>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+/*
+* binary serialization of module states, used by the checkpoint.
+* Values are written in the native byte order, so the checkpoint should be read on the same kind of machine.
+* Containers are written as the number of elements (uint64_t) followed by elements.
+*/
+
+template <class T> typename std::enable_if<std::is_arithmetic<T>::value>::type WriteBinary(std::ostream& out_, const T& value_);
+void WriteBinary(std::ostream& out_, const std::string& value_);
+void WriteBinary(std::ostream& out_, const std::vector<bool>& value_);
+template <class T> void WriteBinary(std::ostream& out_, const std::vector<T>& value_);
+template <class T1, class T2> void WriteBinary(std::ostream& out_, const std::pair<T1, T2>& value_);
+template <class K, class V> void WriteBinary(std::ostream& out_, const std::map<K, V>& value_);
+
+template <class T> typename std::enable_if<std::is_arithmetic<T>::value>::type ReadBinary(std::istream& in_, T& value_);
+void ReadBinary(std::istream& in_, std::string& value_);
+void ReadBinary(std::istream& in_, std::vector<bool>& value_);
+template <class T> void ReadBinary(std::istream& in_, std::vector<T>& value_);
+template <class T1, class T2> void ReadBinary(std::istream& in_, std::pair<T1, T2>& value_);
+template <class K, class V> void ReadBinary(std::istream& in_, std::map<K, V>& value_);
+
+void CheckBinaryStream(std::istream& in_) {
+    if (!in_) {
+        printf("[ReadBinary] unexpected end of the stream\n");
+        exit(1);
+    }
+}
+
+template <class T> typename std::enable_if<std::is_arithmetic<T>::value>::type WriteBinary(std::ostream& out_, const T& value_) {
+    out_.write(reinterpret_cast<const char*>(&value_), sizeof(T));
+}
+
+void WriteBinary(std::ostream& out_, const std::string& value_) {
+    WriteBinary(out_, static_cast<uint64_t>(value_.size()));
+    out_.write(value_.data(), value_.size());
+}
+
+void WriteBinary(std::ostream& out_, const std::vector<bool>& value_) {
+    WriteBinary(out_, static_cast<uint64_t>(value_.size()));
+    for (size_t i = 0; i < value_.size(); i++) WriteBinary(out_, static_cast<char>(value_[i]));
+}
+
+// arithmetic elements are written at once
+template <class T> void WriteBinaryElements(std::ostream& out_, const std::vector<T>& value_, std::true_type) {
+    out_.write(reinterpret_cast<const char*>(value_.data()), sizeof(T) * value_.size());
+}
+
+template <class T> void WriteBinaryElements(std::ostream& out_, const std::vector<T>& value_, std::false_type) {
+    for (size_t i = 0; i < value_.size(); i++) WriteBinary(out_, value_[i]);
+}
+
+template <class T> void WriteBinary(std::ostream& out_, const std::vector<T>& value_) {
+    WriteBinary(out_, static_cast<uint64_t>(value_.size()));
+    WriteBinaryElements(out_, value_, std::is_arithmetic<T>());
+}
+
+template <class T1, class T2> void WriteBinary(std::ostream& out_, const std::pair<T1, T2>& value_) {
+    WriteBinary(out_, value_.first);
+    WriteBinary(out_, value_.second);
+}
+
+template <class K, class V> void WriteBinary(std::ostream& out_, const std::map<K, V>& value_) {
+    WriteBinary(out_, static_cast<uint64_t>(value_.size()));
+    for (typename std::map<K, V>::const_iterator iter = value_.begin(); iter != value_.end(); ++iter) {
+        WriteBinary(out_, iter->first);
+        WriteBinary(out_, iter->second);
+    }
+}
+
+template <class T> typename std::enable_if<std::is_arithmetic<T>::value>::type ReadBinary(std::istream& in_, T& value_) {
+    in_.read(reinterpret_cast<char*>(&value_), sizeof(T));
+    CheckBinaryStream(in_);
+}
+
+void ReadBinary(std::istream& in_, std::string& value_) {
+    uint64_t size;
+    ReadBinary(in_, size);
+    value_.resize(size);
+    in_.read(&value_[0], size);
+    CheckBinaryStream(in_);
+}
+
+void ReadBinary(std::istream& in_, std::vector<bool>& value_) {
+    uint64_t size;
+    ReadBinary(in_, size);
+    value_.resize(size);
+    for (uint64_t i = 0; i < size; i++) {
+        char temp;
+        ReadBinary(in_, temp);
+        value_[i] = (temp != 0);
+    }
+}
+
+template <class T> void ReadBinaryElements(std::istream& in_, std::vector<T>& value_, std::true_type) {
+    in_.read(reinterpret_cast<char*>(value_.data()), sizeof(T) * value_.size());
+    CheckBinaryStream(in_);
+}
+
+template <class T> void ReadBinaryElements(std::istream& in_, std::vector<T>& value_, std::false_type) {
+    for (size_t i = 0; i < value_.size(); i++) ReadBinary(in_, value_[i]);
+}
+
+template <class T> void ReadBinary(std::istream& in_, std::vector<T>& value_) {
+    uint64_t size;
+    ReadBinary(in_, size);
+    value_.resize(size);
+    ReadBinaryElements(in_, value_, std::is_arithmetic<T>());
+}
+
+template <class T1, class T2> void ReadBinary(std::istream& in_, std::pair<T1, T2>& value_) {
+    ReadBinary(in_, value_.first);
+    ReadBinary(in_, value_.second);
+}
+
+template <class K, class V> void ReadBinary(std::istream& in_, std::map<K, V>& value_) {
+    uint64_t size;
+    ReadBinary(in_, size);
+    value_.clear();
+    for (uint64_t i = 0; i < size; i++) {
+        K key;
+        ReadBinary(in_, key);
+        ReadBinary(in_, value_[key]);
+    }
+}
+
+#endif
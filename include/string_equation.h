@@ -4,6 +4,17 @@
 #include <string>
 #include <stack>
 #include <sstream>
+#include <vector>
+#include <variant>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <utility>
+#include <memory>
+#include <functional>
+#include <cctype>
+
+#include "schema.h"
 
 enum class OpType {
     Value,      // Literal number (e.g., 3.14)
@@ -12,20 +23,104 @@ enum class OpType {
     GT, LT, GE, LE, EQ, NE,
     And, Or,
     UnaryMinus, UnaryPlus,
-    Openparenthesis, Closeparenthesis
+    Openparenthesis, Closeparenthesis,
+    // functions with one argument
+    Abs, Sqrt, Exp, Log, Log10, Sin, Cos, Tan, Asin, Acos, Atan,
+    // functions with two arguments
+    Min, Max, Atan2,
+    // set membership, `x in {1, 2, 3}` and `x not in {1, 2, 3}`
+    In, NotIn,
+    // functions with any number of arguments. The number of arguments is in `Token::index`
+    ArgmaxK, SelectNth,
+    // conditional operator `a ? b : c`. They jump to `Token::index` so that only the chosen branch is evaluated
+    JumpIfFalse, Jump,
+    // used only while parsing `a ? b : c`
+    Ternary, TernaryElse,
+    // native function of the whole program, appended at the end of the program (see `ExpressionCompiler`)
+    Compiled
+};
+
+/*
+* set of values for `in {...}`. Values are sorted for binary search.
+* If values are integers in a small range (e.g. PDG codes), a lookup table is used instead, so the cost does not depend on the number of values.
+*/
+class ValueSet {
+private:
+    std::vector<double> values;
+
+    // lookup table of integers from `table_min`. It is empty if values are not in a small integer domain
+    std::vector<char> table;
+    double table_min;
+
+    static const size_t MaxTableSize = 4096;
+
+public:
+    ValueSet(std::vector<double> values_) : values(values_), table_min(0) {
+        std::sort(values.begin(), values.end());
+        values.erase(std::unique(values.begin(), values.end()), values.end());
+
+        if (values.size() == 0) return;
+
+        bool IsInteger = true;
+        for (size_t i = 0; i < values.size(); i++) {
+            if (values[i] != std::floor(values[i])) IsInteger = false;
+        }
+
+        if (IsInteger && ((values.back() - values.front()) < MaxTableSize)) {
+            table_min = values.front();
+            table.assign((size_t)(values.back() - values.front()) + 1, 0);
+            for (size_t i = 0; i < values.size(); i++) table[(size_t)(values[i] - table_min)] = 1;
+        }
+    }
+
+    bool Contains(double value_) const {
+        if (table.size() != 0) {
+            double position = value_ - table_min;
+            // NaN fails this check
+            if (!((position >= 0) && (position < table.size()))) return false;
+            if (position != std::floor(position)) return false;
+            return table[(size_t)position] != 0;
+        }
+        // NaN is equivalent to every value for the comparison of binary_search
+        if (std::isnan(value_)) return false;
+        return std::binary_search(values.begin(), values.end(), value_);
+    }
+
+    bool IsEmpty() const { return values.size() == 0; }
+    const std::vector<double>& Values() const { return values; }
+    double Min() const { return values.front(); }
+    double Max() const { return values.back(); }
+};
+
+// native function of a program. It writes the result of the row and returns true, or returns false if a variable of the row has another type
+typedef bool (*CompiledExpression)(const std::variant<int, unsigned int, float, double, std::string*>*, double*);
+
+// native function of a program, which is filled when the modules are started. Until then, or if the compilation fails, `function` is nullptr and the program is interpreted
+struct CompiledProgram {
+    std::string code;
+    CompiledExpression function = nullptr;
 };
 
 struct Token {
     OpType type;
     double value; // Used if type == Value
     int index;    // Used if type == Variable
+    VariableType variable_type = VariableType::Double; // Used if type == Variable. It is resolved in `PostfixExpression`
+    std::shared_ptr<const ValueSet> set = nullptr; // Used if type == In or NotIn
+    std::shared_ptr<CompiledProgram> compiled = nullptr; // Used if type == Compiled. Copies of the program share it
 };
 
+/*
+* if it is set, every program made by `PostfixExpression` is given to it, e.g. `PrepareExpressionWithCling` in jit.h.
+* It may append an `OpType::Compiled` token whose function is given later, and returns false if the program is kept as it is.
+*/
+bool (*ExpressionCompiler)(std::vector<Token>& postfix_expr_) = nullptr;
+
 int precedence(OpType op) {
     switch (op) {
     case OpType::Or: return 1;
     case OpType::And: return 2;
-    case OpType::EQ: case OpType::NE: return 3;
+    case OpType::EQ: case OpType::NE: case OpType::In: case OpType::NotIn: return 3;
     case OpType::LT: case OpType::LE: case OpType::GT: case OpType::GE: return 4;
     case OpType::Add: case OpType::Sub: return 5;
     case OpType::Mul: case OpType::Div: return 6;
@@ -35,6 +130,75 @@ int precedence(OpType op) {
     }
 }
 
+/*
+* built-in functions which can be called in equations, e.g. `abs(deltaE)`, `sqrt(px^2 + py^2)`, `atan2(py, px)`.
+* The number of arguments is fixed except `argmax_k` and `select_nth` (-1), and arguments are separated by `,`
+*     argmax_k(k, x0, x1, ...): index of the k-th largest value among x0, x1, ... (k = 0 is the largest). The earlier one is larger for the same values, and NaN values are skipped
+*     select_nth(k, x0, x1, ...): the k-th largest value among x0, x1, ...
+*/
+struct FunctionInfo {
+    const char* name;
+    OpType op;
+    int Narguments;
+};
+
+const FunctionInfo BuiltinFunctions[] = {
+    { "abs", OpType::Abs, 1 }, { "sqrt", OpType::Sqrt, 1 }, { "exp", OpType::Exp, 1 }, { "log", OpType::Log, 1 }, { "log10", OpType::Log10, 1 },
+    { "sin", OpType::Sin, 1 }, { "cos", OpType::Cos, 1 }, { "tan", OpType::Tan, 1 }, { "asin", OpType::Asin, 1 }, { "acos", OpType::Acos, 1 }, { "atan", OpType::Atan, 1 },
+    { "min", OpType::Min, 2 }, { "max", OpType::Max, 2 }, { "atan2", OpType::Atan2, 2 },
+    { "argmax_k", OpType::ArgmaxK, -1 }, { "select_nth", OpType::SelectNth, -1 }
+};
+
+// return nullptr if there is no such function
+const FunctionInfo* FindFunction(const std::string& name_) {
+    for (const FunctionInfo& function : BuiltinFunctions) {
+        if (name_ == function.name) return &function;
+    }
+    return nullptr;
+}
+
+bool IsVariadic(OpType op) {
+    return (op == OpType::ArgmaxK) || (op == OpType::SelectNth);
+}
+
+// index of the k-th largest value (k = 0 is the largest) among `values_[0, n_)`. The earlier one is larger for the same values, and -1 is returned if there is no such value (e.g. NaN)
+int KthLargestIndex(const double* values_, int n_, int k_) {
+    for (int i = 0; i < n_; i++) {
+        if (std::isnan(values_[i])) continue;
+
+        int rank = 0;
+        for (int j = 0; j < n_; j++) {
+            if ((values_[j] > values_[i]) || ((values_[j] == values_[i]) && (j < i))) rank++;
+        }
+        if (rank == k_) return i;
+    }
+    return -1;
+}
+
+// `arguments_[0]` is k, and the others are values
+double applyVariadicOp(const double* arguments_, int Narguments_, const OpType op) {
+    double k = arguments_[0];
+    if ((k < 0) || (k >= Narguments_ - 1) || (k != std::floor(k))) return std::numeric_limits<double>::quiet_NaN();
+
+    int index = KthLargestIndex(arguments_ + 1, Narguments_ - 1, (int)k);
+    if (index < 0) return std::numeric_limits<double>::quiet_NaN();
+
+    if (op == OpType::ArgmaxK) return index;
+    else return arguments_[index + 1];
+}
+
+// the number of values which the operator takes from the stack
+int Noperands(OpType op) {
+    switch (op) {
+    case OpType::UnaryMinus: case OpType::UnaryPlus:
+    case OpType::Abs: case OpType::Sqrt: case OpType::Exp: case OpType::Log: case OpType::Log10:
+    case OpType::Sin: case OpType::Cos: case OpType::Tan: case OpType::Asin: case OpType::Acos: case OpType::Atan:
+    case OpType::In: case OpType::NotIn:
+        return 1;
+    default: return 2;
+    }
+}
+
 double applyOp(double a, double b, const OpType op) {
     switch (op) {
     case OpType::Add: return (a + b);
@@ -74,6 +238,9 @@ double applyOp(double a, double b, const OpType op) {
         if ((a != 0) || (b != 0)) return 1.0;
         else return 0.0;
     }
+    case OpType::Min: return std::fmin(a, b);
+    case OpType::Max: return std::fmax(a, b);
+    case OpType::Atan2: return std::atan2(a, b);
     default: {
         printf("[applyOp] unknown operator\n");
         exit(1);
@@ -87,6 +254,17 @@ double applyOp(double a, const OpType op) {
     switch (op) {
     case OpType::UnaryMinus: return -a;
     case OpType::UnaryPlus: return a;
+    case OpType::Abs: return std::fabs(a);
+    case OpType::Sqrt: return std::sqrt(a);
+    case OpType::Exp: return std::exp(a);
+    case OpType::Log: return std::log(a);
+    case OpType::Log10: return std::log10(a);
+    case OpType::Sin: return std::sin(a);
+    case OpType::Cos: return std::cos(a);
+    case OpType::Tan: return std::tan(a);
+    case OpType::Asin: return std::asin(a);
+    case OpType::Acos: return std::acos(a);
+    case OpType::Atan: return std::atan(a);
     default: {
         printf("[applyOp] unknown operator\n");
         exit(1);
@@ -95,15 +273,18 @@ double applyOp(double a, const OpType op) {
     }
 }
 
-std::string replaceVariables(const std::string& expression, const std::vector<std::string>* var_name) {
-
-    // placeholder is "\x01" and "\x02", which is hard to be typed by user... but maybe user can type...
-    // therefore, I want to check the equation beforehand
-    // also, "\x03" and "\x04" are used for unary operator
+// placeholder is "\x01" and "\x02", which is hard to be typed by user... but maybe user can type...
+// therefore, I want to check the equation beforehand
+// also, "\x03" and "\x04" are used for unary operator
+void CheckPlaceholderCharacters(const std::string& expression) {
     if ((expression.find(std::string("\x01")) != std::string::npos) || (expression.find(std::string("\x02")) != std::string::npos) || (expression.find(std::string("\x03")) != std::string::npos) || (expression.find(std::string("\x04")) != std::string::npos)) {
         printf("In the equation expression, Ascii 01, 02, 03, 04 are included. It is not feasible\n");
         exit(1);
     }
+}
+
+std::string replaceVariables(const std::string& expression, const std::vector<std::string>* var_name) {
+    CheckPlaceholderCharacters(expression);
 
     std::string replaced_expr = expression;
 
@@ -135,11 +316,97 @@ std::string replaceVariables(const std::string& expression, const std::vector<st
     return replaced_expr;
 }
 
-std::vector<Token> PostfixExpression(const std::string& replaced_expr_, const std::vector<std::string>* VariableTypes_) {
+/*
+* same as above, but each name (letters, digits and `_`) of the expression is found in the schema at once, so the cost does not depend on the number of variables.
+* A name is replaced only if the whole name is a variable, so overlapped names (ex. M and M2) do not depend on the order of variables.
+* If the schema has a name with other characters, names are replaced one by one as above.
+*/
+std::string replaceVariables(const std::string& expression, const Schema& schema_) {
+    if (!schema_.IsIdentifierOnly()) return replaceVariables(expression, &schema_.Names());
+    CheckPlaceholderCharacters(expression);
+
+    auto IsNameCharacter = [](char c_) { return std::isalnum(static_cast<unsigned char>(c_)) || (c_ == '_'); };
+
+    std::string replaced_expr;
+    replaced_expr.reserve(expression.size());
+    std::string::size_type pos = 0;
+    while (pos < expression.size()) {
+        if (!IsNameCharacter(expression.at(pos))) {
+            replaced_expr += expression.at(pos);
+            pos++;
+            continue;
+        }
+
+        std::string::size_type end = pos;
+        while ((end < expression.size()) && IsNameCharacter(expression.at(end))) end++;
+
+        std::string name = expression.substr(pos, end - pos);
+        int index = schema_.Index(name);
+        if (index >= 0) replaced_expr += "\x01" + std::to_string(index) + "\x02";
+        else replaced_expr += name;
+        pos = end;
+    }
+
+    return replaced_expr;
+}
+
+/*
+* replace alias names in the expression by their expressions in parentheses. Aliases are given as (name, expression) pairs.
+* It is applied before `replaceVariables`, so aliases do not need a column.
+*/
+std::string ExpandAliases(const std::string& expression, const std::vector<std::pair<std::string, std::string>>& aliases) {
+    std::string expanded_expr = expression;
+
+    for (int i = 0; i < aliases.size(); i++) {
+        const std::string& name = aliases.at(i).first;
+        const std::string replacement = "(" + aliases.at(i).second + ")";
+
+        std::string::size_type pos = 0;
+        while ((pos = expanded_expr.find(name, pos)) != std::string::npos) {
+            // skip if the name is a part of another name
+            if ((pos != 0) && (std::isalnum(expanded_expr.at(pos - 1)) || (expanded_expr.at(pos - 1) == '_'))) {
+                pos = pos + name.length();
+                continue;
+            }
+            if (((pos + name.length()) != expanded_expr.length()) && (std::isalnum(expanded_expr.at(pos + name.length())) || (expanded_expr.at(pos + name.length()) == '_'))) {
+                pos = pos + name.length();
+                continue;
+            }
+
+            expanded_expr.replace(pos, name.length(), replacement);
+            pos += replacement.length();
+        }
+    }
+
+    return expanded_expr;
+}
+
+// `VariableTypeOf_` gives the type of the variable of the index
+std::vector<Token> PostfixExpression(const std::string& replaced_expr_, const std::function<VariableType(int)>& VariableTypeOf_) {
     std::istringstream iss(replaced_expr_);
     std::vector<Token> output;
     std::stack<OpType> ops;
 
+    // for each open parenthesis, the number of arguments so far if it is a function call. -1 for ordinary parenthesis
+    std::stack<int> Narguments;
+
+    // position of jump tokens in `output` whose destination is not known yet
+    std::stack<size_t> jump_positions;
+
+    // move the top of `ops` into `output`. For the end of `a ? b : c`, the jump to there is resolved instead
+    auto PopOperator = [&]() {
+        if (ops.top() == OpType::Ternary) {
+            printf("[evaluateExpression] `:` is missing for `?`\n");
+            exit(1);
+        }
+        else if (ops.top() == OpType::TernaryElse) {
+            output.at(jump_positions.top()).index = output.size();
+            jump_positions.pop();
+        }
+        else output.push_back({ ops.top(), -1, -1 });
+        ops.pop();
+    };
+
     // previous token is needed to check unary operator
     char previous_token = '\0';
     char token;
@@ -178,20 +445,13 @@ std::vector<Token> PostfixExpression(const std::string& replaced_expr_, const st
             int index;
             iss >> index;
 
-            if (VariableTypes_->at(index) == "Double_t") {}
-            else if (VariableTypes_->at(index) == "Int_t") {}
-            else if (VariableTypes_->at(index) == "UInt_t") {}
-            else if (VariableTypes_->at(index) == "Float_t") {}
-            else if (VariableTypes_->at(index) == "string") {
+            VariableType variable_type = VariableTypeOf_(index);
+            if (variable_type == VariableType::String) {
                 printf("[evaluateExpression] string variable cannot be used in equations\n");
                 exit(1);
             }
-            else {
-                printf("unexpected data type\n");
-                exit(1);
-            }
 
-            output.push_back({ OpType::Variable, -1, index });
+            output.push_back({ OpType::Variable, -1, index, variable_type });
 
             iss >> token;
 
@@ -201,20 +461,147 @@ std::vector<Token> PostfixExpression(const std::string& replaced_expr_, const st
             }
 
         }
+        else if (std::isalpha(token)) { // it is function or `in`
+            std::string name(1, token);
+            while (std::isalnum(iss.peek()) || (iss.peek() == '_')) name.push_back(iss.get());
+
+            if ((name == "in") || (name == "not")) {
+                OpType current_op = OpType::In;
+                if (name == "not") {
+                    std::string next_name;
+                    iss >> std::ws;
+                    while (std::isalpha(iss.peek())) next_name.push_back(iss.get());
+                    if (next_name != "in") {
+                        printf("[evaluateExpression] `in` should follow `not`\n");
+                        exit(1);
+                    }
+                    current_op = OpType::NotIn;
+                }
+
+                // read values in {...}
+                char next_token;
+                if (!(iss >> next_token) || (next_token != '{')) {
+                    printf("[evaluateExpression] `{` should follow `in`\n");
+                    exit(1);
+                }
+                std::vector<double> set_values;
+                while (true) {
+                    double value;
+                    if (!(iss >> value)) {
+                        printf("[evaluateExpression] values in `{...}` should be numbers\n");
+                        exit(1);
+                    }
+                    set_values.push_back(value);
+
+                    if (!(iss >> next_token) || ((next_token != ',') && (next_token != '}'))) {
+                        printf("[evaluateExpression] values in `{...}` should be separated by `,` and closed by `}`\n");
+                        exit(1);
+                    }
+                    if (next_token == '}') break;
+                }
+
+                // the left operand is already in the output, so it is applied after operators with higher precedence
+                while (!ops.empty() && (precedence(ops.top()) >= precedence(current_op)) && (ops.top() != OpType::Openparenthesis)) {
+                    PopOperator();
+                }
+                Token set_token = { current_op, -1, -1 };
+                set_token.set = std::make_shared<const ValueSet>(set_values);
+                output.push_back(set_token);
+
+                // operator after `}` is binary
+                previous_token = ')';
+                continue;
+            }
+
+            const FunctionInfo* function = FindFunction(name);
+            if (function == nullptr) {
+                printf("[evaluateExpression] unknown function or variable: %s\n", name.c_str());
+                exit(1);
+            }
+
+            char next_token;
+            if (!(iss >> next_token) || (next_token != '(')) {
+                printf("[evaluateExpression] `(` should follow the function: %s\n", name.c_str());
+                exit(1);
+            }
+
+            ops.push(function->op);
+            ops.push(OpType::Openparenthesis);
+            Narguments.push(1);
+            token = '(';
+        }
+        else if (token == ',') {
+            while (!ops.empty() && ops.top() != OpType::Openparenthesis) {
+                PopOperator();
+            }
+            if (Narguments.empty() || (Narguments.top() < 0)) {
+                printf("[evaluateExpression] `,` is used outside of function\n");
+                exit(1);
+            }
+            Narguments.top()++;
+        }
         else if (token == '(') {
             ops.push(OpType::Openparenthesis);
+            Narguments.push(-1);
         }
         else if (token == ')') {
             while (!ops.empty() && ops.top() != OpType::Openparenthesis) {
-                output.push_back({ ops.top(), -1, -1 });
-                ops.pop();
+                PopOperator();
 
                 if (ops.empty()) {
                     printf("cannot find `(`\n");
                     exit(1);
                 }
             }
+            if (ops.empty()) {
+                printf("cannot find `(`\n");
+                exit(1);
+            }
             ops.pop();
+
+            // function call is done
+            int temp_Narguments = Narguments.top();
+            Narguments.pop();
+            if (temp_Narguments > 0) {
+                if (IsVariadic(ops.top())) {
+                    if (temp_Narguments < 2) {
+                        printf("[evaluateExpression] the number of arguments is wrong: %d\n", temp_Narguments);
+                        exit(1);
+                    }
+                    output.push_back({ ops.top(), -1, temp_Narguments });
+                }
+                else {
+                    if (temp_Narguments != Noperands(ops.top())) {
+                        printf("[evaluateExpression] the number of arguments is wrong: %d\n", temp_Narguments);
+                        exit(1);
+                    }
+                    output.push_back({ ops.top(), -1, -1 });
+                }
+                ops.pop();
+            }
+        }
+        else if (token == '?') {
+            // condition is done. `?` has the lowest precedence and is right-associative
+            while (!ops.empty() && (ops.top() != OpType::Openparenthesis) && (ops.top() != OpType::Ternary) && (ops.top() != OpType::TernaryElse)) PopOperator();
+
+            jump_positions.push(output.size());
+            output.push_back({ OpType::JumpIfFalse, -1, -1 });
+            ops.push(OpType::Ternary);
+        }
+        else if (token == ':') {
+            while (!ops.empty() && (ops.top() != OpType::Openparenthesis) && (ops.top() != OpType::Ternary)) PopOperator();
+            if (ops.empty() || (ops.top() != OpType::Ternary)) {
+                printf("[evaluateExpression] `?` is missing for `:`\n");
+                exit(1);
+            }
+
+            // if the condition is false, jump over `b` and the jump after `b`
+            output.at(jump_positions.top()).index = output.size() + 1;
+            jump_positions.pop();
+
+            jump_positions.push(output.size());
+            output.push_back({ OpType::Jump, -1, -1 });
+            ops.top() = OpType::TernaryElse;
         }
         else if ((std::string("+-*/^<>=!&|") + std::string("\x03") + std::string("\x04")).find(token) != std::string::npos) {
             OpType current_op;
@@ -303,8 +690,7 @@ std::vector<Token> PostfixExpression(const std::string& replaced_expr_, const st
                 // power is right-associative, do not pop
                 if ((current_op == OpType::Pow) && (precedence(ops.top()) == precedence(current_op))) break;
 
-                output.push_back({ ops.top(), -1, -1 });
-                ops.pop();
+                PopOperator();
             }
             ops.push(current_op);
         }
@@ -317,73 +703,493 @@ std::vector<Token> PostfixExpression(const std::string& replaced_expr_, const st
     }
 
     while (!ops.empty()) {
-        output.push_back({ ops.top(), -1, -1 });
-        ops.pop();
+        PopOperator();
     }
 
+    if (ExpressionCompiler != nullptr) ExpressionCompiler(output);
+
     return output;
 }
 
-double EvaluatePostfixExpression(const std::vector<Token>& postfix_expr_, const std::vector<std::variant<int, unsigned int, float, double, std::string*>>& variables_, const std::vector<std::string>* VariableTypes_) {
-    std::stack<double> values;
+std::vector<Token> PostfixExpression(const std::string& replaced_expr_, const std::vector<std::string>* VariableTypes_) {
+    return PostfixExpression(replaced_expr_, [VariableTypes_](int index_) { return ParseVariableType(VariableTypes_->at(index_)); });
+}
+
+std::vector<Token> PostfixExpression(const std::string& replaced_expr_, const Schema& schema_) {
+    return PostfixExpression(replaced_expr_, [&schema_](int index_) { return schema_.Type(index_); });
+}
+
+double EvaluatePostfixExpression(const std::vector<Token>& postfix_expr_, const std::vector<std::variant<int, unsigned int, float, double, std::string*>>& variables_) {
+    // the stack is kept for each thread to avoid allocation for every row
+    thread_local std::vector<double> values;
+    size_t depth = 0;
+
+    auto push = [&](double value_) {
+        if (values.size() == depth) values.push_back(value_);
+        else values[depth] = value_;
+        depth++;
+    };
+
+    if ((postfix_expr_.size() != 0) && (postfix_expr_.back().type == OpType::Compiled) && (postfix_expr_.back().compiled->function != nullptr)) {
+        double result;
+        if (postfix_expr_.back().compiled->function(variables_.data(), &result)) return result;
+    }
 
     for (int i = 0; i < postfix_expr_.size(); i++) {
-        Token temp_token = postfix_expr_.at(i);
+        const Token& temp_token = postfix_expr_[i];
 
         if (temp_token.type == OpType::Value) {
-            values.push(temp_token.value);
+            push(temp_token.value);
         }
         else if (temp_token.type == OpType::Variable) {
             int index = temp_token.index;
 
-            if (VariableTypes_->at(index) == "Double_t") {
-                values.push((double)std::get<double>(variables_.at(index)));
+            switch (temp_token.variable_type) {
+            case VariableType::Double: push((double)std::get<double>(variables_.at(index))); break;
+            case VariableType::Int: push((double)std::get<int>(variables_.at(index))); break;
+            case VariableType::UInt: push((double)std::get<unsigned int>(variables_.at(index))); break;
+            case VariableType::Float: push((double)std::get<float>(variables_.at(index))); break;
+            case VariableType::String:
+                printf("[evaluateExpression] string variable cannot be used in equations\n");
+                exit(1);
             }
-            else if (VariableTypes_->at(index) == "Int_t") {
-                values.push((double)std::get<int>(variables_.at(index)));
+        }
+        else if (temp_token.type == OpType::JumpIfFalse) {
+            if (depth == 0) {
+                printf("[EvaluatePostfixExpression] there is no condition for `?`\n");
+                exit(1);
             }
-            else if (VariableTypes_->at(index) == "UInt_t") {
-                values.push((double)std::get<unsigned int>(variables_.at(index)));
+            depth--;
+            if (values[depth] == 0) i = temp_token.index - 1;
+        }
+        else if (temp_token.type == OpType::Jump) {
+            i = temp_token.index - 1;
+        }
+        else if (temp_token.type == OpType::Compiled) {
+            continue;
+        }
+        else if (IsVariadic(temp_token.type)) {
+            int Narguments = temp_token.index;
+            if (depth < Narguments) {
+                printf("[EvaluatePostfixExpression] there is only %zu number when function with %d arguments comes\n", depth, Narguments);
+                exit(1);
+            }
+            double result = applyVariadicOp(&values[depth - Narguments], Narguments, temp_token.type);
+            depth = depth - Narguments;
+            push(result);
+        }
+        else if (Noperands(temp_token.type) == 1) {
+            if (depth == 0) {
+                printf("[EvaluatePostfixExpression] there is no number when unary operator comes\n");
+                exit(1);
+            }
+            double& a = values[depth - 1];
+            if (temp_token.type == OpType::In) a = temp_token.set->Contains(a) ? 1.0 : 0.0;
+            else if (temp_token.type == OpType::NotIn) a = temp_token.set->Contains(a) ? 0.0 : 1.0;
+            else a = applyOp(a, temp_token.type);
+        }
+        else {
+            if (depth < 2) {
+                printf("[EvaluatePostfixExpression] there is only %zu number when binary operator comes\n", depth);
+                exit(1);
+            }
+            values[depth - 2] = applyOp(values[depth - 2], values[depth - 1], temp_token.type);
+            depth--;
+        }
+    }
+
+    if (depth != 1) {
+        printf("[EvaluatePostfixExpression] size of values is %zu\n", depth);
+        exit(1);
+    }
+
+    return values[0];
+
+}
+
+// type of each variable is in the token. This is kept for customized modules written with types of variables
+double EvaluatePostfixExpression(const std::vector<Token>& postfix_expr_, const std::vector<std::variant<int, unsigned int, float, double, std::string*>>& variables_, const std::vector<std::string>*) {
+    return EvaluatePostfixExpression(postfix_expr_, variables_);
+}
+
+/*
+* the number of rows evaluated at once by `EvaluatePostfixExpressionBatch`
+* the stack of this size should be fit into L2 cache
+*/
+const size_t EvaluationBlockSize = 4096;
+
+void applyOpBatch(std::vector<double>& a, const std::vector<double>& b, size_t N, const OpType op) {
+    // frequently used operators are written explicitly so that the compiler can vectorize them
+    switch (op) {
+    case OpType::Add: for (size_t k = 0; k < N; k++) a[k] = a[k] + b[k]; break;
+    case OpType::Sub: for (size_t k = 0; k < N; k++) a[k] = a[k] - b[k]; break;
+    case OpType::Mul: for (size_t k = 0; k < N; k++) a[k] = a[k] * b[k]; break;
+    case OpType::Div: for (size_t k = 0; k < N; k++) a[k] = a[k] / b[k]; break;
+    default: for (size_t k = 0; k < N; k++) a[k] = applyOp(a[k], b[k], op); break;
+    }
+}
+
+void applyOpBatch(std::vector<double>& a, size_t N, const OpType op) {
+    switch (op) {
+    case OpType::UnaryMinus: for (size_t k = 0; k < N; k++) a[k] = -a[k]; break;
+    case OpType::UnaryPlus: break;
+    case OpType::Abs: for (size_t k = 0; k < N; k++) a[k] = std::fabs(a[k]); break;
+    case OpType::Sqrt: for (size_t k = 0; k < N; k++) a[k] = std::sqrt(a[k]); break;
+    default: for (size_t k = 0; k < N; k++) a[k] = applyOp(a[k], op); break;
+    }
+}
+
+/*
+* evaluate the postfix expression for many rows at once. `output_[k]` is the result of `*rows_[k]`.
+* Each token is applied to the whole block, so the type of variable is checked once per token rather than once per row.
+*/
+void EvaluatePostfixExpressionBatch(const std::vector<Token>& postfix_expr_, const std::vector<const std::vector<std::variant<int, unsigned int, float, double, std::string*>>*>& rows_, double* output_) {
+    size_t N = rows_.size();
+    if (N == 0) return;
+
+    if ((postfix_expr_.size() != 0) && (postfix_expr_.back().type == OpType::Compiled) && (postfix_expr_.back().compiled->function != nullptr)) {
+        CompiledExpression function = postfix_expr_.back().compiled->function;
+        size_t k = 0;
+        while ((k < N) && function(rows_[k]->data(), &output_[k])) k++;
+        // the whole block is interpreted if a row has a variable of another type
+        if (k == N) return;
+    }
+
+    // stack of columns. Columns are kept after pop to avoid re-allocation
+    std::vector<std::vector<double>> values;
+    size_t depth = 0;
+
+    // both branches of `a ? b : c` are evaluated for all rows, and they are merged at the end of `c`. This is the end position of each conditional operator
+    std::vector<int> ternary_ends;
+    auto MergeBranches = [&](int position_) {
+        while ((ternary_ends.size() != 0) && (ternary_ends.back() == position_)) {
+            std::vector<double>& condition = values.at(depth - 3);
+            const std::vector<double>& a = values.at(depth - 2);
+            const std::vector<double>& b = values.at(depth - 1);
+            for (size_t k = 0; k < N; k++) condition[k] = (condition[k] != 0) ? a[k] : b[k];
+            depth = depth - 2;
+            ternary_ends.pop_back();
+        }
+    };
+
+    // arguments of one row for `argmax_k` and `select_nth`
+    std::vector<double> arguments;
+
+    for (int i = 0; i < postfix_expr_.size(); i++) {
+        MergeBranches(i);
+
+        const Token& temp_token = postfix_expr_.at(i);
+
+        if (temp_token.type == OpType::JumpIfFalse) {
+            // the condition stays in the stack until branches are merged. The end is the destination of the jump before `c`
+            ternary_ends.push_back(postfix_expr_.at(temp_token.index - 1).index);
+            continue;
+        }
+        else if ((temp_token.type == OpType::Jump) || (temp_token.type == OpType::Compiled)) {
+            continue;
+        }
+        else if (IsVariadic(temp_token.type)) {
+            int Narguments = temp_token.index;
+            if (depth < Narguments) {
+                printf("[EvaluatePostfixExpressionBatch] there is only %zu number when function with %d arguments comes\n", depth, Narguments);
+                exit(1);
             }
-            else if (VariableTypes_->at(index) == "Float_t") {
-                values.push((double)std::get<float>(variables_.at(index)));
+            arguments.resize(Narguments);
+            std::vector<double>& result = values.at(depth - Narguments);
+            for (size_t k = 0; k < N; k++) {
+                for (int j = 0; j < Narguments; j++) arguments[j] = values.at(depth - Narguments + j)[k];
+                result[k] = applyVariadicOp(arguments.data(), Narguments, temp_token.type);
+            }
+            depth = depth - Narguments + 1;
+            continue;
+        }
+
+        if ((temp_token.type == OpType::Value) || (temp_token.type == OpType::Variable)) {
+            if (values.size() == depth) values.emplace_back(N);
+            std::vector<double>& column = values.at(depth);
+            depth++;
+
+            if (temp_token.type == OpType::Value) {
+                for (size_t k = 0; k < N; k++) column[k] = temp_token.value;
+                continue;
             }
-            else if (VariableTypes_->at(index) == "string") {
+
+            int index = temp_token.index;
+
+            switch (temp_token.variable_type) {
+            case VariableType::Double: for (size_t k = 0; k < N; k++) column[k] = (double)std::get<double>((*rows_[k])[index]); break;
+            case VariableType::Int: for (size_t k = 0; k < N; k++) column[k] = (double)std::get<int>((*rows_[k])[index]); break;
+            case VariableType::UInt: for (size_t k = 0; k < N; k++) column[k] = (double)std::get<unsigned int>((*rows_[k])[index]); break;
+            case VariableType::Float: for (size_t k = 0; k < N; k++) column[k] = (double)std::get<float>((*rows_[k])[index]); break;
+            case VariableType::String:
                 printf("[evaluateExpression] string variable cannot be used in equations\n");
                 exit(1);
             }
-            else {
-                printf("unexpected data type\n");
+        }
+        else if (Noperands(temp_token.type) == 1) {
+            if (depth == 0) {
+                printf("[EvaluatePostfixExpressionBatch] there is no number when unary operator comes\n");
+                exit(1);
+            }
+            std::vector<double>& a = values.at(depth - 1);
+            if (temp_token.type == OpType::In) {
+                for (size_t k = 0; k < N; k++) a[k] = temp_token.set->Contains(a[k]) ? 1.0 : 0.0;
+            }
+            else if (temp_token.type == OpType::NotIn) {
+                for (size_t k = 0; k < N; k++) a[k] = temp_token.set->Contains(a[k]) ? 0.0 : 1.0;
+            }
+            else applyOpBatch(a, N, temp_token.type);
+        }
+        else {
+            if (depth < 2) {
+                printf("[EvaluatePostfixExpressionBatch] there is only %zu number when binary operator comes\n", depth);
+                exit(1);
+            }
+            applyOpBatch(values.at(depth - 2), values.at(depth - 1), N, temp_token.type);
+            depth--;
+        }
+    }
+    MergeBranches(postfix_expr_.size());
+
+    if (depth != 1) {
+        printf("[EvaluatePostfixExpressionBatch] size of values is %zu\n", depth);
+        exit(1);
+    }
+
+    std::copy(values.at(0).begin(), values.at(0).begin() + N, output_);
+}
+
+/*
+* interval arithmetic over the postfix expression.
+* `ranges_.at(i)` is [min, max] of i-th variable. The result contains every value which the expression can have for variables in the ranges.
+* For comparison and logical operators, the result is [0, 0], [1, 1], or [0, 1].
+* When the range cannot be determined (e.g. division by the range including zero), [-inf, inf] is returned, which is always safe.
+*/
+std::pair<double, double> applyOpInterval(const std::pair<double, double>& a, const std::pair<double, double>& b, const OpType op) {
+    const double inf = std::numeric_limits<double>::infinity();
+    const std::pair<double, double> unknown(-inf, inf);
+    const std::pair<double, double> unknown_bool(0.0, 1.0);
+
+    // (definitely true, definitely false) of logical value
+    auto is_true = [](const std::pair<double, double>& x) { return (x.first > 0) || (x.second < 0); };
+    auto is_false = [](const std::pair<double, double>& x) { return (x.first == 0) && (x.second == 0); };
+
+    std::pair<double, double> result;
+
+    switch (op) {
+    case OpType::Add: result = std::make_pair(a.first + b.first, a.second + b.second); break;
+    case OpType::Sub: result = std::make_pair(a.first - b.second, a.second - b.first); break;
+    case OpType::Mul: {
+        double candidates[4] = { a.first * b.first, a.first * b.second, a.second * b.first, a.second * b.second };
+        result = std::make_pair(*std::min_element(candidates, candidates + 4), *std::max_element(candidates, candidates + 4));
+        break;
+    }
+    case OpType::Div: {
+        if ((b.first <= 0) && (b.second >= 0)) return unknown;
+        double candidates[4] = { a.first / b.first, a.first / b.second, a.second / b.first, a.second / b.second };
+        result = std::make_pair(*std::min_element(candidates, candidates + 4), *std::max_element(candidates, candidates + 4));
+        break;
+    }
+    case OpType::Pow: {
+        // only the monotonic case: non-negative base and constant exponent
+        if ((a.first < 0) || (b.first != b.second)) return unknown;
+        double low = std::pow(a.first, b.first);
+        double high = std::pow(a.second, b.first);
+        result = std::make_pair(std::min(low, high), std::max(low, high));
+        break;
+    }
+    case OpType::GT: {
+        if (a.first > b.second) return std::make_pair(1.0, 1.0);
+        else if (a.second <= b.first) return std::make_pair(0.0, 0.0);
+        else return unknown_bool;
+    }
+    case OpType::LT: {
+        if (a.second < b.first) return std::make_pair(1.0, 1.0);
+        else if (a.first >= b.second) return std::make_pair(0.0, 0.0);
+        else return unknown_bool;
+    }
+    case OpType::GE: {
+        if (a.first >= b.second) return std::make_pair(1.0, 1.0);
+        else if (a.second < b.first) return std::make_pair(0.0, 0.0);
+        else return unknown_bool;
+    }
+    case OpType::LE: {
+        if (a.second <= b.first) return std::make_pair(1.0, 1.0);
+        else if (a.first > b.second) return std::make_pair(0.0, 0.0);
+        else return unknown_bool;
+    }
+    case OpType::EQ: {
+        if ((a.first == a.second) && (b.first == b.second) && (a.first == b.first)) return std::make_pair(1.0, 1.0);
+        else if ((a.second < b.first) || (a.first > b.second)) return std::make_pair(0.0, 0.0);
+        else return unknown_bool;
+    }
+    case OpType::NE: {
+        if ((a.first == a.second) && (b.first == b.second) && (a.first == b.first)) return std::make_pair(0.0, 0.0);
+        else if ((a.second < b.first) || (a.first > b.second)) return std::make_pair(1.0, 1.0);
+        else return unknown_bool;
+    }
+    case OpType::And: {
+        if (is_false(a) || is_false(b)) return std::make_pair(0.0, 0.0);
+        else if (is_true(a) && is_true(b)) return std::make_pair(1.0, 1.0);
+        else return unknown_bool;
+    }
+    case OpType::Or: {
+        if (is_true(a) || is_true(b)) return std::make_pair(1.0, 1.0);
+        else if (is_false(a) && is_false(b)) return std::make_pair(0.0, 0.0);
+        else return unknown_bool;
+    }
+    case OpType::Min: result = std::make_pair(std::min(a.first, b.first), std::min(a.second, b.second)); break;
+    case OpType::Max: result = std::make_pair(std::max(a.first, b.first), std::max(a.second, b.second)); break;
+    case OpType::Atan2: return std::make_pair(-M_PI, M_PI);
+    default: {
+        printf("[applyOpInterval] unknown operator\n");
+        exit(1);
+    }
+    }
+
+    // e.g. inf - inf
+    if (std::isnan(result.first) || std::isnan(result.second)) return unknown;
+
+    return result;
+}
+
+std::pair<double, double> applyOpInterval(const std::pair<double, double>& a, const OpType op) {
+    const double inf = std::numeric_limits<double>::infinity();
+    const std::pair<double, double> unknown(-inf, inf);
+
+    std::pair<double, double> result;
+
+    switch (op) {
+    case OpType::UnaryMinus: result = std::make_pair(-a.second, -a.first); break;
+    case OpType::UnaryPlus: result = a; break;
+    case OpType::Abs: {
+        if (a.first >= 0) result = a;
+        else if (a.second <= 0) result = std::make_pair(-a.second, -a.first);
+        else result = std::make_pair(0.0, std::max(-a.first, a.second));
+        break;
+    }
+    // monotonically increasing functions. Outside of the domain, the range is unknown
+    case OpType::Sqrt: if (a.first < 0) return unknown; result = std::make_pair(std::sqrt(a.first), std::sqrt(a.second)); break;
+    case OpType::Exp: result = std::make_pair(std::exp(a.first), std::exp(a.second)); break;
+    case OpType::Log: if (a.first < 0) return unknown; result = std::make_pair(std::log(a.first), std::log(a.second)); break;
+    case OpType::Log10: if (a.first < 0) return unknown; result = std::make_pair(std::log10(a.first), std::log10(a.second)); break;
+    case OpType::Asin: if ((a.first < -1) || (a.second > 1)) return unknown; result = std::make_pair(std::asin(a.first), std::asin(a.second)); break;
+    case OpType::Atan: result = std::make_pair(std::atan(a.first), std::atan(a.second)); break;
+    // monotonically decreasing
+    case OpType::Acos: if ((a.first < -1) || (a.second > 1)) return unknown; result = std::make_pair(std::acos(a.second), std::acos(a.first)); break;
+    // periodic functions
+    case OpType::Sin: case OpType::Cos: {
+        if (std::isinf(a.first) || std::isinf(a.second)) return unknown;
+        result = std::make_pair(-1.0, 1.0);
+        break;
+    }
+    case OpType::Tan: return unknown;
+    default: {
+        printf("[applyOpInterval] unknown operator\n");
+        exit(1);
+    }
+    }
+
+    if (std::isnan(result.first) || std::isnan(result.second)) return unknown;
+
+    return result;
+}
+
+std::pair<double, double> EvaluatePostfixInterval(const std::vector<Token>& postfix_expr_, const std::vector<std::pair<double, double>>& ranges_) {
+    std::stack<std::pair<double, double>> values;
+
+    // like `EvaluatePostfixExpressionBatch`, both branches of `a ? b : c` are evaluated and merged at the end of `c`
+    std::vector<int> ternary_ends;
+    auto MergeBranches = [&](int position_) {
+        while ((ternary_ends.size() != 0) && (ternary_ends.back() == position_)) {
+            std::pair<double, double> b = values.top(); values.pop();
+            std::pair<double, double> a = values.top(); values.pop();
+            std::pair<double, double> condition = values.top(); values.pop();
+
+            if ((condition.first > 0) || (condition.second < 0)) values.push(a);
+            else if ((condition.first == 0) && (condition.second == 0)) values.push(b);
+            else values.push(std::make_pair(std::min(a.first, b.first), std::max(a.second, b.second)));
+            ternary_ends.pop_back();
+        }
+    };
+
+    for (int i = 0; i < postfix_expr_.size(); i++) {
+        MergeBranches(i);
+
+        const Token& temp_token = postfix_expr_.at(i);
+
+        if (temp_token.type == OpType::JumpIfFalse) {
+            ternary_ends.push_back(postfix_expr_.at(temp_token.index - 1).index);
+            continue;
+        }
+        else if ((temp_token.type == OpType::Jump) || (temp_token.type == OpType::Compiled)) {
+            continue;
+        }
+        else if (IsVariadic(temp_token.type)) {
+            int Narguments = temp_token.index;
+            if (values.size() < Narguments) {
+                printf("[EvaluatePostfixInterval] there is only %zu number when function with %d arguments comes\n", values.size(), Narguments);
                 exit(1);
             }
+
+            // the k-th largest value is between the smallest and the largest value
+            std::pair<double, double> result(std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity());
+            for (int j = 0; j < Narguments - 1; j++) {
+                result.first = std::min(result.first, values.top().first);
+                result.second = std::max(result.second, values.top().second);
+                values.pop();
+            }
+            std::pair<double, double> k = values.top(); values.pop();
+
+            // if k is not a fixed valid index, the result can be NaN
+            if ((k.first != k.second) || (k.first < 0) || (k.first > Narguments - 2) || (k.first != std::floor(k.first))) result = std::make_pair(-std::numeric_limits<double>::infinity(), std::numeric_limits<double>::infinity());
+            else if (temp_token.type == OpType::ArgmaxK) result = std::make_pair(0.0, Narguments - 2.0);
+            values.push(result);
+            continue;
+        }
+
+        if (temp_token.type == OpType::Value) {
+            values.push(std::make_pair(temp_token.value, temp_token.value));
         }
-        else if ((temp_token.type == OpType::UnaryMinus) || (temp_token.type == OpType::UnaryPlus)) {
+        else if (temp_token.type == OpType::Variable) {
+            values.push(ranges_.at(temp_token.index));
+        }
+        else if (Noperands(temp_token.type) == 1) {
             if (values.size() == 0) {
-                printf("[EvaluatePostfixExpression] there is no number when unary operator comes\n");
+                printf("[EvaluatePostfixInterval] there is no number when unary operator comes\n");
                 exit(1);
             }
-            double a = values.top(); values.pop();
-            values.push(applyOp(a, temp_token.type));
+            std::pair<double, double> a = values.top(); values.pop();
+            if ((temp_token.type == OpType::In) || (temp_token.type == OpType::NotIn)) {
+                // decided only if the range is one value or does not overlap with the set
+                std::pair<double, double> is_in(0.0, 1.0);
+                if (a.first == a.second) is_in = temp_token.set->Contains(a.first) ? std::make_pair(1.0, 1.0) : std::make_pair(0.0, 0.0);
+                else if ((a.second < temp_token.set->Min()) || (a.first > temp_token.set->Max())) is_in = std::make_pair(0.0, 0.0);
+
+                if (temp_token.type == OpType::In) values.push(is_in);
+                else values.push(std::make_pair(1.0 - is_in.second, 1.0 - is_in.first));
+            }
+            else values.push(applyOpInterval(a, temp_token.type));
         }
         else {
             if (values.size() < 2) {
-                printf("[EvaluatePostfixExpression] there is only %d number when binary operator comes\n", values.size());
+                printf("[EvaluatePostfixInterval] there is only %zu number when binary operator comes\n", values.size());
                 exit(1);
             }
-            double b = values.top(); values.pop();
-            double a = values.top(); values.pop();
-            values.push(applyOp(a, b, temp_token.type));
+            std::pair<double, double> b = values.top(); values.pop();
+            std::pair<double, double> a = values.top(); values.pop();
+            values.push(applyOpInterval(a, b, temp_token.type));
         }
     }
 
+    MergeBranches(postfix_expr_.size());
+
     if (values.size() != 1) {
-        printf("[EvaluatePostfixExpression] size of values is %d\n", values.size());
+        printf("[EvaluatePostfixInterval] size of values is %zu\n", values.size());
         exit(1);
     }
 
     return values.top();
-
 }
 
-#endif 
-
+#endif
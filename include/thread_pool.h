@@ -0,0 +1,187 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <algorithm>
+
+/*
+* simple fixed-size thread pool.
+* Only the heavy parts (sort, BDT fit/predict, output writing) use it. Modules themselves are still called from the main thread.
+*/
+class ThreadPool {
+private:
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+
+    std::mutex queue_mutex;
+    std::condition_variable condition;
+    bool stop;
+
+    // it is used to avoid the deadlock when a task submits another task and waits for it
+    static bool& InsideWorker() {
+        static thread_local bool inside_worker = false;
+        return inside_worker;
+    }
+
+public:
+    ThreadPool(unsigned int NThreads_);
+    ~ThreadPool();
+
+    template <class F> std::future<void> Enqueue(F&& task_);
+    unsigned int Size() const;
+    static bool IsWorkerThread();
+};
+
+ThreadPool::ThreadPool(unsigned int NThreads_) : stop(false) {
+    if (NThreads_ == 0) NThreads_ = 1;
+
+    for (unsigned int i = 0; i < NThreads_; i++) {
+        workers.emplace_back([this] {
+            InsideWorker() = true;
+            while (true) {
+                std::function<void()> task;
+                {
+                    std::unique_lock<std::mutex> lock(queue_mutex);
+                    condition.wait(lock, [this] { return stop || !tasks.empty(); });
+                    if (stop && tasks.empty()) return;
+                    task = std::move(tasks.front());
+                    tasks.pop();
+                }
+                task();
+            }
+        });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        stop = true;
+    }
+    condition.notify_all();
+    for (size_t i = 0; i < workers.size(); i++) workers.at(i).join();
+}
+
+template <class F> std::future<void> ThreadPool::Enqueue(F&& task_) {
+    // std::function requires copyable object. Therefore, wrap packaged_task by shared_ptr
+    std::shared_ptr<std::packaged_task<void()>> task = std::make_shared<std::packaged_task<void()>>(std::forward<F>(task_));
+    std::future<void> result = task->get_future();
+    {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        tasks.emplace([task]() { (*task)(); });
+    }
+    condition.notify_one();
+    return result;
+}
+
+unsigned int ThreadPool::Size() const {
+    return workers.size();
+}
+
+bool ThreadPool::IsWorkerThread() {
+    return InsideWorker();
+}
+
+/*
+* number of threads used by the global thread pool. 0 means `std::thread::hardware_concurrency()`
+* It should be set before the pool is used for the first time. Otherwise, the pool is re-created.
+*/
+unsigned int NThreads = 0;
+
+std::unique_ptr<ThreadPool>& ThreadPoolHolder() {
+    static std::unique_ptr<ThreadPool> pool;
+    return pool;
+}
+
+ThreadPool* GetThreadPool() {
+    unsigned int requested_threads = NThreads;
+    if (requested_threads == 0) requested_threads = std::max(1u, std::thread::hardware_concurrency());
+
+    std::unique_ptr<ThreadPool>& pool = ThreadPoolHolder();
+    if ((pool == nullptr) || (pool->Size() != requested_threads)) pool.reset(new ThreadPool(requested_threads));
+
+    return pool.get();
+}
+
+void SetNThreads(unsigned int NThreads_) {
+    NThreads = NThreads_;
+}
+
+/*
+* call `function_(begin, end)` for the chunks of [begin_, end_) on the global thread pool and wait.
+* If it is called inside the worker thread or there is only one chunk, it runs in the current thread.
+*/
+template <class F> void ParallelFor(size_t begin_, size_t end_, size_t grain_size_, F function_) {
+    if (end_ <= begin_) return;
+    if (grain_size_ == 0) grain_size_ = 1;
+
+    size_t Nchunk = (end_ - begin_ + grain_size_ - 1) / grain_size_;
+
+    if ((Nchunk <= 1) || ThreadPool::IsWorkerThread()) {
+        function_(begin_, end_);
+        return;
+    }
+
+    ThreadPool* pool = GetThreadPool();
+    if (pool->Size() <= 1) {
+        function_(begin_, end_);
+        return;
+    }
+
+    std::vector<std::future<void>> results;
+    for (size_t chunk_begin = begin_; chunk_begin < end_; chunk_begin += grain_size_) {
+        size_t chunk_end = std::min(end_, chunk_begin + grain_size_);
+        results.push_back(pool->Enqueue([&function_, chunk_begin, chunk_end]() { function_(chunk_begin, chunk_end); }));
+    }
+
+    // `get` re-throws the exception from the task
+    for (size_t i = 0; i < results.size(); i++) results.at(i).get();
+}
+
+/*
+* sort chunks in parallel and merge them pairwise. The result is the same as `std::sort` up to the order of equivalent elements.
+*/
+template <class RandomIt, class Compare> void ParallelSort(RandomIt first_, RandomIt last_, Compare comp_) {
+    size_t N = last_ - first_;
+
+    // below this size, the thread overhead is larger than the gain
+    const size_t MinimumChunkSize = 100000;
+
+    unsigned int Nthread = ThreadPool::IsWorkerThread() ? 1 : GetThreadPool()->Size();
+    size_t Nchunk = std::min<size_t>(Nthread, N / MinimumChunkSize);
+
+    if (Nchunk <= 1) {
+        std::sort(first_, last_, comp_);
+        return;
+    }
+
+    // boundary of each chunk
+    std::vector<size_t> boundaries;
+    for (size_t i = 0; i <= Nchunk; i++) boundaries.push_back(N * i / Nchunk);
+
+    ParallelFor(0, Nchunk, 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) std::sort(first_ + boundaries.at(i), first_ + boundaries.at(i + 1), comp_);
+    });
+
+    // merge neighbouring chunks until only one chunk remains
+    while (boundaries.size() > 2) {
+        std::vector<size_t> merged_boundaries;
+        size_t Npair = (boundaries.size() - 1) / 2;
+
+        ParallelFor(0, Npair, 1, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) std::inplace_merge(first_ + boundaries.at(2 * i), first_ + boundaries.at(2 * i + 1), first_ + boundaries.at(2 * i + 2), comp_);
+        });
+
+        for (size_t i = 0; i < boundaries.size(); i += 2) merged_boundaries.push_back(boundaries.at(i));
+        if (merged_boundaries.back() != boundaries.back()) merged_boundaries.push_back(boundaries.back());
+        boundaries.swap(merged_boundaries);
+    }
+}
+
+#endif
@@ -94,6 +94,12 @@ int main(int argc, char* argv[]) {
     // save into one ROOT file
     loader.PrintRootFile("./OneLargeFile.root");
 
+    // sharded execution. For example, with 4 processes:
+    //     for i in 0 1 2 3; do ./bin/Analysis_main --shard $i/4 & done; wait
+    //     ./bin/Analysis_main --merge 4
+    // Without the options, all files are read in this process
+    loader.SetShardFromArguments(argc, argv, "./shards");
+
     // end
     loader.end();
 
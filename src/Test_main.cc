@@ -0,0 +1,528 @@
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <sstream>
+#include <memory>
+#include <limits>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+#include <functional>
+#include <variant>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+
+#include "Loader.h"
+
+/*
+* regression tests of modules. Each test returns the number of failed checks, and the program fails if any check fails
+*/
+
+int Check(bool condition_, const char* description_) {
+    if (!condition_) printf("[Test] failed: %s\n", description_);
+    return condition_ ? 0 : 1;
+}
+
+// exit code of `function_`, which is run in a child process like an independent job
+int RunInChild(std::function<void()> function_) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        freopen("/dev/null", "w", stdout);
+        // threads of the global pool are not copied into the child, so the pool cannot be joined at exit
+        ThreadPoolHolder().release();
+        function_();
+        exit(0);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// true if `function_` is rejected, i.e. it exits with 1 like modules with a wrong configuration. A crash is not a rejection
+bool Exits(std::function<void()> function_) {
+    return RunInChild(function_) == 1;
+}
+
+// same value, or both are NaN
+bool IsSameValue(double a_, double b_) {
+    return (a_ == b_) || (std::isnan(a_) && std::isnan(b_));
+}
+
+// `expression_` of variables x, y, z (Double_t) and pdg (Int_t) should give `expected_` of each row, both by the scalar and the batch evaluators
+int CheckExpression(const std::string& expression_, const std::vector<std::vector<double>>& rows_, std::function<double(const std::vector<double>&)> expected_) {
+    int Nfailed = 0;
+    std::vector<std::string> variable_names = { "x", "y", "z", "pdg" };
+    std::vector<std::string> VariableTypes = { "Double_t", "Double_t", "Double_t", "Int_t" };
+    SchemaPtr schema = std::make_shared<const Schema>(variable_names, VariableTypes, 0);
+    std::vector<Token> postfix_expr = PostfixExpression(replaceVariables(expression_, *schema), *schema);
+
+    std::vector<std::vector<std::variant<int, unsigned int, float, double, std::string*>>> rows;
+    for (int i = 0; i < rows_.size(); i++) rows.push_back({ rows_.at(i).at(0), rows_.at(i).at(1), rows_.at(i).at(2), static_cast<int>(rows_.at(i).at(3)) });
+
+    std::vector<const std::vector<std::variant<int, unsigned int, float, double, std::string*>>*> row_pointers;
+    for (int i = 0; i < rows.size(); i++) row_pointers.push_back(&rows.at(i));
+    std::vector<double> batch_results(rows.size());
+    EvaluatePostfixExpressionBatch(postfix_expr, row_pointers, batch_results.data());
+
+    for (int i = 0; i < rows.size(); i++) {
+        double expected = expected_(rows_.at(i));
+        double scalar_result = EvaluatePostfixExpression(postfix_expr, rows.at(i));
+        if (IsSameValue(scalar_result, expected) && IsSameValue(batch_results.at(i), expected)) continue;
+
+        printf("[Test] failed: %s for (x, y, z, pdg) = (%g, %g, %g, %g) is %g (batch %g), but %g is expected\n", expression_.c_str(), rows_.at(i).at(0), rows_.at(i).at(1), rows_.at(i).at(2), rows_.at(i).at(3), scalar_result, batch_results.at(i), expected);
+        Nfailed++;
+    }
+    return Nfailed;
+}
+
+// the range of auto-range histogram is fixed after 10MB of values, and the checkpoint should still be resumed
+int TestAutoRangeCheckpoint() {
+    int Nfailed = 0;
+    std::vector<std::string> variable_names = { "x" };
+    std::vector<std::string> VariableTypes = { "Double_t" };
+    SchemaPtr schema = std::make_shared<const Schema>(variable_names, VariableTypes, 0);
+
+    Module::DrawTH1D written("x", ";x;", "auto_range.png", schema);
+    std::string fingerprint = written.Fingerprint();
+    written.Start();
+
+    std::deque<Data> data(1);
+    for (int i = 0; i < 1500000; i++) {
+        data.at(0).variable = { static_cast<double>(i % 1000) };
+        written.ProcessRow(data.begin());
+    }
+    Nfailed += Check(written.Fingerprint() == fingerprint, "fingerprint of DrawTH1D is changed after the range is fixed");
+
+    std::ostringstream state;
+    written.SaveState(state);
+
+    Module::DrawTH1D resumed("x", ";x;", "auto_range.png", schema);
+    Nfailed += Check(resumed.Fingerprint() == fingerprint, "fingerprint of new DrawTH1D is different from the checkpoint");
+    resumed.Start();
+
+    std::istringstream state_stream(state.str());
+    resumed.LoadState(state_stream);
+    Nfailed += Check(state_stream.tellg() == (std::streampos)state.str().size(), "state of DrawTH1D is not fully read");
+
+    std::ostringstream resumed_state;
+    resumed.SaveState(resumed_state);
+    Nfailed += Check(resumed_state.str() == state.str(), "resumed DrawTH1D has different state");
+
+    return Nfailed;
+}
+
+// candidates with NaN or infinite score are not used, and AUC is calculated from the others
+int TestAUCNonFiniteScore() {
+    int Nfailed = 0;
+    std::vector<std::string> variable_names = { "x" };
+    std::vector<std::string> VariableTypes = { "Double_t" };
+    SchemaPtr schema = std::make_shared<const Schema>(variable_names, VariableTypes, 0);
+    std::shared_ptr<double> AUC = std::make_shared<double>();
+
+    Module::CalculateAUC module("x", 0.0, 1.0, "auc_nonfinite.txt", "w", { "S" }, { "B" }, AUC, schema);
+    module.Start();
+
+    std::vector<std::pair<std::string, double>> candidates = { { "S", 0.9 }, { "S", std::numeric_limits<double>::quiet_NaN() }, { "S", 0.8 }, { "B", 0.1 }, { "B", std::numeric_limits<double>::infinity() }, { "B", 0.85 }, { "B", std::numeric_limits<double>::quiet_NaN() } };
+    std::deque<Data> data;
+    for (int i = 0; i < candidates.size(); i++) {
+        Data temp_data;
+        temp_data.variable = { candidates.at(i).second };
+        temp_data.label = candidates.at(i).first;
+        data.push_back(temp_data);
+    }
+    module.Process(&data);
+    module.End();
+    std::remove("auc_nonfinite.txt");
+
+    // 3 of 4 pairs of (signal, background) are ordered correctly
+    Nfailed += Check(*AUC == 0.75, "AUC with NaN and infinite scores is wrong");
+
+    return Nfailed;
+}
+
+// aliases are written when they are matched by the patterns of the written variables
+int TestAliasGlob() {
+    int Nfailed = 0;
+
+    Loader loader("tree");
+    loader.Alias("pt", "1 + 2");
+    loader.Alias("px", "3 * 4");
+    loader.Alias("E", "5");
+    loader.PrintRootFile("alias_glob.root", { "p*" }, { "px" }, {});
+
+    std::vector<std::string>* variable_names = loader.Getvariable_names_address();
+    Nfailed += Check(std::find(variable_names->begin(), variable_names->end(), "pt") != variable_names->end(), "alias matched by include pattern is not written");
+    Nfailed += Check(std::find(variable_names->begin(), variable_names->end(), "px") == variable_names->end(), "alias matched by exclude pattern is written");
+    Nfailed += Check(std::find(variable_names->begin(), variable_names->end(), "E") == variable_names->end(), "alias not matched by include pattern is written");
+
+    return Nfailed;
+}
+
+// new variables cannot hide an alias, because later expressions use the alias
+int TestAliasCollision() {
+    int Nfailed = 0;
+
+    Nfailed += Check(Exits([]() { Loader loader("tree"); loader.Alias("pt", "1 + 2"); loader.DefineNewVariable("3", "pt"); }), "DefineNewVariable with the name of an alias is accepted");
+    Nfailed += Check(Exits([]() { Loader loader("tree"); loader.Alias("pt", "1 + 2"); loader.Reduce({ "3", "4" }, { { "pt", "sum" } }); }), "Reduce with the name of an alias is accepted");
+    Nfailed += Check(Exits([]() { Loader loader("tree"); loader.Alias("pt", "1 + 2"); loader.GetAverage({ "3", "4" }, "pt"); }), "GetAverage with the name of an alias is accepted");
+    Nfailed += Check(!Exits([]() { Loader loader("tree"); loader.Alias("pt", "1 + 2"); loader.DefineNewVariable("pt * 2", "pt2"); }), "DefineNewVariable using an alias is rejected");
+
+    return Nfailed;
+}
+
+// cache with variable `x` of 4 input files. Each input file is a segment of the cache, and segments are assigned to shards in turn
+void WriteTestCache(const char* path_) {
+    std::vector<std::string> variable_names = { "x" };
+    std::vector<std::string> VariableTypes = { "Double_t" };
+    SchemaPtr schema = std::make_shared<const Schema>(variable_names, VariableTypes, 0);
+
+    Module::SaveCache cache(path_, schema);
+    cache.Start();
+    for (int file = 0; file < 4; file++) {
+        std::deque<Data> data;
+        for (int i = 0; i < 100; i++) {
+            Data temp_data;
+            temp_data.label = (i < 30) ? "S" : "B";
+            temp_data.variable = { static_cast<double>((i * 37 + file * 11) % 100) + ((temp_data.label == "S") ? 30.0 : 0.0) };
+            temp_data.filename = "file" + std::to_string(file);
+            data.push_back(temp_data);
+        }
+        cache.Process(&data);
+    }
+    cache.End();
+}
+
+// AUC of a run split into 2 shards, each in its own process, is the same as the one of a single run
+int TestShardMerge() {
+    int Nfailed = 0;
+    WriteTestCache("shard_merge_cache");
+
+    auto Configure = [](Loader& loader_) {
+        loader_.SetSignal({ "S" });
+        loader_.SetBackground({ "B" });
+        loader_.LoadCache("shard_merge_cache");
+        loader_.Cut("x > 5");
+        return loader_.CalculateAUC("x", 0, 200, "shard_merge_auc.txt", "w");
+    };
+
+    double single_AUC;
+    {
+        Loader loader("tree");
+        std::shared_ptr<double> AUC = Configure(loader);
+        loader.end();
+        single_AUC = *AUC;
+    }
+
+    for (int shard = 0; shard < 2; shard++) {
+        int exit_code = RunInChild([&Configure, shard]() {
+            Loader loader("tree");
+            Configure(loader);
+            loader.SetShard(shard, 2, "shard_merge");
+            loader.end();
+        });
+        Nfailed += Check(exit_code == 0, "shard is failed");
+    }
+
+    {
+        Loader loader("tree");
+        std::shared_ptr<double> AUC = Configure(loader);
+        loader.SetMerge(2, "shard_merge");
+        loader.end();
+        Nfailed += Check(*AUC == single_AUC, "AUC of merged shards is different from the single run");
+    }
+
+    // each shard would determine its own range of auto-range histogram
+    Nfailed += Check(Exits([&Configure]() {
+        Loader loader("tree");
+        Configure(loader);
+        loader.DrawStack("x", ";x;", "shard_merge_stack.png");
+        loader.SetShard(0, 2, "shard_merge");
+        loader.end();
+    }), "auto-range DrawStack is accepted in sharded run");
+
+    std::system("rm -rf shard_merge_cache shard_merge shard_merge_auc.txt");
+
+    return Nfailed;
+}
+
+// checkpoints and shards are used only with the same configuration, so every setting of modules should change the fingerprint
+int TestConfigurationFingerprint() {
+    int Nfailed = 0;
+    std::vector<std::string> variable_names = { "x", "y" };
+    std::vector<std::string> VariableTypes = { "Double_t", "Double_t" };
+    SchemaPtr schema = std::make_shared<const Schema>(variable_names, VariableTypes, 0);
+
+    Module::PrintRootFile written("output.root", -1, -1, -1, { "x" }, {}, {}, schema, "tree");
+    Module::PrintRootFile more_columns("output.root", -1, -1, -1, { "x", "y" }, {}, {}, schema, "tree");
+    Module::PrintRootFile other_name("other.root", -1, -1, -1, { "x" }, {}, {}, schema, "tree");
+    Nfailed += Check(written.Fingerprint() != more_columns.Fingerprint(), "fingerprint of PrintRootFile does not have the included columns");
+    Nfailed += Check(written.Fingerprint() != other_name.Fingerprint(), "fingerprint of PrintRootFile does not have the output name");
+
+    Module::PrintEvent printed({ "x" }, schema);
+    Module::PrintEvent other_printed({ "y" }, schema);
+    Nfailed += Check(printed.Fingerprint() != other_printed.Fingerprint(), "fingerprint of PrintEvent does not have the printed values");
+
+    // shards are merged only with the same expression of the histogram
+    WriteTestCache("fingerprint_cache");
+    TH1D hist("fingerprint_hist", "", 10, 0, 200);
+    for (int shard = 0; shard < 2; shard++) {
+        int exit_code = RunInChild([&hist, shard]() {
+            Loader loader("tree");
+            loader.LoadCache("fingerprint_cache");
+            loader.FillTH1D(&hist, "x");
+            loader.SetShard(shard, 2, "fingerprint_shard");
+            loader.end();
+        });
+        Nfailed += Check(exit_code == 0, "shard is failed");
+    }
+    Nfailed += Check(Exits([&hist]() {
+        Loader loader("tree");
+        loader.LoadCache("fingerprint_cache");
+        loader.FillTH1D(&hist, "x * 2");
+        loader.SetMerge(2, "fingerprint_shard");
+        loader.end();
+    }), "shards are merged with a different expression of FillTH1D");
+    Nfailed += Check(!Exits([&hist]() {
+        Loader loader("tree");
+        loader.LoadCache("fingerprint_cache");
+        loader.FillTH1D(&hist, "x");
+        loader.SetMerge(2, "fingerprint_shard");
+        loader.end();
+    }), "shards are not merged with the same configuration");
+
+    std::system("rm -rf fingerprint_cache fingerprint_shard");
+
+    return Nfailed;
+}
+
+// branches of nested conditional operators are chosen like C++, including NaN conditions which are true
+int TestConditionalOperator() {
+    int Nfailed = 0;
+    const double NaN = std::numeric_limits<double>::quiet_NaN();
+
+    std::vector<std::vector<double>> rows;
+    std::vector<double> conditions = { 0, 1, NaN };
+    for (double x : conditions) {
+        for (double y : conditions) {
+            for (double z : conditions) rows.push_back({ x, y, z, 0 });
+        }
+    }
+
+    Nfailed += CheckExpression("x ? 10 : y ? 20 : 30", rows, [](const std::vector<double>& v) { return v[0] ? 10.0 : v[1] ? 20.0 : 30.0; });
+    Nfailed += CheckExpression("(x ? y : z) ? 10 : 20", rows, [](const std::vector<double>& v) { return (v[0] ? v[1] : v[2]) ? 10.0 : 20.0; });
+    Nfailed += CheckExpression("x ? y ? 10 : 20 : 30", rows, [](const std::vector<double>& v) { return v[0] ? (v[1] ? 10.0 : 20.0) : 30.0; });
+    Nfailed += CheckExpression("x ? (y ? 10 : 20) : (z ? 30 : 40)", rows, [](const std::vector<double>& v) { return v[0] ? (v[1] ? 10.0 : 20.0) : (v[2] ? 30.0 : 40.0); });
+    Nfailed += CheckExpression("x ? y ? z ? 1 : 2 : 3 : y ? 4 : z ? 5 : 6", rows, [](const std::vector<double>& v) { return v[0] ? (v[1] ? (v[2] ? 1.0 : 2.0) : 3.0) : (v[1] ? 4.0 : (v[2] ? 5.0 : 6.0)); });
+    Nfailed += CheckExpression("x > 0.5 ? y + 1 : z * 2 + 3", rows, [](const std::vector<double>& v) { return (v[0] > 0.5) ? (v[1] + 1) : (v[2] * 2 + 3); });
+    Nfailed += CheckExpression("(x ? 1 : 2) + (y ? 10 : 20) * (z ? 100 : 200)", rows, [](const std::vector<double>& v) { return (v[0] ? 1.0 : 2.0) + (v[1] ? 10.0 : 20.0) * (v[2] ? 100.0 : 200.0); });
+    Nfailed += CheckExpression("max(x ? y : z, x ? z : y)", rows, [](const std::vector<double>& v) { return std::fmax(v[0] ? v[1] : v[2], v[0] ? v[2] : v[1]); });
+
+    return Nfailed;
+}
+
+// integer sets use the lookup table, and the others use the binary search
+int TestSetMembership() {
+    int Nfailed = 0;
+    const double NaN = std::numeric_limits<double>::quiet_NaN();
+
+    std::vector<std::vector<double>> rows;
+    std::vector<double> pdgs = { -211, -13, -11, 0, 11, 13, 22, 211, 100000 };
+    std::vector<double> xs = { -2.25, -0.5, 0.1, 0.5, 1, 1.5, 100000, NaN };
+    for (int i = 0; i < pdgs.size(); i++) rows.push_back({ xs.at(i % xs.size()), 0, 0, pdgs.at(i) });
+    for (int i = 0; i < xs.size(); i++) rows.push_back({ xs.at(i), 0, 0, pdgs.at(i) });
+
+    auto IsIn = [](double value_, std::vector<double> set_) { return std::find(set_.begin(), set_.end(), value_) != set_.end(); };
+
+    Nfailed += CheckExpression("pdg in {-11, 11, -13, 13}", rows, [&](const std::vector<double>& v) { return IsIn(v[3], { -11, 11, -13, 13 }) ? 1.0 : 0.0; });
+    Nfailed += CheckExpression("pdg not in {-11, 11, -13, 13}", rows, [&](const std::vector<double>& v) { return IsIn(v[3], { -11, 11, -13, 13 }) ? 0.0 : 1.0; });
+    Nfailed += CheckExpression("pdg not in {-211}", rows, [&](const std::vector<double>& v) { return (v[3] == -211) ? 0.0 : 1.0; });
+    Nfailed += CheckExpression("abs(pdg) in {11, 13}", rows, [&](const std::vector<double>& v) { return IsIn(std::fabs(v[3]), { 11, 13 }) ? 1.0 : 0.0; });
+    Nfailed += CheckExpression("x in {0.5, 1.5, -2.25}", rows, [&](const std::vector<double>& v) { return IsIn(v[0], { 0.5, 1.5, -2.25 }) ? 1.0 : 0.0; });
+    Nfailed += CheckExpression("x not in {0.5, 1.5, -2.25}", rows, [&](const std::vector<double>& v) { return IsIn(v[0], { 0.5, 1.5, -2.25 }) ? 0.0 : 1.0; });
+    // integers in a large range are not in the lookup table
+    Nfailed += CheckExpression("pdg in {-211, 100000}", rows, [&](const std::vector<double>& v) { return IsIn(v[3], { -211, 100000 }) ? 1.0 : 0.0; });
+    Nfailed += CheckExpression("x not in {1, 100000}", rows, [&](const std::vector<double>& v) { return IsIn(v[0], { 1, 100000 }) ? 0.0 : 1.0; });
+    // values which are not integers are not in the integer set
+    Nfailed += CheckExpression("x + 10.5 in {10, 11, 12}", rows, [&](const std::vector<double>& v) { return IsIn(v[0] + 10.5, { 10, 11, 12 }) ? 1.0 : 0.0; });
+
+    return Nfailed;
+}
+
+// the earlier one is larger for the same values, and NaN values are never chosen
+int TestKthLargest() {
+    int Nfailed = 0;
+    const double NaN = std::numeric_limits<double>::quiet_NaN();
+
+    std::vector<std::vector<double>> rows = { { 1, 1, 0, 0 }, { 2, 2, 2, 0 }, { NaN, 2, 1, 0 }, { 3, NaN, 3, 0 }, { NaN, NaN, NaN, 0 } };
+
+    // expected values of each row
+    auto Expected = [&rows](std::vector<double> values_) {
+        return [&rows, values_](const std::vector<double>& v) {
+            for (int i = 0; i < rows.size(); i++) {
+                if (std::equal(v.begin(), v.end(), rows.at(i).begin(), IsSameValue)) return values_.at(i);
+            }
+            return -999.0;
+        };
+    };
+
+    Nfailed += CheckExpression("argmax_k(0, x, y, z)", rows, Expected({ 0, 0, 1, 0, NaN }));
+    Nfailed += CheckExpression("argmax_k(1, x, y, z)", rows, Expected({ 1, 1, 2, 2, NaN }));
+    Nfailed += CheckExpression("argmax_k(2, x, y, z)", rows, Expected({ 2, 2, NaN, NaN, NaN }));
+    Nfailed += CheckExpression("select_nth(0, x, y, z)", rows, Expected({ 1, 2, 2, 3, NaN }));
+    Nfailed += CheckExpression("select_nth(1, x, y, z)", rows, Expected({ 1, 2, 1, 3, NaN }));
+    Nfailed += CheckExpression("select_nth(2, x, y, z)", rows, Expected({ 0, 2, NaN, NaN, NaN }));
+    // k should be an integer in the range
+    Nfailed += CheckExpression("argmax_k(3, x, y, z)", rows, Expected({ NaN, NaN, NaN, NaN, NaN }));
+    Nfailed += CheckExpression("argmax_k(-1, x, y, z)", rows, Expected({ NaN, NaN, NaN, NaN, NaN }));
+    Nfailed += CheckExpression("argmax_k(0.5, x, y, z)", rows, Expected({ NaN, NaN, NaN, NaN, NaN }));
+    Nfailed += CheckExpression("argmax_k(x, 5, 7)", rows, Expected({ 0, NaN, NaN, NaN, NaN }));
+    // arguments can be expressions, including conditional operators
+    Nfailed += CheckExpression("select_nth(0, x ? 5 : 6, -y, z * 2)", rows, Expected({ 5, 5, 5, 6, 5 }));
+
+    return Nfailed;
+}
+
+// compiled expressions give the same results as the interpreter, including NaN conditions, and rows whose variable has another type than the schema are given to the interpreter. Libraries of the cache are reused by later processes
+int TestJIT() {
+    int Nfailed = 0;
+    const double NaN = std::numeric_limits<double>::quiet_NaN();
+    std::string directory = "test_jit";
+    std::system(("rm -rf " + directory).c_str());
+
+    std::vector<std::string> variable_names = { "x", "y", "pdg" };
+    std::vector<std::string> VariableTypes = { "Double_t", "Double_t", "Int_t" };
+    SchemaPtr schema = std::make_shared<const Schema>(variable_names, VariableTypes, 0);
+    std::vector<std::string> expressions = {
+        "x ? 10 : y ? 20 : 30", "(x ? y : 2) ? x + 1 : -y", "x > 0.5 ? sqrt(y) : log(x)",
+        "pdg in {-11, 11, -13, 13}", "pdg not in {-211, 211}", "x in {0.5, 1.5, -2.25}", "x not in {1, 100000}",
+        "(x < 1) && (y >= 0) || (pdg == 22)", "max(x, y) / min(x, y) - y ^ 2", "atan2(y, x) + abs(pdg)"
+    };
+
+    std::vector<std::vector<std::variant<int, unsigned int, float, double, std::string*>>> rows;
+    std::vector<double> values = { 0, 1, 0.5, -2.25, NaN };
+    std::vector<int> pdgs = { -13, 0, 22, 211 };
+    for (double x : values) {
+        for (double y : values) {
+            for (int pdg : pdgs) rows.push_back({ x, y, pdg });
+        }
+    }
+    // variables have other types than the schema, so the compiled function cannot read the row and the interpreter is used
+    std::vector<std::variant<int, unsigned int, float, double, std::string*>> float_row = { 0.5f, 2.0f, 11u };
+
+    std::vector<const std::vector<std::variant<int, unsigned int, float, double, std::string*>>*> row_pointers;
+    for (int i = 0; i < rows.size(); i++) row_pointers.push_back(&rows.at(i));
+
+    auto Compile = [&](const std::string& expression_) {
+        ExpressionCompiler = PrepareExpressionWithCling;
+        JITCacheDirectory = directory;
+        std::vector<Token> postfix_expr = PostfixExpression(replaceVariables(expression_, *schema), *schema);
+        CompilePendingExpressions();
+        ExpressionCompiler = nullptr;
+        JITCacheDirectory = "";
+        return postfix_expr;
+    };
+    auto IsCompiled = [](const std::vector<Token>& postfix_expr_) {
+        return (postfix_expr_.back().type == OpType::Compiled) && (postfix_expr_.back().compiled->function != nullptr);
+    };
+
+    // the first expression is compiled by another process
+    Nfailed += Check(RunInChild([&]() { exit(IsCompiled(Compile(expressions.at(0))) ? 0 : 2); }) == 0, "expression is not compiled in the child process");
+
+    for (int i = 0; i < expressions.size(); i++) {
+        std::vector<Token> interpreted_expr = PostfixExpression(replaceVariables(expressions.at(i), *schema), *schema);
+
+        // library of the first expression is written by the child process
+        std::string body;
+        GenerateExpressionCode(interpreted_expr, body);
+        std::string library_name = directory + "/Belle2AnalysisExpression_" + FingerprintKey(body) + "_C.so";
+        struct stat library_status;
+        bool IsBuiltBefore = (stat(library_name.c_str(), &library_status) == 0);
+        struct timespec built_time = library_status.st_mtim;
+
+        std::vector<Token> compiled_expr = Compile(expressions.at(i));
+        if (Check(IsCompiled(compiled_expr) && (stat(library_name.c_str(), &library_status) == 0), ("cannot compile " + expressions.at(i)).c_str()) != 0) {
+            Nfailed++;
+            continue;
+        }
+        if (i == 0) Nfailed += Check(IsBuiltBefore && (library_status.st_mtim.tv_sec == built_time.tv_sec) && (library_status.st_mtim.tv_nsec == built_time.tv_nsec), "library of the child process is compiled again");
+
+        double result;
+        Nfailed += Check(!compiled_expr.back().compiled->function(float_row.data(), &result), ("compiled function reads a row of another type: " + expressions.at(i)).c_str());
+        bool IsInterpreted = false;
+        try {
+            EvaluatePostfixExpression(compiled_expr, float_row);
+        }
+        catch (const std::bad_variant_access&) {
+            IsInterpreted = true;
+        }
+        Nfailed += Check(IsInterpreted, ("row of another type is not given to the interpreter: " + expressions.at(i)).c_str());
+
+        std::vector<double> batch_results(rows.size());
+        EvaluatePostfixExpressionBatch(compiled_expr, row_pointers, batch_results.data());
+        for (int j = 0; j < rows.size(); j++) {
+            Nfailed += Check(compiled_expr.back().compiled->function(rows.at(j).data(), &result), ("compiled function cannot read a row: " + expressions.at(i)).c_str());
+            double interpreted = EvaluatePostfixExpression(interpreted_expr, rows.at(j));
+            double compiled = EvaluatePostfixExpression(compiled_expr, rows.at(j));
+            if (IsSameValue(compiled, interpreted) && IsSameValue(batch_results.at(j), interpreted)) continue;
+
+            printf("[Test] failed: compiled %s of row %d is %g (batch %g), but %g is interpreted\n", expressions.at(i).c_str(), j, compiled, batch_results.at(j), interpreted);
+            Nfailed++;
+        }
+    }
+
+    std::system(("rm -rf " + directory).c_str());
+    return Nfailed;
+}
+
+// names are resolved by the shared schema regardless of the order of variables, and the Loader shares a snapshot until variables change
+int TestSchema() {
+    int Nfailed = 0;
+    std::vector<std::string> variable_names = { "M", "M2", "x" };
+    std::vector<std::string> VariableTypes = { "Double_t", "Int_t", "Double_t" };
+    Schema schema(variable_names, VariableTypes, 0);
+
+    Nfailed += Check((schema.Index("M2") == 1) && (schema.Index("y") == -1), "index of the schema is wrong");
+    Nfailed += Check(schema.Type(1) == VariableType::Int, "type of the schema is wrong");
+    Nfailed += Check(replaceVariables("M2 + M * x", schema) == "\x01" "1\x02 + \x01" "0\x02 * \x01" "2\x02", "overlapped names are not replaced by the schema");
+    Nfailed += Check(replaceVariables("max(x, M) / 1.5e3", schema) == replaceVariables("max(x, M) / 1.5e3", &variable_names), "schema and the list of variables give different expressions");
+    std::vector<std::vector<std::variant<int, unsigned int, float, double, std::string*>>> rows = { { 1.5, 3, 2.0 } };
+    Nfailed += Check(EvaluatePostfixExpression(PostfixExpression(replaceVariables("M2 + M * x", schema), schema), rows.at(0)) == 6.0, "expression resolved by the schema gives a wrong value");
+
+    Loader loader("tree");
+    SchemaPtr empty = loader.GetSchema();
+    Nfailed += Check(loader.GetSchema() == empty, "same variables give a new snapshot of the schema");
+    loader.DefineNewVariable("1 + 2", "a");
+    SchemaPtr defined = loader.GetSchema();
+    Nfailed += Check((defined != empty) && (defined->Version() > empty->Version()), "new variable does not give a new snapshot of the schema");
+    Nfailed += Check((empty->Size() == 0) && (defined->Index("a") == 0), "older snapshot of the schema is changed");
+
+    Nfailed += Check(Exits([]() { Loader loader("tree"); loader.Reduce({ "1", "2" }, { { "a", "sum" }, { "a", "max" } }); }), "Reduce with duplicated new variables is accepted");
+
+    return Nfailed;
+}
+
+int main(int argc, char* argv[]) {
+    int Nfailed = 0;
+    Nfailed += TestAutoRangeCheckpoint();
+    Nfailed += TestAUCNonFiniteScore();
+    Nfailed += TestAliasGlob();
+    Nfailed += TestAliasCollision();
+    Nfailed += TestShardMerge();
+    Nfailed += TestConfigurationFingerprint();
+    Nfailed += TestConditionalOperator();
+    Nfailed += TestSetMembership();
+    Nfailed += TestKthLargest();
+    Nfailed += TestJIT();
+    Nfailed += TestSchema();
+
+    if (Nfailed != 0) {
+        printf("[Test] %d checks failed\n", Nfailed);
+        return 1;
+    }
+    printf("[Test] all checks passed\n");
+    return 0;
+}